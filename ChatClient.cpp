@@ -0,0 +1,524 @@
+#include "ChatClient.h"
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <random>
+
+#ifndef _WIN32
+#include <netdb.h>
+#endif
+
+// 每次回收已发送数据的阈值，避免每次发送都移动缓冲区
+#define CLIENT_COMPACT_BYTES (64 * 1024)
+
+static uint64_t NowMs() {
+    return (uint64_t) std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t ParseSeq(const Command &cmd, int index) {
+    uint64_t value = 0;
+    if (index >= cmd.fieldCount) return 0;
+    std::string_view text = cmd.fields[index];
+    std::from_chars(text.data(), text.data() + text.size(), value);
+    return value;
+}
+
+// 从 pos 开始的完整帧的长度，不完整时返回 0
+static size_t FrameSizeAt(const std::string &buffer, size_t pos) {
+    if (buffer.size() - pos < 4) return 0;
+    auto *p = (const unsigned char *) buffer.data() + pos;
+    size_t size = 4 + (((size_t) p[0] << 24) | ((size_t) p[1] << 16) | ((size_t) p[2] << 8) | p[3]);
+    return buffer.size() - pos >= size ? size : 0;
+}
+
+// 非阻塞连接是否仍在进行
+static bool ConnectPending(int err) {
+#ifdef _WIN32
+    return err == WSAEWOULDBLOCK;
+#else
+    return err == EINPROGRESS || err == EINTR;
+#endif
+}
+
+bool ChatClient::SeqTracker::Seen(uint64_t seq) {
+    if (last == 0 && ahead.empty()) {
+        // 会话中第一次收到消息，之前的消息不追溯
+        last = seq;
+        return false;
+    }
+    if (seq <= last || !ahead.insert(seq).second) return true;
+    while (!ahead.empty() && (*ahead.begin() == last + 1 || ahead.size() > CLIENT_SEQ_AHEAD)) {
+        last = *ahead.begin();
+        ahead.erase(ahead.begin());
+    }
+    return false;
+}
+
+ChatClient::ChatClient(std::string host, int port) : host(std::move(host)), port(port), readBuffer(65536) {}
+
+ChatClient::~ChatClient() {
+    Stop();
+}
+
+bool ChatClient::EnableMulticast(const std::string &interfaceAddress) {
+    auto receiver = std::make_unique<MulticastReceiver>(
+            [this](const Command &cmd) { OnMulticast(cmd); },
+            [this](uint8_t opcode, std::initializer_list<std::string_view> fields) { Append(opcode, fields); });
+    if (!receiver->Open(interfaceAddress) || !poller.Add(receiver->Socket(), receiver.get())) return false;
+    poller.SetWriteInterest(receiver->Socket(), false);
+    multicast = std::move(receiver);
+    return true;
+}
+
+bool ChatClient::Start() {
+    if (running) return true;
+    if (!poller.Valid()) return false;
+    running = true;
+    reconnectAtMs = 0;
+    thread = std::thread(&ChatClient::Loop, this);
+    return true;
+}
+
+void ChatClient::Stop() {
+    if (!running) return;
+    running = false;
+    poller.Wakeup();
+    thread.join();
+}
+
+void ChatClient::Register(std::string_view name) {
+    Send(OP_REGISTER, {name});
+}
+
+void ChatClient::Message(std::string_view target, std::string_view text) {
+    Send(OP_MESSAGE, {target, text});
+}
+
+void ChatClient::CreateGroup(std::string_view group) {
+    Send(OP_CREATE_GROUP, {group});
+}
+
+void ChatClient::JoinGroup(std::string_view group) {
+    Send(OP_JOIN_GROUP, {group});
+}
+
+void ChatClient::LeaveGroup(std::string_view group) {
+    Send(OP_LEAVE_GROUP, {group});
+}
+
+void ChatClient::CheckGroup(std::string_view group) {
+    Send(OP_GROUP_CHECK, {group});
+}
+
+void ChatClient::GroupMessage(std::string_view group, std::string_view text) {
+    Send(OP_GROUP_MESSAGE, {group, text});
+}
+
+void ChatClient::SyncPresence() {
+    Send(OP_PRESENCE_SYNC, {});
+}
+
+void ChatClient::History(std::string_view target, uint64_t since) {
+    Send(OP_HISTORY, {target, std::to_string(since)});
+}
+
+void ChatClient::SubscribeMulticast(std::string_view group) {
+    Send(OP_MULTICAST_SUBSCRIBE, {group});
+}
+
+void ChatClient::Remove() {
+    Send(OP_REMOVE, {});
+}
+
+void ChatClient::Send(uint8_t opcode, std::initializer_list<std::string_view> fields) {
+    Send(opcode, fields.begin(), fields.size());
+}
+
+void ChatClient::Send(uint8_t opcode, const std::string_view *fields, size_t count) {
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        // 队列原本不空时事件循环已被唤醒，会一并取走
+        wake = queued.empty();
+        AppendBinaryFrame(queued, opcode, fields, count);
+    }
+    if (wake) poller.Wakeup();
+}
+
+void ChatClient::Loop() {
+    std::vector<PollEvent> events;
+    while (running) {
+        uint64_t now = NowMs();
+        if (state == State::Idle && now >= reconnectAtMs) Connect(now);
+        TakeQueued();
+        Flush(now);
+
+        // 等待到最近的重连、连接超时、空闲超时或组播检查时间
+        int64_t timeout = -1;
+        auto until = [&](uint64_t at) {
+            int64_t wait = at > now ? (int64_t) (at - now) : 0;
+            timeout = timeout < 0 ? wait : std::min(timeout, wait);
+        };
+        if (state == State::Idle) until(reconnectAtMs);
+        if (state == State::Connecting) until(connectStartMs + CLIENT_CONNECT_TIMEOUT_MS);
+        if (state == State::Connected) until(lastReceiveMs + CLIENT_IDLE_TIMEOUT_MS);
+        if (multicast) until(lastTickMs + MULTICAST_NAK_DELAY_MS);
+        if (poller.Wait(events, (int) timeout) < 0) break;
+
+        now = NowMs();
+        for (const auto &ev: events) {
+            if (multicast && ev.ptr == multicast.get()) {
+                multicast->ReadDatagrams(now);
+                continue;
+            }
+            if (state == State::Connecting && (ev.writable || ev.error)) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(sock, SOL_SOCKET, SO_ERROR, (char *) &err, &len);
+                if (err != 0) {
+                    Disconnect(now);
+                    continue;
+                }
+                OnConnected(now);
+            }
+            if (state != State::Connected) continue;
+            if (ev.readable || ev.error) OnReadable(now);
+            if (state == State::Connected && ev.writable) Flush(now);
+        }
+
+        if (state == State::Connecting && now >= connectStartMs + CLIENT_CONNECT_TIMEOUT_MS) Disconnect(now);
+        if (state == State::Connected && now >= lastReceiveMs + CLIENT_IDLE_TIMEOUT_MS) Disconnect(now);
+        if (multicast && now >= lastTickMs + MULTICAST_NAK_DELAY_MS) {
+            multicast->OnTick(now);
+            lastTickMs = now;
+        }
+    }
+    // 停止时尽量发出已排队的命令后关闭连接，会话状态和未发出的命令留到下次 Start
+    if (state == State::Connected) {
+        TakeQueued();
+        Flush(NowMs());
+    }
+    if (sock != INVALID_SOCKET) {
+        poller.Remove(sock);
+        closesocket(sock);
+        sock = INVALID_SOCKET;
+    }
+    bool wasConnected = state == State::Connected;
+    Rewind();
+    state = State::Idle;
+    connected = false;
+    if (wasConnected && onState) onState(false);
+}
+
+void ChatClient::Connect(uint64_t nowMs) {
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *result = nullptr;
+    sock = INVALID_SOCKET;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result) == 0 && result != nullptr) {
+        sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    }
+    if (sock == INVALID_SOCKET || !SetNonBlocking(sock) || !poller.Add(sock, this)) {
+        if (result != nullptr) freeaddrinfo(result);
+        Disconnect(nowMs);
+        return;
+    }
+    // 发送队列在客户端内合并，不需要 Nagle 算法再延迟
+    int noDelay = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char *) &noDelay, sizeof(noDelay));
+    int ret = connect(sock, result->ai_addr, (int) result->ai_addrlen);
+    freeaddrinfo(result);
+    if (ret == 0) {
+        OnConnected(nowMs);
+    } else if (ConnectPending(LastSocketError())) {
+        state = State::Connecting;
+        connectStartMs = nowMs;
+    } else {
+        Disconnect(nowMs);
+    }
+}
+
+void ChatClient::OnConnected(uint64_t nowMs) {
+    if (connections++ > 0) reconnects++;
+    state = State::Connected;
+    connected = true;
+    lastReceiveMs = nowMs;
+    in.clear();
+    // 握手和恢复会话的命令排在断开前未发出的命令之前
+    Rewind();
+    std::string pending;
+    pending.swap(out);
+    Append(OP_HELLO, {});
+    if (!username.empty()) Append(OP_REGISTER, {username});
+    for (const auto &group: groups) {
+        Append(OP_JOIN_GROUP, {group});
+        pendingRejoins++;
+    }
+    if (multicast) {
+        for (const auto &group: multicastGroups) Append(OP_MULTICAST_SUBSCRIBE, {group});
+    }
+    char seqText[24];
+    for (const auto &[group, tracker]: groupSeqs) {
+        auto result = std::to_chars(seqText, seqText + sizeof(seqText), tracker.last);
+        Append(OP_HISTORY, {group, std::string_view(seqText, result.ptr - seqText)});
+        resuming[group] = Resume{true, tracker.last};
+    }
+    if (!username.empty()) {
+        for (const auto &[peer, tracker]: directSeqs) {
+            auto result = std::to_chars(seqText, seqText + sizeof(seqText), tracker.last);
+            Append(OP_HISTORY, {peer, std::string_view(seqText, result.ptr - seqText)});
+            resuming[peer] = Resume{false, tracker.last};
+        }
+    }
+    out += pending;
+    if (onState) onState(true);
+}
+
+void ChatClient::Disconnect(uint64_t nowMs) {
+    if (sock != INVALID_SOCKET) {
+        poller.Remove(sock);
+        closesocket(sock);
+        sock = INVALID_SOCKET;
+    }
+    bool wasConnected = state == State::Connected;
+    Rewind();
+    in.clear();
+    pendingRejoins = 0;
+    // 新连接上服务器不再知道哪些成员能收到组播，重新订阅
+    if (multicast) {
+        for (const auto &group: multicastGroups) multicast->Unsubscribe(group);
+    }
+    state = State::Idle;
+    connected = false;
+    // 在退避间隔的后一半内随机选择重连时间，避免大量客户端同时重连
+    static thread_local std::mt19937 rng(std::random_device{}());
+    reconnectAtMs = nowMs + backoffMs / 2 + rng() % (backoffMs / 2 + 1);
+    backoffMs = std::min<uint64_t>(backoffMs * 2, CLIENT_RECONNECT_MAX_MS);
+    if (wasConnected && onState) onState(false);
+}
+
+void ChatClient::Rewind() {
+    std::string kept;
+    Command cmd;
+    size_t size = 0;
+    for (size_t pos = outCommitted; pos < out.size(); pos += size) {
+        if (DecodeBinary(out.data() + pos, out.size() - pos, cmd, size) != DecodeResult::Ok) break;
+        switch (cmd.opcode) {
+            case OP_HELLO:
+            case OP_REGISTER:
+            case OP_JOIN_GROUP:
+            case OP_PONG:
+            case OP_MULTICAST_SUBSCRIBE:
+            case OP_MULTICAST_ACK:
+            case OP_MULTICAST_NAK:
+            case OP_MULTICAST_LEAVE:
+                continue;
+            case OP_HISTORY:
+                if (resuming.count(std::string(cmd.fields[0])) > 0) continue;
+                break;
+            default:
+                break;
+        }
+        kept.append(out, pos, size);
+    }
+    out.swap(kept);
+    outSent = 0;
+    outCommitted = 0;
+    resuming.clear();
+}
+
+void ChatClient::TakeQueued() {
+    if (state != State::Connected) return;
+    std::string taken;
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        if (queued.empty()) return;
+        taken.swap(queued);
+    }
+    Command cmd;
+    size_t size = 0;
+    for (size_t pos = 0; pos < taken.size(); pos += size) {
+        if (DecodeBinary(taken.data() + pos, taken.size() - pos, cmd, size) != DecodeResult::Ok) break;
+        Track(cmd);
+        commandsSent++;
+    }
+    out += taken;
+}
+
+void ChatClient::Track(const Command &cmd) {
+    std::string name = cmd.fieldCount > 0 ? std::string(cmd.fields[0]) : std::string();
+    switch (cmd.opcode) {
+        case OP_REGISTER:
+            if (name != username) directSeqs.clear();
+            username = name;
+            break;
+        case OP_CREATE_GROUP:
+        case OP_JOIN_GROUP:
+            groups.insert(name);
+            break;
+        case OP_LEAVE_GROUP:
+            groups.erase(name);
+            groupSeqs.erase(name);
+            if (multicastGroups.erase(name) > 0) multicast->Unsubscribe(name);
+            break;
+        case OP_MULTICAST_SUBSCRIBE:
+            if (multicast) multicastGroups.insert(name);
+            break;
+        case OP_REMOVE:
+            username.clear();
+            groups.clear();
+            multicastGroups.clear();
+            groupSeqs.clear();
+            directSeqs.clear();
+            break;
+        default:
+            break;
+    }
+}
+
+void ChatClient::Append(uint8_t opcode, std::initializer_list<std::string_view> fields) {
+    AppendBinaryFrame(out, opcode, fields.begin(), fields.size());
+    commandsSent++;
+}
+
+void ChatClient::Flush(uint64_t nowMs) {
+    if (state != State::Connected) return;
+    while (outSent < out.size()) {
+        long n = (long) send(sock, out.data() + outSent, (int) (out.size() - outSent), 0);
+        sendCalls++;
+        if (n > 0) {
+            outSent += (size_t) n;
+            continue;
+        }
+        if (n < 0 && IsWouldBlock(LastSocketError())) break;
+        Disconnect(nowMs);
+        return;
+    }
+    // 推进到最后一个完整发出的帧，断开时从这里重新发送
+    size_t size;
+    while ((size = FrameSizeAt(out, outCommitted)) != 0 && outCommitted + size <= outSent) outCommitted += size;
+    if (outSent == out.size()) {
+        out.clear();
+        outSent = 0;
+        outCommitted = 0;
+    } else if (outCommitted >= CLIENT_COMPACT_BYTES) {
+        out.erase(0, outCommitted);
+        outSent -= outCommitted;
+        outCommitted = 0;
+    }
+    poller.SetWriteInterest(sock, outSent < out.size());
+}
+
+void ChatClient::OnReadable(uint64_t nowMs) {
+    bool closed = false;
+    while (true) {
+        long n = (long) recv(sock, readBuffer.data(), (int) readBuffer.size(), 0);
+        if (n > 0) {
+            in.append(readBuffer.data(), (size_t) n);
+            lastReceiveMs = nowMs;
+            continue;
+        }
+        closed = n == 0 || !IsWouldBlock(LastSocketError());
+        break;
+    }
+    size_t offset = 0;
+    Command cmd;
+    size_t size = 0;
+    DecodeResult result;
+    while ((result = DecodeBinary(in.data() + offset, in.size() - offset, cmd, size)) == DecodeResult::Ok) {
+        offset += size;
+        OnCommand(cmd, nowMs);
+    }
+    in.erase(0, offset);
+    if (closed || result == DecodeResult::Invalid) Disconnect(nowMs);
+}
+
+void ChatClient::OnCommand(const Command &cmd, uint64_t nowMs) {
+    switch (cmd.opcode) {
+        case OP_SERVER_PING:
+            Append(OP_PONG, {cmd.fieldCount > 0 ? cmd.fields[0] : std::string_view()});
+            return;
+        case OP_HELLO_ACK:
+            backoffMs = CLIENT_RECONNECT_MIN_MS;
+            break;
+        case OP_NOTICE:
+            // 重连时重新加入群组的回复
+            if (pendingRejoins > 0 && cmd.fieldCount > 0 &&
+                (cmd.fields[0] == "Server: Joined group." || cmd.fields[0] == "Server: User already in group." ||
+                 cmd.fields[0] == "Server: Group not found.")) {
+                pendingRejoins--;
+                return;
+            }
+            break;
+        case OP_DELIVER:
+            if (cmd.fieldCount >= 3) {
+                Deliver(&directSeqs[std::string(cmd.fields[0])], ParseSeq(cmd, 2), OP_DELIVER,
+                        {cmd.fields[0], cmd.fields[1], cmd.fields[2]});
+                return;
+            }
+            break;
+        case OP_GROUP_DELIVER:
+            if (cmd.fieldCount >= 4) {
+                Deliver(&groupSeqs[std::string(cmd.fields[0])], ParseSeq(cmd, 3), OP_GROUP_DELIVER,
+                        {cmd.fields[0], cmd.fields[1], cmd.fields[2], cmd.fields[3]});
+                return;
+            }
+            break;
+        case OP_HISTORY_MESSAGE: {
+            // 恢复会话取回的消息与在线时收到的一样交给上层：目标, 序列号, 发送者, 消息内容, 时间
+            auto it = cmd.fieldCount >= 4 ? resuming.find(std::string(cmd.fields[0])) : resuming.end();
+            if (it == resuming.end()) break;
+            uint64_t seq = ParseSeq(cmd, 1);
+            if (it->second.group) {
+                Deliver(&groupSeqs[it->first], seq, OP_GROUP_DELIVER,
+                        {cmd.fields[0], cmd.fields[2], cmd.fields[3], cmd.fields[1]});
+            } else if (cmd.fields[2] == username) {
+                // 私聊历史中自己发出的消息只用于补齐序列号
+                directSeqs[it->first].Seen(seq);
+            } else {
+                Deliver(&directSeqs[it->first], seq, OP_DELIVER, {cmd.fields[2], cmd.fields[3], cmd.fields[1]});
+            }
+            return;
+        }
+        case OP_HISTORY_END: {
+            // 目标, 本页最后一条序列号, 最新序列号；没有取完时继续取下一页
+            auto it = cmd.fieldCount >= 3 ? resuming.find(std::string(cmd.fields[0])) : resuming.end();
+            if (it == resuming.end()) break;
+            uint64_t last = ParseSeq(cmd, 1);
+            if (last > it->second.since && last < ParseSeq(cmd, 2)) {
+                it->second.since = last;
+                Append(OP_HISTORY, {cmd.fields[0], cmd.fields[1]});
+            } else {
+                resuming.erase(it);
+            }
+            return;
+        }
+        default:
+            if (multicast && multicast->OnServerCommand(cmd, nowMs)) return;
+            break;
+    }
+    if (onMessage) onMessage(cmd);
+}
+
+void ChatClient::Deliver(SeqTracker *tracker, uint64_t seq, uint8_t opcode,
+                         std::initializer_list<std::string_view> fields) {
+    if (seq != 0 && tracker->Seen(seq)) return;
+    if (!onMessage) return;
+    Command cmd;
+    cmd.version = PROTOCOL_VERSION;
+    cmd.opcode = opcode;
+    for (std::string_view field: fields) cmd.fields[cmd.fieldCount++] = field;
+    onMessage(cmd);
+}
+
+void ChatClient::OnMulticast(const Command &cmd) {
+    // 群组名, 组播序列号, 发送者, 消息内容[, 群组历史序列号]
+    if (cmd.fieldCount >= 5) {
+        Deliver(&groupSeqs[std::string(cmd.fields[0])], ParseSeq(cmd, 4), OP_GROUP_DELIVER,
+                {cmd.fields[0], cmd.fields[2], cmd.fields[3], cmd.fields[4]});
+    } else if (cmd.fieldCount == 4) {
+        Deliver(nullptr, 0, OP_GROUP_DELIVER, {cmd.fields[0], cmd.fields[2], cmd.fields[3]});
+    }
+}
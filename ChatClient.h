@@ -0,0 +1,211 @@
+#ifndef ONLINECHAT_CHATCLIENT_H
+#define ONLINECHAT_CHATCLIENT_H
+
+#include "Platform.h"
+#include "Poller.h"
+#include "Protocol.h"
+#include "Multicast.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// 重连的退避间隔（毫秒）：第一次失败后等待最小值，之后每次翻倍直到最大值，握手成功后复位
+#define CLIENT_RECONNECT_MIN_MS 100
+#define CLIENT_RECONNECT_MAX_MS 10000
+// 非阻塞连接的超时时间（毫秒）
+#define CLIENT_CONNECT_TIMEOUT_MS 5000
+// 超过该时间（毫秒）没有收到任何数据时视为连接已失效；服务器在连接空闲30秒后发送 PING
+#define CLIENT_IDLE_TIMEOUT_MS 45000
+// 每个会话记录的不连续序列号的上限，超过时放弃最早的缺口
+#define CLIENT_SEQ_AHEAD 1024
+
+/**
+ * 事件驱动的聊天客户端库，使用二进制协议。
+ * 一个线程运行事件循环：非阻塞连接，读取并解码服务器的帧，回复心跳，
+ * 把其它线程调用命令接口时加入发送队列的命令合并后一次系统调用发出。
+ * 连接断开后按指数退避重连，重连后自动 HELLO、重新注册、重新加入群组和订阅组播，
+ * 并对收到过消息的会话用 HISTORY 从最后连续收到的序列号继续，重复的消息按序列号丢弃。
+ * 回调在事件循环线程中调用，不能阻塞；命令接口可在任意线程调用
+ */
+class ChatClient {
+public:
+    // 收到服务器的一条消息（恢复会话时取回的历史消息转换为 DELIVER 和 GROUP_DELIVER）
+    using MessageCallback = std::function<void(const Command &cmd)>;
+    // 连接建立（已发送握手）或断开
+    using StateCallback = std::function<void(bool connected)>;
+
+    ChatClient(std::string host, int port);
+
+    ~ChatClient();
+
+    ChatClient(const ChatClient &) = delete;
+
+    ChatClient &operator=(const ChatClient &) = delete;
+
+    // 以下设置在 Start 之前调用
+    void SetMessageCallback(MessageCallback callback) { onMessage = std::move(callback); }
+
+    void SetStateCallback(StateCallback callback) { onState = std::move(callback); }
+
+    /**
+     * 启用组播接收，之后 SubscribeMulticast 订阅的群组消息通过组播收到
+     * @param interfaceAddress 加入组播的本机接口地址
+     * @return 是否成功
+     */
+    bool EnableMulticast(const std::string &interfaceAddress);
+
+    // 启动事件循环线程并开始连接；Stop 之后再次调用时恢复之前的会话
+    bool Start();
+
+    // 尽量发出已排队的命令后断开连接并停止事件循环线程，保留会话状态和尚未发送的命令
+    void Stop();
+
+    // 命令接口：命令加入发送队列，断开期间保留，重连后发送
+    void Register(std::string_view username);
+
+    void Message(std::string_view target, std::string_view text);
+
+    void CreateGroup(std::string_view group);
+
+    void JoinGroup(std::string_view group);
+
+    void LeaveGroup(std::string_view group);
+
+    void CheckGroup(std::string_view group);
+
+    void GroupMessage(std::string_view group, std::string_view text);
+
+    void SyncPresence();
+
+    void History(std::string_view target, uint64_t since);
+
+    void SubscribeMulticast(std::string_view group);
+
+    void Remove();
+
+    // 发送任意命令
+    void Send(uint8_t opcode, std::initializer_list<std::string_view> fields);
+
+    void Send(uint8_t opcode, const std::string_view *fields, size_t count);
+
+    bool Connected() const { return connected; }
+
+    // 已发送的命令数、发送系统调用次数和重连次数
+    uint64_t CommandsSent() const { return commandsSent; }
+
+    uint64_t SendCalls() const { return sendCalls; }
+
+    uint64_t Reconnects() const { return reconnects; }
+
+private:
+    enum class State {
+        Idle,       // 未连接，等待重连时间
+        Connecting, // 非阻塞连接进行中
+        Connected   // 已连接
+    };
+
+    // 一个会话中已收到的序列号：last 之前的都已收到，ahead 为之后零散收到的
+    struct SeqTracker {
+        uint64_t last{};
+        std::set<uint64_t> ahead;
+
+        // 是否已收到；未收到时记录并返回 false
+        bool Seen(uint64_t seq);
+    };
+
+    // 恢复会话时正在取回历史的一个会话
+    struct Resume {
+        bool group{};
+        uint64_t since{}; // 本页请求的起始序列号
+    };
+
+    void Loop();
+
+    void Connect(uint64_t nowMs);
+
+    // 连接建立：发送握手和恢复会话的命令，之后是断开期间排队的命令
+    void OnConnected(uint64_t nowMs);
+
+    // 关闭连接并安排重连，未完整发出的命令在重连后重新发送
+    void Disconnect(uint64_t nowMs);
+
+    void OnReadable(uint64_t nowMs);
+
+    void OnCommand(const Command &cmd, uint64_t nowMs);
+
+    // 按序列号去重后交给上层，没有序列号（seq 为 0）的消息直接交给上层
+    void Deliver(SeqTracker *tracker, uint64_t seq, uint8_t opcode, std::initializer_list<std::string_view> fields);
+
+    // 通过组播收到的群组消息，与TCP收到的一样按群组历史的序列号去重
+    void OnMulticast(const Command &cmd);
+
+    /**
+     * 整理断开时未完整发出的帧：丢弃重连时会重新生成的握手、注册、加入群组、恢复会话和组播命令，
+     * 其余命令重连后按原顺序重新发送
+     */
+    void Rewind();
+
+    // 把其它线程排队的命令移入发送缓冲区，同时记录会话状态
+    void TakeQueued();
+
+    // 记录会话状态：用户名、加入的群组和订阅组播的群组
+    void Track(const Command &cmd);
+
+    // 尽量发出发送缓冲区中的数据
+    void Flush(uint64_t nowMs);
+
+    // 在发送缓冲区末尾追加一条命令，只在事件循环线程中调用
+    void Append(uint8_t opcode, std::initializer_list<std::string_view> fields);
+
+    const std::string host;
+    const int port;
+    MessageCallback onMessage;
+    StateCallback onState;
+    Poller poller;
+    std::thread thread;
+    std::atomic<bool> running{false};
+    std::atomic<bool> connected{false};
+    SOCKET sock{INVALID_SOCKET};
+    State state{State::Idle};
+    // 其它线程加入的命令，由事件循环取走
+    std::mutex queueMutex;
+    std::string queued;
+    // 以下只在事件循环线程中访问
+    std::string out;        // 待发送的完整帧
+    size_t outSent{};       // 已发送的字节数
+    size_t outCommitted{};  // 已完整发送的帧的末尾，断开时之后的帧重新发送
+    std::string in;         // 尚未组成完整帧的数据
+    std::vector<char> readBuffer;
+    uint64_t backoffMs{CLIENT_RECONNECT_MIN_MS};
+    uint64_t reconnectAtMs{};
+    uint64_t connectStartMs{};
+    uint64_t lastReceiveMs{};
+    uint64_t lastTickMs{};
+    uint64_t connections{}; // 建立过的连接数
+    // 会话状态，重连后据此恢复
+    std::string username;
+    std::set<std::string> groups;
+    std::set<std::string> multicastGroups;
+    std::unordered_map<std::string, SeqTracker> groupSeqs;
+    std::unordered_map<std::string, SeqTracker> directSeqs;
+    // 恢复会话时正在取回历史的会话
+    std::unordered_map<std::string, Resume> resuming;
+    // 重连时重新加入的群组数，对应的回复不交给上层
+    int pendingRejoins{};
+    std::unique_ptr<MulticastReceiver> multicast;
+    std::atomic<uint64_t> commandsSent{0};
+    std::atomic<uint64_t> sendCalls{0};
+    std::atomic<uint64_t> reconnects{0};
+};
+
+#endif //ONLINECHAT_CHATCLIENT_H
@@ -0,0 +1,1506 @@
+#include "ChatServer.h"
+#include "Log.h"
+#include "Shard.h"
+#include "WebSocket.h"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+
+// 把数字格式化到调用方提供的缓冲区，避免为消息字段分配字符串
+template<typename T>
+static std::string_view FormatNumber(T value, char (&buf)[24]) {
+    auto result = std::to_chars(buf, buf + sizeof(buf), value);
+    return {buf, (size_t) (result.ptr - buf)};
+}
+
+// 解析完整的十进制数字字段
+static bool ParseNumber(std::string_view text, uint64_t &value) {
+    auto result = std::from_chars(text.data(), text.data() + text.size(), value);
+    return result.ec == std::errc() && result.ptr == text.data() + text.size();
+}
+
+ChatServer::ChatServer(Shard &shard)
+        : shard(shard), reactor(shard.GetReactor()), registry(shard.Set().GetRegistry()),
+          presence(shard.Set().GetPresence()), store(shard.Set().Store()), limits(shard.Set().GetLimits()),
+          userLimiter(shard.Set().GetUserLimiter()), admission(shard.Set().GetAdmission()),
+          files(shard.Set().Files()) {
+    handlers[OP_HELLO] = {&ChatServer::HandleHello, 0};
+    handlers[OP_REGISTER] = {&ChatServer::HandleRegister, 0};
+    handlers[OP_MESSAGE] = {&ChatServer::HandleMessage, 2};
+    handlers[OP_CREATE_GROUP] = {&ChatServer::HandleCreateGroup, 1};
+    handlers[OP_JOIN_GROUP] = {&ChatServer::HandleJoinGroup, 1};
+    handlers[OP_GROUP_CHECK] = {&ChatServer::HandleGroupCheck, 1};
+    handlers[OP_GROUP_MESSAGE] = {&ChatServer::HandleGroupMessage, 2};
+    handlers[OP_REMOVE] = {&ChatServer::HandleRemove, 0};
+    handlers[OP_PRESENCE_SYNC] = {&ChatServer::HandlePresenceSync, 0};
+    handlers[OP_LEAVE_GROUP] = {&ChatServer::HandleLeaveGroup, 1};
+    handlers[OP_HISTORY] = {&ChatServer::HandleHistory, 1};
+    handlers[OP_PING] = {&ChatServer::HandlePing, 0};
+    handlers[OP_PONG] = {&ChatServer::HandlePong, 0};
+    handlers[OP_MULTICAST_SUBSCRIBE] = {&ChatServer::HandleMulticastSubscribe, 1};
+    handlers[OP_MULTICAST_ACK] = {&ChatServer::HandleMulticastAck, 1};
+    handlers[OP_MULTICAST_NAK] = {&ChatServer::HandleMulticastNak, 3};
+    handlers[OP_MULTICAST_LEAVE] = {&ChatServer::HandleMulticastLeave, 2};
+    handlers[OP_SEND_FILE] = {&ChatServer::HandleSendFile, 3};
+    handlers[OP_GROUP_FILE] = {&ChatServer::HandleGroupFile, 3};
+    handlers[OP_FILE_CHUNK] = {&ChatServer::HandleFileChunk, 2};
+    handlers[OP_FILE_GET] = {&ChatServer::HandleFileGet, 1};
+    handlers[OP_FILE_CANCEL] = {&ChatServer::HandleFileCancel, 1};
+    reactor.SetCallbacks([this](ClientInfo *c) { OnOpen(c); },
+                         [this](ClientInfo *c) { OnData(c); },
+                         [this](ClientInfo *c) { OnClose(c); });
+    reactor.SetCongestionCallback([this](ClientInfo *c, bool congested) { OnCongestion(c, congested); });
+    reactor.SetAcceptCallback([this](const sockaddr_in &addr) { return OnAccept(addr); });
+    reactor.SetFileCallbacks([this](ClientInfo *c) { OnChunkSpliced(c); },
+                             [this](ClientInfo *c) { PumpDownloads(c); });
+}
+
+ClientHandle ChatServer::HandleOf(const ClientInfo *clientInfo) const {
+    return ClientHandle{shard.Index(), clientInfo->id};
+}
+
+void ChatServer::SendToClient(ClientInfo *clientInfo, const SharedMessage &msg) {
+    switch (clientInfo->protocol) {
+        case PROTOCOL_TEXT:
+        case PROTOCOL_TEXT_LINE:
+        case PROTOCOL_WEBSOCKET:
+            break;
+        case PROTOCOL_BINARY: {
+            // 协商完成之前不发送，保证客户端收到的第一帧是 HELLO_ACK
+            uint8_t opcode = msg.Opcode();
+            if (clientInfo->protocolVersion == 0 && opcode != OP_HELLO_ACK && opcode != OP_NOTICE) return;
+            break;
+        }
+        default:
+            // 客户端还没有发送任何数据，协议未知；WebSocket 连接尚未完成升级
+            return;
+    }
+    reactor.Send(clientInfo, msg.Encode(EncodingOf(clientInfo->protocol)));
+    if (clientInfo->congested) Throttle(clientInfo);
+}
+
+const MessagePtr &ChatServer::CachedNotice(const char *text) {
+    MessagePtr &msg = noticeCache[text];
+    if (!msg) msg = MakeMessage(OP_NOTICE, {text});
+    return msg;
+}
+
+void ChatServer::SendNotice(ClientInfo *clientInfo, const char *text) {
+    SendToClient(clientInfo, *CachedNotice(text));
+}
+
+void ChatServer::SendToHandle(ClientHandle handle, const MessagePtr &msg) {
+    if (handle.shard == shard.Index()) {
+        ClientInfo *client = reactor.Find(handle.clientId);
+        if (client) SendToClient(client, *msg);
+        return;
+    }
+    ShardMessage shardMsg;
+    shardMsg.data = msg;
+    shardMsg.target = handle.clientId;
+    shardMsg.sender = currentSender;
+    shard.PostTo(handle.shard, std::move(shardMsg));
+}
+
+void ChatServer::BroadcastAll(const MessagePtr &msg) {
+    for (int i = 0; i < shard.Set().Count(); i++) {
+        ShardMessage shardMsg;
+        shardMsg.kind = ShardMessage::BROADCAST;
+        shardMsg.data = msg;
+        shard.PostTo(i, std::move(shardMsg));
+    }
+}
+
+void ChatServer::OnShardMessage(const ShardMessage &msg) {
+    switch (msg.kind) {
+        case ShardMessage::PRESENCE:
+            for (ClientInfo *client: reactor.Clients()) {
+                if (!client->closing) SendPresence(client, *msg.data);
+            }
+            return;
+        case ShardMessage::BROADCAST:
+            for (ClientInfo *client: reactor.Clients()) {
+                // 拥塞的连接降级，不再接收服务器广播
+                if (!client->closing && !client->congested) SendToClient(client, *msg.data);
+            }
+            return;
+        case ShardMessage::PAUSE_READ:
+        case ShardMessage::RESUME_READ: {
+            ClientInfo *client = reactor.Find(msg.target);
+            if (client == nullptr) return;
+            if (msg.kind == ShardMessage::PAUSE_READ) reactor.PauseRead(client);
+            else reactor.ResumeRead(client);
+            return;
+        }
+        case ShardMessage::FILE_READY: {
+            ClientInfo *client = reactor.Find(msg.target);
+            if (client) PumpDownloads(client);
+            return;
+        }
+        case ShardMessage::DELIVER:
+        case ShardMessage::GROUP_DELIVER:
+            break;
+    }
+    // 投递给本分片客户端时仍以原发送者计算背压，发往自身分片时保留外层的发送者
+    ClientHandle outer = currentSender;
+    currentSender = msg.sender;
+    if (msg.kind == ShardMessage::DELIVER) {
+        // 目标连接可能已经断开，过期的ID查找不到复用同一槽位的新连接
+        ClientInfo *client = reactor.Find(msg.target);
+        if (client) SendToClient(client, *msg.data);
+    } else {
+        // 群组消息的目标是投递时本分片上的群组成员
+        msg.group->MembersOn(shard.Index(), groupTargets, msg.multicastSeq);
+        for (uint64_t clientId: groupTargets) {
+            ClientInfo *client = reactor.Find(clientId);
+            if (client) SendToClient(client, *msg.data);
+        }
+    }
+    currentSender = outer;
+}
+
+void ChatServer::OnCongestion(ClientInfo *clientInfo, bool congested) {
+    if (!congested) {
+        LOG_INFO << "Client [" << clientInfo->id << "] drained its send queue.";
+        ReleaseThrottled(clientInfo->id);
+        return;
+    }
+    LOG_WARN << "Client [" << clientInfo->id << "] is congested: " << clientInfo->outQueue.Size() << " frames, "
+             << clientInfo->outQueue.Bytes() << " bytes queued.";
+    // 超时后仍处于同一次拥塞的连接视为慢消费者，断开连接
+    uint64_t clientId = clientInfo->id;
+    auto since = clientInfo->congestedSince;
+    reactor.RunAfter(SLOW_CONSUMER_TIMEOUT_MS, [this, clientId, since]() {
+        ClientInfo *client = reactor.Find(clientId);
+        if (client == nullptr) return;
+        if (!client->congested || client->congestedSince != since) return;
+        LOG_WARN << "Client [" << clientId << "] stayed congested for " << SLOW_CONSUMER_TIMEOUT_MS
+                 << " ms, disconnecting.";
+        reactor.Metrics().evictions.Add();
+        reactor.Close(client);
+    });
+}
+
+void ChatServer::Throttle(ClientInfo *recipient) {
+    ClientHandle sender = currentSender;
+    // 发送者自身拥塞时同样暂停读取，直到它读走积压的回复
+    if (sender.shard < 0) return;
+    std::vector<ClientHandle> &senders = throttledSenders[recipient->id];
+    for (const auto &handle: senders) {
+        if (handle == sender) return;
+    }
+    senders.push_back(sender);
+    SetReadPaused(sender, true);
+}
+
+void ChatServer::ReleaseThrottled(uint64_t clientId) {
+    auto it = throttledSenders.find(clientId);
+    if (it == throttledSenders.end()) return;
+    std::vector<ClientHandle> senders = std::move(it->second);
+    throttledSenders.erase(it);
+    for (const auto &handle: senders) {
+        SetReadPaused(handle, false);
+    }
+}
+
+void ChatServer::SetReadPaused(ClientHandle handle, bool paused) {
+    if (handle.shard == shard.Index()) {
+        ClientInfo *client = reactor.Find(handle.clientId);
+        if (client == nullptr) return;
+        if (paused) reactor.PauseRead(client);
+        else reactor.ResumeRead(client);
+        return;
+    }
+    ShardMessage shardMsg;
+    shardMsg.kind = paused ? ShardMessage::PAUSE_READ : ShardMessage::RESUME_READ;
+    shardMsg.target = handle.clientId;
+    shard.PostTo(handle.shard, std::move(shardMsg));
+}
+
+void ChatServer::ReportQueues() {
+    size_t totalBytes = 0, maxBytes = 0, maxFrames = 0;
+    int congested = 0, paused = 0;
+    for (const ClientInfo *client: reactor.Clients()) {
+        const FrameQueue &queue = client->outQueue;
+        totalBytes += queue.Bytes();
+        if (queue.Bytes() > maxBytes) maxBytes = queue.Bytes();
+        if (queue.Size() > maxFrames) maxFrames = queue.Size();
+        if (client->congested) congested++;
+        if (client->readPauses > 0) paused++;
+    }
+    // 经异步日志输出，各分片同时报告时每行保持完整
+    LOG_INFO << "Shard " << shard.Index() << ": " << reactor.ConnectionCount() << " connections, " << totalBytes
+             << " bytes queued, max " << maxFrames << " frames / " << maxBytes << " bytes, " << congested
+             << " congested, " << paused << " read paused";
+    for (const ClientInfo *client: reactor.Clients()) {
+        const FrameQueue &queue = client->outQueue;
+        // 只列出有积压或被暂停的连接
+        if (queue.Empty() && client->readPauses == 0) continue;
+        LOG_INFO << "  [" << client->id << "] " << client->username << ": " << queue.Size() << " frames, "
+                 << queue.Bytes() << " bytes" << (client->congested ? ", congested" : "")
+                 << (client->readPauses > 0 ? ", read paused" : "");
+    }
+}
+
+void ChatServer::FailTransfers() {
+    // 先结束上传，唤醒的其它分片的下载者由移交前的投递循环处理
+    std::vector<uint64_t> interrupted;
+    for (const auto &upload: uploads) interrupted.push_back(upload.first);
+    for (uint64_t id: interrupted) FailUpload(id, "failed");
+    for (const auto &list: downloads) {
+        ClientInfo *client = reactor.Find(list.first);
+        if (client == nullptr) continue;
+        for (const Download &download: list.second) SendFileEnd(client, download.spool->id, "failed");
+    }
+    downloads.clear();
+}
+
+void ChatServer::ExportClients(std::vector<HandoffClient> &clients) {
+    for (const ClientInfo *client: reactor.Clients()) {
+        // 已请求关闭的连接不移交，旧进程退出时关闭；正在直接写入文件的连接停在帧的中间，同样不移交
+        if (client->closing || client->spliceRemaining > 0) continue;
+        HandoffClient exported;
+        exported.socket = client->sclient;
+        exported.shard = shard.Index();
+        exported.addr = client->addrClient;
+        exported.protocol = (uint8_t) client->protocol;
+        exported.protocolVersion = client->protocolVersion;
+        exported.presenceStale = client->presenceStale;
+        exported.heartbeat = client->heartbeat;
+        exported.username = client->username;
+        exported.input.assign(client->inBuf.ReadPtr(), client->inBuf.Readable());
+        exported.messageOffset = (uint32_t) client->messageOffset;
+        const FrameQueue &queue = client->outQueue;
+        for (size_t i = 0; i < queue.Size(); i++) {
+            const FramePtr &frame = queue.At(i);
+            size_t offset = i == 0 ? client->outOffset : 0;
+            if (frame->IsFile()) {
+                // 文件帧读出内容，文件传输本身不移交
+                const FileRegion &region = frame->Region();
+                size_t at = exported.output.size();
+                exported.output.resize(at + frame->Size() - offset);
+                long n = ReadAt(region.file, &exported.output[at], frame->Size() - offset, region.offset + offset);
+                exported.output.resize(at + (n > 0 ? (size_t) n : 0));
+                continue;
+            }
+            exported.output.append(frame->Data() + offset, frame->Size() - offset);
+        }
+        auto joined = clientGroups.find(client->id);
+        if (joined != clientGroups.end()) {
+            for (const auto &group: joined->second) {
+                MulticastRange range = group->MulticastOf(HandleOf(client));
+                exported.groups.push_back(group->Name());
+                exported.multicast.emplace_back(range.from, range.until);
+            }
+        }
+        clients.push_back(std::move(exported));
+    }
+}
+
+void ChatServer::AdoptClient(const HandoffClient &client) {
+    ClientInfo *clientInfo = reactor.Adopt(client.socket, client.addr);
+    if (clientInfo == nullptr) return;
+    ++shard.Set().connectionCount;
+    clientInfo->protocol = (ProtocolMode) client.protocol;
+    clientInfo->protocolVersion = client.protocolVersion;
+    clientInfo->presenceStale = client.presenceStale;
+    clientInfo->heartbeat = client.heartbeat;
+    clientInfo->username = client.username;
+    // 暂停读取时停在一条 WebSocket 消息中间，新进程从下一条命令继续，已处理的命令不再重复执行
+    clientInfo->messageOffset = client.messageOffset;
+    clientInfo->handshakePending = clientInfo->protocol == PROTOCOL_UNKNOWN ||
+                                   clientInfo->protocol == PROTOCOL_WEBSOCKET_UPGRADE ||
+                                   (clientInfo->protocol == PROTOCOL_BINARY && clientInfo->protocolVersion == 0);
+    admission.Add(clientInfo->addrClient, clientInfo->handshakePending);
+    // 空闲时间从接管时重新计算，旧进程中发出的 PING 视为已回复
+    ArmTimer(clientInfo, reactor.NowMs() + HANDSHAKE_TIMEOUT_MS);
+    if (!client.input.empty()) {
+        RingBuffer &in = clientInfo->inBuf;
+        in.Reserve(client.input.size());
+        in.PrepareWrite();
+        memcpy(in.WritePtr(), client.input.data(), client.input.size());
+        in.Commit(client.input.size());
+    }
+    // 旧进程未发出的数据作为一个帧排在最前面
+    if (!client.output.empty()) reactor.Send(clientInfo, FramePtr(SharedFrame::Create(client.output)));
+    ClientHandle handle = HandleOf(clientInfo);
+    Cluster *cluster = shard.Set().GetCluster();
+    if (!clientInfo->username.empty()) {
+        registry.AddUser(clientInfo->username, handle);
+        if (cluster) cluster->UserUp(clientInfo->username);
+    }
+    GroupPtr group;
+    bool multicast = shard.Set().Multicast() != nullptr;
+    for (size_t i = 0; i < client.groups.size(); i++) {
+        if (registry.FindGroup(client.groups[i], group) && group->Add(GroupMember{handle, clientInfo->username})) {
+            clientGroups[clientInfo->id].push_back(group);
+            if (cluster) cluster->GroupChanged(group);
+            if (multicast && i < client.multicast.size()) {
+                group->SetMulticast(handle, MulticastRange{client.multicast[i].first, client.multicast[i].second});
+            }
+        }
+    }
+}
+
+void ChatServer::PresenceChanged(const std::string &username) {
+    if (username.empty()) return;
+    if (presence.Touch(username)) shard.Set().SchedulePresence();
+}
+
+void ChatServer::PublishPresence() {
+    PresenceDelta delta;
+    if (!presence.TakeDelta(delta)) return;
+    MessagePtr msg = MakeMessage(OP_PRESENCE, {std::to_string(delta.seq), delta.joined, delta.left});
+    for (int i = 0; i < shard.Set().Count(); i++) {
+        ShardMessage shardMsg;
+        shardMsg.kind = ShardMessage::PRESENCE;
+        shardMsg.data = msg;
+        shard.PostTo(i, std::move(shardMsg));
+    }
+}
+
+void ChatServer::SendPresenceSnapshot(ClientInfo *clientInfo) {
+    std::string users;
+    uint64_t seq = presence.Snapshot(users);
+    SendToClient(clientInfo, *MakeMessage(OP_ONLINE_USERS, {users, std::to_string(seq)}));
+}
+
+void ChatServer::SendPresence(ClientInfo *clientInfo, const SharedMessage &delta) {
+    if (clientInfo->congested) {
+        // 拥塞的客户端跳过增量，之后用一次快照代替所有错过的增量
+        clientInfo->presenceStale = true;
+        return;
+    }
+    if (clientInfo->presenceStale) {
+        clientInfo->presenceStale = false;
+        SendPresenceSnapshot(clientInfo);
+        return;
+    }
+    SendToClient(clientInfo, delta);
+}
+
+void ChatServer::Broadcast(const std::string &message) {
+    MessagePtr msg = MakeMessage(OP_NOTICE, {message});
+    for (ClientInfo *client: reactor.Clients()) {
+        if (client->closing || client->congested) continue;
+        LOG_SAMPLED(LOG_LEVEL_DEBUG) << "Sending to [" << client->id << "]: " << message;
+        SendToClient(client, *msg);
+    }
+}
+
+bool ChatServer::OnAccept(const sockaddr_in &addr) {
+    ShardMetrics &metrics = reactor.Metrics();
+    switch (admission.Check(addr, limits)) {
+        case Admission::Result::Accepted:
+            return true;
+        case Admission::Result::TooManyPending:
+            metrics.rejectedPending.Add();
+            LOG_DEBUG << "Too many pending handshakes, rejected " << inet_ntoa(addr.sin_addr);
+            return false;
+        case Admission::Result::TooManyFromIp:
+            metrics.rejectedPerIp.Add();
+            LOG_DEBUG << "Too many connections from " << inet_ntoa(addr.sin_addr) << ", rejected.";
+            return false;
+    }
+    return false;
+}
+
+void ChatServer::HandshakeDone(ClientInfo *clientInfo) {
+    if (!clientInfo->handshakePending) return;
+    clientInfo->handshakePending = false;
+    admission.HandshakeDone();
+}
+
+void ChatServer::OnOpen(ClientInfo *clientInfo) {
+    // 客户端连接信息
+    int total = ++shard.Set().connectionCount;
+    LOG_INFO << "Client [" << clientInfo->id << "] connected from " << inet_ntoa(clientInfo->addrClient.sin_addr)
+             << ":" << ntohs(clientInfo->addrClient.sin_port) << ", total connections: " << total;
+    // 不回复心跳的旧客户端依靠TCP保活发现失效的对端
+    SetKeepAlive(clientInfo->sclient, HEARTBEAT_INTERVAL_MS / 1000, HEARTBEAT_TIMEOUT_MS / 1000 / KEEPALIVE_PROBES,
+                 KEEPALIVE_PROBES);
+    clientInfo->handshakePending = true;
+    admission.Add(clientInfo->addrClient, true);
+    ArmTimer(clientInfo, reactor.NowMs() + HANDSHAKE_TIMEOUT_MS);
+}
+
+void ChatServer::ArmTimer(ClientInfo *clientInfo, uint64_t expireMs) {
+    uint64_t clientId = clientInfo->id;
+    uint64_t now = reactor.NowMs();
+    int delayMs = expireMs > now ? (int) (expireMs - now) : 0;
+    clientInfo->timer = reactor.RunAfter(delayMs, [this, clientId]() { OnTimer(clientId); });
+}
+
+void ChatServer::OnTimer(uint64_t clientId) {
+    ClientInfo *clientInfo = reactor.Find(clientId);
+    if (clientInfo == nullptr) return;
+    clientInfo->timer = 0;
+    uint64_t now = reactor.NowMs();
+    bool handshaken = clientInfo->protocol == PROTOCOL_BINARY ? clientInfo->protocolVersion != 0
+                                                               : clientInfo->protocol != PROTOCOL_UNKNOWN &&
+                                                                 clientInfo->protocol != PROTOCOL_WEBSOCKET_UPGRADE;
+    if (!handshaken) {
+        LOG_WARN << "Client [" << clientId << "] did not complete the handshake in " << HANDSHAKE_TIMEOUT_MS
+                 << " ms, disconnecting.";
+        reactor.Metrics().handshakeTimeouts.Add();
+        reactor.Close(clientInfo);
+        return;
+    }
+    // 暂停读取或发送拥塞期间收不到回复，由背压和慢消费者超时处理
+    if (clientInfo->readPauses > 0 || clientInfo->congested) {
+        clientInfo->pingSent = false;
+        ArmTimer(clientInfo, now + HEARTBEAT_INTERVAL_MS);
+        return;
+    }
+    uint64_t idle = now - clientInfo->lastActiveMs;
+    if (idle < HEARTBEAT_INTERVAL_MS) {
+        clientInfo->pingSent = false;
+        ArmTimer(clientInfo, clientInfo->lastActiveMs + HEARTBEAT_INTERVAL_MS);
+        return;
+    }
+    if (!clientInfo->heartbeat) {
+        // 客户端之后发送 PING 或 PONG 时开始心跳
+        ArmTimer(clientInfo, now + HEARTBEAT_INTERVAL_MS);
+        return;
+    }
+    if (!clientInfo->pingSent) {
+        clientInfo->pingSent = true;
+        char buf[24];
+        if (clientInfo->protocol == PROTOCOL_WEBSOCKET) {
+            // 浏览器自动回复 WebSocket 控制帧 PING，网页脚本不需要处理心跳
+            reactor.Send(clientInfo, MakeWebSocketFrame(WS_PING, FormatNumber(now, buf)));
+        } else {
+            SendToClient(clientInfo, *MakeMessage(OP_SERVER_PING, {FormatNumber(now, buf)}));
+        }
+        ArmTimer(clientInfo, now + HEARTBEAT_TIMEOUT_MS);
+        return;
+    }
+    LOG_WARN << "Client [" << clientId << "] did not answer the heartbeat in " << HEARTBEAT_TIMEOUT_MS
+             << " ms, disconnecting.";
+    reactor.Metrics().heartbeatTimeouts.Add();
+    reactor.Close(clientInfo);
+}
+
+void ChatServer::OnData(ClientInfo *clientInfo) {
+    if (clientInfo->protocol == PROTOCOL_WEBSOCKET_UPGRADE || clientInfo->protocol == PROTOCOL_WEBSOCKET) {
+        OnWebSocketData(clientInfo);
+        return;
+    }
+    RingBuffer &in = clientInfo->inBuf;
+    // 被暂停读取后剩余的命令留在缓冲区，恢复读取时继续处理
+    while (!clientInfo->closing && clientInfo->readPauses == 0 && in.Readable() > 0) {
+        // 首字节决定连接使用二进制帧还是旧文本协议
+        if (clientInfo->protocol == PROTOCOL_UNKNOWN) {
+            clientInfo->protocol = DetectProtocol(*in.ReadPtr());
+            // 文本协议没有握手，收到数据即完成
+            if (clientInfo->protocol != PROTOCOL_BINARY) HandshakeDone(clientInfo);
+        }
+        Command cmd;
+        size_t size = 0;
+        DecodeResult result = clientInfo->protocol == PROTOCOL_BINARY
+                              ? DecodeBinary(in.ReadPtr(), in.Readable(), cmd, size)
+                              : DecodeText(in.ReadPtr(), in.Readable(), clientInfo->protocol == PROTOCOL_TEXT_LINE,
+                                           cmd, size);
+        if (result == DecodeResult::NeedMore) {
+            // 文件数据块不等整个帧到达，剩余部分直接从套接字写入中转文件
+            if (clientInfo->protocol == PROTOCOL_BINARY && files.ZeroCopy() && SpliceChunk(clientInfo)) return;
+            if (size <= MAX_FRAME_SIZE) {
+                // 命令不完整，等待后续数据，缓冲区不够时扩容
+                in.Reserve(size);
+                return;
+            }
+            result = DecodeResult::Invalid;
+        }
+        if (result == DecodeResult::Invalid) {
+            LOG_WARN << "Invalid frame from client [" << clientInfo->id << "].";
+            SendNotice(clientInfo, "Server: Invalid frame.");
+            reactor.Close(clientInfo);
+            return;
+        }
+        // 收到换行后按行分隔命令，不再把每次读到的数据视为一条命令
+        if (clientInfo->protocol == PROTOCOL_TEXT && in.ReadPtr()[size - 1] == '\n') {
+            clientInfo->protocol = PROTOCOL_TEXT_LINE;
+        }
+        if (!Dispatch(clientInfo, cmd)) return;
+        in.Consume(size);
+    }
+}
+
+void ChatServer::OnWebSocketData(ClientInfo *clientInfo) {
+    RingBuffer &in = clientInfo->inBuf;
+    while (!clientInfo->closing && clientInfo->readPauses == 0 && in.Readable() > 0) {
+        size_t size = 0;
+        if (clientInfo->protocol == PROTOCOL_WEBSOCKET_UPGRADE) {
+            std::string response;
+            DecodeResult result = ParseUpgradeRequest(in.ReadPtr(), in.Readable(), response, size);
+            if (result == DecodeResult::NeedMore) {
+                in.Reserve(size);
+                return;
+            }
+            reactor.Send(clientInfo, FramePtr(SharedFrame::Create(response)));
+            if (result == DecodeResult::Invalid) {
+                LOG_WARN << "Invalid WebSocket upgrade request from client [" << clientInfo->id << "].";
+                reactor.Close(clientInfo);
+                return;
+            }
+            in.Consume(size);
+            // 网页客户端由浏览器回复控制帧 PING，升级完成即开始心跳
+            clientInfo->protocol = PROTOCOL_WEBSOCKET;
+            clientInfo->heartbeat = true;
+            HandshakeDone(clientInfo);
+            reactor.Metrics().webSocketUpgrades.Add();
+            continue;
+        }
+        WebSocketFrame frame;
+        DecodeResult result = DecodeWebSocket(in.MutableReadPtr(), in.Readable(), frame, size);
+        if (result == DecodeResult::NeedMore) {
+            // 帧长度在解码帧头时已经检查过
+            in.Reserve(size);
+            return;
+        }
+        if (result == DecodeResult::Invalid) {
+            LOG_WARN << "Invalid WebSocket frame from client [" << clientInfo->id << "].";
+            // 关闭状态码 1002：协议错误
+            reactor.Send(clientInfo, MakeWebSocketFrame(WS_CLOSE, std::string_view("\x03\xea", 2)));
+            reactor.Close(clientInfo);
+            return;
+        }
+        switch (frame.opcode) {
+            case WS_TEXT:
+            case WS_BINARY:
+                // 每行是一条文本协议命令，与 TCP 文本客户端共用命令处理。
+                // 处理到一半被暂停读取时记下位置，帧留在缓冲区中，恢复后从下一条命令继续
+                while (clientInfo->messageOffset < frame.length) {
+                    if (clientInfo->closing || clientInfo->readPauses > 0) return;
+                    Command cmd;
+                    size_t commandSize = 0;
+                    DecodeText(frame.payload + clientInfo->messageOffset, frame.length - clientInfo->messageOffset,
+                               false, cmd, commandSize);
+                    if (!Dispatch(clientInfo, cmd)) return;
+                    clientInfo->messageOffset += commandSize;
+                }
+                clientInfo->messageOffset = 0;
+                break;
+            case WS_PING:
+                reactor.Send(clientInfo, MakeWebSocketFrame(WS_PONG, {frame.payload, frame.length}));
+                break;
+            case WS_CLOSE:
+                // 回显关闭帧后断开
+                reactor.Send(clientInfo, MakeWebSocketFrame(WS_CLOSE, {frame.payload, frame.length}));
+                reactor.Close(clientInfo);
+                return;
+            default:
+                // PONG 只用于刷新活跃时间
+                break;
+        }
+        in.Consume(size);
+    }
+}
+
+bool ChatServer::Dispatch(ClientInfo *clientInfo, const Command &cmd) {
+    // 逐条消息的日志只在 DEBUG 级别按采样输出，关闭时不格式化消息内容
+    if (Logger::Enabled(LOG_LEVEL_DEBUG) && Logger::Sample()) {
+        LogLine line(LOG_LEVEL_DEBUG);
+        line << "Received from [" << clientInfo->id << "][" << inet_ntoa(clientInfo->addrClient.sin_addr) << ":"
+             << ntohs(clientInfo->addrClient.sin_port) << "]: " << OpcodeName(cmd.opcode);
+        for (int i = 0; i < cmd.fieldCount; i++) line << ' ' << cmd.fields[i];
+    }
+
+    ShardMetrics &metrics = reactor.Metrics();
+    const HandlerEntry &entry = handlers[cmd.opcode];
+    if (entry.handler == nullptr) {
+        // 未知命令，忽略
+        metrics.commands[0].Add();
+        return true;
+    }
+    if (!Admit(clientInfo, cmd)) return false;
+    int metricIndex = ShardMetrics::OpcodeIndex(cmd.opcode);
+    metrics.commands[metricIndex].Add();
+    if (clientInfo->protocol == PROTOCOL_BINARY && clientInfo->protocolVersion == 0 && cmd.opcode != OP_HELLO) {
+        LOG_WARN << "Client [" << clientInfo->id << "] sent a command before HELLO.";
+        SendNotice(clientInfo, "Server: HELLO required.");
+        reactor.Close(clientInfo);
+        return true;
+    }
+    if (cmd.fieldCount < entry.minFields) {
+        LOG_WARN << "Invalid " << OpcodeName(cmd.opcode) << " command format.";
+        SendNotice(clientInfo, "Server: Invalid command format.");
+        return true;
+    }
+    currentSender = HandleOf(clientInfo);
+    int64_t start = MonotonicNs();
+    (this->*(entry.handler))(clientInfo, cmd);
+    metrics.handlerLatency[metricIndex].Record((uint64_t) (MonotonicNs() - start));
+    currentSender = ClientHandle();
+    return true;
+}
+
+bool ChatServer::Admit(ClientInfo *clientInfo, const Command &cmd) {
+    double messages = 1, bytes = 0;
+    for (int i = 0; i < cmd.fieldCount; i++) bytes += (double) cmd.fields[i].size();
+    GroupPtr group;
+    if (cmd.opcode == OP_GROUP_MESSAGE && cmd.fieldCount > 0 && registry.FindGroup(cmd.fields[0], group)) {
+        // 群组消息的流量随成员数放大
+        messages = (double) std::max<size_t>(group->Size(), 1);
+        bytes *= messages;
+    } else if (cmd.opcode == OP_FILE_CHUNK) {
+        // 文件数据块的条数由传输窗口控制，不消耗聊天消息的令牌，字节数与消息合并计入
+        messages = 0;
+    }
+    bool userLimited = false;
+    int waitMs = TakeTokens(clientInfo, messages, bytes, userLimited);
+    if (waitMs == 0) return true;
+    // 不丢弃命令：暂停读取后由TCP流量控制把压力传回客户端
+    ShardMetrics &metrics = reactor.Metrics();
+    (userLimited ? metrics.userRateLimited : metrics.connRateLimited).Add();
+    LOG_DEBUG << "Client [" << clientInfo->id << "] exceeded the " << (userLimited ? "user" : "connection")
+              << " rate limit, pausing reads for " << waitMs << " ms.";
+    clientInfo->rateLimited = true;
+    reactor.PauseRead(clientInfo);
+    uint64_t clientId = clientInfo->id;
+    reactor.RunAfter(waitMs, [this, clientId]() {
+        ClientInfo *client = reactor.Find(clientId);
+        if (client == nullptr || !client->rateLimited) return;
+        client->rateLimited = false;
+        reactor.ResumeRead(client);
+    });
+    return false;
+}
+
+int ChatServer::TakeTokens(ClientInfo *clientInfo, double messages, double bytes, bool &userLimited) {
+    uint64_t now = reactor.NowMs();
+    int waitMs = std::max(clientInfo->messageTokens.Check(limits.connMessages, messages, now),
+                          clientInfo->byteTokens.Check(limits.connBytes, bytes, now));
+    userLimited = false;
+    if (waitMs == 0 && !clientInfo->username.empty()) {
+        waitMs = userLimiter.Take(clientInfo->username, limits, messages, bytes, now);
+        userLimited = waitMs > 0;
+    }
+    if (waitMs == 0) {
+        clientInfo->messageTokens.Take(messages);
+        clientInfo->byteTokens.Take(bytes);
+    }
+    return waitMs;
+}
+
+void ChatServer::OnClose(ClientInfo *clientInfo) {
+    // 客户端断开连接
+    int total = --shard.Set().connectionCount;
+    if (clientInfo->timer != 0) reactor.CancelTimer(clientInfo->timer);
+    admission.Release(clientInfo->addrClient, clientInfo->handshakePending);
+    clientInfo->handshakePending = false;
+    ReleaseThrottled(clientInfo->id);
+    // 退出连接加入的所有群组
+    Cluster *cluster = shard.Set().GetCluster();
+    auto joined = clientGroups.find(clientInfo->id);
+    if (joined != clientGroups.end()) {
+        for (const auto &group: joined->second) {
+            group->Remove(HandleOf(clientInfo));
+            if (cluster) cluster->GroupChanged(group);
+        }
+        clientGroups.erase(joined);
+    }
+    if (registry.RemoveUser(clientInfo->username, HandleOf(clientInfo)) && cluster) {
+        cluster->UserDown(clientInfo->username);
+    }
+    // 中断的上传使已开始下载的接收者收到失败的 FILE_END
+    std::vector<uint64_t> interrupted;
+    for (const auto &upload: uploads) {
+        if (upload.second.clientId == clientInfo->id) interrupted.push_back(upload.first);
+    }
+    for (uint64_t id: interrupted) FailUpload(id, "failed");
+    downloads.erase(clientInfo->id);
+    splicedChunks.erase(clientInfo->id);
+    LOG_INFO << "Client [" << clientInfo->id << "] disconnected, total connections: " << total;
+    // 在合并窗口结束后向所有客户端发送在线状态增量
+    PresenceChanged(clientInfo->username);
+}
+
+// 协议协商处理
+void ChatServer::HandleHello(ClientInfo *clientInfo, const Command &cmd) {
+    if (clientInfo->protocol != PROTOCOL_BINARY) return;
+    if (cmd.version != PROTOCOL_VERSION) {
+        LOG_WARN << "Unsupported protocol version " << (int) cmd.version << " from client [" << clientInfo->id
+                 << "].";
+        SendNotice(clientInfo, "Server: Unsupported protocol version.");
+        reactor.Close(clientInfo);
+        return;
+    }
+    clientInfo->protocolVersion = cmd.version;
+    HandshakeDone(clientInfo);
+    // 二进制客户端必须回复服务器的 PING
+    clientInfo->heartbeat = true;
+    SendToClient(clientInfo, *MakeMessage(OP_HELLO_ACK, {std::to_string(PROTOCOL_VERSION)}));
+}
+
+// 注册命令处理
+void ChatServer::HandleRegister(ClientInfo *clientInfo, const Command &cmd) {
+    if (cmd.fieldCount < 1) {
+        LOG_WARN << "Invalid registration command format.";
+        // 通知客户端注册失败
+        SendNotice(clientInfo, "Server: Invalid registration command format.");
+        return;
+    }
+    std::string username(cmd.fields[0]);
+    Cluster *cluster = shard.Set().GetCluster();
+    if (!clientInfo->username.empty() && clientInfo->username != username) {
+        // 同一连接改用新用户名注册，旧用户名下线
+        if (registry.RemoveUser(clientInfo->username, HandleOf(clientInfo)) && cluster) {
+            cluster->UserDown(clientInfo->username);
+        }
+        PresenceChanged(clientInfo->username);
+    }
+    clientInfo->username = username;
+    registry.AddUser(username, HandleOf(clientInfo));
+    // 其它节点从此把发给该用户的私聊转发到本节点
+    if (cluster) cluster->UserUp(username);
+    LOG_INFO << "User registered: " << username;
+    // 重新加入用户的持久成员关系中的群组
+    std::vector<GroupPtr> rejoined;
+    registry.RejoinGroups(GroupMember{HandleOf(clientInfo), username}, rejoined);
+    if (!rejoined.empty()) {
+        auto &joined = clientGroups[clientInfo->id];
+        joined.insert(joined.end(), rejoined.begin(), rejoined.end());
+        if (cluster) {
+            for (const auto &group: rejoined) cluster->GroupChanged(group);
+        }
+        LOG_DEBUG << "User " << username << " rejoined " << rejoined.size() << " groups.";
+    }
+    // 通知客户端注册成功
+    SendNotice(clientInfo, "Server: Registered.");
+    // 发送在线用户快照，之后只接收增量
+    SendPresenceSnapshot(clientInfo);
+    PresenceChanged(username);
+    DeliverInbox(clientInfo);
+    // 离线期间收到的文件，中转文件仍在保留期内的可以下载
+    for (const SpoolPtr &spool: files.TakePending(username)) SendToClient(clientInfo, *MakeOffer(*spool));
+}
+
+// 消息发送命令处理
+void ChatServer::HandleMessage(ClientInfo *clientInfo, const Command &cmd) {
+    std::string_view target = cmd.fields[0];
+    if (target == "SERVER") {
+        LOG_SAMPLED(LOG_LEVEL_DEBUG) << "Message to SERVER: " << cmd.fields[1];
+        return;
+    }
+    ClientHandle handle;
+    bool online = registry.FindUser(target, handle);
+    int node;
+    Cluster *cluster = shard.Set().GetCluster();
+    if (!online && cluster && cluster->FindUser(target, node)) {
+        // 目标用户在其它节点上，由该节点写入会话历史并投递
+        if (cluster->Deliver(node, target, clientInfo->username, cmd.fields[1])) {
+            SendNotice(clientInfo, "Server: Message sent.");
+        } else {
+            SendNotice(clientInfo, "Server: User not reachable.");
+        }
+        return;
+    }
+    // 离线消息只为在本节点注册过（已有收件箱）的用户保存，任意名字不会创建会话和收件箱
+    MessageLogPtr inbox;
+    if (!online && store != nullptr) inbox = store->InboxLog(target, false);
+    if (!online && !inbox) {
+        LOG_DEBUG << "User not found: " << target;
+        // 通知客户端用户不存在
+        SendNotice(clientInfo, "Server: User not found.");
+        return;
+    }
+    // 已注册用户的私聊写入会话历史，序列号作为投递消息的最后一个字段
+    uint64_t seq = 0;
+    char seqText[24];
+    if (store != nullptr && !clientInfo->username.empty()) {
+        MessageLogPtr log = store->DirectLog(clientInfo->username, target, true);
+        if (log) seq = store->Append(log, clientInfo->username, cmd.fields[1]);
+    }
+    if (online) {
+        //在消息前加上发送者的用户名，字段直接从接收缓冲区复制到池中的消息里
+        SendToHandle(handle, seq != 0
+                             ? MakeMessage(OP_DELIVER, {clientInfo->username, cmd.fields[1], FormatNumber(seq, seqText)})
+                             : MakeMessage(OP_DELIVER, {clientInfo->username, cmd.fields[1]}));
+        // 通知客户端消息已发送
+        SendNotice(clientInfo, "Server: Message sent.");
+    } else if (seq != 0) {
+        // 目标用户离线，放入其离线收件箱，注册时投递
+        store->Append(inbox, clientInfo->username, cmd.fields[1], seq);
+        LOG_DEBUG << "User offline, message queued: " << target;
+        SendNotice(clientInfo, "Server: User offline, message queued.");
+    } else {
+        LOG_DEBUG << "User not found: " << target;
+        SendNotice(clientInfo, "Server: User not found.");
+    }
+}
+
+// 创建群组命令处理
+void ChatServer::HandleCreateGroup(ClientInfo *clientInfo, const Command &cmd) {
+    std::string groupName(cmd.fields[0]);
+    //检查群组是否已存在
+    GroupPtr group;
+    if (!registry.CreateGroup(groupName, GroupMember{HandleOf(clientInfo), clientInfo->username}, group)) {
+        LOG_DEBUG << "Group already exists: " << groupName;
+        // 通知客户端群组已存在
+        SendNotice(clientInfo, "Server: Group already exists.");
+    } else {
+        LOG_INFO << "Group created: " << groupName;
+        clientGroups[clientInfo->id].push_back(group);
+        if (Cluster *cluster = shard.Set().GetCluster()) {
+            cluster->GroupCreated(groupName);
+            cluster->GroupChanged(group);
+        }
+        // 通知客户端群组创建成功
+        SendNotice(clientInfo, "Server: Group created.");
+        //广播所有用户群组数量和名字
+        BroadcastAll(MakeMessage(OP_GROUP_LIST, {registry.GroupList()}));
+    }
+}
+
+// 加入群组命令处理
+void ChatServer::HandleJoinGroup(ClientInfo *clientInfo, const Command &cmd) {
+    std::string_view groupName = cmd.fields[0];
+    GroupPtr group;
+    switch (registry.JoinGroup(groupName, GroupMember{HandleOf(clientInfo), clientInfo->username}, group)) {
+        case Registry::JoinResult::AlreadyMember:
+            LOG_DEBUG << "User already in group: " << groupName;
+            // 通知客户端用户已在群组中
+            SendNotice(clientInfo, "Server: User already in group.");
+            break;
+        case Registry::JoinResult::Joined:
+            LOG_INFO << "User " << clientInfo->username << " joined group: " << groupName;
+            // 记录连接加入的群组，断开时退出
+            clientGroups[clientInfo->id].push_back(group);
+            if (Cluster *cluster = shard.Set().GetCluster()) cluster->GroupChanged(group);
+            // 通知客户端加入群组成功
+            SendNotice(clientInfo, "Server: Joined group.");
+            break;
+        case Registry::JoinResult::GroupNotFound:
+            LOG_DEBUG << "Group not found: " << groupName;
+            // 通知客户端群组不存在
+            SendNotice(clientInfo, "Server: Group not found.");
+            break;
+    }
+}
+
+// 退出群组命令处理
+void ChatServer::HandleLeaveGroup(ClientInfo *clientInfo, const Command &cmd) {
+    std::string_view groupName = cmd.fields[0];
+    GroupPtr group;
+    switch (registry.LeaveGroup(groupName, GroupMember{HandleOf(clientInfo), clientInfo->username}, group)) {
+        case Registry::LeaveResult::Left: {
+            LOG_INFO << "User " << clientInfo->username << " left group: " << groupName;
+            // 只删除了持久成员关系时，本连接不在群组中
+            auto &joined = clientGroups[clientInfo->id];
+            auto it = std::find(joined.begin(), joined.end(), group);
+            if (it != joined.end()) joined.erase(it);
+            if (Cluster *cluster = shard.Set().GetCluster()) cluster->GroupChanged(group);
+            // 通知客户端退出群组成功
+            SendNotice(clientInfo, "Server: Left group.");
+            break;
+        }
+        case Registry::LeaveResult::NotMember:
+            // 通知客户端用户不在群组中
+            SendNotice(clientInfo, "Server: User not in group.");
+            break;
+        case Registry::LeaveResult::GroupNotFound:
+            LOG_DEBUG << "Group not found: " << groupName;
+            // 通知客户端群组不存在
+            SendNotice(clientInfo, "Server: Group not found.");
+            break;
+    }
+}
+
+// 检查群组成员命令处理
+void ChatServer::HandleGroupCheck(ClientInfo *clientInfo, const Command &cmd) {
+    std::string_view groupName = cmd.fields[0];
+    //查看群组是否存在并输出成员名称
+    GroupPtr group;
+    if (registry.FindGroup(groupName, group)) {
+        SendToClient(clientInfo, *MakeMessage(OP_GROUP_MEMBERS, {group->MemberNames()}));
+    } else {
+        LOG_DEBUG << "Group not found: " << groupName;
+        // 通知客户端群组不存在
+        SendNotice(clientInfo, "Server: Group not found.");
+    }
+}
+
+// 群组消息发送命令处理
+void ChatServer::HandleGroupMessage(ClientInfo *clientInfo, const Command &cmd) {
+    std::string_view groupName = cmd.fields[0];
+    //检查群组是否存在
+    GroupPtr group;
+    if (registry.FindGroup(groupName, group)) {
+        //检查用户是否在群组中
+        if (group->Contains(HandleOf(clientInfo))) {
+            //在消息前加上群组名和发送者的用户名
+            // 消息只构造一次，每种协议只编码一次，所有成员共享同一个帧
+            MessagePtr shared;
+            MulticastSender *multicast = shard.Set().Multicast();
+            uint64_t multicastSeq = 0;
+            size_t multicastBytes = 0;
+            MessageLogPtr log = store != nullptr ? store->GroupLog(groupName, true) : nullptr;
+            if (log) {
+                // 写入群组历史，序列号作为投递消息的最后一个字段
+                char seqText[24];
+                uint64_t seq = store->Append(log, clientInfo->username, cmd.fields[1]);
+                std::string_view seqField = FormatNumber(seq, seqText);
+                shared = MakeMessage(OP_GROUP_DELIVER, {groupName, clientInfo->username, cmd.fields[1], seqField});
+                if (multicast != nullptr) {
+                    multicastSeq = multicast->Send(groupName, {clientInfo->username, cmd.fields[1], seqField},
+                                                   multicastBytes);
+                }
+            } else {
+                shared = MakeMessage(OP_GROUP_DELIVER, {groupName, clientInfo->username, cmd.fields[1]});
+                if (multicast != nullptr) {
+                    multicastSeq = multicast->Send(groupName, {clientInfo->username, cmd.fields[1]}, multicastBytes);
+                }
+            }
+            // 整个网段只发送一个数据报，确认能收到组播的成员在扇出时被跳过
+            if (multicastSeq != 0) {
+                reactor.Metrics().multicastDatagrams.Add();
+                reactor.Metrics().multicastBytes.Add((int64_t) multicastBytes);
+            }
+            // 每个有成员的分片只投递一次，由目标分片遍历自己的成员
+            group->ShardsWithMembers(groupShards);
+            for (int i: groupShards) {
+                ShardMessage shardMsg;
+                shardMsg.kind = ShardMessage::GROUP_DELIVER;
+                shardMsg.data = shared;
+                shardMsg.group = group;
+                shardMsg.sender = currentSender;
+                shardMsg.multicastSeq = multicastSeq;
+                shard.PostTo(i, std::move(shardMsg));
+            }
+            // 有成员的其它节点各收到一帧，在各自节点上扇出
+            if (Cluster *cluster = shard.Set().GetCluster()) {
+                cluster->GroupDeliver(*group, clientInfo->username, cmd.fields[1]);
+            }
+            // 通知客户端消息已发送
+            SendNotice(clientInfo, "Server: Group message sent.");
+        }
+    } else {
+        LOG_DEBUG << "Group not found: " << groupName;
+        // 通知客户端群组不存在
+        SendNotice(clientInfo, "Server: Group not found.");
+    }
+}
+
+// 移除用户命令处理
+void ChatServer::HandleRemove(ClientInfo *clientInfo, const Command &) {
+    Cluster *cluster = shard.Set().GetCluster();
+    if (registry.RemoveUser(clientInfo->username, HandleOf(clientInfo)) && cluster) {
+        cluster->UserDown(clientInfo->username);
+    }
+    LOG_INFO << "User removed: " << clientInfo->username;
+    PresenceChanged(clientInfo->username);
+}
+
+// 在线用户快照请求处理
+void ChatServer::HandlePresenceSync(ClientInfo *clientInfo, const Command &) {
+    SendPresenceSnapshot(clientInfo);
+}
+
+// 历史消息查询处理：返回一页序列号大于给定值的消息，以 HISTORY_END 结束，客户端据此继续请求下一页
+void ChatServer::HandleHistory(ClientInfo *clientInfo, const Command &cmd) {
+    if (store == nullptr) {
+        SendNotice(clientInfo, "Server: History is disabled.");
+        return;
+    }
+    if (clientInfo->username.empty()) {
+        SendNotice(clientInfo, "Server: Not registered.");
+        return;
+    }
+    std::string_view target = cmd.fields[0];
+    uint64_t since = 0;
+    if (cmd.fieldCount > 1) {
+        if (!ParseNumber(cmd.fields[1], since)) {
+            SendNotice(clientInfo, "Server: Invalid command format.");
+            return;
+        }
+    }
+    // 目标为群组时只有成员可以读取，否则为与该用户的私聊
+    MessageLogPtr log;
+    GroupPtr group;
+    if (registry.FindGroup(target, group)) {
+        if (!group->Contains(HandleOf(clientInfo))) {
+            SendNotice(clientInfo, "Server: User not in group.");
+            return;
+        }
+        log = store->GroupLog(target, false);
+    } else {
+        log = store->DirectLog(clientInfo->username, target, false);
+    }
+    uint64_t last = since;
+    uint64_t latest = 0;
+    if (log) {
+        latest = log->LastSeq();
+        size_t bytes = 0;
+        char seqText[24], timeText[24];
+        log->Read(since, HISTORY_PAGE_SIZE, [&](const HistoryEntry &entry) {
+            SendToClient(clientInfo, *MakeMessage(OP_HISTORY_MESSAGE,
+                                                  {target, FormatNumber(entry.seq, seqText), entry.sender,
+                                                   entry.body, FormatNumber(entry.timeMs, timeText)}));
+            last = entry.seq;
+            bytes += entry.sender.size() + entry.body.size();
+            return bytes < HISTORY_PAGE_BYTES && !clientInfo->closing;
+        });
+    }
+    char lastText[24], latestText[24];
+    SendToClient(clientInfo, *MakeMessage(OP_HISTORY_END, {target, FormatNumber(last, lastText),
+                                                           FormatNumber(latest, latestText)}));
+}
+
+// 订阅群组的组播：回复组播地址和当前序列号，客户端加入组播组后收到第一个数据报时发送 ACK
+void ChatServer::HandleMulticastSubscribe(ClientInfo *clientInfo, const Command &cmd) {
+    std::string_view groupName = cmd.fields[0];
+    if (!MulticastGroup(clientInfo, groupName)) return;
+    char seqText[24];
+    uint64_t seq = shard.Set().Multicast()->Subscribe(groupName);
+    SendToClient(clientInfo, *MakeMessage(OP_MULTICAST_INFO, {groupName, MulticastSender::AddressOf(groupName),
+                                                              FormatNumber(seq, seqText)}));
+}
+
+// 客户端确认能收到组播：此后分配的序列号不再通过TCP发给它
+void ChatServer::HandleMulticastAck(ClientInfo *clientInfo, const Command &cmd) {
+    std::string_view groupName = cmd.fields[0];
+    GroupPtr group = MulticastGroup(clientInfo, groupName);
+    if (!group) return;
+    ClientHandle handle = HandleOf(clientInfo);
+    if (group->MulticastOf(handle).Active()) return;
+    uint64_t from = shard.Set().Multicast()->LastSeq(groupName) + 1;
+    group->SetMulticast(handle, MulticastRange{from, UINT64_MAX});
+    char seqText[24];
+    SendToClient(clientInfo, *MakeMessage(OP_MULTICAST_ACTIVE, {groupName, FormatNumber(from, seqText)}));
+}
+
+// 客户端发现序列号缺口：通过TCP重传缺失的数据报
+void ChatServer::HandleMulticastNak(ClientInfo *clientInfo, const Command &cmd) {
+    std::string_view groupName = cmd.fields[0];
+    uint64_t from = 0, to = 0;
+    if (!ParseNumber(cmd.fields[1], from) || !ParseNumber(cmd.fields[2], to) || from == 0 || to < from ||
+        to - from >= MULTICAST_WINDOW) {
+        SendNotice(clientInfo, "Server: Invalid command format.");
+        return;
+    }
+    GroupPtr group = MulticastGroup(clientInfo, groupName);
+    if (!group) return;
+    // 只重传本该通过组播到达该成员的消息
+    MulticastRange range = group->MulticastOf(HandleOf(clientInfo));
+    if (!range.Active()) return;
+    from = std::max(from, range.from);
+    to = std::min(to, range.until - 1);
+    if (to < from) return;
+    reactor.Metrics().multicastNaks.Add();
+    SendRepairs(clientInfo, groupName, from, to);
+}
+
+// 客户端退出组播（长时间收不到数据报或主动退出）：之后的消息恢复通过TCP投递，并补发它没有收到的部分
+void ChatServer::HandleMulticastLeave(ClientInfo *clientInfo, const Command &cmd) {
+    std::string_view groupName = cmd.fields[0];
+    uint64_t last = 0;
+    if (!ParseNumber(cmd.fields[1], last)) {
+        SendNotice(clientInfo, "Server: Invalid command format.");
+        return;
+    }
+    GroupPtr group = MulticastGroup(clientInfo, groupName);
+    if (!group) return;
+    ClientHandle handle = HandleOf(clientInfo);
+    MulticastRange range = group->MulticastOf(handle);
+    if (!range.Active() || range.until != UINT64_MAX) return;
+    range.until = shard.Set().Multicast()->LastSeq(groupName) + 1;
+    group->SetMulticast(handle, range);
+    uint64_t from = std::max(last + 1, range.from);
+    if (from < range.until) SendRepairs(clientInfo, groupName, from, range.until - 1);
+}
+
+GroupPtr ChatServer::MulticastGroup(ClientInfo *clientInfo, std::string_view groupName) {
+    if (shard.Set().Multicast() == nullptr) {
+        SendNotice(clientInfo, "Server: Multicast is disabled.");
+        return nullptr;
+    }
+    GroupPtr group;
+    if (!registry.FindGroup(groupName, group)) {
+        SendNotice(clientInfo, "Server: Group not found.");
+        return nullptr;
+    }
+    if (!group->Contains(HandleOf(clientInfo))) {
+        SendNotice(clientInfo, "Server: User not in group.");
+        return nullptr;
+    }
+    return group;
+}
+
+void ChatServer::SendRepairs(ClientInfo *clientInfo, std::string_view groupName, uint64_t from, uint64_t to) {
+    uint64_t earliest = shard.Set().Multicast()->Retransmit(groupName, from, to, repairFrames);
+    if (earliest > from) {
+        // 窗口外的消息由客户端通过 HISTORY 补齐
+        char seqText[24];
+        SendToClient(clientInfo, *MakeMessage(OP_MULTICAST_GAP, {groupName, FormatNumber(earliest, seqText)}));
+    }
+    Command repair;
+    size_t size = 0;
+    for (const auto &frame: repairFrames) {
+        if (DecodeBinary(frame.data(), frame.size(), repair, size) != DecodeResult::Ok) continue;
+        SendToClient(clientInfo, *MessagePtr(SharedMessage::Create(repair.opcode, repair.fields, repair.fieldCount)));
+    }
+    reactor.Metrics().multicastRetransmits.Add((int64_t) repairFrames.size());
+}
+
+// 心跳：原样返回令牌，文本客户端发送过 PING 后也会收到服务器的 PING
+void ChatServer::HandlePing(ClientInfo *clientInfo, const Command &cmd) {
+    clientInfo->heartbeat = true;
+    SendToClient(clientInfo, *MakeMessage(OP_SERVER_PONG, {cmd.fieldCount > 0 ? cmd.fields[0] : std::string_view()}));
+}
+
+// 收到数据时已更新活跃时间，回复本身不需要处理
+void ChatServer::HandlePong(ClientInfo *clientInfo, const Command &) {
+    clientInfo->heartbeat = true;
+}
+
+void ChatServer::DeliverInbox(ClientInfo *clientInfo) {
+    if (store == nullptr) return;
+    // 注册时创建收件箱，它同时是用户注册过的持久记录，之后发给该用户的离线消息才会保存
+    MessageLogPtr inbox = store->InboxLog(clientInfo->username, true);
+    if (!inbox) return;
+    uint64_t delivered = inbox->Cursor();
+    uint64_t cursor = delivered;
+    char seqText[24];
+    // 以私聊会话中的序列号投递，与在线时收到的消息一致
+    inbox->Read(delivered, SIZE_MAX, [&](const HistoryEntry &entry) {
+        SendToClient(clientInfo, *MakeMessage(OP_DELIVER, {entry.sender, entry.body, FormatNumber(entry.ref, seqText)}));
+        delivered = entry.seq;
+        return !clientInfo->congested && !clientInfo->closing;
+    });
+    if (delivered == cursor) return;
+    LOG_INFO << "Delivered " << delivered - cursor << " offline messages to " << clientInfo->username;
+    store->SetCursor(inbox, delivered);
+}
+
+bool ChatServer::CheckFile(ClientInfo *clientInfo, std::string_view sizeField, uint64_t &size) {
+    if (clientInfo->protocol != PROTOCOL_BINARY) {
+        SendNotice(clientInfo, "Server: File transfer requires the binary protocol.");
+        return false;
+    }
+    if (clientInfo->username.empty()) {
+        SendNotice(clientInfo, "Server: Register before sending files.");
+        return false;
+    }
+    if (!ParseNumber(sizeField, size) || size > FILE_MAX_SIZE) {
+        SendNotice(clientInfo, "Server: Invalid file size.");
+        return false;
+    }
+    return true;
+}
+
+SpoolPtr ChatServer::StartUpload(ClientInfo *clientInfo, std::string_view name, std::string_view group,
+                                 std::string_view target, uint64_t size) {
+    if (files.OverQuota(clientInfo->username, size)) {
+        // 还没有分配传输ID，以 0 作为ID拒绝
+        LOG_WARN << "Upload of " << size << " bytes from " << clientInfo->username << " exceeds the spool quota.";
+        SendFileEnd(clientInfo, 0, "quota exceeded");
+        return nullptr;
+    }
+    SpoolPtr spool = files.Create(clientInfo->username, name, group, target, size);
+    if (!spool) {
+        SendNotice(clientInfo, "Server: File transfer failed.");
+        return nullptr;
+    }
+    uploads[spool->id] = Upload{spool, clientInfo->id, 0};
+    reactor.Metrics().fileTransfers.Add();
+    char idText[24], windowText[24];
+    SendToClient(clientInfo, *MakeMessage(OP_FILE_ACCEPT, {FormatNumber(spool->id, idText),
+                                                           FormatNumber(FILE_WINDOW, windowText)}));
+    // 空文件没有数据块，立即完成
+    if (size == 0) ChunkDone(clientInfo, spool->id, 0);
+    return spool;
+}
+
+MessagePtr ChatServer::MakeOffer(const FileSpool &spool) {
+    char idText[24], sizeText[24];
+    std::string_view id = FormatNumber(spool.id, idText);
+    std::string_view size = FormatNumber(spool.size, sizeText);
+    if (spool.group.empty()) return MakeMessage(OP_FILE_OFFER, {id, spool.sender, spool.name, size});
+    return MakeMessage(OP_FILE_OFFER, {id, spool.sender, spool.name, size, spool.group});
+}
+
+// 私聊文件命令处理
+void ChatServer::HandleSendFile(ClientInfo *clientInfo, const Command &cmd) {
+    uint64_t size;
+    if (!CheckFile(clientInfo, cmd.fields[2], size)) return;
+    std::string_view target = cmd.fields[0];
+    ClientHandle handle;
+    bool online = registry.FindUser(target, handle);
+    int node;
+    Cluster *cluster = shard.Set().GetCluster();
+    if (!online && cluster && cluster->FindUser(target, node)) {
+        // 中转文件只在本节点上，不经节点间连接转发
+        SendNotice(clientInfo, "Server: File transfer to users on other nodes is not supported.");
+        return;
+    }
+    // 与私聊消息相同，只为在本节点注册过（已有收件箱）的离线用户保留
+    if (!online && (store == nullptr || !store->InboxLog(target, false))) {
+        LOG_DEBUG << "User not found: " << target;
+        SendNotice(clientInfo, "Server: User not found.");
+        return;
+    }
+    SpoolPtr spool = StartUpload(clientInfo, cmd.fields[1], {}, target, size);
+    if (!spool) return;
+    if (online) {
+        // 接收者不必等上传完成，已写入的部分立即可以下载
+        SendToHandle(handle, MakeOffer(*spool));
+    } else {
+        files.AddPending(target, spool->id);
+        SendNotice(clientInfo, "Server: User offline, file queued.");
+    }
+}
+
+// 群组文件命令处理
+void ChatServer::HandleGroupFile(ClientInfo *clientInfo, const Command &cmd) {
+    uint64_t size;
+    if (!CheckFile(clientInfo, cmd.fields[2], size)) return;
+    std::string_view groupName = cmd.fields[0];
+    GroupPtr group;
+    if (!registry.FindGroup(groupName, group)) {
+        SendNotice(clientInfo, "Server: Group not found.");
+        return;
+    }
+    if (!group->Contains(HandleOf(clientInfo))) {
+        SendNotice(clientInfo, "Server: User not in group.");
+        return;
+    }
+    SpoolPtr spool = StartUpload(clientInfo, cmd.fields[1], groupName, {}, size);
+    if (!spool) return;
+    // 所有成员共享同一个通知帧，之后从同一个中转文件各自下载；其它节点上的成员收不到文件
+    MessagePtr offer = MakeOffer(*spool);
+    group->ShardsWithMembers(groupShards);
+    for (int i: groupShards) {
+        ShardMessage shardMsg;
+        shardMsg.kind = ShardMessage::GROUP_DELIVER;
+        shardMsg.data = offer;
+        shardMsg.group = group;
+        shardMsg.sender = currentSender;
+        shard.PostTo(i, std::move(shardMsg));
+    }
+}
+
+bool ChatServer::SpliceChunk(ClientInfo *clientInfo) {
+    RingBuffer &in = clientInfo->inBuf;
+    Command cmd;
+    size_t size = 0;
+    if (clientInfo->protocolVersion == 0 || DecodeBinaryHead(in.ReadPtr(), in.Readable(), cmd, size) != DecodeResult::Ok ||
+        cmd.opcode != OP_FILE_CHUNK || cmd.fieldCount != 2 || size > MAX_FRAME_SIZE) {
+        return false;
+    }
+    uint64_t id;
+    auto it = ParseNumber(cmd.fields[0], id) ? uploads.find(id) : uploads.end();
+    if (it == uploads.end() || it->second.clientId != clientInfo->id) return false;
+    Upload &upload = it->second;
+    // 数据块的总长度，超出块大小或文件长度时按普通命令处理，由 HandleFileChunk 拒绝
+    std::string_view prefix = cmd.fields[1];
+    size_t len = size - (size_t) (prefix.data() - in.ReadPtr());
+    if (len > FILE_CHUNK_SIZE || upload.received + len > upload.spool->size) return false;
+    // 与经过 Dispatch 的数据块一样计入连接和用户的字节令牌，不足时等整个帧到达，由 Admit 暂停读取
+    bool userLimited;
+    if (TakeTokens(clientInfo, 0, (double) (len + cmd.fields[0].size()), userLimited) > 0) return false;
+    if (!WriteAt(upload.spool->file, prefix.data(), prefix.size(), upload.received)) return false;
+    reactor.Metrics().commands[ShardMetrics::OpcodeIndex(OP_FILE_CHUNK)].Add();
+    uint64_t offset = upload.received + prefix.size();
+    in.Consume(in.Readable());
+    splicedChunks[clientInfo->id] = SplicedChunk{id, len};
+    reactor.SpliceToFile(clientInfo, upload.spool->file, offset, len - prefix.size(), upload.copy);
+    return true;
+}
+
+void ChatServer::OnChunkSpliced(ClientInfo *clientInfo) {
+    auto it = splicedChunks.find(clientInfo->id);
+    if (it == splicedChunks.end()) return;
+    SplicedChunk chunk = it->second;
+    splicedChunks.erase(it);
+    // splice 失败后 Reactor 已改为复制，同一传输之后的数据块不再尝试
+    auto upload = uploads.find(chunk.id);
+    if (upload != uploads.end() && clientInfo->spliceCopy) upload->second.copy = true;
+    ChunkDone(clientInfo, chunk.id, chunk.len);
+    // 上传未完成时下一个帧通常是同一传输的数据块，只读入它的帧头，数据部分仍直接写入文件
+    if (uploads.count(chunk.id) > 0) {
+        char idText[24];
+        std::string_view head[1] = {FormatNumber(chunk.id, idText)};
+        reactor.LimitNextRead(clientInfo, BinaryHeadSize(head, 1));
+    }
+}
+
+// 文件数据块命令处理
+void ChatServer::HandleFileChunk(ClientInfo *clientInfo, const Command &cmd) {
+    uint64_t id;
+    bool valid = ParseNumber(cmd.fields[0], id);
+    auto it = valid ? uploads.find(id) : uploads.end();
+    // 传输已结束（取消、失败或热重启）时丢弃数据块并回复 FILE_END，客户端据此停止发送
+    if (it == uploads.end() || it->second.clientId != clientInfo->id) {
+        if (valid) SendFileEnd(clientInfo, id, "unknown transfer");
+        return;
+    }
+    Upload &upload = it->second;
+    std::string_view data = cmd.fields[1];
+    if (data.size() > FILE_CHUNK_SIZE || upload.received + data.size() > upload.spool->size) {
+        LOG_WARN << "Client [" << clientInfo->id << "] sent an oversized chunk for file " << id << ".";
+        FailUpload(id, "invalid chunk");
+        return;
+    }
+    if (!WriteAt(upload.spool->file, data.data(), data.size(), upload.received)) {
+        LOG_ERROR << "Writing file " << id << " failed with error: " << errno;
+        FailUpload(id, "write failed");
+        return;
+    }
+    ChunkDone(clientInfo, id, data.size());
+}
+
+void ChatServer::ChunkDone(ClientInfo *clientInfo, uint64_t id, size_t len) {
+    auto it = uploads.find(id);
+    if (it == uploads.end()) return;
+    SpoolPtr spool = it->second.spool;
+    uint64_t received = it->second.received += len;
+    reactor.Metrics().fileBytesReceived.Add((int64_t) len);
+    bool complete = received == spool->size;
+    if (complete) uploads.erase(it);
+    WakeDownloaders(files.Commit(*spool, received));
+    if (complete) {
+        LOG_INFO << "File " << id << " from " << spool->sender << " uploaded, " << received << " bytes.";
+        SendFileEnd(clientInfo, id, "complete");
+        return;
+    }
+    // 数据已写入文件，归还同样多的窗口
+    char idText[24], lenText[24];
+    SendToClient(clientInfo, *MakeMessage(OP_FILE_CREDIT, {FormatNumber(id, idText), FormatNumber(len, lenText)}));
+}
+
+void ChatServer::FailUpload(uint64_t id, const char *reason) {
+    auto it = uploads.find(id);
+    if (it == uploads.end()) return;
+    SpoolPtr spool = std::move(it->second.spool);
+    ClientInfo *uploader = reactor.Find(it->second.clientId);
+    uploads.erase(it);
+    if (uploader && !uploader->closing) SendFileEnd(uploader, id, reason);
+    WakeDownloaders(files.Fail(*spool));
+}
+
+void ChatServer::WakeDownloaders(const std::vector<ClientHandle> &waiters) {
+    for (const auto &handle: waiters) {
+        if (handle.shard == shard.Index()) {
+            ClientInfo *client = reactor.Find(handle.clientId);
+            if (client) PumpDownloads(client);
+            continue;
+        }
+        ShardMessage shardMsg;
+        shardMsg.kind = ShardMessage::FILE_READY;
+        shardMsg.target = handle.clientId;
+        shard.PostTo(handle.shard, std::move(shardMsg));
+    }
+}
+
+// 文件下载命令处理
+void ChatServer::HandleFileGet(ClientInfo *clientInfo, const Command &cmd) {
+    if (clientInfo->protocol != PROTOCOL_BINARY) {
+        SendNotice(clientInfo, "Server: File transfer requires the binary protocol.");
+        return;
+    }
+    uint64_t id, offset = 0;
+    SpoolPtr spool = ParseNumber(cmd.fields[0], id) ? files.Find(id) : nullptr;
+    // 私聊文件只有接收者可以下载，群组文件需要是群组成员
+    bool allowed = false;
+    if (spool && spool->group.empty()) {
+        allowed = !clientInfo->username.empty() && clientInfo->username == spool->target;
+    } else if (spool) {
+        GroupPtr group;
+        allowed = registry.FindGroup(spool->group, group) && group->Contains(HandleOf(clientInfo));
+    }
+    if (!allowed) {
+        SendNotice(clientInfo, "Server: File not found.");
+        return;
+    }
+    if (cmd.fieldCount > 1 && (!ParseNumber(cmd.fields[1], offset) || offset > spool->size)) {
+        SendNotice(clientInfo, "Server: Invalid file offset.");
+        return;
+    }
+    // 重复请求同一文件时从新的偏移继续
+    std::vector<Download> &list = downloads[clientInfo->id];
+    auto same = std::find_if(list.begin(), list.end(), [id](const Download &d) { return d.spool->id == id; });
+    if (same != list.end()) same->offset = offset;
+    else list.push_back(Download{spool, offset});
+    PumpDownloads(clientInfo);
+}
+
+// 取消文件传输命令处理
+void ChatServer::HandleFileCancel(ClientInfo *clientInfo, const Command &cmd) {
+    uint64_t id;
+    if (!ParseNumber(cmd.fields[0], id)) return;
+    auto upload = uploads.find(id);
+    if (upload != uploads.end() && upload->second.clientId == clientInfo->id) {
+        FailUpload(id, "cancelled");
+        return;
+    }
+    auto it = downloads.find(clientInfo->id);
+    if (it == downloads.end()) return;
+    std::vector<Download> &list = it->second;
+    auto same = std::find_if(list.begin(), list.end(), [id](const Download &d) { return d.spool->id == id; });
+    if (same == list.end()) return;
+    list.erase(same);
+    if (list.empty()) downloads.erase(it);
+    // 已排队的数据块仍会发出，之后是取消的 FILE_END
+    SendFileEnd(clientInfo, id, "cancelled");
+}
+
+void ChatServer::PumpDownloads(ClientInfo *clientInfo) {
+    auto it = downloads.find(clientInfo->id);
+    if (it == downloads.end()) return;
+    std::vector<Download> &list = it->second;
+    const FrameQueue &queue = clientInfo->outQueue;
+    bool zeroCopy = files.ZeroCopy();
+    bool progress = true;
+    // 每一轮每个下载发送一块，多个下载轮流使用发送窗口
+    while (progress && !clientInfo->closing && !list.empty() && queue.Bytes() < FILE_SEND_WINDOW) {
+        progress = false;
+        for (size_t i = 0; i < list.size() && !clientInfo->closing && queue.Bytes() < FILE_SEND_WINDOW;) {
+            Download &download = list[i];
+            FileSpool &spool = *download.spool;
+            uint64_t committed = spool.committed.load(std::memory_order_acquire);
+            if (download.offset == spool.size || (download.offset == committed && spool.failed)) {
+                SendFileEnd(clientInfo, spool.id, download.offset == spool.size ? "complete" : "failed");
+                list.erase(list.begin() + (long) i);
+                continue;
+            }
+            if (download.offset == committed) {
+                // 已读到上传进度，上传者写入新数据后唤醒；登记失败说明刚有新数据，继续读取
+                if (files.Wait(spool, HandleOf(clientInfo), download.offset)) i++;
+                else progress = true;
+                continue;
+            }
+            size_t len = (size_t) std::min<uint64_t>(committed - download.offset, FILE_CHUNK_SIZE);
+            char idText[24], offsetText[24];
+            std::string_view head[2] = {FormatNumber(spool.id, idText), FormatNumber(download.offset, offsetText)};
+            size_t headSize = BinaryHeadSize(head, 2);
+            FramePtr frame(SharedFrame::Create(headSize + (zeroCopy ? 0 : len)));
+            WriteBinaryHead(frame->MutableData(), OP_FILE_DATA, head, 2, len);
+            if (zeroCopy) {
+                // 帧头在内存中，文件数据由内核从页缓存直接发送，帧持有中转文件的引用
+                reactor.Send(clientInfo, std::move(frame));
+                reactor.Send(clientInfo, FramePtr(SharedFrame::CreateFile(download.spool, spool.file,
+                                                                          download.offset, len)));
+            } else {
+                if (ReadAt(spool.file, frame->MutableData() + headSize, len, download.offset) != (long) len) {
+                    LOG_ERROR << "Reading file " << spool.id << " failed with error: " << errno;
+                    SendFileEnd(clientInfo, spool.id, "read failed");
+                    list.erase(list.begin() + (long) i);
+                    continue;
+                }
+                reactor.Send(clientInfo, std::move(frame));
+            }
+            reactor.Metrics().fileBytesSent.Add((int64_t) len);
+            download.offset += len;
+            progress = true;
+            i++;
+        }
+    }
+    if (list.empty()) downloads.erase(it);
+    else if (queue.Bytes() >= FILE_SEND_WINDOW) reactor.NotifyDrain(clientInfo, FILE_SEND_WINDOW / 2);
+}
+
+void ChatServer::SendFileEnd(ClientInfo *clientInfo, uint64_t id, std::string_view result) {
+    char idText[24];
+    SendToClient(clientInfo, *MakeMessage(OP_FILE_END, {FormatNumber(id, idText), result}));
+}
@@ -0,0 +1,306 @@
+#ifndef ONLINECHAT_CHATSERVER_H
+#define ONLINECHAT_CHATSERVER_H
+
+#include "Reactor.h"
+#include "Registry.h"
+#include "Protocol.h"
+#include "Frame.h"
+#include "Handoff.h"
+#include "FileRelay.h"
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class Shard;
+class Presence;
+class MessageStore;
+struct ShardMessage;
+
+// 发送队列持续拥塞超过该时间（毫秒）的客户端被断开
+#define SLOW_CONSUMER_TIMEOUT_MS 10000
+// 连接建立后必须在该时间（毫秒）内完成握手：二进制客户端发送 HELLO，文本客户端发送数据
+#define HANDSHAKE_TIMEOUT_MS 10000
+// 连接空闲该时间（毫秒）后向会回复心跳的客户端发送 PING
+#define HEARTBEAT_INTERVAL_MS 30000
+// 发送 PING 后该时间（毫秒）内没有收到任何数据视为对端已失效，不大于 HEARTBEAT_INTERVAL_MS
+#define HEARTBEAT_TIMEOUT_MS 10000
+// 不回复 PING 的旧文本客户端由TCP保活探测失效的对端：空闲 HEARTBEAT_INTERVAL_MS 后探测的次数
+#define KEEPALIVE_PROBES 3
+// 下载时每个连接发送队列中最多排队的文件数据，排空一半后继续读取中转文件
+#define FILE_SEND_WINDOW (256 * 1024)
+
+/**
+ * 聊天服务器的命令处理逻辑。连接上的数据按协议解码为命令后，
+ * 按操作码分发给 REGISTER、MESSAGE、CREATE_GROUP 等处理函数，
+ * 由所属分片的事件循环调用。本地连接只在该分片线程中访问，
+ * 发往其它分片连接的数据通过分片消息队列投递
+ */
+class ChatServer {
+public:
+    explicit ChatServer(Shard &shard);
+
+    // 向本分片的所有客户端发送服务器广播消息
+    void Broadcast(const std::string &message);
+
+    // 处理其它分片投递过来的消息
+    void OnShardMessage(const ShardMessage &msg);
+
+    // 结束在线状态的合并窗口并向所有分片发布增量，只在分片0中调用
+    void PublishPresence();
+
+    // 以 INFO 级别日志输出本分片连接的发送队列深度
+    void ReportQueues();
+
+    // 热重启：文件传输不移交，以失败的 FILE_END 结束本分片所有进行中的上传和下载，只在事件循环停止后调用
+    void FailTransfers();
+
+    // 热重启：导出本分片所有未关闭的连接，只在事件循环停止后调用
+    void ExportClients(std::vector<HandoffClient> &clients);
+
+    // 热重启：恢复旧进程移交的连接，在事件循环开始前调用
+    void AdoptClient(const HandoffClient &client);
+
+private:
+    // 命令处理函数，命令字段在处理函数返回后失效
+    using CommandHandler = void (ChatServer::*)(ClientInfo *clientInfo, const Command &cmd);
+
+    // 操作码对应的处理函数和至少需要的字段数
+    struct HandlerEntry {
+        CommandHandler handler{};
+        int minFields{};
+    };
+
+    // 连接准入检查，超过限制时拒绝
+    bool OnAccept(const sockaddr_in &addr);
+
+    void OnOpen(ClientInfo *clientInfo);
+
+    // 从接收缓冲区中解码所有完整的命令并处理
+    void OnData(ClientInfo *clientInfo);
+
+    // WebSocket 连接：先处理 HTTP 升级请求，之后解码帧，每个文本或二进制消息作为一条文本协议命令处理
+    void OnWebSocketData(ClientInfo *clientInfo);
+
+    void OnClose(ClientInfo *clientInfo);
+
+    // 连接进入拥塞时安排超时断开，解除拥塞时恢复被它阻塞的发送者
+    void OnCongestion(ClientInfo *clientInfo, bool congested);
+
+    // 向拥塞连接发送数据的客户端暂停读取，直到该连接解除拥塞或断开
+    void Throttle(ClientInfo *recipient);
+
+    // 恢复所有因该连接拥塞而暂停读取的发送者
+    void ReleaseThrottled(uint64_t clientId);
+
+    // 暂停或恢复任意分片上客户端的读取
+    void SetReadPaused(ClientHandle handle, bool paused);
+
+    /**
+     * 处理一条命令
+     * @return 命令是否已处理，超过速率限制时返回 false，命令留在接收缓冲区中等待恢复读取后重新处理
+     */
+    bool Dispatch(ClientInfo *clientInfo, const Command &cmd);
+
+    /**
+     * 按命令的投递代价（群组消息按成员数计，文件数据块只计字节数）扣除连接和用户的令牌，
+     * 不足时暂停读取连接，令牌补足后恢复
+     * @return 是否已扣除
+     */
+    bool Admit(ClientInfo *clientInfo, const Command &cmd);
+
+    /**
+     * 连接和用户的令牌都足够时扣除
+     * @param userLimited 输出不足的是否为用户的令牌
+     * @return 0 表示已扣除，否则为需要等待的毫秒数
+     */
+    int TakeTokens(ClientInfo *clientInfo, double messages, double bytes, bool &userLimited);
+
+    // 连接完成握手，不再计入握手中的连接数
+    void HandshakeDone(ClientInfo *clientInfo);
+
+    void HandleHello(ClientInfo *clientInfo, const Command &cmd);
+
+    void HandleRegister(ClientInfo *clientInfo, const Command &cmd);
+
+    void HandleMessage(ClientInfo *clientInfo, const Command &cmd);
+
+    void HandleCreateGroup(ClientInfo *clientInfo, const Command &cmd);
+
+    void HandleJoinGroup(ClientInfo *clientInfo, const Command &cmd);
+
+    void HandleLeaveGroup(ClientInfo *clientInfo, const Command &cmd);
+
+    void HandleGroupCheck(ClientInfo *clientInfo, const Command &cmd);
+
+    void HandleGroupMessage(ClientInfo *clientInfo, const Command &cmd);
+
+    void HandleRemove(ClientInfo *clientInfo, const Command &cmd);
+
+    void HandlePresenceSync(ClientInfo *clientInfo, const Command &cmd);
+
+    void HandleHistory(ClientInfo *clientInfo, const Command &cmd);
+
+    void HandlePing(ClientInfo *clientInfo, const Command &cmd);
+
+    void HandlePong(ClientInfo *clientInfo, const Command &cmd);
+
+    void HandleMulticastSubscribe(ClientInfo *clientInfo, const Command &cmd);
+
+    void HandleMulticastAck(ClientInfo *clientInfo, const Command &cmd);
+
+    void HandleMulticastNak(ClientInfo *clientInfo, const Command &cmd);
+
+    void HandleMulticastLeave(ClientInfo *clientInfo, const Command &cmd);
+
+    void HandleSendFile(ClientInfo *clientInfo, const Command &cmd);
+
+    void HandleGroupFile(ClientInfo *clientInfo, const Command &cmd);
+
+    void HandleFileChunk(ClientInfo *clientInfo, const Command &cmd);
+
+    void HandleFileGet(ClientInfo *clientInfo, const Command &cmd);
+
+    void HandleFileCancel(ClientInfo *clientInfo, const Command &cmd);
+
+    /**
+     * 文件命令的公共检查：二进制客户端、已注册、文件长度有效
+     * @return 是否通过，失败时已通知客户端
+     */
+    bool CheckFile(ClientInfo *clientInfo, std::string_view sizeField, uint64_t &size);
+
+    // 创建传输并回复 FILE_ACCEPT，失败时通知客户端（超过在途字节数上限时回复ID为 0 的 FILE_END）并返回空指针
+    SpoolPtr StartUpload(ClientInfo *clientInfo, std::string_view name, std::string_view group,
+                         std::string_view target, uint64_t size);
+
+    // 通知接收者的 FILE_OFFER 消息
+    static MessagePtr MakeOffer(const FileSpool &spool);
+
+    /**
+     * 接收缓冲区中是一个不完整的 FILE_CHUNK 帧时，写入已到达的部分，
+     * 请求 Reactor 把剩余的数据直接从套接字写入中转文件
+     * @return 是否已接管，否则按普通命令等待整个帧到达
+     */
+    bool SpliceChunk(ClientInfo *clientInfo);
+
+    // Reactor 已把 SpliceChunk 接管的数据块全部写入文件
+    void OnChunkSpliced(ClientInfo *clientInfo);
+
+    // 一块上传数据已写入中转文件：唤醒下载者，归还窗口，上传完成时回复 FILE_END
+    void ChunkDone(ClientInfo *clientInfo, uint64_t id, size_t len);
+
+    // 上传失败或被取消，通知上传者并唤醒下载者
+    void FailUpload(uint64_t id, const char *reason);
+
+    // 唤醒等待中转文件新数据的下载者
+    void WakeDownloaders(const std::vector<ClientHandle> &waiters);
+
+    // 按发送队列的空闲窗口轮流发送客户端各个下载的下一块数据
+    void PumpDownloads(ClientInfo *clientInfo);
+
+    // 发送 FILE_END
+    void SendFileEnd(ClientInfo *clientInfo, uint64_t id, std::string_view result);
+
+    /**
+     * 组播命令的公共检查：组播已启用且客户端是群组成员
+     * @return 群组，检查失败时已通知客户端并返回空指针
+     */
+    GroupPtr MulticastGroup(ClientInfo *clientInfo, std::string_view groupName);
+
+    // 通过TCP重传组播序列号在 [from, to] 内的消息，已移出重传窗口的部分先发送 MULTICAST_GAP
+    void SendRepairs(ClientInfo *clientInfo, std::string_view groupName, uint64_t from, uint64_t to);
+
+    // 安排连接的握手或心跳定时任务，每个连接同时只有一个
+    void ArmTimer(ClientInfo *clientInfo, uint64_t expireMs);
+
+    /**
+     * 连接的定时任务到期：未完成握手的连接被断开；空闲超过心跳间隔时发送 PING，
+     * 发送后仍没有收到数据时断开。收到数据只更新活跃时间，由到期时重新计算下一次检查的时间
+     */
+    void OnTimer(uint64_t clientId);
+
+    // 投递用户离线期间收到的私聊消息，客户端拥塞时停止，剩余的在下次注册时投递
+    void DeliverInbox(ClientInfo *clientInfo);
+
+    // 记录用户的在线状态发生变化，窗口内的第一条变更安排一次发布
+    void PresenceChanged(const std::string &username);
+
+    // 发送在线用户快照
+    void SendPresenceSnapshot(ClientInfo *clientInfo);
+
+    // 发送在线状态增量，客户端拥塞时跳过，恢复后补发快照
+    void SendPresence(ClientInfo *clientInfo, const SharedMessage &delta);
+
+    // 本地客户端的句柄
+    ClientHandle HandleOf(const ClientInfo *clientInfo) const;
+
+    // 按客户端的协议取得消息的共享帧并加入发送队列
+    void SendToClient(ClientInfo *clientInfo, const SharedMessage &msg);
+
+    // 发送一次性的服务器通知
+    void SendNotice(ClientInfo *clientInfo, const char *text);
+
+    // 向任意分片上的客户端发送消息
+    void SendToHandle(ClientHandle handle, const MessagePtr &msg);
+
+    // 向所有分片的所有客户端发送消息
+    void BroadcastAll(const MessagePtr &msg);
+
+    // 固定文本的服务器通知只构造一次，按字符串常量的地址缓存
+    const MessagePtr &CachedNotice(const char *text);
+
+    Shard &shard;
+    Reactor &reactor;
+    Registry &registry;
+    Presence &presence;
+    // 消息历史存储，未启用时为空指针
+    MessageStore *store;
+    const Limits &limits;
+    UserLimiter &userLimiter;
+    Admission &admission;
+    FileRelay &files;
+    // 操作码到处理函数的映射
+    HandlerEntry handlers[256];
+    // 正在处理其命令的客户端，发送给拥塞连接时对它施加背压
+    ClientHandle currentSender;
+    // 拥塞连接的ID到因它而暂停读取的发送者
+    std::unordered_map<uint64_t, std::vector<ClientHandle>> throttledSenders;
+    // 本分片连接加入的群组，断开时退出
+    std::unordered_map<uint64_t, std::vector<GroupPtr>> clientGroups;
+    // 群组扇出时复用的临时数组，避免每条消息分配
+    std::vector<int> groupShards;
+    std::vector<uint64_t> groupTargets;
+    // 组播重传时复用的数据报缓冲区
+    std::vector<std::string> repairFrames;
+    std::unordered_map<const char *, MessagePtr> noticeCache;
+
+    // 本分片连接正在进行的上传
+    struct Upload {
+        SpoolPtr spool;
+        uint64_t clientId{};
+        uint64_t received{}; // 已写入中转文件的字节数
+        uint64_t credit{};   // 客户端剩余的发送窗口
+        bool copy{};         // 中转文件上 splice 失败过，之后的数据块经用户态缓冲区复制写入
+    };
+
+    // 一个接收者的下载进度
+    struct Download {
+        SpoolPtr spool;
+        uint64_t offset{};
+    };
+
+    // 正在直接写入文件的 FILE_CHUNK
+    struct SplicedChunk {
+        uint64_t id{};
+        size_t len{};
+    };
+
+    // 传输ID到上传
+    std::unordered_map<uint64_t, Upload> uploads;
+    // 客户端ID到它的下载
+    std::unordered_map<uint64_t, std::vector<Download>> downloads;
+    // 客户端ID到正在直接写入文件的数据块
+    std::unordered_map<uint64_t, SplicedChunk> splicedChunks;
+};
+
+#endif //ONLINECHAT_CHATSERVER_H
@@ -0,0 +1,634 @@
+#include "Cluster.h"
+#include "Log.h"
+#include "Shard.h"
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <sstream>
+
+#ifndef _WIN32
+#include <netdb.h>
+#endif
+
+// 把数字格式化到调用方提供的缓冲区
+template<typename T>
+static std::string_view FormatNumber(T value, char (&buf)[24]) {
+    auto result = std::to_chars(buf, buf + sizeof(buf), value);
+    return {buf, (size_t) (result.ptr - buf)};
+}
+
+static uint64_t NowMs() {
+    return (uint64_t) std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 非阻塞连接是否仍在进行
+static bool ConnectPending(int err) {
+#ifdef _WIN32
+    return err == WSAEWOULDBLOCK;
+#else
+    return err == EINPROGRESS || err == EINTR;
+#endif
+}
+
+// 解析主机名的所有 IPv4 地址
+static std::vector<in_addr> ResolveHost(const std::string &host) {
+    std::vector<in_addr> addresses;
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *result = nullptr;
+    if (getaddrinfo(host.c_str(), nullptr, &hints, &result) != 0) return addresses;
+    for (addrinfo *item = result; item != nullptr; item = item->ai_next) {
+        addresses.push_back(((sockaddr_in *) item->ai_addr)->sin_addr);
+    }
+    freeaddrinfo(result);
+    return addresses;
+}
+
+// 比较密钥，耗时与第一个不同字节的位置无关
+static bool SecretEquals(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    unsigned char diff = 0;
+    for (size_t i = 0; i < a.size(); i++) diff |= (unsigned char) (a[i] ^ b[i]);
+    return diff == 0;
+}
+
+Cluster::Cluster(ShardSet &set, int nodeId, std::vector<ClusterNode> nodes, std::string secret)
+        : set(set), nodeId(nodeId), secret(std::move(secret)), readBuffer(65536), batches(set.Count()) {
+    std::fill(std::begin(peerIndex), std::end(peerIndex), -1);
+    for (auto &node: nodes) {
+        if (node.id == nodeId) {
+            listenHost = node.host;
+            listenPort = node.port;
+            continue;
+        }
+        peerIndex[node.id] = (int) peers.size();
+        auto peer = std::make_unique<Peer>();
+        peer->node = std::move(node);
+        peers.push_back(std::move(peer));
+    }
+}
+
+Cluster::~Cluster() {
+    Stop();
+}
+
+bool Cluster::ParseNodes(const std::string &spec, std::vector<ClusterNode> &nodes) {
+    std::stringstream stream(spec);
+    std::string item;
+    nodes.clear();
+    while (std::getline(stream, item, ',')) {
+        size_t eq = item.find('=');
+        size_t colon = item.rfind(':');
+        if (eq == std::string::npos || colon == std::string::npos || colon < eq) return false;
+        ClusterNode node;
+        auto idResult = std::from_chars(item.data(), item.data() + eq, node.id);
+        auto portResult = std::from_chars(item.data() + colon + 1, item.data() + item.size(), node.port);
+        if (idResult.ec != std::errc() || portResult.ec != std::errc() || node.id < 0 ||
+            node.id >= CLUSTER_MAX_NODES || node.port <= 0) {
+            return false;
+        }
+        node.host = item.substr(eq + 1, colon - eq - 1);
+        for (const auto &other: nodes) {
+            if (other.id == node.id) return false;
+        }
+        nodes.push_back(std::move(node));
+    }
+    return !nodes.empty();
+}
+
+bool Cluster::Listen() {
+    if (sListen != INVALID_SOCKET) return true;
+    if (listenPort == 0) {
+        LOG_ERROR << "Node " << nodeId << " is not in the cluster node list.";
+        return false;
+    }
+    // 只在节点列表中本节点的地址上监听，节点间端口不暴露在其它网卡上
+    std::vector<in_addr> addresses = ResolveHost(listenHost);
+    if (addresses.empty()) {
+        LOG_ERROR << "Cannot resolve cluster address " << listenHost << ".";
+        return false;
+    }
+    sListen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sListen == INVALID_SOCKET) return false;
+    int reuse = 1;
+    setsockopt(sListen, SOL_SOCKET, SO_REUSEADDR, (const char *) &reuse, sizeof(reuse));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(listenPort);
+    addr.sin_addr = addresses[0];
+    if (bind(sListen, (sockaddr *) &addr, sizeof(addr)) == SOCKET_ERROR ||
+        listen(sListen, SOMAXCONN) == SOCKET_ERROR || !SetNonBlocking(sListen) || !poller.Add(sListen, &sListen)) {
+        LOG_ERROR << "Cluster listen on " << listenHost << ":" << listenPort << " failed with error: "
+                  << LastSocketError();
+        closesocket(sListen);
+        sListen = INVALID_SOCKET;
+        return false;
+    }
+    poller.SetWriteInterest(sListen, false);
+    return true;
+}
+
+void Cluster::Start() {
+    if (running) return;
+    running = true;
+    for (auto &peer: peers) peer->reconnectAtMs = 0;
+    thread = std::thread([this]() {
+        Logger::SetThreadName("cluster");
+        Loop();
+    });
+}
+
+void Cluster::Stop() {
+    if (running) {
+        running = false;
+        poller.Wakeup();
+        thread.join();
+    }
+    uint64_t now = NowMs();
+    for (auto &peer: peers) {
+        if (peer->sock != INVALID_SOCKET) Disconnect(*peer, now);
+    }
+    for (auto &inbound: inbounds) {
+        if (inbound->sock != INVALID_SOCKET) CloseInbound(inbound.get());
+    }
+    inbounds.clear();
+    if (sListen != INVALID_SOCKET) {
+        poller.Remove(sListen);
+        closesocket(sListen);
+        sListen = INVALID_SOCKET;
+    }
+}
+
+bool Cluster::FindUser(std::string_view username, int &node) const {
+    return remoteUsers.Find(username, node);
+}
+
+void Cluster::UserUp(const std::string &username) {
+    std::lock_guard<std::mutex> lock(announceMutex);
+    Announce(CLUSTER_USER_UP, username);
+}
+
+void Cluster::UserDown(const std::string &username) {
+    std::lock_guard<std::mutex> lock(announceMutex);
+    // 用户已在本节点的其它连接上重新注册，它的上线通知已经或即将发出
+    ClientHandle handle;
+    if (set.GetRegistry().FindUser(username, handle)) return;
+    Announce(CLUSTER_USER_DOWN, username);
+}
+
+void Cluster::GroupCreated(const std::string &groupName) {
+    std::lock_guard<std::mutex> lock(announceMutex);
+    Announce(CLUSTER_GROUP, groupName);
+}
+
+void Cluster::GroupChanged(const GroupPtr &group) {
+    std::lock_guard<std::mutex> lock(announceMutex);
+    // 在锁内读取成员数：最后一次变更之后的调用一定看到最终状态
+    bool members = group->Size() > 0;
+    bool announced = announcedGroups.count(group->Name()) > 0;
+    if (members == announced) return;
+    if (members) announcedGroups.insert(group->Name());
+    else announcedGroups.erase(group->Name());
+    Announce(members ? CLUSTER_GROUP_JOIN : CLUSTER_GROUP_LEAVE, group->Name());
+}
+
+void Cluster::Announce(uint8_t opcode, std::string_view name) {
+    std::string frame;
+    AppendBinaryFrame(frame, opcode, &name, 1);
+    for (auto &peer: peers) Enqueue(*peer, frame, true);
+}
+
+bool Cluster::Deliver(int node, std::string_view target, std::string_view sender, std::string_view body) {
+    if (node < 0 || node >= CLUSTER_MAX_NODES || peerIndex[node] < 0) return false;
+    // 每个分片线程复用自己的编码缓冲区
+    static thread_local std::string frame;
+    frame.clear();
+    std::string_view fields[] = {target, sender, body};
+    AppendBinaryFrame(frame, CLUSTER_DELIVER, fields, 3);
+    return Enqueue(*peers[peerIndex[node]], frame, false);
+}
+
+int Cluster::GroupDeliver(const Group &group, std::string_view sender, std::string_view body) {
+    uint64_t nodes = group.RemoteNodes();
+    if (nodes == 0) return 0;
+    static thread_local std::string frame;
+    frame.clear();
+    std::string_view fields[] = {group.Name(), sender, body};
+    AppendBinaryFrame(frame, CLUSTER_GROUP_DELIVER, fields, 3);
+    int sent = 0;
+    for (int node = 0; node < CLUSTER_MAX_NODES; node++) {
+        if ((nodes >> node & 1) && peerIndex[node] >= 0 && Enqueue(*peers[peerIndex[node]], frame, false)) sent++;
+    }
+    return sent;
+}
+
+bool Cluster::Enqueue(Peer &peer, std::string_view frame, bool announce) {
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(peer.mutex);
+        if (!peer.up && (announce || peer.queued.size() + frame.size() > CLUSTER_MAX_PENDING_BYTES)) {
+            if (!announce) dropped++;
+            return false;
+        }
+        wake = peer.queued.empty() && peer.up;
+        peer.queued.append(frame);
+    }
+    framesSent++;
+    if (wake) poller.Wakeup();
+    return true;
+}
+
+void Cluster::Loop() {
+    std::vector<PollEvent> events;
+    while (running) {
+        uint64_t now = NowMs();
+        int timeout = -1;
+        for (auto &peer: peers) {
+            if (peer->sock == INVALID_SOCKET) {
+                if (now >= peer->reconnectAtMs) Connect(*peer, now);
+                // 连接失败时 Connect 已安排下一次重连
+                if (peer->sock == INVALID_SOCKET) {
+                    int wait = (int) (peer->reconnectAtMs > now ? peer->reconnectAtMs - now : 0);
+                    timeout = timeout < 0 ? wait : std::min(timeout, wait);
+                }
+            } else if (!peer->connecting) {
+                Flush(*peer, now);
+            }
+        }
+        if (poller.Wait(events, timeout) < 0) break;
+
+        now = NowMs();
+        for (const auto &ev: events) {
+            if (ev.ptr == &sListen) {
+                Accept();
+                continue;
+            }
+            auto peer = std::find_if(peers.begin(), peers.end(), [&](const auto &p) { return p.get() == ev.ptr; });
+            if (peer != peers.end()) {
+                Peer &p = **peer;
+                if (p.sock == INVALID_SOCKET) continue;
+                if (p.connecting && (ev.writable || ev.error)) {
+                    int err = 0;
+                    socklen_t len = sizeof(err);
+                    getsockopt(p.sock, SOL_SOCKET, SO_ERROR, (char *) &err, &len);
+                    if (err != 0) {
+                        Disconnect(p, now);
+                        continue;
+                    }
+                    OnConnected(p);
+                }
+                // 发送连接上不会收到数据，可读表示对端关闭
+                if (ev.readable || ev.error) {
+                    char buf[256];
+                    long n = (long) recv(p.sock, buf, sizeof(buf), 0);
+                    if (n == 0 || (n < 0 && !IsWouldBlock(LastSocketError()))) {
+                        Disconnect(p, now);
+                        continue;
+                    }
+                }
+                if (ev.writable) Flush(p, now);
+                continue;
+            }
+            auto *inbound = static_cast<Inbound *>(ev.ptr);
+            if (inbound->sock != INVALID_SOCKET) OnReadable(inbound);
+        }
+        PostBatches();
+        // 已关闭的连入连接在本轮事件处理结束后释放
+        inbounds.erase(std::remove_if(inbounds.begin(), inbounds.end(),
+                                      [](const auto &inbound) { return inbound->sock == INVALID_SOCKET; }),
+                       inbounds.end());
+    }
+}
+
+void Cluster::Connect(Peer &peer, uint64_t nowMs) {
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *result = nullptr;
+    if (getaddrinfo(peer.node.host.c_str(), std::to_string(peer.node.port).c_str(), &hints, &result) != 0 ||
+        result == nullptr) {
+        Disconnect(peer, nowMs);
+        return;
+    }
+    peer.sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (peer.sock == INVALID_SOCKET || !SetNonBlocking(peer.sock) || !poller.Add(peer.sock, &peer)) {
+        freeaddrinfo(result);
+        Disconnect(peer, nowMs);
+        return;
+    }
+    // 帧已在队列中合并，不需要 Nagle 算法再延迟
+    int noDelay = 1;
+    setsockopt(peer.sock, IPPROTO_TCP, TCP_NODELAY, (const char *) &noDelay, sizeof(noDelay));
+    SetKeepAlive(peer.sock, 5, 1, 3);
+    int ret = connect(peer.sock, result->ai_addr, (int) result->ai_addrlen);
+    freeaddrinfo(result);
+    if (ret == 0) {
+        OnConnected(peer);
+    } else if (ConnectPending(LastSocketError())) {
+        peer.connecting = true;
+    } else {
+        Disconnect(peer, nowMs);
+    }
+}
+
+void Cluster::OnConnected(Peer &peer) {
+    peer.connecting = false;
+    peer.backoffMs = CLUSTER_RECONNECT_MIN_MS;
+    // 快照与目录变更的广播互斥：快照之前的变更已包含在快照中，之后的变更排在快照后面
+    std::lock_guard<std::mutex> announceLock(announceMutex);
+    std::string snapshot;
+    char idText[24];
+    std::string_view id = FormatNumber(nodeId, idText);
+    std::string_view hello[] = {id, secret};
+    AppendBinaryFrame(snapshot, CLUSTER_HELLO, hello, 2);
+    for (const auto &name: set.GetRegistry().UserNames()) {
+        std::string_view field = name;
+        AppendBinaryFrame(snapshot, CLUSTER_USER_UP, &field, 1);
+    }
+    for (const auto &name: set.GetRegistry().GroupNames()) {
+        std::string_view field = name;
+        AppendBinaryFrame(snapshot, CLUSTER_GROUP, &field, 1);
+    }
+    for (const auto &name: announcedGroups) {
+        std::string_view field = name;
+        AppendBinaryFrame(snapshot, CLUSTER_GROUP_JOIN, &field, 1);
+    }
+    {
+        std::lock_guard<std::mutex> lock(peer.mutex);
+        // 断开期间暂存的只有消息，排在快照后面
+        snapshot += peer.queued;
+        peer.queued.swap(snapshot);
+        peer.up = true;
+    }
+    linksUp++;
+    LOG_INFO << "Cluster link to node " << peer.node.id << " (" << peer.node.host << ":" << peer.node.port
+             << ") is up.";
+}
+
+void Cluster::Disconnect(Peer &peer, uint64_t nowMs) {
+    bool wasUp;
+    {
+        std::lock_guard<std::mutex> lock(peer.mutex);
+        wasUp = peer.up;
+        peer.up = false;
+        // 已发出一部分的数据和排队的目录变更都丢弃，重连后的快照包含最新的目录
+        peer.queued.clear();
+    }
+    if (peer.sock != INVALID_SOCKET) {
+        poller.Remove(peer.sock);
+        closesocket(peer.sock);
+        peer.sock = INVALID_SOCKET;
+    }
+    peer.connecting = false;
+    peer.out.clear();
+    peer.outSent = 0;
+    peer.reconnectAtMs = nowMs + peer.backoffMs;
+    peer.backoffMs = std::min<uint64_t>(peer.backoffMs * 2, CLUSTER_RECONNECT_MAX_MS);
+    if (wasUp) {
+        linksUp--;
+        LOG_WARN << "Cluster link to node " << peer.node.id << " is down.";
+    }
+}
+
+void Cluster::Flush(Peer &peer, uint64_t nowMs) {
+    {
+        std::lock_guard<std::mutex> lock(peer.mutex);
+        if (!peer.queued.empty()) {
+            if (peer.outSent == peer.out.size()) {
+                peer.out.clear();
+                peer.outSent = 0;
+                peer.out.swap(peer.queued);
+            } else {
+                peer.out += peer.queued;
+                peer.queued.clear();
+            }
+        }
+    }
+    while (peer.outSent < peer.out.size()) {
+        long n = (long) send(peer.sock, peer.out.data() + peer.outSent, (int) (peer.out.size() - peer.outSent), 0);
+        sendCalls++;
+        if (n > 0) {
+            peer.outSent += (size_t) n;
+            bytesSent += n;
+            continue;
+        }
+        if (n < 0 && IsWouldBlock(LastSocketError())) break;
+        Disconnect(peer, nowMs);
+        return;
+    }
+    if (peer.outSent == peer.out.size()) {
+        peer.out.clear();
+        peer.outSent = 0;
+    }
+    poller.SetWriteInterest(peer.sock, peer.outSent < peer.out.size());
+}
+
+void Cluster::Accept() {
+    while (true) {
+        sockaddr_in addr{};
+        socklen_t len = sizeof(addr);
+        SOCKET s = accept(sListen, (sockaddr *) &addr, &len);
+        if (s == INVALID_SOCKET) {
+            if (!IsWouldBlock(LastSocketError())) LOG_ERROR << "Cluster accept failed with error: " << LastSocketError();
+            return;
+        }
+        auto inbound = std::make_unique<Inbound>();
+        inbound->sock = s;
+        inbound->address = addr.sin_addr;
+        if (!SetNonBlocking(s) || !poller.Add(s, inbound.get())) {
+            closesocket(s);
+            continue;
+        }
+        poller.SetWriteInterest(s, false);
+        SetKeepAlive(s, 5, 1, 3);
+        inbounds.push_back(std::move(inbound));
+    }
+}
+
+void Cluster::OnReadable(Inbound *inbound) {
+    bool closed = false;
+    while (true) {
+        long n = (long) recv(inbound->sock, readBuffer.data(), (int) readBuffer.size(), 0);
+        if (n > 0) {
+            inbound->in.append(readBuffer.data(), (size_t) n);
+            continue;
+        }
+        closed = n == 0 || !IsWouldBlock(LastSocketError());
+        break;
+    }
+    Registry &registry = set.GetRegistry();
+    MessageStore *store = set.Store();
+    std::vector<int> shards;
+    size_t offset = 0;
+    Command cmd;
+    size_t size = 0;
+    DecodeResult result;
+    while ((result = DecodeBinary(inbound->in.data() + offset, inbound->in.size() - offset, cmd, size)) ==
+           DecodeResult::Ok) {
+        offset += size;
+        framesReceived++;
+        if (inbound->node < 0) {
+            // 第一帧必须是 HELLO，新的连接代替同一节点之前的连接，目录由随后的快照重建
+            int node = -1;
+            if (cmd.opcode == CLUSTER_HELLO && cmd.fieldCount >= 2) {
+                std::from_chars(cmd.fields[0].data(), cmd.fields[0].data() + cmd.fields[0].size(), node);
+            }
+            if (!AcceptHello(*inbound, node, cmd.fieldCount >= 2 ? cmd.fields[1] : std::string_view())) {
+                result = DecodeResult::Invalid;
+                break;
+            }
+            inbound->node = node;
+            Inbound *old = remotes[node].current;
+            remotes[node].current = inbound;
+            ClearRemote(node);
+            if (old != nullptr) CloseInbound(old);
+            continue;
+        }
+        if (cmd.fieldCount < 1) continue;
+        int node = inbound->node;
+        Remote &remote = remotes[node];
+        std::string name(cmd.fields[0]);
+        GroupPtr group;
+        switch (cmd.opcode) {
+            case CLUSTER_USER_UP:
+                remoteUsers.Set(name, node);
+                if (remote.users.insert(name).second) remoteUserCount++;
+                break;
+            case CLUSTER_USER_DOWN:
+                remoteUsers.EraseIf(name, [node](int current) { return current == node; });
+                if (remote.users.erase(name) > 0) remoteUserCount--;
+                break;
+            case CLUSTER_GROUP:
+                if (!registry.FindGroup(name, group)) registry.AddGroups({name});
+                break;
+            case CLUSTER_GROUP_JOIN:
+            case CLUSTER_GROUP_LEAVE:
+                if (!registry.FindGroup(name, group)) {
+                    registry.AddGroups({name});
+                    if (!registry.FindGroup(name, group)) break;
+                }
+                group->SetRemoteNode(node, cmd.opcode == CLUSTER_GROUP_JOIN);
+                if (cmd.opcode == CLUSTER_GROUP_JOIN) remote.groups.insert(name);
+                else remote.groups.erase(name);
+                break;
+            case CLUSTER_DELIVER: {
+                if (cmd.fieldCount < 3) break;
+                // 用户在消息到达前下线时，只为在本节点注册过（已有收件箱）的用户保存
+                ClientHandle handle;
+                bool online = registry.FindUser(cmd.fields[0], handle);
+                MessageLogPtr inboxLog;
+                if (!online && store != nullptr) inboxLog = store->InboxLog(cmd.fields[0], false);
+                if (!online && !inboxLog) {
+                    dropped++;
+                    break;
+                }
+                // 本节点也记录会话历史，序列号在本节点内分配
+                uint64_t seq = 0;
+                char seqText[24];
+                if (store != nullptr) {
+                    MessageLogPtr log = store->DirectLog(cmd.fields[1], cmd.fields[0], true);
+                    if (log) seq = store->Append(log, cmd.fields[1], cmd.fields[2]);
+                }
+                if (online) {
+                    ShardMessage msg;
+                    msg.data = seq != 0 ? MakeMessage(OP_DELIVER, {cmd.fields[1], cmd.fields[2],
+                                                                    FormatNumber(seq, seqText)})
+                                        : MakeMessage(OP_DELIVER, {cmd.fields[1], cmd.fields[2]});
+                    msg.target = handle.clientId;
+                    batches[handle.shard].push_back(std::move(msg));
+                } else if (seq != 0) {
+                    // 用户在消息到达前下线，放入本节点的离线收件箱
+                    store->Append(inboxLog, cmd.fields[1], cmd.fields[2], seq);
+                } else {
+                    dropped++;
+                }
+                break;
+            }
+            case CLUSTER_GROUP_DELIVER: {
+                if (cmd.fieldCount < 3 || !registry.FindGroup(cmd.fields[0], group)) break;
+                uint64_t seq = 0;
+                char seqText[24];
+                MessageLogPtr log = store != nullptr ? store->GroupLog(cmd.fields[0], true) : nullptr;
+                if (log) seq = store->Append(log, cmd.fields[1], cmd.fields[2]);
+                MessagePtr data = seq != 0
+                                  ? MakeMessage(OP_GROUP_DELIVER, {cmd.fields[0], cmd.fields[1], cmd.fields[2],
+                                                                   FormatNumber(seq, seqText)})
+                                  : MakeMessage(OP_GROUP_DELIVER, {cmd.fields[0], cmd.fields[1], cmd.fields[2]});
+                // 消息只构造一次，每个有成员的分片投递一次，由分片遍历自己的成员
+                group->ShardsWithMembers(shards);
+                for (int shard: shards) {
+                    ShardMessage msg;
+                    msg.kind = ShardMessage::GROUP_DELIVER;
+                    msg.data = data;
+                    msg.group = group;
+                    batches[shard].push_back(std::move(msg));
+                }
+                groupFanout += (int64_t) group->Size();
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    inbound->in.erase(0, offset);
+    if (closed || result == DecodeResult::Invalid) CloseInbound(inbound);
+}
+
+bool Cluster::AcceptHello(const Inbound &inbound, int node, std::string_view given) const {
+    char source[INET_ADDRSTRLEN] = "?";
+    inet_ntop(AF_INET, &inbound.address, source, sizeof(source));
+    if (node < 0 || node >= CLUSTER_MAX_NODES || peerIndex[node] < 0) {
+        LOG_WARN << "Cluster connection from " << source << " claims unknown node " << node << ".";
+        return false;
+    }
+    if (!SecretEquals(given, secret)) {
+        LOG_WARN << "Cluster connection from " << source << " for node " << node << " has a wrong secret.";
+        return false;
+    }
+    const ClusterNode &expected = peers[peerIndex[node]]->node;
+    for (const auto &address: ResolveHost(expected.host)) {
+        if (address.s_addr == inbound.address.s_addr) return true;
+    }
+    LOG_WARN << "Cluster connection from " << source << " claims node " << node << " at " << expected.host << ".";
+    return false;
+}
+
+void Cluster::CloseInbound(Inbound *inbound) {
+    poller.Remove(inbound->sock);
+    closesocket(inbound->sock);
+    inbound->sock = INVALID_SOCKET;
+    int node = inbound->node;
+    if (node >= 0 && remotes[node].current == inbound) {
+        remotes[node].current = nullptr;
+        ClearRemote(node);
+        LOG_WARN << "Cluster link from node " << node << " closed, its users and groups are unreachable.";
+    }
+}
+
+void Cluster::ClearRemote(int node) {
+    Remote &remote = remotes[node];
+    for (const auto &name: remote.users) {
+        remoteUsers.EraseIf(name, [node](int current) { return current == node; });
+    }
+    remoteUserCount -= remote.users.size();
+    remote.users.clear();
+    GroupPtr group;
+    for (const auto &name: remote.groups) {
+        if (set.GetRegistry().FindGroup(name, group)) group->SetRemoteNode(node, false);
+    }
+    remote.groups.clear();
+}
+
+void Cluster::PostBatches() {
+    for (int i = 0; i < (int) batches.size(); i++) {
+        if (batches[i].empty()) continue;
+        Shard *target = &set.At(i);
+        target->GetReactor().Post([target, batch = std::move(batches[i])]() {
+            for (const auto &msg: batch) target->Server().OnShardMessage(msg);
+        });
+        batches[i].clear();
+    }
+}
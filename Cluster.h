@@ -0,0 +1,241 @@
+#ifndef ONLINECHAT_CLUSTER_H
+#define ONLINECHAT_CLUSTER_H
+
+#include "Platform.h"
+#include "Poller.h"
+#include "ConcurrentMap.h"
+#include "Group.h"
+#include <atomic>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+class ShardSet;
+struct ShardMessage;
+
+// 节点ID的上限，群组用一个64位掩码记录有成员的节点
+#define CLUSTER_MAX_NODES 64
+// 节点间连接断开后重连的退避间隔（毫秒）
+#define CLUSTER_RECONNECT_MIN_MS 100
+#define CLUSTER_RECONNECT_MAX_MS 2000
+// 连接断开期间每个对端最多暂存的待发送字节数，超过时丢弃新的消息
+#define CLUSTER_MAX_PENDING_BYTES (64 * 1024 * 1024)
+
+/**
+ * 节点之间连接上的帧，与客户端二进制协议使用相同的帧格式
+ */
+enum ClusterOpcode : uint8_t {
+    CLUSTER_HELLO = 0x01,         // 节点ID, 集群密钥，连接上的第一帧
+    CLUSTER_USER_UP = 0x02,       // 用户名，用户在发送方节点上线
+    CLUSTER_USER_DOWN = 0x03,     // 用户名，用户从发送方节点下线
+    CLUSTER_GROUP = 0x04,         // 群组名，群组已创建
+    CLUSTER_GROUP_JOIN = 0x05,    // 群组名，发送方节点上有该群组的成员
+    CLUSTER_GROUP_LEAVE = 0x06,   // 群组名，发送方节点上不再有该群组的成员
+    CLUSTER_DELIVER = 0x07,       // 目标用户, 发送者, 消息内容
+    CLUSTER_GROUP_DELIVER = 0x08  // 群组名, 发送者, 消息内容
+};
+
+// 集群中的一个节点
+struct ClusterNode {
+    int id{};
+    std::string host;
+    int port{};   // 节点间连接的监听端口
+};
+
+/**
+ * 多节点联邦：每个节点向其它每个节点保持一条持久的TCP连接，只用于发送，
+ * 对端发来的数据从它主动建立的连接上接收。
+ * 节点上线、下线的用户以及本节点开始或不再有成员的群组广播给所有节点，各节点据此维护集群目录：
+ * 远程用户所在的节点和群组在哪些节点上有成员。连接建立时先发送本节点目录的完整快照，
+ * 连接断开时对端在本节点的目录条目被清除。
+ * 分片线程把发往其它节点的帧追加到对应连接的发送队列，由集群线程合并后一次系统调用发出；
+ * 群组消息对每个有成员的节点只发送一次，由接收节点在本地扇出。
+ * 收到的消息按目标分片合并，每批只向每个分片投递一个任务
+ */
+class Cluster {
+public:
+    /**
+     * @param set 本节点的分片
+     * @param nodeId 本节点ID
+     * @param nodes 所有节点，包括本节点
+     * @param secret 所有节点共享的集群密钥，连入的连接须在 HELLO 中给出相同的密钥
+     */
+    Cluster(ShardSet &set, int nodeId, std::vector<ClusterNode> nodes, std::string secret);
+
+    ~Cluster();
+
+    Cluster(const Cluster &) = delete;
+
+    Cluster &operator=(const Cluster &) = delete;
+
+    /**
+     * 解析节点列表，例如 "1=10.0.0.1:7001,2=10.0.0.2:7001"
+     * @return 格式是否正确
+     */
+    static bool ParseNodes(const std::string &spec, std::vector<ClusterNode> &nodes);
+
+    // 在本节点配置的地址上监听节点间端口，失败时返回 false
+    bool Listen();
+
+    // 启动集群线程，开始连接其它节点
+    void Start();
+
+    // 停止集群线程并关闭所有连接，清除远程目录；之后可以重新 Listen 和 Start
+    void Stop();
+
+    int NodeId() const { return nodeId; }
+
+    /**
+     * 在集群目录中查找其它节点上的用户，无等待，可在任意线程调用
+     * @param node 输出用户所在的节点
+     */
+    bool FindUser(std::string_view username, int &node) const;
+
+    // 以下在分片线程中调用：本节点目录的变更，广播给所有已连接的节点
+    void UserUp(const std::string &username);
+
+    // 用户已从本节点的目录中移除，在本节点上重新注册时不广播
+    void UserDown(const std::string &username);
+
+    void GroupCreated(const std::string &groupName);
+
+    // 群组在本节点的成员发生变化，成员数在 0 和非 0 之间变化时广播
+    void GroupChanged(const GroupPtr &group);
+
+    /**
+     * 把私聊消息发给用户所在的节点
+     * @return 是否加入发送队列，连接断开太久、暂存已满时返回 false
+     */
+    bool Deliver(int node, std::string_view target, std::string_view sender, std::string_view body);
+
+    /**
+     * 把群组消息发给每个有成员的其它节点，每个节点一次
+     * @return 发往的节点数
+     */
+    int GroupDeliver(const Group &group, std::string_view sender, std::string_view body);
+
+    // 指标，可在任意线程读取
+    int64_t FramesSent() const { return framesSent; }
+
+    int64_t FramesReceived() const { return framesReceived; }
+
+    int64_t BytesSent() const { return bytesSent; }
+
+    int64_t SendCalls() const { return sendCalls; }
+
+    int64_t Dropped() const { return dropped; }
+
+    // 收到的群组消息在本节点扇出的成员数
+    int64_t GroupFanout() const { return groupFanout; }
+
+    int LinksUp() const { return linksUp; }
+
+    size_t RemoteUsers() const { return remoteUserCount; }
+
+private:
+    // 发往一个节点的连接
+    struct Peer {
+        ClusterNode node;
+        SOCKET sock{INVALID_SOCKET};
+        bool connecting{false};
+        bool up{false};             // 已发送快照，之后的目录变更直接加入队列；受 mutex 保护
+        std::mutex mutex;
+        std::string queued;         // 分片线程加入的帧
+        std::string out;            // 集群线程正在发送的数据
+        size_t outSent{};
+        uint64_t reconnectAtMs{};
+        uint64_t backoffMs{CLUSTER_RECONNECT_MIN_MS};
+    };
+
+    // 其它节点连入的连接
+    struct Inbound {
+        SOCKET sock{INVALID_SOCKET};
+        int node{-1};               // 收到 HELLO 之前为 -1
+        in_addr address{};          // 对端地址，HELLO 声称的节点须配置为该地址
+        std::string in;
+    };
+
+    // 一个远程节点在本节点目录中的条目，连接断开时据此清除
+    struct Remote {
+        Inbound *current{};
+        std::unordered_set<std::string> users;
+        std::unordered_set<std::string> groups;
+    };
+
+    void Loop();
+
+    void Connect(Peer &peer, uint64_t nowMs);
+
+    // 连接建立：发送 HELLO 和本节点目录的快照，之后是断开期间暂存的消息
+    void OnConnected(Peer &peer);
+
+    void Disconnect(Peer &peer, uint64_t nowMs);
+
+    // 取走分片线程加入的帧并尽量发出
+    void Flush(Peer &peer, uint64_t nowMs);
+
+    void Accept();
+
+    // 读取连入的连接，解码帧并处理，批量投递给各分片
+    void OnReadable(Inbound *inbound);
+
+    void CloseInbound(Inbound *inbound);
+
+    // 检查连入连接的 HELLO：节点在列表中、来源地址与该节点的配置一致且密钥正确
+    bool AcceptHello(const Inbound &inbound, int node, std::string_view given) const;
+
+    // 清除一个节点在本节点目录中的所有条目
+    void ClearRemote(int node);
+
+    /**
+     * 向一个节点的发送队列追加一帧
+     * @param announce 是否为目录变更，连接未建立时不暂存，连接建立时的快照已包含最新状态
+     */
+    bool Enqueue(Peer &peer, std::string_view frame, bool announce);
+
+    // 向所有节点广播目录变更，调用方持有 announceMutex
+    void Announce(uint8_t opcode, std::string_view name);
+
+    // 把收到的消息按分片投递，每个分片一个任务
+    void PostBatches();
+
+    ShardSet &set;
+    const int nodeId;
+    const std::string secret;
+    std::string listenHost;
+    int listenPort{};
+    Poller poller;
+    SOCKET sListen{INVALID_SOCKET};
+    std::thread thread;
+    std::atomic<bool> running{false};
+    std::vector<std::unique_ptr<Peer>> peers;
+    // 节点ID到 peers 下标，不是其它节点时为 -1
+    int peerIndex[CLUSTER_MAX_NODES];
+    std::vector<std::unique_ptr<Inbound>> inbounds;
+    // 以下只在集群线程中访问
+    Remote remotes[CLUSTER_MAX_NODES];
+    std::vector<char> readBuffer;
+    std::vector<std::vector<ShardMessage>> batches;
+    // 目录变更按发生顺序广播，连接建立时的快照与之互斥
+    std::mutex announceMutex;
+    std::set<std::string> announcedGroups;
+    // 其它节点上的用户到其所在节点
+    ConcurrentMap<int> remoteUsers;
+    std::atomic<size_t> remoteUserCount{0};
+    std::atomic<int> linksUp{0};
+    std::atomic<int64_t> framesSent{0};
+    std::atomic<int64_t> framesReceived{0};
+    std::atomic<int64_t> bytesSent{0};
+    std::atomic<int64_t> sendCalls{0};
+    std::atomic<int64_t> dropped{0};
+    std::atomic<int64_t> groupFanout{0};
+};
+
+#endif //ONLINECHAT_CLUSTER_H
@@ -0,0 +1,250 @@
+#ifndef ONLINECHAT_CONCURRENTMAP_H
+#define ONLINECHAT_CONCURRENTMAP_H
+
+#include "Epoch.h"
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// 分段数（2的幂），写操作只锁一个分段
+#define CONCURRENT_MAP_STRIPES 1024
+
+/**
+ * 读多写少的并发字符串映射：按键的哈希分为多个分段，每个分段是一个链式哈希表，写操作在分段锁内原地修改。
+ * 读操作在纪元临界区内沿桶链查找，不加锁、不写共享数据，是无等待的。
+ * 节点发布后内容不再改变：覆盖时用新节点替换，删除时从链上摘下，摘下的节点在没有读者引用之后由纪元回收释放；
+ * 只有分段扩容时才复制该分段的节点，每次写操作均摊 O(1)
+ * @tparam V 值类型，需可复制
+ */
+template<typename V>
+class ConcurrentMap {
+public:
+    ConcurrentMap() = default;
+
+    ConcurrentMap(const ConcurrentMap &) = delete;
+
+    ConcurrentMap &operator=(const ConcurrentMap &) = delete;
+
+    ~ConcurrentMap() {
+        for (auto &stripe: stripes) DeleteTable(stripe.table.load(std::memory_order_relaxed));
+    }
+
+    /**
+     * 查找键，无等待，可在任意线程调用
+     * @param key 键
+     * @param value 输出的值
+     * @return 键是否存在
+     */
+    bool Find(std::string_view key, V &value) const {
+        size_t hash = Hash(key);
+        EpochDomain::Guard guard;
+        const Table *table = stripes[hash & (CONCURRENT_MAP_STRIPES - 1)].table.load(std::memory_order_seq_cst);
+        if (table == nullptr) return false;
+        const Node *node = table->Find(key, hash);
+        if (node == nullptr) return false;
+        value = node->value;
+        return true;
+    }
+
+    // 插入或覆盖
+    void Set(const std::string &key, const V &value) {
+        Modify(key, [&](const V *) { return true; }, &value);
+    }
+
+    // 键不存在时插入，返回是否插入
+    bool Insert(const std::string &key, const V &value) {
+        return Modify(key, [&](const V *current) { return current == nullptr; }, &value);
+    }
+
+    /**
+     * 批量插入不存在的键，每个分段最多扩容一次，用于启动时加载大量数据
+     * @param keys 键，可以重复
+     * @param make 只为实际插入的键调用，返回其值
+     * @return 插入的条数
+     */
+    template<typename Make>
+    size_t InsertAll(const std::vector<std::string> &keys, Make make) {
+        std::vector<std::vector<std::pair<size_t, const std::string *>>> byStripe(CONCURRENT_MAP_STRIPES);
+        for (const auto &key: keys) {
+            size_t hash = Hash(key);
+            byStripe[hash & (CONCURRENT_MAP_STRIPES - 1)].emplace_back(hash, &key);
+        }
+        size_t inserted = 0;
+        for (size_t i = 0; i < CONCURRENT_MAP_STRIPES; i++) {
+            if (byStripe[i].empty()) continue;
+            Stripe &stripe = stripes[i];
+            std::lock_guard<std::mutex> lock(stripe.writeMutex);
+            Table *table = Reserve(stripe, stripe.count + byStripe[i].size());
+            for (const auto &[hash, key]: byStripe[i]) {
+                if (table->Find(*key, hash) != nullptr) continue;
+                table->Push(new Node{hash, *key, make(*key)});
+                stripe.count++;
+                inserted++;
+            }
+        }
+        return inserted;
+    }
+
+    // 键存在且值满足条件时删除，返回是否删除
+    template<typename Pred>
+    bool EraseIf(const std::string &key, Pred pred) {
+        return Modify(key, [&](const V *current) { return current != nullptr && pred(*current); }, nullptr);
+    }
+
+    // 遍历所有键值，每个键最多出现一次，遍历期间的并发修改可能看到也可能看不到
+    template<typename Fn>
+    void ForEach(Fn fn) const {
+        EpochDomain::Guard guard;
+        for (const auto &stripe: stripes) {
+            const Table *table = stripe.table.load(std::memory_order_seq_cst);
+            if (table == nullptr) continue;
+            for (const auto &bucket: table->buckets) {
+                for (const Node *node = bucket.load(std::memory_order_seq_cst); node != nullptr;
+                     node = node->next.load(std::memory_order_seq_cst)) {
+                    fn(node->key, node->value);
+                }
+            }
+        }
+    }
+
+private:
+    // 发布后只有 next 会被写者修改的链表节点
+    struct Node {
+        size_t hash{};
+        std::string key;
+        V value{};
+        std::atomic<Node *> next{nullptr};
+    };
+
+    /**
+     * 一个分段的桶数组，容量为2的幂，元素数超过容量时扩容。
+     * 低位哈希用于选择分段，桶使用高位
+     */
+    struct Table {
+        size_t mask;
+        std::vector<std::atomic<Node *>> buckets;
+
+        explicit Table(size_t capacity) : mask(capacity - 1), buckets(capacity) {}
+
+        std::atomic<Node *> &Bucket(size_t hash) { return buckets[(hash >> 10) & mask]; }
+
+        const Node *Find(std::string_view key, size_t hash) const {
+            for (const Node *node = buckets[(hash >> 10) & mask].load(std::memory_order_seq_cst); node != nullptr;
+                 node = node->next.load(std::memory_order_seq_cst)) {
+                if (node->hash == hash && node->key == key) return node;
+            }
+            return nullptr;
+        }
+
+        // 把新节点发布到桶链的开头，调用方持有分段锁
+        void Push(Node *node) {
+            std::atomic<Node *> &bucket = Bucket(node->hash);
+            node->next.store(bucket.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            bucket.store(node, std::memory_order_seq_cst);
+        }
+    };
+
+    struct alignas(64) Stripe {
+        std::atomic<Table *> table{nullptr};  // 第一次插入时创建
+        size_t count{};                       // 元素数，由 writeMutex 保护
+        std::mutex writeMutex;
+    };
+
+    static size_t Hash(std::string_view key) { return std::hash<std::string_view>()(key); }
+
+    // 释放桶数组和仍在链上的节点，只在没有读者引用时调用
+    static void DeleteTable(Table *table) {
+        if (table == nullptr) return;
+        for (auto &bucket: table->buckets) {
+            Node *node = bucket.load(std::memory_order_relaxed);
+            while (node != nullptr) {
+                Node *next = node->next.load(std::memory_order_relaxed);
+                delete node;
+                node = next;
+            }
+        }
+        delete table;
+    }
+
+    static void RetireNode(Node *node) {
+        EpochDomain::Instance().Retire(node, [](void *p) { delete static_cast<Node *>(p); });
+    }
+
+    /**
+     * 保证分段能容纳 count 个元素，不够时按两倍扩容：复制所有节点到新的桶数组后替换，
+     * 旧的桶数组连同其节点整体退役，仍在旧链上的读者不受影响。调用方持有分段锁
+     * @return 分段当前的桶数组
+     */
+    static Table *Reserve(Stripe &stripe, size_t count) {
+        Table *table = stripe.table.load(std::memory_order_relaxed);
+        size_t capacity = table ? table->mask + 1 : 0;
+        if (count <= capacity) return table;
+        size_t grown = capacity > 0 ? capacity : 4;
+        while (grown < count) grown <<= 1;
+        auto *next = new Table(grown);
+        if (table) {
+            for (const auto &bucket: table->buckets) {
+                for (const Node *node = bucket.load(std::memory_order_relaxed); node != nullptr;
+                     node = node->next.load(std::memory_order_relaxed)) {
+                    next->Push(new Node{node->hash, node->key, node->value});
+                }
+            }
+        }
+        stripe.table.store(next, std::memory_order_seq_cst);
+        if (table) {
+            EpochDomain::Instance().Retire(table, [](void *p) { DeleteTable(static_cast<Table *>(p)); });
+        }
+        return next;
+    }
+
+    /**
+     * 在分段锁内根据当前值决定是否修改：value 不为空时插入或用新节点替换旧节点，否则摘下旧节点
+     * @param accept 以当前值（不存在时为空）判断是否修改
+     * @return 是否修改
+     */
+    template<typename Accept>
+    bool Modify(const std::string &key, Accept accept, const V *value) {
+        size_t hash = Hash(key);
+        Stripe &stripe = stripes[hash & (CONCURRENT_MAP_STRIPES - 1)];
+        std::lock_guard<std::mutex> lock(stripe.writeMutex);
+        Table *table = stripe.table.load(std::memory_order_relaxed);
+        // 找到键的节点和指向它的链接（桶或前一个节点的 next）
+        std::atomic<Node *> *link = nullptr;
+        Node *current = nullptr;
+        if (table) {
+            link = &table->Bucket(hash);
+            for (current = link->load(std::memory_order_relaxed); current != nullptr;
+                 current = link->load(std::memory_order_relaxed)) {
+                if (current->hash == hash && current->key == key) break;
+                link = &current->next;
+            }
+        }
+        if (!accept(current ? &current->value : nullptr)) return false;
+        if (current == nullptr) {
+            if (value == nullptr) return true;
+            Reserve(stripe, stripe.count + 1)->Push(new Node{hash, key, *value});
+            stripe.count++;
+            return true;
+        }
+        // 被替换或摘下的节点的 next 保持不变，正停在它上面的读者仍能走完桶链
+        Node *after = current->next.load(std::memory_order_relaxed);
+        if (value) {
+            auto *node = new Node{hash, key, *value};
+            node->next.store(after, std::memory_order_relaxed);
+            link->store(node, std::memory_order_seq_cst);
+        } else {
+            link->store(after, std::memory_order_seq_cst);
+            stripe.count--;
+        }
+        RetireNode(current);
+        return true;
+    }
+
+    Stripe stripes[CONCURRENT_MAP_STRIPES];
+};
+
+#endif //ONLINECHAT_CONCURRENTMAP_H
@@ -0,0 +1,110 @@
+#include "Epoch.h"
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
+// 退役对象积累到该数量时在 Retire 中顺便回收
+#define EPOCH_COLLECT_THRESHOLD 64
+
+/**
+ * 线程私有的状态：槽位、临界区嵌套深度和退役列表，线程结束时归还槽位并转交未释放的对象
+ */
+struct EpochThreadState {
+    std::atomic<uint64_t> *epoch{};
+    std::atomic<bool> *used{};
+    int depth{0};
+    std::vector<EpochDomain::Retired> retired;
+    // 有读者长时间停留在旧纪元时按剩余数量加倍，避免每次退役都扫描
+    size_t collectAt{EPOCH_COLLECT_THRESHOLD};
+
+    ~EpochThreadState() {
+        if (!retired.empty()) EpochDomain::Instance().Adopt(retired);
+        if (used) used->store(false, std::memory_order_release);
+    }
+};
+
+static thread_local EpochThreadState threadState;
+
+EpochDomain &EpochDomain::Instance() {
+    static EpochDomain domain;
+    return domain;
+}
+
+EpochDomain::~EpochDomain() {
+    // 进程退出时已没有读者，直接释放
+    for (auto &r: orphans) r.deleter(r.object);
+}
+
+EpochDomain::Slot &EpochDomain::ThreadSlot() {
+    for (auto &slot: slots) {
+        bool expected = false;
+        if (!slot.used.load(std::memory_order_relaxed) &&
+            slot.used.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            return slot;
+        }
+    }
+    std::cerr << "More than " << EPOCH_MAX_THREADS << " threads entered the epoch domain." << std::endl;
+    std::abort();
+}
+
+EpochDomain::Guard::Guard() {
+    EpochThreadState &state = threadState;
+    if (state.depth++ > 0) return;
+    EpochDomain &domain = Instance();
+    if (state.epoch == nullptr) {
+        Slot &slot = domain.ThreadSlot();
+        state.epoch = &slot.epoch;
+        state.used = &slot.used;
+    }
+    // 登记之后读到的共享指针都不早于该纪元，seq_cst 保证登记先于后续的读对推进者可见
+    state.epoch->store(domain.globalEpoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+}
+
+EpochDomain::Guard::~Guard() {
+    EpochThreadState &state = threadState;
+    if (--state.depth > 0) return;
+    state.epoch->store(0, std::memory_order_release);
+}
+
+void EpochDomain::Retire(void *object, void (*deleter)(void *)) {
+    EpochThreadState &state = threadState;
+    state.retired.push_back(Retired{object, deleter, globalEpoch.load(std::memory_order_seq_cst)});
+    if (state.retired.size() >= state.collectAt) Collect();
+}
+
+uint64_t EpochDomain::TryAdvance() {
+    uint64_t epoch = globalEpoch.load(std::memory_order_seq_cst);
+    for (auto &slot: slots) {
+        uint64_t e = slot.epoch.load(std::memory_order_seq_cst);
+        if (e != 0 && e != epoch) return epoch;
+    }
+    // 失败说明其它线程已经推进，返回最新的纪元
+    globalEpoch.compare_exchange_strong(epoch, epoch + 1, std::memory_order_seq_cst);
+    return globalEpoch.load(std::memory_order_seq_cst);
+}
+
+void EpochDomain::Reclaim(std::vector<Retired> &objects, uint64_t epoch) {
+    size_t kept = 0;
+    for (auto &r: objects) {
+        if (r.epoch + 2 <= epoch) r.deleter(r.object);
+        else objects[kept++] = r;
+    }
+    objects.resize(kept);
+}
+
+size_t EpochDomain::Collect() {
+    uint64_t epoch = TryAdvance();
+    EpochThreadState &state = threadState;
+    Reclaim(state.retired, epoch);
+    state.collectAt = std::max<size_t>(EPOCH_COLLECT_THRESHOLD, state.retired.size() * 2);
+    // 顺便回收已结束线程留下的对象，锁被占用时下次再试
+    std::unique_lock<std::mutex> lock(orphanMutex, std::try_to_lock);
+    if (lock.owns_lock() && !orphans.empty()) Reclaim(orphans, epoch);
+    return state.retired.size();
+}
+
+void EpochDomain::Adopt(std::vector<Retired> &objects) {
+    std::lock_guard<std::mutex> lock(orphanMutex);
+    orphans.insert(orphans.end(), objects.begin(), objects.end());
+    objects.clear();
+}
@@ -0,0 +1,84 @@
+#ifndef ONLINECHAT_EPOCH_H
+#define ONLINECHAT_EPOCH_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// 同时进入读临界区的线程数上限
+#define EPOCH_MAX_THREADS 256
+
+/**
+ * 基于纪元的内存回收：读者进入临界区时只需登记当前纪元（一次读一次写，无等待），
+ * 写者把替换下来的对象连同当时的纪元交给 Retire，等所有读者都离开该纪元后才真正释放。
+ * 全局纪元只有在所有处于临界区的读者都登记了当前纪元时才能前进，
+ * 因此纪元 e 中退役的对象在全局纪元到达 e + 2 时不再被任何读者引用。
+ * 退役对象记录在各线程自己的列表中，退役和回收都不需要加锁
+ */
+class EpochDomain {
+public:
+    // 读临界区，可以嵌套；在临界区内读到的对象在离开前不会被释放
+    class Guard {
+    public:
+        Guard();
+
+        ~Guard();
+
+        Guard(const Guard &) = delete;
+
+        Guard &operator=(const Guard &) = delete;
+    };
+
+    // 退役的对象及其释放函数
+    struct Retired {
+        void *object;
+        void (*deleter)(void *);
+        uint64_t epoch;
+    };
+
+    // 进程内所有共享数据结构使用同一个回收域
+    static EpochDomain &Instance();
+
+    /**
+     * 退役一个已从共享结构中摘除的对象，可在任意线程调用
+     * @param object 对象
+     * @param deleter 释放函数
+     */
+    void Retire(void *object, void (*deleter)(void *));
+
+    // 尝试推进纪元并释放当前线程退役的、不再被引用的对象，返回当前线程尚未释放的对象数
+    size_t Collect();
+
+    // 线程结束时把尚未释放的对象转交给回收域，由之后的 Collect 释放
+    void Adopt(std::vector<Retired> &objects);
+
+    ~EpochDomain();
+
+private:
+    EpochDomain() = default;
+
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> epoch{0};  // 0 表示不在临界区
+        std::atomic<bool> used{false};
+    };
+
+    // 当前线程的槽位，第一次使用时分配，线程结束时归还
+    Slot &ThreadSlot();
+
+    // 所有临界区中的读者都已登记当前纪元时推进全局纪元，返回推进后的纪元
+    uint64_t TryAdvance();
+
+    // 释放 objects 中纪元早于 epoch - 1 的对象，其余的保留
+    static void Reclaim(std::vector<Retired> &objects, uint64_t epoch);
+
+    std::atomic<uint64_t> globalEpoch{1};
+    Slot slots[EPOCH_MAX_THREADS];
+    // 已结束线程留下的退役对象
+    std::mutex orphanMutex;
+    std::vector<Retired> orphans;
+
+    friend class Guard;
+};
+
+#endif //ONLINECHAT_EPOCH_H
@@ -0,0 +1,250 @@
+#ifndef ONLINECHAT_FILE_H
+#define ONLINECHAT_FILE_H
+
+/**
+ * 文件平台适配层：追加写入、按偏移读写、临时文件、落盘和只读内存映射。
+ * Linux/POSIX 下使用 open/pread/fdatasync/mmap，Windows 下使用 CRT 文件函数和文件映射
+ */
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+typedef int FileHandle;
+#define INVALID_FILE (-1)
+
+/**
+ * 以追加方式打开文件，不存在时创建
+ * @return 文件句柄，失败时返回 INVALID_FILE
+ */
+inline FileHandle OpenAppendFile(const std::string &path) {
+#ifdef _WIN32
+    return _open(path.c_str(), _O_WRONLY | _O_APPEND | _O_CREAT | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    return open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+#endif
+}
+
+/**
+ * 以覆盖方式打开文件用于写入，不存在时创建
+ * @return 文件句柄，失败时返回 INVALID_FILE
+ */
+inline FileHandle OpenWriteFile(const std::string &path) {
+#ifdef _WIN32
+    return _open(path.c_str(), _O_WRONLY | _O_TRUNC | _O_CREAT | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    return open(path.c_str(), O_WRONLY | O_TRUNC | O_CREAT | O_CLOEXEC, 0644);
+#endif
+}
+
+// 写入全部数据，返回是否成功
+inline bool WriteAll(FileHandle file, const char *data, size_t len) {
+    while (len > 0) {
+#ifdef _WIN32
+        int n = _write(file, data, (unsigned int) (len > (1u << 30) ? (1u << 30) : len));
+#else
+        ssize_t n = write(file, data, len);
+        if (n < 0 && errno == EINTR) continue;
+#endif
+        if (n <= 0) return false;
+        data += n;
+        len -= (size_t) n;
+    }
+    return true;
+}
+
+/**
+ * 在目录中创建读写的临时文件，文件没有名字（或创建后立即删除），最后一个句柄关闭时由系统回收
+ * @return 文件句柄，失败时返回 INVALID_FILE
+ */
+inline FileHandle OpenTempFile(const std::string &dir) {
+#ifdef _WIN32
+    char path[MAX_PATH];
+    if (GetTempFileNameA(dir.c_str(), "oc", 0, path) == 0) return INVALID_FILE;
+    return _open(path, _O_RDWR | _O_CREAT | _O_TRUNC | _O_BINARY | _O_TEMPORARY, _S_IREAD | _S_IWRITE);
+#else
+#ifdef O_TMPFILE
+    int tmp = open(dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (tmp >= 0) return tmp;
+#endif
+    std::string path = dir + "/onlinechat-XXXXXX";
+    int fd = mkstemp(&path[0]);
+    if (fd >= 0) unlink(path.c_str());
+    return fd;
+#endif
+}
+
+// 在指定偏移写入全部数据，不改变文件位置，可在多个线程中对同一文件调用，返回是否成功
+inline bool WriteAt(FileHandle file, const char *data, size_t len, uint64_t offset) {
+    while (len > 0) {
+#ifdef _WIN32
+        OVERLAPPED at{};
+        at.Offset = (DWORD) offset;
+        at.OffsetHigh = (DWORD) (offset >> 32);
+        DWORD n = 0;
+        DWORD chunk = (DWORD) (len > (1u << 30) ? (1u << 30) : len);
+        if (!WriteFile((HANDLE) _get_osfhandle(file), data, chunk, &n, &at)) return false;
+#else
+        ssize_t n = pwrite(file, data, len, (off_t) offset);
+        if (n < 0 && errno == EINTR) continue;
+#endif
+        if (n <= 0) return false;
+        data += n;
+        len -= (size_t) n;
+        offset += (uint64_t) n;
+    }
+    return true;
+}
+
+// 从指定偏移读取最多 len 字节，不改变文件位置，返回读到的字节数，出错时返回 -1
+inline long ReadAt(FileHandle file, char *data, size_t len, uint64_t offset) {
+#ifdef _WIN32
+    OVERLAPPED at{};
+    at.Offset = (DWORD) offset;
+    at.OffsetHigh = (DWORD) (offset >> 32);
+    DWORD n = 0;
+    if (!ReadFile((HANDLE) _get_osfhandle(file), data, (DWORD) len, &n, &at)) {
+        return GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
+    }
+    return (long) n;
+#else
+    while (true) {
+        ssize_t n = pread(file, data, len, (off_t) offset);
+        if (n < 0 && errno == EINTR) continue;
+        return (long) n;
+    }
+#endif
+}
+
+// 把已写入的数据落盘（只保证数据和文件长度，不强制更新修改时间等元数据）
+inline bool SyncFile(FileHandle file) {
+#ifdef _WIN32
+    return _commit(file) == 0;
+#elif defined(__APPLE__)
+    return fsync(file) == 0;
+#else
+    return fdatasync(file) == 0;
+#endif
+}
+
+// 把目录项的变化（创建、改名、删除）落盘，Windows 下不需要
+inline void SyncDirectory(const std::string &path) {
+#ifndef _WIN32
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    fsync(fd);
+    close(fd);
+#else
+    (void) path;
+#endif
+}
+
+// 把文件截断到 size 字节，返回是否成功
+inline bool TruncateFile(FileHandle file, uint64_t size) {
+#ifdef _WIN32
+    return _chsize_s(file, (__int64) size) == 0;
+#else
+    while (ftruncate(file, (off_t) size) != 0) {
+        if (errno != EINTR) return false;
+    }
+    return true;
+#endif
+}
+
+inline void CloseFile(FileHandle file) {
+#ifdef _WIN32
+    _close(file);
+#else
+    close(file);
+#endif
+}
+
+/**
+ * 整个文件的只读内存映射，析构时解除映射。空文件映射成功但 Data() 为空
+ */
+class MappedFile {
+public:
+    MappedFile() = default;
+
+    ~MappedFile() { Close(); }
+
+    MappedFile(const MappedFile &) = delete;
+
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // 映射文件，返回是否成功
+    bool Open(const std::string &path) {
+        Close();
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                  nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER fileSize;
+        GetFileSizeEx(file, &fileSize);
+        size = (size_t) fileSize.QuadPart;
+        if (size > 0) {
+            HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping != nullptr) {
+                data = (const char *) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                CloseHandle(mapping);
+            }
+        }
+        CloseHandle(file);
+        if (size > 0 && data == nullptr) {
+            size = 0;
+            return false;
+        }
+#else
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        struct stat st{};
+        fstat(fd, &st);
+        size = (size_t) st.st_size;
+        if (size > 0) {
+            void *p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED) {
+                close(fd);
+                size = 0;
+                return false;
+            }
+            data = (const char *) p;
+        }
+        close(fd);
+#endif
+        return true;
+    }
+
+    void Close() {
+        if (data != nullptr) {
+#ifdef _WIN32
+            UnmapViewOfFile(data);
+#else
+            munmap((void *) data, size);
+#endif
+        }
+        data = nullptr;
+        size = 0;
+    }
+
+    const char *Data() const { return data; }
+
+    size_t Size() const { return size; }
+
+private:
+    const char *data{};
+    size_t size{};
+};
+
+#endif //ONLINECHAT_FILE_H
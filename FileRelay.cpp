@@ -0,0 +1,133 @@
+#include "FileRelay.h"
+#include "Log.h"
+#include "Metrics.h"
+
+static int64_t NowMs() {
+    return MonotonicNs() / 1000000;
+}
+
+FileRelay::FileRelay(std::string dir) : dir(std::move(dir)) {}
+
+bool FileRelay::OverQuota(const std::string &sender, uint64_t size) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = userInflight.find(sender);
+    uint64_t user = it != userInflight.end() ? it->second : 0;
+    return inflightBytes + size > FILE_INFLIGHT_TOTAL_BYTES || user + size > FILE_INFLIGHT_USER_BYTES;
+}
+
+SpoolPtr FileRelay::Create(const std::string &sender, std::string_view name, std::string_view group,
+                           std::string_view target, uint64_t size) {
+    FileHandle file = OpenTempFile(dir);
+    if (file == INVALID_FILE) {
+        LOG_ERROR << "Failed to create a spool file in " << dir << ", error: " << errno;
+        return nullptr;
+    }
+    auto spool = std::make_shared<FileSpool>();
+    spool->sender = sender;
+    spool->name = name;
+    spool->group = group;
+    spool->target = target;
+    spool->size = size;
+    spool->file = file;
+    std::lock_guard<std::mutex> lock(mutex);
+    Expire(NowMs());
+    spool->id = nextId++;
+    spools[spool->id] = spool;
+    inflightBytes += size;
+    userInflight[sender] += size;
+    return spool;
+}
+
+SpoolPtr FileRelay::Find(uint64_t id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = spools.find(id);
+    return it != spools.end() ? it->second : nullptr;
+}
+
+void FileRelay::AddPending(std::string_view username, uint64_t id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending[std::string(username)].push_back(id);
+}
+
+std::vector<SpoolPtr> FileRelay::TakePending(const std::string &username) {
+    std::vector<SpoolPtr> result;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = pending.find(username);
+    if (it == pending.end()) return result;
+    // 已过期或失败的传输不再通知
+    for (uint64_t id: it->second) {
+        auto spool = spools.find(id);
+        if (spool != spools.end() && !spool->second->failed) result.push_back(spool->second);
+    }
+    pending.erase(it);
+    return result;
+}
+
+std::vector<ClientHandle> FileRelay::Commit(FileSpool &spool, uint64_t committed) {
+    std::vector<ClientHandle> waiters;
+    {
+        std::lock_guard<std::mutex> lock(spool.mutex);
+        spool.committed.store(committed, std::memory_order_release);
+        if (committed != spool.size) {
+            waiters.swap(spool.waiters);
+            return waiters;
+        }
+        waiters = Finish(spool);
+    }
+    Release(spool);
+    return waiters;
+}
+
+std::vector<ClientHandle> FileRelay::Fail(FileSpool &spool) {
+    std::vector<ClientHandle> waiters;
+    {
+        std::lock_guard<std::mutex> lock(spool.mutex);
+        spool.failed = true;
+        waiters = Finish(spool);
+    }
+    Release(spool);
+    return waiters;
+}
+
+void FileRelay::Release(const FileSpool &spool) {
+    // 上传者所在的分片对每个传输只结束一次：完成或失败
+    std::lock_guard<std::mutex> lock(mutex);
+    inflightBytes -= spool.size;
+    auto it = userInflight.find(spool.sender);
+    if (it != userInflight.end() && (it->second -= spool.size) == 0) userInflight.erase(it);
+}
+
+std::vector<ClientHandle> FileRelay::Finish(FileSpool &spool) {
+    spool.finishedMs = NowMs();
+    std::vector<ClientHandle> waiters;
+    waiters.swap(spool.waiters);
+    return waiters;
+}
+
+bool FileRelay::Wait(FileSpool &spool, ClientHandle handle, uint64_t offset) {
+    // 与 Commit 在同一把锁下检查，不会错过检查之后写入的数据
+    std::lock_guard<std::mutex> lock(spool.mutex);
+    if (spool.failed || spool.committed.load(std::memory_order_relaxed) > offset) return false;
+    for (const auto &waiter: spool.waiters) {
+        if (waiter == handle) return true;
+    }
+    spool.waiters.push_back(handle);
+    return true;
+}
+
+void FileRelay::Expire(int64_t nowMs) {
+    for (auto it = spools.begin(); it != spools.end();) {
+        FileSpool &spool = *it->second;
+        int64_t finishedMs;
+        {
+            std::lock_guard<std::mutex> lock(spool.mutex);
+            finishedMs = spool.finishedMs;
+        }
+        if (finishedMs != 0 && nowMs - finishedMs > FILE_SPOOL_TTL_MS) {
+            // 正在下载的接收者仍持有引用，文件在下载结束后才关闭
+            it = spools.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
@@ -0,0 +1,123 @@
+#ifndef ONLINECHAT_FILERELAY_H
+#define ONLINECHAT_FILERELAY_H
+
+#include "File.h"
+#include "Group.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// 传输结束（完成或失败）后中转文件保留的时间（毫秒），期间接收者仍可下载
+#define FILE_SPOOL_TTL_MS (10 * 60 * 1000)
+// 尚未结束的上传按声明的文件长度计入的字节数上限：每个用户和所有用户合计
+#define FILE_INFLIGHT_USER_BYTES (8ull * 1024 * 1024 * 1024)
+#define FILE_INFLIGHT_TOTAL_BYTES (64ull * 1024 * 1024 * 1024)
+
+/**
+ * 一次文件传输的中转文件：上传按顺序写入，所有接收者（私聊的目标或群组的全部成员）
+ * 从同一个文件按各自的进度读取，已写入的部分立即可以下载，不需要等上传完成。
+ * 文件创建后即没有名字，最后一个引用释放时由系统回收
+ */
+struct FileSpool {
+    uint64_t id{};
+    std::string sender;
+    std::string name;
+    std::string group;  // 群组文件的群组名，私聊为空
+    std::string target; // 私聊文件的接收者
+    uint64_t size{};
+    FileHandle file{INVALID_FILE};
+    // 已写入文件、可以下载的字节数，只由上传者所在的分片增加
+    std::atomic<uint64_t> committed{0};
+    std::atomic<bool> failed{false};
+
+    ~FileSpool() { CloseFile(file); }
+
+private:
+    friend class FileRelay;
+
+    std::mutex mutex;
+    // 已读到 committed 的下载者，有新数据或传输失败时唤醒
+    std::vector<ClientHandle> waiters;
+    // 传输结束的时间（单调时钟毫秒），为 0 表示仍在上传
+    int64_t finishedMs{};
+};
+
+using SpoolPtr = std::shared_ptr<FileSpool>;
+
+/**
+ * 所有分片共享的文件中转：分配传输ID、保存中转文件和离线用户待接收的文件，可在任意线程调用
+ */
+class FileRelay {
+public:
+    // @param dir 中转文件所在的目录
+    explicit FileRelay(std::string dir);
+
+    /**
+     * 开始上传 size 字节是否会超过在途字节数的上限。检查和计入分开进行，
+     * 多个分片同时开始上传时可能略微超出
+     */
+    bool OverQuota(const std::string &sender, uint64_t size);
+
+    /**
+     * 创建传输和中转文件，计入在途字节数，同时回收过期的传输
+     * @return 传输，创建文件失败时为空指针
+     */
+    SpoolPtr Create(const std::string &sender, std::string_view name, std::string_view group,
+                    std::string_view target, uint64_t size);
+
+    // 查找传输，不存在或已过期时返回空指针
+    SpoolPtr Find(uint64_t id);
+
+    // 接收者离线，注册时再发送该文件的通知
+    void AddPending(std::string_view username, uint64_t id);
+
+    // 取出用户离线期间收到的文件
+    std::vector<SpoolPtr> TakePending(const std::string &username);
+
+    /**
+     * 上传的数据已写入文件
+     * @param committed 已写入的总字节数
+     * @return 需要唤醒的下载者
+     */
+    std::vector<ClientHandle> Commit(FileSpool &spool, uint64_t committed);
+
+    // 上传失败或被取消，返回需要唤醒的下载者
+    std::vector<ClientHandle> Fail(FileSpool &spool);
+
+    /**
+     * 下载者已读到 offset，没有更多数据时登记等待
+     * @return 是否已登记，返回 false 时已有新数据或传输已失败，应继续读取
+     */
+    bool Wait(FileSpool &spool, ClientHandle handle, uint64_t offset);
+
+    // 是否用 splice 和 sendfile 在内核中直接收发文件数据，否则经过用户态缓冲区复制
+    void SetZeroCopy(bool enabled) { zeroCopy = enabled; }
+
+    bool ZeroCopy() const { return zeroCopy; }
+
+private:
+    // 回收结束超过保留时间的传输，调用方持有 mutex
+    void Expire(int64_t nowMs);
+
+    // 标记传输结束并取出所有等待者，调用方持有 spool.mutex
+    static std::vector<ClientHandle> Finish(FileSpool &spool);
+
+    // 传输结束，不再计入在途字节数
+    void Release(const FileSpool &spool);
+
+    std::string dir;
+    std::atomic<bool> zeroCopy{true};
+    std::mutex mutex;
+    uint64_t nextId{1};
+    std::unordered_map<uint64_t, SpoolPtr> spools;
+    std::unordered_map<std::string, std::vector<uint64_t>> pending;
+    // 尚未结束的上传声明的字节数：合计和按发送者
+    uint64_t inflightBytes{};
+    std::unordered_map<std::string, uint64_t> userInflight;
+};
+
+#endif //ONLINECHAT_FILERELAY_H
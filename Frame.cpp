@@ -0,0 +1,151 @@
+#include "Frame.h"
+#include "Metrics.h"
+#include "Pool.h"
+#include "WebSocket.h"
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+SharedFrame *SharedFrame::Create(size_t size) {
+    void *mem = BufferPool::Allocate(sizeof(SharedFrame) + size);
+    return new(mem) SharedFrame(size);
+}
+
+SharedFrame *SharedFrame::Create(std::string_view data) {
+    SharedFrame *frame = Create(data.size());
+    memcpy(frame->MutableData(), data.data(), data.size());
+    return frame;
+}
+
+SharedFrame *SharedFrame::CreateFile(std::shared_ptr<void> owner, int file, uint64_t offset, size_t size) {
+    void *mem = BufferPool::Allocate(sizeof(SharedFrame) + sizeof(FileRegion));
+    auto *frame = new(mem) SharedFrame(size);
+    frame->file = true;
+    new(frame + 1) FileRegion{std::move(owner), file, offset};
+    return frame;
+}
+
+void SharedFrame::Release() {
+    if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        size_t total = sizeof(SharedFrame) + (file ? sizeof(FileRegion) : size);
+        if (file) reinterpret_cast<FileRegion *>(this + 1)->~FileRegion();
+        this->~SharedFrame();
+        BufferPool::Free(this, total);
+    }
+}
+
+void FrameQueue::Push(FramePtr frame) {
+    if (count == slots.size()) {
+        // 扩容为两倍，按顺序搬移到新数组开头
+        std::vector<FramePtr> larger(slots.empty() ? 8 : slots.size() * 2);
+        for (size_t i = 0; i < count; i++) {
+            larger[i] = std::move(slots[(head + i) & (slots.size() - 1)]);
+        }
+        slots.swap(larger);
+        head = 0;
+    }
+    bytes += frame->Size();
+    slots[(head + count) & (slots.size() - 1)] = std::move(frame);
+    count++;
+}
+
+void FrameQueue::Pop() {
+    FramePtr &front = slots[head];
+    bytes -= front->Size();
+    front = FramePtr();
+    head = (head + 1) & (slots.size() - 1);
+    count--;
+}
+
+void FrameQueue::Clear() {
+    while (!Empty()) Pop();
+}
+
+Encoding EncodingOf(ProtocolMode mode) {
+    switch (mode) {
+        case PROTOCOL_TEXT_LINE:
+            return ENCODING_TEXT_LINE;
+        case PROTOCOL_BINARY:
+            return ENCODING_BINARY;
+        case PROTOCOL_WEBSOCKET:
+            return ENCODING_WEBSOCKET;
+        default:
+            return ENCODING_TEXT;
+    }
+}
+
+SharedMessage *SharedMessage::Create(uint8_t opcode, const std::string_view *fields, size_t count) {
+    count = std::min<size_t>(count, MAX_FIELDS);
+    size_t contentSize = 0;
+    for (size_t i = 0; i < count; i++) contentSize += fields[i].size();
+    void *mem = BufferPool::Allocate(sizeof(SharedMessage) + contentSize);
+    auto *msg = new(mem) SharedMessage();
+    msg->opcode = opcode;
+    msg->fieldCount = (uint8_t) count;
+    // 只统计用户之间的聊天消息，通知等服务器消息可能被缓存复用
+    if (opcode == OP_DELIVER || opcode == OP_GROUP_DELIVER) msg->createdNs = MonotonicNs();
+    char *content = reinterpret_cast<char *>(msg + 1);
+    uint32_t offset = 0;
+    for (size_t i = 0; i < count; i++) {
+        msg->offsets[i] = offset;
+        memcpy(content + offset, fields[i].data(), fields[i].size());
+        offset += (uint32_t) fields[i].size();
+    }
+    msg->offsets[count] = offset;
+    return msg;
+}
+
+void SharedMessage::Release() const {
+    if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        size_t total = sizeof(SharedMessage) + offsets[fieldCount];
+        this->~SharedMessage();
+        BufferPool::Free(const_cast<SharedMessage *>(this), total);
+    }
+}
+
+SharedMessage::~SharedMessage() {
+    for (auto &slot: encoded) {
+        SharedFrame *frame = slot.load(std::memory_order_relaxed);
+        if (frame) frame->Release();
+    }
+}
+
+FramePtr SharedMessage::Encode(Encoding encoding) const {
+    SharedFrame *frame = encoded[encoding].load(std::memory_order_acquire);
+    if (frame == nullptr) {
+        std::string_view views[MAX_FIELDS];
+        for (size_t i = 0; i < fieldCount; i++) views[i] = Field(i);
+        // 直接编码到帧中，不经过临时字符串
+        SharedFrame *created;
+        if (encoding == ENCODING_BINARY) {
+            created = SharedFrame::Create(BinaryFrameSize(views, fieldCount));
+            WriteBinaryFrame(created->MutableData(), opcode, views, fieldCount);
+        } else if (encoding == ENCODING_WEBSOCKET) {
+            // 所有网页客户端共享同一个帧，帧头和内容一起编码；帧头的长度与类型无关，先写内容再按内容选择类型
+            size_t payloadSize = TextFrameSize(opcode, views, fieldCount, false);
+            size_t headerSize = WebSocketHeaderSize(payloadSize);
+            created = SharedFrame::Create(headerSize + payloadSize);
+            char *payload = created->MutableData() + headerSize;
+            WriteTextFrame(payload, opcode, views, fieldCount, false);
+            WriteWebSocketHeader(created->MutableData(), IsValidUtf8(payload, payloadSize) ? WS_TEXT : WS_BINARY,
+                                 payloadSize);
+        } else {
+            bool lineMode = encoding == ENCODING_TEXT_LINE;
+            created = SharedFrame::Create(TextFrameSize(opcode, views, fieldCount, lineMode));
+            WriteTextFrame(created->MutableData(), opcode, views, fieldCount, lineMode);
+        }
+        created->SetOrigin(createdNs);
+        // 多个分片可能同时编码，只保留第一个发布的结果
+        if (encoded[encoding].compare_exchange_strong(frame, created, std::memory_order_acq_rel)) {
+            frame = created;
+        } else {
+            created->Release();
+        }
+    }
+    frame->AddRef();
+    return FramePtr(frame);
+}
+
+MessagePtr MakeMessage(uint8_t opcode, std::initializer_list<std::string_view> fields) {
+    return MessagePtr(SharedMessage::Create(opcode, fields.begin(), fields.size()));
+}
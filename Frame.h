@@ -0,0 +1,238 @@
+#ifndef ONLINECHAT_FRAME_H
+#define ONLINECHAT_FRAME_H
+
+#include "Protocol.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// 文件帧引用的文件区间，owner 保证文件在帧发送完成之前不被关闭
+struct FileRegion {
+    std::shared_ptr<void> owner;
+    int file{-1};
+    uint64_t offset{};
+};
+
+/**
+ * 编码完成、不可变、带引用计数的待发送数据。一条广播消息只编码一次，
+ * 每个接收者的发送队列中只保存指针，数据在最后一个引用释放时才被回收，
+ * 因此发送未完成时数据不会被提前释放。
+ * 文件帧不保存内容，只引用文件中的一段区间，发送时由内核直接从文件复制到套接字
+ */
+class SharedFrame {
+public:
+    // 分配 size 字节的帧，引用计数为 1，内容由调用方在发布之前写入
+    static SharedFrame *Create(size_t size);
+
+    // 复制数据创建帧
+    static SharedFrame *Create(std::string_view data);
+
+    /**
+     * 创建引用文件区间的帧，引用计数为 1
+     * @param owner 持有文件的对象，帧释放时释放引用
+     * @param file 文件句柄
+     * @param offset 区间在文件中的偏移
+     * @param size 区间长度
+     */
+    static SharedFrame *CreateFile(std::shared_ptr<void> owner, int file, uint64_t offset, size_t size);
+
+    // 内存帧的内容，文件帧没有内容
+    char *MutableData() { return reinterpret_cast<char *>(this + 1); }
+
+    const char *Data() const { return reinterpret_cast<const char *>(this + 1); }
+
+    // 内容长度，文件帧为区间长度
+    size_t Size() const { return size; }
+
+    bool IsFile() const { return file; }
+
+    const FileRegion &Region() const { return *reinterpret_cast<const FileRegion *>(this + 1); }
+
+    // 所属消息的构造时间（单调时钟纳秒），不统计投递延迟的帧为 0
+    int64_t Origin() const { return origin; }
+
+    void SetOrigin(int64_t ns) { origin = ns; }
+
+    void AddRef() { refs.fetch_add(1, std::memory_order_relaxed); }
+
+    void Release();
+
+private:
+    explicit SharedFrame(size_t size) : size(size) {}
+
+    std::atomic<int> refs{1};
+    bool file{false};
+    size_t size;
+    int64_t origin{};
+};
+
+/**
+ * SharedFrame 的侵入式智能指针
+ */
+class FramePtr {
+public:
+    FramePtr() = default;
+
+    // 接管一个已有的引用
+    explicit FramePtr(SharedFrame *frame) : frame(frame) {}
+
+    FramePtr(const FramePtr &other) : frame(other.frame) {
+        if (frame) frame->AddRef();
+    }
+
+    FramePtr(FramePtr &&other) noexcept: frame(std::exchange(other.frame, nullptr)) {}
+
+    FramePtr &operator=(FramePtr other) noexcept {
+        std::swap(frame, other.frame);
+        return *this;
+    }
+
+    ~FramePtr() {
+        if (frame) frame->Release();
+    }
+
+    SharedFrame *Get() const { return frame; }
+
+    SharedFrame *operator->() const { return frame; }
+
+    explicit operator bool() const { return frame != nullptr; }
+
+private:
+    SharedFrame *frame{};
+};
+
+/**
+ * 每个连接的发送队列：按顺序保存待发送帧的指针。
+ * 使用可复用的环形数组，稳定状态下入队出队都不分配内存
+ */
+class FrameQueue {
+public:
+    bool Empty() const { return count == 0; }
+
+    size_t Size() const { return count; }
+
+    // 队列中尚未发送的总字节数（不扣除队首已发送的部分）
+    size_t Bytes() const { return bytes; }
+
+    void Push(FramePtr frame);
+
+    const FramePtr &At(size_t i) const { return slots[(head + i) & (slots.size() - 1)]; }
+
+    void Pop();
+
+    void Clear();
+
+private:
+    std::vector<FramePtr> slots;
+    size_t head{0};
+    size_t count{0};
+    size_t bytes{0};
+};
+
+// 帧的编码方式，与接收方的协议对应
+enum Encoding {
+    ENCODING_TEXT,
+    ENCODING_TEXT_LINE,
+    ENCODING_BINARY,
+    ENCODING_WEBSOCKET,  // 文本协议内容放在一个 WebSocket 文本帧中
+    ENCODING_COUNT
+};
+
+// 协议对应的编码方式
+Encoding EncodingOf(ProtocolMode mode);
+
+/**
+ * 待发送的消息。内容只构造一次，每种编码方式在第一次需要时编码一次，
+ * 之后所有接收者（包括其它分片上的接收者）共享同一个帧。
+ * 消息对象和字段内容放在从缓冲区池取得的同一块内存中，带侵入式引用计数
+ */
+class SharedMessage {
+public:
+    /**
+     * 构造消息，字段内容被复制，引用计数为 1
+     * @param opcode 操作码
+     * @param fields 字段，超过 MAX_FIELDS 的部分被忽略
+     * @param count 字段数
+     */
+    static SharedMessage *Create(uint8_t opcode, const std::string_view *fields, size_t count);
+
+    SharedMessage(const SharedMessage &) = delete;
+
+    SharedMessage &operator=(const SharedMessage &) = delete;
+
+    uint8_t Opcode() const { return opcode; }
+
+    size_t FieldCount() const { return fieldCount; }
+
+    std::string_view Field(size_t i) const {
+        return {reinterpret_cast<const char *>(this + 1) + offsets[i], offsets[i + 1] - offsets[i]};
+    }
+
+    // 获取指定编码的帧，可在任意线程调用
+    FramePtr Encode(Encoding encoding) const;
+
+    void AddRef() const { refs.fetch_add(1, std::memory_order_relaxed); }
+
+    void Release() const;
+
+private:
+    SharedMessage() = default;
+
+    ~SharedMessage();
+
+    mutable std::atomic<int> refs{1};
+    uint8_t opcode{};
+    uint8_t fieldCount{};
+    int64_t createdNs{};  // 聊天消息的构造时间，编码出的帧据此统计投递延迟
+    uint32_t offsets[MAX_FIELDS + 1]{};  // 第 i 个字段位于字段内容的 [offsets[i], offsets[i + 1])
+    mutable std::atomic<SharedFrame *> encoded[ENCODING_COUNT]{};
+};
+
+/**
+ * SharedMessage 的侵入式智能指针
+ */
+class MessagePtr {
+public:
+    MessagePtr() = default;
+
+    // 接管一个已有的引用
+    explicit MessagePtr(const SharedMessage *msg) : msg(msg) {}
+
+    MessagePtr(const MessagePtr &other) : msg(other.msg) {
+        if (msg) msg->AddRef();
+    }
+
+    MessagePtr(MessagePtr &&other) noexcept: msg(std::exchange(other.msg, nullptr)) {}
+
+    MessagePtr &operator=(MessagePtr other) noexcept {
+        std::swap(msg, other.msg);
+        return *this;
+    }
+
+    ~MessagePtr() {
+        if (msg) msg->Release();
+    }
+
+    const SharedMessage &operator*() const { return *msg; }
+
+    const SharedMessage *operator->() const { return msg; }
+
+    explicit operator bool() const { return msg != nullptr; }
+
+private:
+    const SharedMessage *msg{};
+};
+
+/**
+ * 构造共享消息，字段内容被复制，调用方的字段在返回后即可释放
+ * @param opcode 操作码
+ * @param fields 字段
+ */
+MessagePtr MakeMessage(uint8_t opcode, std::initializer_list<std::string_view> fields);
+
+#endif //ONLINECHAT_FRAME_H
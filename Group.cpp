@@ -0,0 +1,104 @@
+#include "Group.h"
+#include <mutex>
+
+bool Group::Add(const GroupMember &member) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    const ClientHandle &handle = member.handle;
+    if ((int) shards.size() <= handle.shard) shards.resize(handle.shard + 1);
+    ShardMembers &local = shards[handle.shard];
+    if (!local.index.try_emplace(handle.clientId, (uint32_t) local.clientIds.size()).second) return false;
+    memberCount++;
+    local.clientIds.push_back(handle.clientId);
+    local.usernames.push_back(member.username);
+    local.multicast.emplace_back();
+    return true;
+}
+
+bool Group::Remove(ClientHandle handle) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    if (MembersOf(handle) == nullptr) return false;
+    ShardMembers &local = shards[handle.shard];
+    auto it = local.index.find(handle.clientId);
+    if (it == local.index.end()) return false;
+    uint32_t pos = it->second;
+    local.index.erase(it);
+    memberCount--;
+    // 与末尾成员交换后删除，并更新被移动成员的下标
+    uint32_t last = (uint32_t) local.clientIds.size() - 1;
+    if (local.multicast[pos].Active()) local.multicastCount--;
+    if (pos != last) {
+        local.clientIds[pos] = local.clientIds[last];
+        local.usernames[pos] = std::move(local.usernames[last]);
+        local.multicast[pos] = local.multicast[last];
+        local.index[local.clientIds[pos]] = pos;
+    }
+    local.clientIds.pop_back();
+    local.usernames.pop_back();
+    local.multicast.pop_back();
+    return true;
+}
+
+bool Group::Contains(ClientHandle handle) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    const ShardMembers *local = MembersOf(handle);
+    return local != nullptr && local->index.count(handle.clientId) > 0;
+}
+
+size_t Group::Size() const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return memberCount;
+}
+
+void Group::ShardsWithMembers(std::vector<int> &result) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    result.clear();
+    for (int i = 0; i < (int) shards.size(); i++) {
+        if (!shards[i].clientIds.empty()) result.push_back(i);
+    }
+}
+
+void Group::MembersOn(int shard, std::vector<uint64_t> &clientIds, uint64_t multicastSeq) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    clientIds.clear();
+    if (shard >= (int) shards.size()) return;
+    const ShardMembers &local = shards[shard];
+    if (multicastSeq == 0 || local.multicastCount == 0) {
+        clientIds.assign(local.clientIds.begin(), local.clientIds.end());
+        return;
+    }
+    for (size_t i = 0; i < local.clientIds.size(); i++) {
+        if (!local.multicast[i].Covers(multicastSeq)) clientIds.push_back(local.clientIds[i]);
+    }
+}
+
+bool Group::SetMulticast(ClientHandle handle, MulticastRange range) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    if (MembersOf(handle) == nullptr) return false;
+    ShardMembers &local = shards[handle.shard];
+    auto it = local.index.find(handle.clientId);
+    if (it == local.index.end()) return false;
+    MulticastRange &current = local.multicast[it->second];
+    local.multicastCount += (size_t) range.Active() - (size_t) current.Active();
+    current = range;
+    return true;
+}
+
+MulticastRange Group::MulticastOf(ClientHandle handle) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    const ShardMembers *local = MembersOf(handle);
+    if (local == nullptr) return {};
+    auto it = local->index.find(handle.clientId);
+    if (it == local->index.end()) return {};
+    return local->multicast[it->second];
+}
+
+std::string Group::MemberNames() const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    std::string names;
+    for (const auto &local: shards) {
+        for (const auto &username: local.usernames) {
+            names += username + " ";
+        }
+    }
+    return names;
+}
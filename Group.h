@@ -0,0 +1,123 @@
+#ifndef ONLINECHAT_GROUP_H
+#define ONLINECHAT_GROUP_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * 客户端句柄：连接所在的分片和客户端ID。连接只能由所属分片访问，
+ * 其它分片通过句柄把消息投递到所属分片的消息队列
+ */
+struct ClientHandle {
+    int shard{-1};
+    uint64_t clientId{};
+
+    bool operator==(const ClientHandle &other) const {
+        return shard == other.shard && clientId == other.clientId;
+    }
+};
+
+/**
+ * 一个成员通过组播接收的群组消息的组播序列号范围 [from, until)，范围外的消息通过TCP投递。
+ * 成员确认能收到组播时 from 为服务器当时的下一个序列号，退出组播时 until 为当时的下一个序列号，
+ * 序列号在发送时分配，因此每条消息恰好通过一种方式到达成员
+ */
+struct MulticastRange {
+    uint64_t from{UINT64_MAX};
+    uint64_t until{UINT64_MAX};
+
+    // 序列号为 seq 的组播消息是否不需要通过TCP发给该成员，seq 为 0 表示消息没有组播
+    bool Covers(uint64_t seq) const { return seq >= from && seq < until; }
+
+    // 成员曾确认能收到组播
+    bool Active() const { return from != UINT64_MAX; }
+};
+
+// 群组成员
+struct GroupMember {
+    ClientHandle handle;
+    std::string username;
+};
+
+/**
+ * 一个群组的成员索引：按分片划分的紧凑数组保存成员，扇出时每个分片只顺序遍历自己的客户端ID；
+ * 每个分片上客户端ID到数组下标的哈希表提供 O(1) 的成员检查，删除时与末尾元素交换，数组始终紧凑。
+ * 所有操作由群组自己的读写锁保护，可在任意线程调用
+ */
+class Group {
+public:
+    explicit Group(std::string name) : name(std::move(name)) {}
+
+    const std::string &Name() const { return name; }
+
+    // 加入成员，已是成员时返回 false
+    bool Add(const GroupMember &member);
+
+    // 移除成员，不是成员时返回 false
+    bool Remove(ClientHandle handle);
+
+    bool Contains(ClientHandle handle) const;
+
+    size_t Size() const;
+
+    // 有成员的分片
+    void ShardsWithMembers(std::vector<int> &shards) const;
+
+    /**
+     * 复制某个分片上需要通过TCP投递的成员的客户端ID
+     * @param shard 分片
+     * @param clientIds 输出，会先被清空，调用方可复用以避免分配
+     * @param multicastSeq 消息的组播序列号，通过组播收到该消息的成员被跳过，0 表示消息没有组播
+     */
+    void MembersOn(int shard, std::vector<uint64_t> &clientIds, uint64_t multicastSeq = 0) const;
+
+    // 设置成员通过组播接收的序列号范围，不是成员时返回 false
+    bool SetMulticast(ClientHandle handle, MulticastRange range);
+
+    // 成员当前的组播范围，不是成员或没有组播时范围为空
+    MulticastRange MulticastOf(ClientHandle handle) const;
+
+    // 以空格分隔的成员名
+    std::string MemberNames() const;
+
+    // 记录集群中其它节点上是否有该群组的成员，由集群线程维护
+    void SetRemoteNode(int node, bool present) {
+        if (present) remoteNodes.fetch_or(1ull << node, std::memory_order_relaxed);
+        else remoteNodes.fetch_and(~(1ull << node), std::memory_order_relaxed);
+    }
+
+    // 有成员的其它节点，按节点ID的位掩码
+    uint64_t RemoteNodes() const { return remoteNodes.load(std::memory_order_relaxed); }
+
+private:
+    // 一个分片上的成员，各数组按下标一一对应
+    struct ShardMembers {
+        std::vector<uint64_t> clientIds;
+        std::vector<std::string> usernames;
+        std::vector<MulticastRange> multicast;
+        size_t multicastCount{}; // 有组播范围的成员数，为 0 时扇出不需要逐个检查
+        // 客户端ID到数组下标的映射
+        std::unordered_map<uint64_t, uint32_t> index;
+    };
+
+    // 句柄所在分片的成员，分片上没有过成员时返回空指针，调用方持有 mutex
+    const ShardMembers *MembersOf(const ClientHandle &handle) const {
+        return handle.shard >= 0 && handle.shard < (int) shards.size() ? &shards[handle.shard] : nullptr;
+    }
+
+    const std::string name;
+    mutable std::shared_mutex mutex;
+    std::vector<ShardMembers> shards;
+    size_t memberCount{};
+    std::atomic<uint64_t> remoteNodes{0};
+};
+
+using GroupPtr = std::shared_ptr<Group>;
+
+#endif //ONLINECHAT_GROUP_H
@@ -0,0 +1,379 @@
+#include "GroupStore.h"
+#include "Log.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+/**
+ * 日志记录格式（主机字节序）：
+ *   u32 长度（不含长度字段本身） | u32 校验和（其后所有字节） | u8 操作 | u32 群组名长度 | 群组名 | 用户名
+ */
+#define WAL_HEADER_SIZE 13
+
+/**
+ * 快照格式（主机字节序）：
+ *   成员关系：每个用户为 u32 长度 + 用户名, u32 群组数, 每个群组为 u32 长度 + 群组名
+ *   群组：每个群组为 u32 长度 + 群组名
+ *   尾部：u64 之后的第一个日志序号 | u64 用户数 | u64 群组数 | u64 之前所有字节的校验和 | u32 版本 | u32 魔数
+ */
+#define SNAPSHOT_TRAILER_SIZE 40
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_MAGIC 0x5347434Fu // "OCGS"
+#define HASH_SEED 1469598103934665603ULL
+
+// 按 8 字节处理的 FNV 变体，分块计算时除最后一块外每块须为 8 字节的整数倍
+static uint64_t HashBytes(uint64_t hash, const char *data, size_t len) {
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 1099511628211ULL;
+        hash ^= hash >> 29;
+    }
+    for (; i < len; i++) hash = (hash ^ (unsigned char) data[i]) * 1099511628211ULL;
+    return hash;
+}
+
+template<typename T>
+static T Get(const char *p) {
+    T value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+template<typename T>
+static void Put(std::string &out, T value) {
+    out.append((const char *) &value, sizeof(value));
+}
+
+// 读取一个 u32 长度前缀的字符串，越界时返回 false
+static bool GetString(const char *&p, const char *end, std::string_view &text) {
+    if (end - p < 4) return false;
+    uint32_t len = Get<uint32_t>(p);
+    if ((size_t) (end - p - 4) < len) return false;
+    text = std::string_view(p + 4, len);
+    p += 4 + len;
+    return true;
+}
+
+void GroupSnapshotWriter::PutString(std::string_view text) {
+    Put(buffer, (uint32_t) text.size());
+    buffer.append(text.data(), text.size());
+    if (buffer.size() >= GROUP_SNAPSHOT_BUFFER) Flush(false);
+}
+
+void GroupSnapshotWriter::AddMembership(std::string_view user, const std::vector<std::string> &groupNames) {
+    PutString(user);
+    Put(buffer, (uint32_t) groupNames.size());
+    for (const auto &group: groupNames) PutString(group);
+    users++;
+}
+
+void GroupSnapshotWriter::AddGroup(std::string_view group) {
+    PutString(group);
+    groups++;
+}
+
+void GroupSnapshotWriter::Flush(bool final) {
+    size_t len = final ? buffer.size() : buffer.size() & ~(size_t) 7;
+    hash = HashBytes(hash, buffer.data(), len);
+    if (!failed && !WriteAll(file, buffer.data(), len)) failed = true;
+    written += len;
+    buffer.erase(0, len);
+}
+
+GroupStore::~GroupStore() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    wakeup.notify_one();
+    // 写入失败时仍在等待落盘的调用方不再等待
+    synced.notify_all();
+    if (writer.joinable()) writer.join();
+    if (compactor.joinable()) compactor.join();
+    if (wal != INVALID_FILE) CloseFile(wal);
+}
+
+std::string GroupStore::WalPath(uint64_t seq) const {
+    char name[40];
+    snprintf(name, sizeof(name), "wal-%020llu.log", (unsigned long long) seq);
+    return dir + "/" + name;
+}
+
+bool GroupStore::LoadSnapshot(const ReplayFn &replay, uint64_t &firstWal) {
+    firstWal = 1;
+    std::string path = dir + "/snapshot";
+    std::error_code ec;
+    if (!fs::exists(path, ec)) return true;
+    MappedFile map;
+    if (!map.Open(path) || map.Size() < SNAPSHOT_TRAILER_SIZE) {
+        LOG_ERROR << "Cannot read group snapshot " << path;
+        return false;
+    }
+    const char *data = map.Data();
+    const char *end = data + map.Size() - SNAPSHOT_TRAILER_SIZE;
+    uint64_t walSeqValue = Get<uint64_t>(end);
+    uint64_t users = Get<uint64_t>(end + 8);
+    uint64_t groups = Get<uint64_t>(end + 16);
+    uint64_t hash = Get<uint64_t>(end + 24);
+    if (Get<uint32_t>(end + 36) != SNAPSHOT_MAGIC || Get<uint32_t>(end + 32) != SNAPSHOT_VERSION ||
+        HashBytes(HASH_SEED, data, end - data) != hash) {
+        LOG_ERROR << "Group snapshot " << path << " is damaged.";
+        return false;
+    }
+    const char *p = data;
+    std::string_view user, group;
+    for (uint64_t i = 0; i < users; i++) {
+        if (!GetString(p, end, user) || end - p < 4) return false;
+        uint32_t count = Get<uint32_t>(p);
+        p += 4;
+        for (uint32_t j = 0; j < count; j++) {
+            if (!GetString(p, end, group)) return false;
+            replay(GROUP_OP_JOIN, group, user);
+        }
+    }
+    for (uint64_t i = 0; i < groups; i++) {
+        if (!GetString(p, end, group)) return false;
+        replay(GROUP_OP_CREATE, group, {});
+    }
+    firstWal = walSeqValue;
+    return p == end;
+}
+
+void GroupStore::ReplayWal(const std::string &path, const ReplayFn &replay) {
+    MappedFile map;
+    if (!map.Open(path)) {
+        LOG_ERROR << "Cannot map " << path;
+        return;
+    }
+    const char *data = map.Data();
+    size_t offset = 0;
+    while (map.Size() - offset >= WAL_HEADER_SIZE) {
+        const char *p = data + offset;
+        size_t total = 4 + (size_t) Get<uint32_t>(p);
+        if (total < WAL_HEADER_SIZE || total > map.Size() - offset) break;
+        if (Get<uint32_t>(p + 4) != (uint32_t) HashBytes(HASH_SEED, p + 8, total - 8)) break;
+        size_t groupLen = Get<uint32_t>(p + 9);
+        if (groupLen > total - WAL_HEADER_SIZE) break;
+        replay((GroupLogOp) p[8], std::string_view(p + WAL_HEADER_SIZE, groupLen),
+               std::string_view(p + WAL_HEADER_SIZE + groupLen, total - WAL_HEADER_SIZE - groupLen));
+        offset += total;
+        walBytes += total;
+    }
+    if (offset < map.Size()) {
+        LOG_WARN << "Truncating " << path << " from " << map.Size() << " to " << offset << " bytes.";
+        map.Close();
+        std::error_code ec;
+        fs::resize_file(path, offset, ec);
+    }
+}
+
+bool GroupStore::Open(const ReplayFn &replay, DumpFn dumpFn) {
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    if (ec) {
+        LOG_ERROR << "Cannot create " << dir << ": " << ec.message();
+        return false;
+    }
+    uint64_t firstWal;
+    if (!LoadSnapshot(replay, firstWal)) return false;
+    std::vector<uint64_t> seqs;
+    for (const auto &item: fs::directory_iterator(dir, ec)) {
+        std::string name = item.path().filename().string();
+        if (name.rfind("wal-", 0) != 0) continue;
+        seqs.push_back(std::strtoull(name.c_str() + 4, nullptr, 10));
+    }
+    std::sort(seqs.begin(), seqs.end());
+    for (uint64_t seq: seqs) {
+        // 快照已包含的日志是上次删除旧日志之前退出留下的
+        if (seq < firstWal) fs::remove(WalPath(seq), ec);
+        else ReplayWal(WalPath(seq), replay);
+        // 没有任何变更的日志（例如启动后没有修改就退出）直接删除
+        if (fs::exists(WalPath(seq), ec) && fs::file_size(WalPath(seq), ec) == 0) fs::remove(WalPath(seq), ec);
+    }
+    // 每次启动写入新的日志文件，不在可能被截断过的文件后追加
+    walSeq = std::max(firstWal, seqs.empty() ? 1 : seqs.back() + 1);
+    wal = OpenAppendFile(WalPath(walSeq));
+    if (wal == INVALID_FILE) {
+        LOG_ERROR << "Cannot open " << WalPath(walSeq) << ": " << strerror(errno);
+        return false;
+    }
+    SyncDirectory(dir);
+    dump = std::move(dumpFn);
+    running = true;
+    writer = std::thread([this]() {
+        Logger::SetThreadName("groups");
+        Run();
+    });
+    return true;
+}
+
+void GroupStore::Append(GroupLogOp op, std::string_view group, std::string_view user) {
+    std::lock_guard<std::mutex> lock(mutex);
+    bool wasEmpty = pending.empty();
+    size_t offset = pending.size();
+    size_t total = WAL_HEADER_SIZE + group.size() + user.size();
+    Put(pending, (uint32_t) (total - 4));
+    Put(pending, (uint32_t) 0);
+    pending += (char) op;
+    Put(pending, (uint32_t) group.size());
+    pending.append(group.data(), group.size());
+    pending.append(user.data(), user.size());
+    uint32_t checksum = (uint32_t) HashBytes(HASH_SEED, &pending[offset + 8], total - 8);
+    memcpy(&pending[offset + 4], &checksum, 4);
+    if (wasEmpty) wakeup.notify_one();
+}
+
+void GroupStore::Sync() {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!running) return;
+    uint64_t target = ++syncRequested;
+    wakeup.notify_one();
+    synced.wait(lock, [&]() { return syncDone >= target || !running; });
+}
+
+void GroupStore::Compact() {
+    std::lock_guard<std::mutex> lock(mutex);
+    compactRequested = true;
+    wakeup.notify_one();
+}
+
+void GroupStore::WaitCompaction() {
+    std::unique_lock<std::mutex> lock(mutex);
+    synced.wait(lock, [&]() { return !running || (!compactRequested && !compacting); });
+}
+
+void GroupStore::Run() {
+    std::string batch;
+    while (true) {
+        uint64_t requested;
+        bool stop, compact;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeup.wait_for(lock, std::chrono::milliseconds(GROUP_WAL_COMMIT_INTERVAL_MS), [&]() {
+                return !pending.empty() || !running || syncRequested != syncDone || (compactRequested && !compacting);
+            });
+            batch.swap(pending);
+            requested = syncRequested;
+            stop = !running;
+            compact = compactRequested;
+        }
+        bool failed = false;
+        if (!batch.empty()) {
+            if (WriteAll(wal, batch.data(), batch.size()) && SyncFile(wal)) {
+                walBytes += batch.size();
+                walSize += batch.size();
+                batch.clear();
+            } else {
+                // 截掉写了一半的记录，否则重放时会在这里停止并丢弃之后写入的全部记录；
+                // 这批变更放回队首稍后重试，等待落盘的调用方继续等待
+                LOG_ERROR << "Write to " << WalPath(walSeq) << " failed: " << strerror(errno);
+                if (!TruncateFile(wal, walSize)) {
+                    LOG_ERROR << "Truncate " << WalPath(walSeq) << " failed: " << strerror(errno);
+                }
+                failed = true;
+                if (stop) {
+                    LOG_ERROR << "Dropping " << batch.size() << " bytes of group changes";
+                } else {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    batch.append(pending);
+                    pending.swap(batch);
+                }
+                batch.clear();
+            }
+        }
+        if (!stop && !failed && !compacting && (compact || walBytes >= GROUP_WAL_COMPACT_BYTES)) {
+            // 切换到新的日志，此后的变更都写入新日志，快照只需覆盖切换之前的变更
+            FileHandle next = OpenAppendFile(WalPath(walSeq + 1));
+            if (next != INVALID_FILE) {
+                CloseFile(wal);
+                wal = next;
+                walSeq++;
+                walBytes = 0;
+                walSize = 0;
+                SyncDirectory(dir);
+                if (compactor.joinable()) compactor.join();
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    compactRequested = false;
+                    compacting = true;
+                }
+                compactor = std::thread([this, seq = walSeq]() {
+                    Logger::SetThreadName("compactor");
+                    WriteSnapshot(seq);
+                });
+            } else {
+                LOG_ERROR << "Cannot open " << WalPath(walSeq + 1) << ": " << strerror(errno);
+            }
+        }
+        if (failed && !stop) {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeup.wait_for(lock, std::chrono::milliseconds(GROUP_WAL_RETRY_MS), [&]() { return !running; });
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!failed && syncDone < requested) {
+                syncDone = requested;
+                synced.notify_all();
+            }
+        }
+        if (stop) break;
+    }
+}
+
+void GroupStore::WriteSnapshot(uint64_t firstWal) {
+    auto start = std::chrono::steady_clock::now();
+    std::string path = dir + "/snapshot";
+    FileHandle file = OpenWriteFile(path + ".tmp");
+    bool ok = file != INVALID_FILE;
+    uint64_t users = 0, groups = 0, size = 0;
+    if (ok) {
+        GroupSnapshotWriter writer(file);
+        writer.hash = HASH_SEED;
+        writer.buffer.reserve(GROUP_SNAPSHOT_BUFFER + 64);
+        dump(writer);
+        writer.Flush(true);
+        std::string trailer;
+        Put(trailer, firstWal);
+        Put(trailer, writer.users);
+        Put(trailer, writer.groups);
+        Put(trailer, writer.hash);
+        Put(trailer, (uint32_t) SNAPSHOT_VERSION);
+        Put(trailer, (uint32_t) SNAPSHOT_MAGIC);
+        ok = !writer.failed && WriteAll(file, trailer.data(), trailer.size()) && SyncFile(file);
+        CloseFile(file);
+        users = writer.users;
+        groups = writer.groups;
+        size = writer.written + trailer.size();
+    }
+    std::error_code ec;
+    if (ok) {
+        // 改名是原子的，任何时刻都有一个完整的快照
+        fs::rename(path + ".tmp", path, ec);
+        ok = !ec;
+        SyncDirectory(dir);
+    }
+    if (ok) {
+        for (const auto &item: fs::directory_iterator(dir, ec)) {
+            std::string name = item.path().filename().string();
+            if (name.rfind("wal-", 0) == 0 && std::strtoull(name.c_str() + 4, nullptr, 10) < firstWal) {
+                fs::remove(item.path(), ec);
+            }
+        }
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        LOG_INFO << "Group snapshot written: " << groups << " groups, " << users << " members, " << size
+                 << " bytes in " << (int64_t) ms << " ms.";
+    } else {
+        LOG_ERROR << "Writing group snapshot " << path << " failed.";
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (ok) compactions.fetch_add(1, std::memory_order_relaxed);
+    compacting = false;
+    synced.notify_all();
+}
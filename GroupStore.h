@@ -0,0 +1,140 @@
+#ifndef ONLINECHAT_GROUPSTORE_H
+#define ONLINECHAT_GROUPSTORE_H
+
+#include "File.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// 写前日志自上次快照以来超过该大小时，在后台生成新的快照
+#define GROUP_WAL_COMPACT_BYTES (16 * 1024 * 1024)
+// 写入线程在没有新记录时的最长等待时间（毫秒）
+#define GROUP_WAL_COMMIT_INTERVAL_MS 5
+// 写入日志失败后重试的间隔（毫秒）
+#define GROUP_WAL_RETRY_MS 1000
+// 快照写入缓冲区的大小
+#define GROUP_SNAPSHOT_BUFFER (1024 * 1024)
+
+// 写前日志中的一条变更，重放是幂等的
+enum GroupLogOp : uint8_t {
+    GROUP_OP_CREATE = 1, // 创建群组
+    GROUP_OP_JOIN = 2,   // 用户成为群组的成员
+    GROUP_OP_LEAVE = 3   // 用户退出群组
+};
+
+/**
+ * 快照的写入器：先写入所有用户的成员关系，再写入所有群组名，边写边计算校验和
+ */
+class GroupSnapshotWriter {
+public:
+    // 一个用户加入的所有群组
+    void AddMembership(std::string_view user, const std::vector<std::string> &groups);
+
+    void AddGroup(std::string_view group);
+
+private:
+    friend class GroupStore;
+
+    explicit GroupSnapshotWriter(FileHandle file) : file(file) {}
+
+    void PutString(std::string_view text);
+
+    // 写出缓冲区中 8 字节对齐的部分，final 为 true 时全部写出
+    void Flush(bool final);
+
+    FileHandle file;
+    std::string buffer;
+    uint64_t hash;
+    uint64_t written{0};
+    uint64_t users{0};
+    uint64_t groups{0};
+    uint64_t groupsOffset{0};
+    bool failed{false};
+};
+
+/**
+ * 群组和成员关系的持久化：一个二进制快照加上之后的写前日志。
+ * 变更只追加到内存缓冲区，由写入线程按批写入日志并落盘；日志超过阈值时写入线程切换到新的日志文件，
+ * 并在独立的线程中生成快照，快照写完后删除旧的日志。快照是模糊的（生成期间仍有变更），
+ * 由于日志中的变更可以幂等重放，加载快照后重放切换之后的日志即得到最新状态。
+ * 启动时映射快照文件顺序解析，再重放日志
+ */
+class GroupStore {
+public:
+    // 加载时对快照和日志中的每条记录调用，快照中的群组和成员关系分别作为 CREATE 和 JOIN 传入
+    using ReplayFn = std::function<void(GroupLogOp op, std::string_view group, std::string_view user)>;
+
+    // 生成快照时调用，在后台线程中写入当前的全部状态
+    using DumpFn = std::function<void(GroupSnapshotWriter &writer)>;
+
+    explicit GroupStore(std::string dir) : dir(std::move(dir)) {}
+
+    ~GroupStore();
+
+    GroupStore(const GroupStore &) = delete;
+
+    GroupStore &operator=(const GroupStore &) = delete;
+
+    /**
+     * 加载快照并重放日志，之后启动写入线程
+     * @return 是否成功，快照损坏时返回 false
+     */
+    bool Open(const ReplayFn &replay, DumpFn dump);
+
+    // 追加一条变更，可在任意线程调用，不阻塞
+    void Append(GroupLogOp op, std::string_view group, std::string_view user);
+
+    // 等待此前的变更全部落盘，写入失败时一直等到重试成功或存储关闭
+    void Sync();
+
+    // 请求立即在后台生成快照
+    void Compact();
+
+    // 等待正在进行的快照生成结束
+    void WaitCompaction();
+
+    // 完成的快照次数
+    uint64_t Compactions() const { return compactions.load(std::memory_order_relaxed); }
+
+private:
+    std::string WalPath(uint64_t seq) const;
+
+    // 映射并解析快照，返回快照之后的第一个日志序号，没有快照时返回 1
+    bool LoadSnapshot(const ReplayFn &replay, uint64_t &walSeq);
+
+    // 重放一个日志文件，截掉末尾写了一半的记录
+    void ReplayWal(const std::string &path, const ReplayFn &replay);
+
+    void Run();
+
+    // 写入快照，之后删除序号小于 walSeq 的日志
+    void WriteSnapshot(uint64_t walSeq);
+
+    std::string dir;
+    DumpFn dump;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::condition_variable synced;
+    std::string pending;
+    uint64_t syncRequested{0};
+    uint64_t syncDone{0};
+    bool compactRequested{false};
+    bool running{false};
+    std::thread writer;
+    // 以下只由写入线程访问
+    FileHandle wal{INVALID_FILE};
+    uint64_t walSeq{1};
+    uint64_t walBytes{0};    // 自上次切换以来写入日志的字节数
+    uint64_t walSize{0};     // 当前日志文件中完整落盘的字节数，写入失败时截断到这里
+    std::thread compactor;
+    std::atomic<bool> compacting{false};
+    std::atomic<uint64_t> compactions{0};
+};
+
+#endif //ONLINECHAT_GROUPSTORE_H
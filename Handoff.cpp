@@ -0,0 +1,444 @@
+#include "Handoff.h"
+#include "Log.h"
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+
+void HandoffState::CloseSockets() {
+    for (SOCKET s: listeners) closesocket(s);
+    for (SOCKET s: webSocketListeners) closesocket(s);
+    for (const auto &client: clients) {
+        if (client.socket != INVALID_SOCKET) closesocket(client.socket);
+    }
+    listeners.clear();
+    webSocketListeners.clear();
+    clients.clear();
+}
+
+#ifdef _WIN32
+
+// Windows 没有 Unix 域套接字传递描述符的机制，不支持热重启
+SOCKET HandoffListen(const std::string &) { return INVALID_SOCKET; }
+
+SOCKET HandoffAccept(SOCKET) { return INVALID_SOCKET; }
+
+SOCKET HandoffConnect(const std::string &) {
+    LOG_ERROR << "Hot restart is not supported on this platform !";
+    return INVALID_SOCKET;
+}
+
+bool SendHandoff(SOCKET, const HandoffState &) { return false; }
+
+bool ReceiveHandoff(SOCKET, HandoffState &) { return false; }
+
+bool SendHandoffAck(SOCKET) { return false; }
+
+bool WaitHandoffAck(SOCKET, int) { return false; }
+
+bool SendHandoffDecision(SOCKET, bool) { return false; }
+
+bool WaitHandoffCommit(SOCKET) { return false; }
+
+void WaitHandoffClosed(SOCKET) {}
+
+#else
+
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+// 请求、确认和状态开头的标识 "OCHF"，以及状态格式的版本
+#define HANDOFF_MAGIC 0x4F434846u
+#define HANDOFF_VERSION 4u
+// 旧进程等待请求内容和向新进程发送时的超时（毫秒）
+#define HANDOFF_IO_TIMEOUT_MS 5000
+// 旧进程收到确认后的最终答复："OCCM" 表示由新进程服务，"OCAB" 表示旧进程恢复服务
+#define HANDOFF_COMMIT 0x4F43434Du
+#define HANDOFF_ABORT 0x4F434142u
+
+// 状态的二进制编码，两端是同一台机器上的进程，整数按本机字节序
+static void PutU32(std::string &out, uint32_t value) {
+    out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+static void PutU64(std::string &out, uint64_t value) {
+    out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+static void PutString(std::string &out, std::string_view text) {
+    PutU32(out, (uint32_t) text.size());
+    out.append(text);
+}
+
+static void PutStrings(std::string &out, const std::vector<std::string> &items) {
+    PutU32(out, (uint32_t) items.size());
+    for (const auto &item: items) PutString(out, item);
+}
+
+/**
+ * 按顺序解码，越界时记录失败，之后的读取都返回空值
+ */
+class HandoffReader {
+public:
+    explicit HandoffReader(std::string_view data) : data(data) {}
+
+    bool Failed() const { return failed; }
+
+    uint32_t U32() { return Get<uint32_t>(); }
+
+    uint64_t U64() { return Get<uint64_t>(); }
+
+    std::string String() {
+        uint32_t size = U32();
+        if (failed || size > data.size() - pos) {
+            failed = true;
+            return {};
+        }
+        std::string text(data.substr(pos, size));
+        pos += size;
+        return text;
+    }
+
+    void Strings(std::vector<std::string> &items) {
+        uint32_t count = U32();
+        // 每个字符串至少占 4 字节的长度，防止损坏的计数导致大量分配
+        if (failed || count > (data.size() - pos) / sizeof(uint32_t)) {
+            failed = true;
+            return;
+        }
+        items.resize(count);
+        for (auto &item: items) item = String();
+    }
+
+private:
+    template<typename T>
+    T Get() {
+        T value{};
+        if (failed || data.size() - pos < sizeof(T)) {
+            failed = true;
+            return value;
+        }
+        memcpy(&value, data.data() + pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+
+    std::string_view data;
+    size_t pos{0};
+    bool failed{false};
+};
+
+static std::string EncodeState(const HandoffState &state) {
+    std::string out;
+    PutU32(out, HANDOFF_MAGIC);
+    PutU32(out, HANDOFF_VERSION);
+    PutU32(out, (uint32_t) state.listeners.size());
+    PutU32(out, (uint32_t) state.webSocketListeners.size());
+    PutU32(out, (uint32_t) state.clients.size());
+    PutU64(out, state.presenceSeq);
+    PutStrings(out, state.online);
+    PutStrings(out, state.touched);
+    PutStrings(out, state.groups);
+    PutStrings(out, state.multicastGroups);
+    PutU32(out, (uint32_t) state.multicastSeqs.size());
+    for (uint64_t seq: state.multicastSeqs) PutU64(out, seq);
+    for (const auto &client: state.clients) {
+        PutU32(out, (uint32_t) client.shard);
+        PutU32(out, client.addr.sin_addr.s_addr);
+        PutU32(out, client.addr.sin_port);
+        PutU32(out, client.protocol | (uint32_t) client.protocolVersion << 8 | (uint32_t) client.presenceStale << 16 |
+                    (uint32_t) client.heartbeat << 17);
+        PutString(out, client.username);
+        PutString(out, client.input);
+        PutU32(out, client.messageOffset);
+        PutString(out, client.output);
+        PutStrings(out, client.groups);
+        PutU32(out, (uint32_t) client.multicast.size());
+        for (const auto &range: client.multicast) {
+            PutU64(out, range.first);
+            PutU64(out, range.second);
+        }
+    }
+    return out;
+}
+
+static bool DecodeState(std::string_view data, HandoffState &state, uint32_t &listeners,
+                        uint32_t &webSocketListeners) {
+    HandoffReader reader(data);
+    if (reader.U32() != HANDOFF_MAGIC || reader.U32() != HANDOFF_VERSION) return false;
+    listeners = reader.U32();
+    webSocketListeners = reader.U32();
+    uint32_t clients = reader.U32();
+    state.presenceSeq = reader.U64();
+    reader.Strings(state.online);
+    reader.Strings(state.touched);
+    reader.Strings(state.groups);
+    reader.Strings(state.multicastGroups);
+    uint32_t channels = reader.U32();
+    if (reader.Failed() || clients > data.size() || channels > data.size() || listeners > data.size() ||
+        webSocketListeners > data.size()) {
+        return false;
+    }
+    state.multicastSeqs.resize(channels);
+    for (auto &seq: state.multicastSeqs) seq = reader.U64();
+    state.clients.resize(clients);
+    for (auto &client: state.clients) {
+        client.shard = (int) reader.U32();
+        client.addr.sin_family = AF_INET;
+        client.addr.sin_addr.s_addr = reader.U32();
+        client.addr.sin_port = (uint16_t) reader.U32();
+        uint32_t flags = reader.U32();
+        client.protocol = (uint8_t) flags;
+        client.protocolVersion = (uint8_t) (flags >> 8);
+        client.presenceStale = (flags >> 16) & 1;
+        client.heartbeat = (flags >> 17) & 1;
+        client.username = reader.String();
+        client.input = reader.String();
+        client.messageOffset = reader.U32();
+        client.output = reader.String();
+        reader.Strings(client.groups);
+        uint32_t ranges = reader.U32();
+        if (reader.Failed() || ranges > data.size()) return false;
+        client.multicast.resize(ranges);
+        for (auto &range: client.multicast) {
+            range.first = reader.U64();
+            range.second = reader.U64();
+        }
+    }
+    return !reader.Failed();
+}
+
+static bool SendAll(SOCKET s, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t n = send(s, data, size, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        size -= (size_t) n;
+    }
+    return true;
+}
+
+// 只读取 size 字节：后面紧接着携带描述符的消息，多读会丢弃其中的描述符
+static bool ReceiveAll(SOCKET s, char *data, size_t size) {
+    while (size > 0) {
+        ssize_t n = recv(s, data, size, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        size -= (size_t) n;
+    }
+    return true;
+}
+
+static void SetTimeout(SOCKET s, int option, int ms) {
+    timeval timeout{ms / 1000, (ms % 1000) * 1000};
+    setsockopt(s, SOL_SOCKET, option, &timeout, sizeof(timeout));
+}
+
+// 一条消息发送一批描述符，数据部分是本批的数量
+static bool SendFds(SOCKET s, const SOCKET *fds, uint32_t count) {
+    char control[CMSG_SPACE(sizeof(int) * HANDOFF_FDS_PER_MESSAGE)]{};
+    iovec iov{&count, sizeof(count)};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+    while (true) {
+        ssize_t n = sendmsg(s, &msg, 0);
+        if (n < 0 && errno == EINTR) continue;
+        // 描述符随第一个字节送达，数据部分只有 4 字节，流式套接字不会只发送一部分
+        return n == (ssize_t) sizeof(count);
+    }
+}
+
+static bool ReceiveFds(SOCKET s, std::vector<SOCKET> &fds) {
+    uint32_t count = 0;
+    char control[CMSG_SPACE(sizeof(int) * HANDOFF_FDS_PER_MESSAGE)];
+    iovec iov{&count, sizeof(count)};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t n;
+    do {
+        n = recvmsg(s, &msg, 0);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) return false;
+    size_t before = fds.size();
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+        size_t received = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const auto *data = reinterpret_cast<const int *>(CMSG_DATA(cmsg));
+        for (size_t i = 0; i < received; i++) {
+            int fd;
+            memcpy(&fd, data + i, sizeof(fd));
+            fds.push_back(fd);
+        }
+    }
+    if (msg.msg_flags & MSG_CTRUNC) {
+        // 描述符数达到进程上限时内核丢弃放不下的描述符
+        LOG_ERROR << "Handoff sockets were truncated, raise the open file limit (ulimit -n).";
+        return false;
+    }
+    if (n < (ssize_t) sizeof(count) && !ReceiveAll(s, reinterpret_cast<char *>(&count) + n, sizeof(count) - n)) {
+        return false;
+    }
+    return fds.size() - before == count;
+}
+
+static bool MakeAddress(const std::string &path, sockaddr_un &addr) {
+    addr = sockaddr_un{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        LOG_ERROR << "Handoff socket path is too long: " << path;
+        return false;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+SOCKET HandoffListen(const std::string &path) {
+    sockaddr_un addr;
+    if (!MakeAddress(path, addr)) return INVALID_SOCKET;
+    SOCKET s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s == INVALID_SOCKET) return INVALID_SOCKET;
+    // 接管时新进程也会删除旧进程的路径再监听，旧进程之后只通过已建立的连接通信
+    unlink(path.c_str());
+    if (bind(s, (sockaddr *) &addr, sizeof(addr)) != 0 || listen(s, 4) != 0) {
+        LOG_ERROR << "Handoff listen failed on " << path << " with error: " << errno;
+        closesocket(s);
+        return INVALID_SOCKET;
+    }
+    // 只允许同一用户的进程接管
+    chmod(path.c_str(), 0600);
+    return s;
+}
+
+SOCKET HandoffAccept(SOCKET listener) {
+    while (true) {
+        SOCKET conn = accept(listener, nullptr, nullptr);
+        if (conn == INVALID_SOCKET) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            return INVALID_SOCKET;
+        }
+        SetTimeout(conn, SO_RCVTIMEO, HANDOFF_IO_TIMEOUT_MS);
+        SetTimeout(conn, SO_SNDTIMEO, HANDOFF_IO_TIMEOUT_MS);
+        uint32_t request[2];
+        if (ReceiveAll(conn, reinterpret_cast<char *>(request), sizeof(request)) &&
+            request[0] == HANDOFF_MAGIC && request[1] == HANDOFF_VERSION) {
+            return conn;
+        }
+        LOG_WARN << "Ignored an invalid handoff request.";
+        closesocket(conn);
+    }
+}
+
+SOCKET HandoffConnect(const std::string &path) {
+    sockaddr_un addr;
+    if (!MakeAddress(path, addr)) return INVALID_SOCKET;
+    SOCKET s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s == INVALID_SOCKET) return INVALID_SOCKET;
+    // 旧进程导出状态前要等待存储落盘，留出足够的时间
+    SetTimeout(s, SO_RCVTIMEO, HANDOFF_ACK_TIMEOUT_MS);
+    uint32_t request[2] = {HANDOFF_MAGIC, HANDOFF_VERSION};
+    if (connect(s, (sockaddr *) &addr, sizeof(addr)) != 0 ||
+        !SendAll(s, reinterpret_cast<const char *>(request), sizeof(request))) {
+        LOG_ERROR << "Cannot reach the running server on " << path << " with error: " << errno;
+        closesocket(s);
+        return INVALID_SOCKET;
+    }
+    return s;
+}
+
+bool SendHandoff(SOCKET conn, const HandoffState &state) {
+    std::string encoded = EncodeState(state);
+    uint64_t size = encoded.size();
+    if (!SendAll(conn, reinterpret_cast<const char *>(&size), sizeof(size)) ||
+        !SendAll(conn, encoded.data(), encoded.size())) {
+        return false;
+    }
+    // 先发监听套接字和 WebSocket 监听套接字，再按状态中的顺序发送连接
+    std::vector<SOCKET> fds(state.listeners);
+    fds.insert(fds.end(), state.webSocketListeners.begin(), state.webSocketListeners.end());
+    fds.reserve(fds.size() + state.clients.size());
+    for (const auto &client: state.clients) fds.push_back(client.socket);
+    for (size_t i = 0; i < fds.size(); i += HANDOFF_FDS_PER_MESSAGE) {
+        auto count = (uint32_t) std::min<size_t>(HANDOFF_FDS_PER_MESSAGE, fds.size() - i);
+        if (!SendFds(conn, fds.data() + i, count)) return false;
+    }
+    return true;
+}
+
+bool ReceiveHandoff(SOCKET conn, HandoffState &state) {
+    uint64_t size = 0;
+    if (!ReceiveAll(conn, reinterpret_cast<char *>(&size), sizeof(size))) {
+        LOG_ERROR << "The running server refused the handoff.";
+        return false;
+    }
+    std::string encoded(size, '\0');
+    uint32_t listeners = 0, webSocketListeners = 0;
+    if (!ReceiveAll(conn, encoded.data(), encoded.size()) ||
+        !DecodeState(encoded, state, listeners, webSocketListeners)) {
+        LOG_ERROR << "Invalid handoff state.";
+        return false;
+    }
+    std::vector<SOCKET> fds;
+    size_t sockets = listeners + webSocketListeners;
+    size_t total = sockets + state.clients.size();
+    fds.reserve(total);
+    bool ok = true;
+    while (ok && fds.size() < total) ok = ReceiveFds(conn, fds);
+    if (!ok || fds.size() != total) {
+        LOG_ERROR << "Received " << fds.size() << " of " << total << " handoff sockets.";
+        for (SOCKET s: fds) closesocket(s);
+        state.clients.clear();
+        return false;
+    }
+    state.listeners.assign(fds.begin(), fds.begin() + listeners);
+    state.webSocketListeners.assign(fds.begin() + listeners, fds.begin() + (long) sockets);
+    for (size_t i = 0; i < state.clients.size(); i++) state.clients[i].socket = fds[sockets + i];
+    return true;
+}
+
+bool SendHandoffAck(SOCKET conn) {
+    uint32_t ack = HANDOFF_MAGIC;
+    return SendAll(conn, reinterpret_cast<const char *>(&ack), sizeof(ack));
+}
+
+bool WaitHandoffAck(SOCKET conn, int timeoutMs) {
+    pollfd pfd{conn, POLLIN, 0};
+    if (poll(&pfd, 1, timeoutMs) <= 0) return false;
+    uint32_t ack = 0;
+    return ReceiveAll(conn, reinterpret_cast<char *>(&ack), sizeof(ack)) && ack == HANDOFF_MAGIC;
+}
+
+bool SendHandoffDecision(SOCKET conn, bool commit) {
+    uint32_t decision = commit ? HANDOFF_COMMIT : HANDOFF_ABORT;
+    return SendAll(conn, reinterpret_cast<const char *>(&decision), sizeof(decision));
+}
+
+bool WaitHandoffCommit(SOCKET conn) {
+    // 旧进程收到确认后立即答复，超时前已放弃时答复早已在缓冲区中，连接的接收超时足够
+    uint32_t decision = 0;
+    return ReceiveAll(conn, reinterpret_cast<char *>(&decision), sizeof(decision)) && decision == HANDOFF_COMMIT;
+}
+
+void WaitHandoffClosed(SOCKET conn) {
+    // 丢弃迟到的确认，接收超时只是让循环继续等待
+    char buffer[16];
+    while (true) {
+        ssize_t n = recv(conn, buffer, sizeof(buffer), 0);
+        if (n == 0) return;
+        if (n < 0 && errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) return;
+    }
+}
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef ONLINECHAT_HANDOFF_H
+#define ONLINECHAT_HANDOFF_H
+
+#include "Platform.h"
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// 旧进程等待接管请求的 Unix 域套接字路径，按服务端口区分
+#define HANDOFF_PATH_FORMAT "/tmp/onlinechat-%d.sock"
+// 每条消息携带的描述符数，低于内核 SCM_MAX_FD 的限制
+#define HANDOFF_FDS_PER_MESSAGE 250
+// 旧进程等待新进程确认接管的最长时间（毫秒），超时后恢复服务
+#define HANDOFF_ACK_TIMEOUT_MS 30000
+
+/**
+ * 一个被移交的连接：套接字和需要在新进程中恢复的状态
+ */
+struct HandoffClient {
+    SOCKET socket{INVALID_SOCKET};
+    int shard{};                      // 所属分片，新进程放入同一分片
+    sockaddr_in addr{};
+    uint8_t protocol{};               // ProtocolMode
+    uint8_t protocolVersion{};
+    bool presenceStale{};
+    bool heartbeat{};                 // 客户端会回复服务器的 PING
+    std::string username;
+    std::string input;                // 已读取但尚未处理的数据（不完整的命令或暂停读取期间缓冲的命令）
+    uint32_t messageOffset{};         // input 开头的 WebSocket 消息中已处理的命令字节数
+    std::string output;               // 尚未发出的数据，从队首帧的发送进度开始
+    std::vector<std::string> groups;  // 连接加入的群组
+    std::vector<std::pair<uint64_t, uint64_t>> multicast; // 与 groups 对应的组播序列号范围 [from, until)
+};
+
+/**
+ * 旧进程交给新进程的全部状态
+ */
+struct HandoffState {
+    std::vector<SOCKET> listeners;    // 每个分片一个监听套接字，新进程使用相同的分片数
+    std::vector<SOCKET> webSocketListeners; // 每个分片一个 WebSocket 监听套接字，未启用时为空
+    std::vector<HandoffClient> clients;
+    uint64_t presenceSeq{};
+    std::vector<std::string> online;  // 已发布的在线用户
+    std::vector<std::string> touched; // 尚未发布的在线状态变更
+    std::vector<std::string> groups;  // 旧进程没有持久化群组时传递所有群组名，否则新进程从数据目录加载
+    std::vector<std::string> multicastGroups; // 有组播通道的群组及其已分配的最后一个序列号
+    std::vector<uint64_t> multicastSeqs;
+
+    // 关闭所有套接字，接管失败时使用
+    void CloseSockets();
+};
+
+/**
+ * 热重启：新进程连接旧进程监听的 Unix 域套接字并发出请求，旧进程停止事件循环后
+ * 把监听套接字和所有连接通过 SCM_RIGHTS 传给新进程，连接状态序列化后随之发送。
+ * 描述符在两个进程中指向同一个打开的套接字，旧进程关闭自己的副本不会断开连接，
+ * 客户端察觉不到切换。新进程恢复所有连接后回复确认，旧进程收到确认后退出，
+ * 未收到确认（新进程启动失败）时恢复服务
+ */
+
+/**
+ * 旧进程：在路径上监听接管请求，先删除上次运行遗留的路径
+ * @return 监听套接字，失败时返回 INVALID_SOCKET
+ */
+SOCKET HandoffListen(const std::string &path);
+
+/**
+ * 旧进程：阻塞等待下一个合法的接管请求
+ * @return 与新进程的连接，监听套接字出错时返回 INVALID_SOCKET
+ */
+SOCKET HandoffAccept(SOCKET listener);
+
+/**
+ * 新进程：连接旧进程并发出接管请求
+ * @return 与旧进程的连接，失败时返回 INVALID_SOCKET
+ */
+SOCKET HandoffConnect(const std::string &path);
+
+/**
+ * 旧进程：发送全部状态和套接字
+ * @return 是否发送成功
+ */
+bool SendHandoff(SOCKET conn, const HandoffState &state);
+
+/**
+ * 新进程：接收全部状态和套接字，失败时已收到的套接字被关闭
+ * @return 是否接收成功
+ */
+bool ReceiveHandoff(SOCKET conn, HandoffState &state);
+
+// 新进程：恢复所有连接后确认接管，此后仍要等旧进程答复才能开始服务
+bool SendHandoffAck(SOCKET conn);
+
+/**
+ * 旧进程：等待新进程确认接管
+ * @return 在超时前收到确认时返回 true
+ */
+bool WaitHandoffAck(SOCKET conn, int timeoutMs);
+
+/**
+ * 旧进程：给出最终答复，之后不再改变。答复由新进程服务后旧进程退出；
+ * 放弃时旧进程须等新进程退出（WaitHandoffClosed）后才恢复服务，保证任何时刻只有一个进程处理连接和写数据目录
+ * @param commit 是否由新进程服务
+ * @return 是否发送成功
+ */
+bool SendHandoffDecision(SOCKET conn, bool commit);
+
+/**
+ * 新进程：确认接管后等待旧进程的答复
+ * @return 旧进程答复由新进程服务时返回 true，否则新进程须直接退出，不处理任何连接
+ */
+bool WaitHandoffCommit(SOCKET conn);
+
+// 旧进程：放弃移交后等待新进程关闭连接（即退出），不设超时
+void WaitHandoffClosed(SOCKET conn);
+
+#endif //ONLINECHAT_HANDOFF_H
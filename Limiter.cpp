@@ -0,0 +1,76 @@
+#include "Limiter.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+int TokenBucket::Check(const RateLimit &limit, double cost, uint64_t nowMs) {
+    if (limit.rate <= 0) return 0;
+    if (lastMs == 0) {
+        tokens = limit.burst;
+    } else if (nowMs > lastMs) {
+        tokens = std::min(limit.burst, tokens + (double) (nowMs - lastMs) * limit.rate / 1000);
+    }
+    lastMs = std::max(lastMs, nowMs);
+    double need = std::min(cost, limit.burst);
+    if (tokens >= need) return 0;
+    return std::max(1, (int) std::ceil((need - tokens) * 1000 / limit.rate));
+}
+
+UserLimiter::UserLimiter() : stripes(new Stripe[LIMITER_STRIPES]) {}
+
+int UserLimiter::Take(const std::string &username, const Limits &limits, double messages, double bytes,
+                      uint64_t nowMs) {
+    if (limits.userMessages.rate <= 0 && limits.userBytes.rate <= 0) return 0;
+    Stripe &stripe = stripes[std::hash<std::string>()(username) % LIMITER_STRIPES];
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    if (stripe.users.size() >= stripe.sweepAt) {
+        // 补满的令牌桶与新建的相同，删除后不影响限制
+        for (auto it = stripe.users.begin(); it != stripe.users.end();) {
+            if (it->second.messages.Full(limits.userMessages) && it->second.bytes.Full(limits.userBytes)) {
+                it = stripe.users.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        stripe.sweepAt = std::max<size_t>(1024, stripe.users.size() * 2);
+    }
+    Buckets &buckets = stripe.users[username];
+    int waitMs = std::max(buckets.messages.Check(limits.userMessages, messages, nowMs),
+                          buckets.bytes.Check(limits.userBytes, bytes, nowMs));
+    if (waitMs > 0) return waitMs;
+    buckets.messages.Take(messages);
+    buckets.bytes.Take(bytes);
+    return 0;
+}
+
+Admission::Admission() : stripes(new Stripe[LIMITER_STRIPES]) {}
+
+Admission::Result Admission::Check(const sockaddr_in &addr, const Limits &limits) {
+    if (limits.maxPendingHandshakes > 0 && Pending() >= limits.maxPendingHandshakes) return Result::TooManyPending;
+    if (limits.maxConnectionsPerIp <= 0 || IsLoopback(addr)) return Result::Accepted;
+    uint32_t ip = addr.sin_addr.s_addr;
+    Stripe &stripe = StripeOf(ip);
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    auto it = stripe.connections.find(ip);
+    if (it != stripe.connections.end() && it->second >= limits.maxConnectionsPerIp) return Result::TooManyFromIp;
+    return Result::Accepted;
+}
+
+void Admission::Add(const sockaddr_in &addr, bool pendingHandshake) {
+    if (pendingHandshake) pending.fetch_add(1, std::memory_order_relaxed);
+    if (IsLoopback(addr)) return;
+    uint32_t ip = addr.sin_addr.s_addr;
+    Stripe &stripe = StripeOf(ip);
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    stripe.connections[ip]++;
+}
+
+void Admission::Release(const sockaddr_in &addr, bool pendingHandshake) {
+    if (pendingHandshake) pending.fetch_sub(1, std::memory_order_relaxed);
+    if (IsLoopback(addr)) return;
+    uint32_t ip = addr.sin_addr.s_addr;
+    Stripe &stripe = StripeOf(ip);
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    auto it = stripe.connections.find(ip);
+    if (it != stripe.connections.end() && --it->second <= 0) stripe.connections.erase(it);
+}
@@ -0,0 +1,149 @@
+#ifndef ONLINECHAT_LIMITER_H
+#define ONLINECHAT_LIMITER_H
+
+#include "Platform.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// 每个连接每秒投递的消息数和突发量，群组消息按成员数计，其它命令各计一条
+#define CONN_MESSAGE_RATE 5000
+#define CONN_MESSAGE_BURST 20000
+// 每个连接每秒投递的字节数和突发量，群组消息按成员数计
+#define CONN_BYTE_RATE (4 * 1024 * 1024)
+#define CONN_BYTE_BURST (16 * 1024 * 1024)
+// 同一用户名的所有连接合计的限制
+#define USER_MESSAGE_RATE 10000
+#define USER_MESSAGE_BURST 50000
+#define USER_BYTE_RATE (8 * 1024 * 1024)
+#define USER_BYTE_BURST (32 * 1024 * 1024)
+// 所有分片合计尚未完成握手的连接数上限
+#define MAX_PENDING_HANDSHAKES 10000
+// 每个远端IP的连接数上限，本机地址（反向代理、测试）不受限制
+#define MAX_CONNECTIONS_PER_IP 256
+// 用户令牌桶和IP计数的分段数
+#define LIMITER_STRIPES 64
+
+// 令牌桶的速率（每秒）和容量，速率为 0 表示不限制
+struct RateLimit {
+    double rate{};
+    double burst{};
+};
+
+/**
+ * 服务器的速率限制和连接准入参数，数值为 0 表示不限制
+ */
+struct Limits {
+    RateLimit connMessages{CONN_MESSAGE_RATE, CONN_MESSAGE_BURST};
+    RateLimit connBytes{CONN_BYTE_RATE, CONN_BYTE_BURST};
+    RateLimit userMessages{USER_MESSAGE_RATE, USER_MESSAGE_BURST};
+    RateLimit userBytes{USER_BYTE_RATE, USER_BYTE_BURST};
+    int maxPendingHandshakes{MAX_PENDING_HANDSHAKES};
+    int maxConnectionsPerIp{MAX_CONNECTIONS_PER_IP};
+
+    // 全部不限制，用于测量服务器本身吞吐量的测试
+    static Limits Unlimited() { return Limits{{}, {}, {}, {}, 0, 0}; }
+};
+
+/**
+ * 令牌桶：按速率持续补充令牌，最多积累到容量。代价超过容量的操作（例如向大群组发送消息）
+ * 在桶满时允许并把令牌扣成负数，之后的操作等待补齐欠账，长期速率仍不超过限制。
+ * 不加锁，由调用方保证同一时间只有一个线程使用
+ */
+class TokenBucket {
+public:
+    /**
+     * 补充令牌后检查能否扣除 cost
+     * @return 0 表示可以扣除，否则为需要等待的毫秒数
+     */
+    int Check(const RateLimit &limit, double cost, uint64_t nowMs);
+
+    // 扣除令牌，先调用 Check
+    void Take(double cost) { tokens -= cost; }
+
+    // 令牌已补满，可以丢弃
+    bool Full(const RateLimit &limit) const { return tokens >= limit.burst; }
+
+private:
+    double tokens{};
+    uint64_t lastMs{};  // 上次补充的时间，0 表示尚未使用，首次使用时桶是满的
+};
+
+/**
+ * 按用户名的令牌桶，所有分片共享，按用户名分段加锁。
+ * 令牌已补满的用户在分段增长时被清理，内存只与最近活跃的用户数有关
+ */
+class UserLimiter {
+public:
+    UserLimiter();
+
+    /**
+     * 同时检查用户的消息数和字节数，两者都足够时才扣除
+     * @return 0 表示已扣除，否则为需要等待的毫秒数
+     */
+    int Take(const std::string &username, const Limits &limits, double messages, double bytes, uint64_t nowMs);
+
+private:
+    struct Buckets {
+        TokenBucket messages;
+        TokenBucket bytes;
+    };
+
+    struct alignas(64) Stripe {
+        std::mutex mutex;
+        std::unordered_map<std::string, Buckets> users;
+        size_t sweepAt{1024};  // 用户数达到该值时清理令牌已补满的用户
+    };
+
+    std::unique_ptr<Stripe[]> stripes;
+};
+
+/**
+ * 连接准入：在 accept 之后、分配连接对象之前判断是否接受，超过限制的连接立即重置，
+ * 不为它分配任何资源。限制所有分片合计的握手中连接数和每个远端IP的连接数。
+ * 检查和计数分开进行，多个分片同时接受时最多超出分片数个连接
+ */
+class Admission {
+public:
+    // 检查的结果
+    enum class Result {
+        Accepted, TooManyPending, TooManyFromIp
+    };
+
+    Admission();
+
+    // 判断是否接受来自该地址的新连接
+    Result Check(const sockaddr_in &addr, const Limits &limits);
+
+    // 计入已接受或热重启接管的连接
+    void Add(const sockaddr_in &addr, bool pendingHandshake);
+
+    // 连接完成握手
+    void HandshakeDone() { pending.fetch_sub(1, std::memory_order_relaxed); }
+
+    // 连接关闭
+    void Release(const sockaddr_in &addr, bool pendingHandshake);
+
+    // 当前握手中的连接数
+    int Pending() const { return pending.load(std::memory_order_relaxed); }
+
+private:
+    struct alignas(64) Stripe {
+        std::mutex mutex;
+        std::unordered_map<uint32_t, int> connections;
+    };
+
+    // 地址是网络字节序，先打散再取分段
+    Stripe &StripeOf(uint32_t ip) { return stripes[((ip * 2654435761u) >> 16) % LIMITER_STRIPES]; }
+
+    // 本机地址不计数
+    static bool IsLoopback(const sockaddr_in &addr) { return (ntohl(addr.sin_addr.s_addr) >> 24) == 127; }
+
+    std::atomic<int> pending{0};
+    std::unique_ptr<Stripe[]> stripes;
+};
+
+#endif //ONLINECHAT_LIMITER_H
@@ -0,0 +1,232 @@
+#include "Log.h"
+#include "Mailbox.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * 一个线程的日志队列。线程结束后队列标记为退役，由写入线程取完剩余日志后释放
+ */
+struct ThreadLog {
+    SpscQueue<LogRecord> queue{LOG_QUEUE_CAPACITY};
+    std::string name;
+    std::atomic<uint64_t> dropped{0};  // 队列满时丢弃的条数
+    std::atomic<bool> retired{false};
+};
+
+/**
+ * 后台写入线程：每隔 LOG_FLUSH_INTERVAL_MS 取出所有线程队列中的日志，
+ * 格式化为带时间、级别和线程名的行后一次写出
+ */
+class LogWriter {
+public:
+    LogWriter() {
+        std::thread([this]() { Run(); }).detach();
+        // 正常退出时写出剩余日志
+        std::atexit([]() { Logger::Flush(); });
+    }
+
+    ThreadLog *Register(const std::string &name) {
+        auto *log = new ThreadLog;
+        log->name = name.empty() ? "thread-" + std::to_string(nextThread++) : name;
+        std::lock_guard<std::mutex> lock(mutex);
+        logs.push_back(log);
+        return log;
+    }
+
+    void Flush() {
+        std::unique_lock<std::mutex> lock(mutex);
+        uint64_t target = ++flushRequested;
+        wakeup.notify_one();
+        // fork 出的子进程没有写入线程，限时等待避免退出时卡住
+        flushed.wait_for(lock, std::chrono::seconds(1), [&]() { return flushDone >= target; });
+    }
+
+private:
+    void Run() {
+        std::string out, err;
+        std::vector<ThreadLog *> snapshot;
+        while (true) {
+            uint64_t requested;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                requested = flushRequested;
+                // 释放已退役且取空的队列
+                for (size_t i = 0; i < logs.size();) {
+                    if (logs[i]->retired.load(std::memory_order_acquire) && logs[i]->queue.Empty()) {
+                        delete logs[i];
+                        logs[i] = logs.back();
+                        logs.pop_back();
+                    } else {
+                        i++;
+                    }
+                }
+                snapshot = logs;
+            }
+            for (ThreadLog *log: snapshot) Drain(log, out, err);
+            if (!out.empty()) {
+                fwrite(out.data(), 1, out.size(), stdout);
+                fflush(stdout);
+                out.clear();
+            }
+            if (!err.empty()) {
+                fwrite(err.data(), 1, err.size(), stderr);
+                fflush(stderr);
+                err.clear();
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            if (flushDone < requested) {
+                flushDone = requested;
+                flushed.notify_all();
+            }
+            wakeup.wait_for(lock, std::chrono::milliseconds(LOG_FLUSH_INTERVAL_MS),
+                            [&]() { return flushRequested != flushDone; });
+        }
+    }
+
+    void Drain(ThreadLog *log, std::string &out, std::string &err) {
+        LogRecord record;
+        while (log->queue.TryPop(record)) {
+            Format(record, log->name, record.level >= LOG_LEVEL_WARN ? err : out);
+        }
+        uint64_t dropped = log->dropped.exchange(0, std::memory_order_relaxed);
+        if (dropped > 0) {
+            LogRecord notice;
+            notice.timeUs = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count();
+            notice.level = LOG_LEVEL_WARN;
+            notice.length = (uint16_t) snprintf(notice.text, sizeof(notice.text), "%llu log lines dropped",
+                                                (unsigned long long) dropped);
+            Format(notice, log->name, err);
+        }
+    }
+
+    // 格式化为 "2024-01-01 12:00:00.123456 INFO  [shard-0] 内容"，同一秒内复用日期部分
+    void Format(const LogRecord &record, const std::string &thread, std::string &out) {
+        static const char *names[] = {"DEBUG", "INFO ", "WARN ", "ERROR"};
+        time_t seconds = (time_t) (record.timeUs / 1000000);
+        if (seconds != cachedSecond) {
+            tm local{};
+#ifdef _WIN32
+            localtime_s(&local, &seconds);
+#else
+            localtime_r(&seconds, &local);
+#endif
+            strftime(cachedPrefix, sizeof(cachedPrefix), "%Y-%m-%d %H:%M:%S", &local);
+            cachedSecond = seconds;
+        }
+        char head[64];
+        int n = snprintf(head, sizeof(head), "%s.%06d %s [", cachedPrefix, (int) (record.timeUs % 1000000),
+                         names[record.level < LOG_LEVEL_OFF ? record.level : LOG_LEVEL_ERROR]);
+        out.append(head, n);
+        out += thread;
+        out += "] ";
+        out.append(record.text, record.length);
+        out += '\n';
+    }
+
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::condition_variable flushed;
+    std::vector<ThreadLog *> logs;
+    std::atomic<int> nextThread{0};
+    uint64_t flushRequested{0};
+    uint64_t flushDone{0};
+    // 以下只在写入线程中使用
+    time_t cachedSecond{-1};
+    char cachedPrefix[32]{};
+};
+
+// 写入线程永不析构：其它线程可能在静态对象析构之后仍在记录日志
+static LogWriter &Writer() {
+    static auto *writer = new LogWriter;
+    return *writer;
+}
+
+/**
+ * 当前线程的日志队列，第一次记录日志时创建，线程结束时标记为退役
+ */
+struct ThreadLogHandle {
+    ThreadLog *log{};
+    std::string name;
+
+    ThreadLog *Get() {
+        if (log == nullptr) log = Writer().Register(name);
+        return log;
+    }
+
+    ~ThreadLogHandle() {
+        if (log) log->retired.store(true, std::memory_order_release);
+    }
+};
+
+static thread_local ThreadLogHandle threadLog;
+static thread_local uint32_t sampleCounter = 0;
+static std::atomic<int> sampleEvery{1};
+
+void Logger::SetSampleEvery(int every) {
+    sampleEvery.store(every < 1 ? 1 : every, std::memory_order_relaxed);
+}
+
+bool Logger::Sample() {
+    int every = sampleEvery.load(std::memory_order_relaxed);
+    return every <= 1 || ++sampleCounter % (uint32_t) every == 0;
+}
+
+void Logger::SetThreadName(const std::string &name) {
+    threadLog.name = name;
+}
+
+void Logger::Submit(LogRecord &record) {
+    ThreadLog *log = threadLog.Get();
+    if (!log->queue.TryPush(std::move(record))) {
+        log->dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void Logger::Flush() {
+    Writer().Flush();
+}
+
+bool Logger::ParseLevel(std::string_view name, LogLevel &level) {
+    static const std::pair<const char *, LogLevel> levels[] = {
+            {"debug", LOG_LEVEL_DEBUG},
+            {"info",  LOG_LEVEL_INFO},
+            {"warn",  LOG_LEVEL_WARN},
+            {"error", LOG_LEVEL_ERROR},
+            {"off",   LOG_LEVEL_OFF},
+    };
+    for (const auto &entry: levels) {
+        if (name == entry.first) {
+            level = entry.second;
+            return true;
+        }
+    }
+    return false;
+}
+
+LogLine::LogLine(LogLevel level) {
+    record.level = level;
+    record.timeUs = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void LogLine::Append(const char *data, size_t len) {
+    size_t room = sizeof(record.text) - record.length;
+    if (len > room) {
+        // 截断并以省略号结尾
+        memcpy(record.text + record.length, data, room);
+        record.length = sizeof(record.text);
+        memcpy(record.text + sizeof(record.text) - 3, "...", 3);
+        return;
+    }
+    memcpy(record.text + record.length, data, len);
+    record.length += (uint16_t) len;
+}
@@ -0,0 +1,136 @@
+#ifndef ONLINECHAT_LOG_H
+#define ONLINECHAT_LOG_H
+
+#include <atomic>
+#include <charconv>
+#include <concepts>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// 一条日志的最大长度，超出部分被截断
+#define LOG_LINE_MAX 240
+// 每个线程的日志队列容量（条），写入线程跟不上时新的日志被丢弃并计数
+#define LOG_QUEUE_CAPACITY 1024
+// 写入线程没有日志时的等待间隔（毫秒）
+#define LOG_FLUSH_INTERVAL_MS 10
+
+enum LogLevel : uint8_t {
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_OFF
+};
+
+/**
+ * 一条已格式化的日志，在产生日志的线程中写入队列，由写入线程输出
+ */
+struct LogRecord {
+    int64_t timeUs{};    // 产生时间（系统时钟微秒）
+    LogLevel level{LOG_LEVEL_INFO};
+    uint16_t length{};
+    char text[LOG_LINE_MAX];
+};
+
+/**
+ * 异步日志：每个线程把日志写入自己的无锁单生产者单消费者队列，
+ * 后台写入线程定期取出所有队列中的日志，按批写入标准输出（WARN 及以上写入标准错误）。
+ * 产生日志的线程从不阻塞，队列满时丢弃日志并在之后输出丢弃的条数
+ */
+class Logger {
+public:
+    // 级别是否输出，级别关闭时日志的参数不会被求值
+    static bool Enabled(LogLevel level) { return level >= minLevel.load(std::memory_order_relaxed); }
+
+    static void SetLevel(LogLevel level) { minLevel.store(level, std::memory_order_relaxed); }
+
+    static LogLevel Level() { return minLevel.load(std::memory_order_relaxed); }
+
+    /**
+     * 设置逐条消息日志（LOG_SAMPLED）的采样间隔
+     * @param every 每个线程每 every 条输出一条，1 表示全部输出
+     */
+    static void SetSampleEvery(int every);
+
+    // 按采样间隔决定本条逐条消息日志是否输出
+    static bool Sample();
+
+    // 设置当前线程在日志中的名称，须在该线程记录第一条日志之前调用
+    static void SetThreadName(const std::string &name);
+
+    // 把日志加入当前线程的队列
+    static void Submit(LogRecord &record);
+
+    // 等待此前产生的日志全部写出
+    static void Flush();
+
+    /**
+     * 解析级别名称（debug、info、warn、error、off）
+     * @return 名称是否有效
+     */
+    static bool ParseLevel(std::string_view name, LogLevel &level);
+
+private:
+    static inline std::atomic<LogLevel> minLevel{LOG_LEVEL_INFO};
+};
+
+/**
+ * 正在格式化的一条日志，直接写入定长缓冲区，不分配内存，析构时提交
+ */
+class LogLine {
+public:
+    explicit LogLine(LogLevel level);
+
+    ~LogLine() { Logger::Submit(record); }
+
+    LogLine(const LogLine &) = delete;
+
+    LogLine &operator=(const LogLine &) = delete;
+
+    LogLine &operator<<(std::string_view text) {
+        Append(text.data(), text.size());
+        return *this;
+    }
+
+    LogLine &operator<<(const char *text) { return *this << std::string_view(text); }
+
+    LogLine &operator<<(const std::string &text) { return *this << std::string_view(text); }
+
+    LogLine &operator<<(char c) {
+        Append(&c, 1);
+        return *this;
+    }
+
+    template<std::integral T>
+    LogLine &operator<<(T value) {
+        char buf[24];
+        auto result = std::to_chars(buf, buf + sizeof(buf), value);
+        Append(buf, result.ptr - buf);
+        return *this;
+    }
+
+private:
+    void Append(const char *data, size_t len);
+
+    LogRecord record;
+};
+
+/**
+ * 把格式化完成的日志表达式变为 void，使日志宏是一个完整的条件表达式而不是 if 语句，
+ * 用在没有花括号的 if/else 中不会吞掉外层的 else。& 的优先级低于 <<，所有参数先写入 LogLine
+ */
+struct LogVoidify {
+    void operator&(const LogLine &) const {}
+};
+
+// 按级别输出一条日志，用法与输出流相同：LOG_INFO << "text " << value;
+#define LOG(level) !Logger::Enabled(level) ? (void) 0 : LogVoidify() & LogLine(level)
+// 逐条消息的日志，额外按采样间隔输出
+#define LOG_SAMPLED(level) !Logger::Enabled(level) || !Logger::Sample() ? (void) 0 : LogVoidify() & LogLine(level)
+#define LOG_DEBUG LOG(LOG_LEVEL_DEBUG)
+#define LOG_INFO LOG(LOG_LEVEL_INFO)
+#define LOG_WARN LOG(LOG_LEVEL_WARN)
+#define LOG_ERROR LOG(LOG_LEVEL_ERROR)
+
+#endif //ONLINECHAT_LOG_H
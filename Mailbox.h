@@ -0,0 +1,77 @@
+#ifndef ONLINECHAT_MAILBOX_H
+#define ONLINECHAT_MAILBOX_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+/**
+ * 有界单生产者单消费者无锁队列，用于分片之间传递消息。
+ * 每对(源分片, 目标分片)各使用一个队列，因此入队和出队都不需要加锁
+ */
+template<typename T>
+class SpscQueue {
+public:
+    /**
+     * @param capacity 队列容量，会向上取整为2的幂
+     */
+    explicit SpscQueue(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    SpscQueue(const SpscQueue &) = delete;
+
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    // 入队，只能由生产者线程调用。队列已满时返回 false，item 保持不变
+    bool TryPush(T &&item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - cachedHead > mask) {
+            cachedHead = head.load(std::memory_order_acquire);
+            if (t - cachedHead > mask) return false;
+        }
+        slots[t & mask] = std::move(item);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 出队，只能由消费者线程调用。队列为空时返回 false
+    bool TryPop(T &item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == cachedTail) {
+            cachedTail = tail.load(std::memory_order_acquire);
+            if (h == cachedTail) return false;
+        }
+        item = std::move(slots[h & mask]);
+        slots[h & mask] = T();
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 队列是否为空，任意线程都可以调用
+    bool Empty() const {
+        return head.load(std::memory_order_seq_cst) == tail.load(std::memory_order_seq_cst);
+    }
+
+    // 队列中的消息数，任意线程都可以调用，并发读写时为近似值
+    size_t Size() const {
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t t = tail.load(std::memory_order_relaxed);
+        return t > h ? t - h : 0;
+    }
+
+private:
+    std::vector<T> slots;
+    size_t mask{};
+    // 生产者和消费者各自的下标放在不同的缓存行，避免伪共享
+    alignas(64) std::atomic<size_t> head{0};
+    size_t cachedTail{0};  // 消费者缓存的 tail
+    alignas(64) std::atomic<size_t> tail{0};
+    size_t cachedHead{0};  // 生产者缓存的 head
+};
+
+#endif //ONLINECHAT_MAILBOX_H
@@ -0,0 +1,453 @@
+#include "MessageStore.h"
+#include "Log.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <utility>
+
+namespace fs = std::filesystem;
+
+/**
+ * 记录格式（主机字节序）：
+ *   u32 长度（不含长度字段本身） | u32 校验和（其后所有字节） | u64 序列号 | i64 时间（毫秒） | u64 引用序列号 |
+ *   u32 发送者长度 | 发送者 | 消息内容
+ */
+#define RECORD_HEADER_SIZE 36
+
+// FNV-1a 校验和，用于在恢复时识别写了一半的记录
+static uint32_t Checksum(const char *data, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char) data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+template<typename T>
+static char *Put(char *out, T value) {
+    memcpy(out, &value, sizeof(value));
+    return out + sizeof(value);
+}
+
+template<typename T>
+static T Get(const char *p) {
+    T value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static void EncodeRecord(std::string &out, uint64_t seq, int64_t timeMs, uint64_t ref, std::string_view sender,
+                         std::string_view body) {
+    size_t total = RECORD_HEADER_SIZE + sender.size() + body.size();
+    size_t offset = out.size();
+    out.resize(offset + total);
+    char *p = &out[offset];
+    char *q = Put(p, (uint32_t) (total - 4));
+    q = Put(q, (uint32_t) 0);
+    q = Put(q, seq);
+    q = Put(q, timeMs);
+    q = Put(q, ref);
+    q = Put(q, (uint32_t) sender.size());
+    memcpy(q, sender.data(), sender.size());
+    memcpy(q + sender.size(), body.data(), body.size());
+    Put(p + 4, Checksum(p + 8, total - 8));
+}
+
+/**
+ * 解码一条记录
+ * @param size 成功时为记录的总长度
+ * @return 数据不完整或校验失败时返回 false
+ */
+static bool DecodeRecord(const char *data, size_t len, HistoryEntry &entry, size_t &size) {
+    if (len < RECORD_HEADER_SIZE) return false;
+    size_t total = 4 + (size_t) Get<uint32_t>(data);
+    if (total < RECORD_HEADER_SIZE || total > len) return false;
+    if (Get<uint32_t>(data + 4) != Checksum(data + 8, total - 8)) return false;
+    size_t senderLen = Get<uint32_t>(data + 32);
+    if (senderLen > total - RECORD_HEADER_SIZE) return false;
+    entry.seq = Get<uint64_t>(data + 8);
+    entry.timeMs = Get<int64_t>(data + 16);
+    entry.ref = Get<uint64_t>(data + 24);
+    entry.sender = std::string_view(data + RECORD_HEADER_SIZE, senderLen);
+    entry.body = std::string_view(data + RECORD_HEADER_SIZE + senderLen, total - RECORD_HEADER_SIZE - senderLen);
+    size = total;
+    return true;
+}
+
+MessageLog::~MessageLog() {
+    if (file != INVALID_FILE) CloseFile(file);
+}
+
+std::string MessageLog::SegmentPath(uint64_t firstSeq) const {
+    char name[32];
+    snprintf(name, sizeof(name), "%020llu.log", (unsigned long long) firstSeq);
+    return dir + "/" + name;
+}
+
+bool MessageLog::Open() {
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    if (ec) {
+        LOG_ERROR << "Cannot create message log " << dir << ": " << ec.message();
+        return false;
+    }
+    std::vector<uint64_t> firstSeqs;
+    for (const auto &item: fs::directory_iterator(dir, ec)) {
+        if (item.path().extension() != ".log") continue;
+        firstSeqs.push_back(std::strtoull(item.path().stem().string().c_str(), nullptr, 10));
+    }
+    std::sort(firstSeqs.begin(), firstSeqs.end());
+
+    for (size_t i = 0; i < firstSeqs.size(); i++) {
+        Segment segment;
+        segment.firstSeq = firstSeqs[i];
+        segment.path = SegmentPath(segment.firstSeq);
+        bool broken = !segments.empty() && segment.firstSeq != nextSeq;
+        if (!broken) {
+            MappedFile map;
+            if (!map.Open(segment.path)) {
+                LOG_ERROR << "Cannot map " << segment.path;
+                return false;
+            }
+            // 顺序扫描，遇到不完整、校验失败或序列号不连续的记录即停止
+            HistoryEntry entry;
+            size_t size;
+            while (DecodeRecord(map.Data() + segment.size, map.Size() - segment.size, entry, size) &&
+                   entry.seq == segment.firstSeq + segment.count) {
+                if (segment.count % STORE_INDEX_INTERVAL == 0) segment.index.push_back((uint32_t) segment.size);
+                segment.count++;
+                segment.size += size;
+            }
+            broken = segment.size < map.Size();
+            map.Close();
+            if (broken) {
+                LOG_WARN << "Truncating " << segment.path << " from " << fs::file_size(segment.path, ec) << " to "
+                         << segment.size << " bytes.";
+                fs::resize_file(segment.path, segment.size, ec);
+            }
+            segments.push_back(std::move(segment));
+            nextSeq = segments.back().firstSeq + segments.back().count;
+            if (!broken) continue;
+            i++;
+        }
+        // 损坏位置之后的段与已恢复的序列号不连续，删除
+        for (; i < firstSeqs.size(); i++) {
+            LOG_WARN << "Removing " << SegmentPath(firstSeqs[i]) << " after a damaged segment.";
+            fs::remove(SegmentPath(firstSeqs[i]), ec);
+        }
+    }
+
+    std::ifstream in(dir + "/cursor");
+    if (in >> cursor) savedCursor = cursor;
+    return true;
+}
+
+bool MessageLog::ScanRecords(const char *data, size_t size, uint64_t &next, size_t limit, size_t &count,
+                             const std::function<bool(const HistoryEntry &)> &fn) {
+    HistoryEntry entry;
+    size_t recordSize;
+    size_t offset = 0;
+    while (count < limit && DecodeRecord(data + offset, size - offset, entry, recordSize)) {
+        offset += recordSize;
+        if (entry.seq < next) continue;
+        next = entry.seq + 1;
+        count++;
+        if (!fn(entry)) return false;
+    }
+    return count < limit;
+}
+
+size_t MessageLog::Read(uint64_t since, size_t limit, const std::function<bool(const HistoryEntry &)> &fn) {
+    uint64_t next = since + 1;
+    size_t count = 0;
+    if (limit == 0) return 0;
+    // 在锁内记下要读的段文件范围和尚未写入文件的记录，回调在锁外执行，
+    // 慢的回调（例如向客户端发送）不阻塞追加和写入线程。段文件只追加，已记下的范围不会改变
+    struct Range {
+        std::string path;
+        size_t offset;
+        size_t size;
+    };
+    std::vector<Range> ranges;
+    std::string unwritten;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // 找到包含 next 的段，之前的段都已读过
+        auto it = std::upper_bound(segments.begin(), segments.end(), next,
+                                   [](uint64_t seq, const Segment &segment) { return seq < segment.firstSeq; });
+        if (it != segments.begin()) --it;
+        for (; it != segments.end(); ++it) {
+            const Segment &segment = *it;
+            if (segment.count == 0 || next >= segment.firstSeq + segment.count) continue;
+            uint64_t start = std::max(next, segment.firstSeq);
+            size_t slot = (size_t) ((start - segment.firstSeq) / STORE_INDEX_INTERVAL);
+            size_t offset = slot < segment.index.size() ? segment.index[slot] : 0;
+            ranges.push_back({segment.path, offset, (size_t) segment.size});
+        }
+        unwritten.reserve(writing.size() + pending.size());
+        unwritten += writing;
+        unwritten += pending;
+    }
+    for (const Range &range: ranges) {
+        MappedFile map;
+        if (!map.Open(range.path)) {
+            LOG_ERROR << "Cannot map " << range.path;
+            return count;
+        }
+        size_t usable = std::min<size_t>(map.Size(), range.size);
+        if (range.offset > usable) return count;
+        if (!ScanRecords(map.Data() + range.offset, usable - range.offset, next, limit, count, fn)) return count;
+    }
+    // 尚未写入文件的记录
+    ScanRecords(unwritten.data(), unwritten.size(), next, limit, count, fn);
+    return count;
+}
+
+uint64_t MessageLog::LastSeq() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return nextSeq - 1;
+}
+
+uint64_t MessageLog::Cursor() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return cursor;
+}
+
+void MessageLog::Publish(Segment &segment, const std::string &batch) {
+    HistoryEntry entry;
+    size_t size;
+    for (size_t offset = 0; DecodeRecord(batch.data() + offset, batch.size() - offset, entry, size); offset += size) {
+        if ((entry.seq - segment.firstSeq) % STORE_INDEX_INTERVAL == 0) {
+            segment.index.push_back((uint32_t) (segment.size + offset));
+        }
+        segment.count++;
+    }
+    segment.size += batch.size();
+}
+
+MessageStore::~MessageStore() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    wakeup.notify_one();
+    if (writer.joinable()) writer.join();
+}
+
+bool MessageStore::Open() {
+    std::error_code ec;
+    fs::create_directories(dataDir + "/logs", ec);
+    if (ec) {
+        LOG_ERROR << "Cannot create data directory " << dataDir << ": " << ec.message();
+        return false;
+    }
+    running = true;
+    writer = std::thread([this]() {
+        Logger::SetThreadName("store");
+        Run();
+    });
+    return true;
+}
+
+// 会话键编码为目录名：十六进制，过长时截断并附加哈希
+static std::string KeyDirName(const std::string &key) {
+    static const char digits[] = "0123456789abcdef";
+    std::string name;
+    size_t len = std::min<size_t>(key.size(), 100);
+    for (size_t i = 0; i < len; i++) {
+        name += digits[(unsigned char) key[i] >> 4];
+        name += digits[(unsigned char) key[i] & 15];
+    }
+    if (len < key.size()) {
+        char hash[24];
+        snprintf(hash, sizeof(hash), "-%08x", Checksum(key.data(), key.size()));
+        name += hash;
+    }
+    return name;
+}
+
+MessageLogPtr MessageStore::GetLog(const std::string &key, bool create) {
+    MessageLogPtr log;
+    if (logs.Find(key, log)) return log;
+    std::string dir = dataDir + "/logs/" + KeyDirName(key);
+    std::error_code ec;
+    if (!create && !fs::exists(dir, ec)) return nullptr;
+    std::lock_guard<std::mutex> lock(openMutex);
+    if (logs.Find(key, log)) return log;
+    log = std::make_shared<MessageLog>(dir);
+    if (!log->Open()) return nullptr;
+    logs.Insert(key, log);
+    return log;
+}
+
+MessageLogPtr MessageStore::GroupLog(std::string_view group, bool create) {
+    std::string key = "g";
+    key += group;
+    return GetLog(key, create);
+}
+
+MessageLogPtr MessageStore::DirectLog(std::string_view userA, std::string_view userB, bool create) {
+    // 两个方向共用一个会话
+    if (userB < userA) std::swap(userA, userB);
+    std::string key = "d";
+    key += userA;
+    key += '\0';
+    key += userB;
+    return GetLog(key, create);
+}
+
+MessageLogPtr MessageStore::InboxLog(std::string_view user, bool create) {
+    std::string key = "i";
+    key += user;
+    return GetLog(key, create);
+}
+
+uint64_t MessageStore::Append(const MessageLogPtr &log, std::string_view sender, std::string_view body,
+                              uint64_t ref) {
+    int64_t timeMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    uint64_t seq;
+    bool wasDirty;
+    {
+        std::lock_guard<std::mutex> lock(log->mutex);
+        seq = log->nextSeq++;
+        EncodeRecord(log->pending, seq, timeMs, ref, sender, body);
+        wasDirty = std::exchange(log->dirty, true);
+    }
+    appends.fetch_add(1, std::memory_order_relaxed);
+    if (!wasDirty) MarkDirty(log);
+    return seq;
+}
+
+void MessageStore::SetCursor(const MessageLogPtr &log, uint64_t seq) {
+    bool wasDirty;
+    {
+        std::lock_guard<std::mutex> lock(log->mutex);
+        if (seq <= log->cursor) return;
+        log->cursor = seq;
+        wasDirty = std::exchange(log->dirty, true);
+    }
+    if (!wasDirty) MarkDirty(log);
+}
+
+void MessageStore::MarkDirty(const MessageLogPtr &log) {
+    std::lock_guard<std::mutex> lock(mutex);
+    dirtyLogs.push_back(log);
+    wakeup.notify_one();
+}
+
+void MessageStore::Sync() {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!running) return;
+    uint64_t target = ++syncRequested;
+    wakeup.notify_one();
+    synced.wait(lock, [&]() { return syncDone >= target; });
+}
+
+void MessageStore::Run() {
+    std::vector<MessageLogPtr> batch;
+    while (true) {
+        uint64_t requested;
+        bool stop;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeup.wait_for(lock, std::chrono::milliseconds(STORE_COMMIT_INTERVAL_MS), [&]() {
+                return !dirtyLogs.empty() || !running || syncRequested != syncDone;
+            });
+            batch.swap(dirtyLogs);
+            requested = syncRequested;
+            stop = !running;
+        }
+        if (!batch.empty()) Commit(batch);
+        batch.clear();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (syncDone < requested) {
+                syncDone = requested;
+                synced.notify_all();
+            }
+        }
+        if (stop) break;
+    }
+}
+
+void MessageStore::Commit(std::vector<MessageLogPtr> &batch) {
+    // 先把每个日志的新记录写入文件，全部写完后再逐个落盘，一次落盘覆盖这一批的所有追加
+    std::vector<MessageLog *> written;
+    for (const auto &log: batch) {
+        uint64_t cursor;
+        {
+            std::lock_guard<std::mutex> lock(log->mutex);
+            log->writing.swap(log->pending);
+            log->dirty = false;
+            cursor = log->cursor;
+        }
+        if (cursor != log->savedCursor) {
+            // 先写临时文件再改名，保证游标文件总是完整的
+            std::string path = log->dir + "/cursor";
+            {
+                std::ofstream out(path + ".tmp", std::ios::trunc);
+                out << cursor;
+            }
+            std::error_code ec;
+            fs::rename(path + ".tmp", path, ec);
+            log->savedCursor = cursor;
+        }
+        if (log->writing.empty()) continue;
+        HistoryEntry first;
+        size_t size;
+        DecodeRecord(log->writing.data(), log->writing.size(), first, size);
+        if (log->segments.empty() || log->segments.back().size >= STORE_SEGMENT_BYTES) {
+            if (log->file != INVALID_FILE) {
+                CloseFile(log->file);
+                log->file = INVALID_FILE;
+            }
+            MessageLog::Segment segment;
+            segment.firstSeq = first.seq;
+            segment.path = log->SegmentPath(first.seq);
+            std::lock_guard<std::mutex> lock(log->mutex);
+            log->segments.push_back(std::move(segment));
+        }
+        if (log->file == INVALID_FILE) {
+            log->file = OpenAppendFile(log->segments.back().path);
+            if (log->file != INVALID_FILE) openFiles.push_back(log);
+        }
+        if (log->file == INVALID_FILE || !WriteAll(log->file, log->writing.data(), log->writing.size())) {
+            // 写入失败时截掉可能写入的部分，记录放回待写缓冲区下一批重试
+            LOG_ERROR << "Write to " << log->segments.back().path << " failed: " << strerror(errno);
+            std::error_code ec;
+            fs::resize_file(log->segments.back().path, log->segments.back().size, ec);
+            std::lock_guard<std::mutex> lock(log->mutex);
+            log->pending.insert(0, log->writing);
+            log->writing.clear();
+            log->dirty = true;
+            std::lock_guard<std::mutex> dirtyLock(mutex);
+            dirtyLogs.push_back(log);
+            continue;
+        }
+        written.push_back(log.get());
+    }
+    for (MessageLog *log: written) {
+        SyncFile(log->file);
+        syncs.fetch_add(1, std::memory_order_relaxed);
+    }
+    // 落盘之后才计入段，读者只从文件中读取已落盘的部分
+    for (MessageLog *log: written) {
+        std::lock_guard<std::mutex> lock(log->mutex);
+        log->Publish(log->segments.back(), log->writing);
+        log->writing.clear();
+    }
+    commits.fetch_add(1, std::memory_order_relaxed);
+    if (openFiles.size() > STORE_MAX_OPEN_FILES) {
+        size_t half = openFiles.size() / 2;
+        for (size_t i = 0; i < half; i++) {
+            if (openFiles[i]->file != INVALID_FILE) CloseFile(openFiles[i]->file);
+            openFiles[i]->file = INVALID_FILE;
+        }
+        openFiles.erase(openFiles.begin(), openFiles.begin() + (long) half);
+    }
+}
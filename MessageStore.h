@@ -0,0 +1,189 @@
+#ifndef ONLINECHAT_MESSAGESTORE_H
+#define ONLINECHAT_MESSAGESTORE_H
+
+#include "ConcurrentMap.h"
+#include "File.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// 单个段文件的目标大小，超过后下一批写入新段
+#define STORE_SEGMENT_BYTES (64 * 1024 * 1024)
+// 稀疏索引的间隔：每隔多少条记录记录一次文件偏移
+#define STORE_INDEX_INTERVAL 64
+// 写入线程在没有新追加时的最长等待时间（毫秒）
+#define STORE_COMMIT_INTERVAL_MS 5
+// 写入线程保持打开的段文件数上限
+#define STORE_MAX_OPEN_FILES 256
+// 一次 HISTORY 最多返回的消息数和字节数
+#define HISTORY_PAGE_SIZE 1000
+#define HISTORY_PAGE_BYTES (512 * 1024)
+
+/**
+ * 日志中的一条消息，字段指向映射的文件或内存缓冲区，只在读取回调中有效
+ */
+struct HistoryEntry {
+    uint64_t seq{};      // 在所属日志中从 1 开始连续编号
+    int64_t timeMs{};    // 追加时的系统时间（毫秒）
+    uint64_t ref{};      // 离线收件箱中为对应私聊会话的序列号，其它日志为 0
+    std::string_view sender;
+    std::string_view body;
+};
+
+/**
+ * 一个会话（群组、私聊或离线收件箱）的只追加消息日志，由按首条序列号命名的段文件组成。
+ * 追加只在内存中编码并分配序列号，由 MessageStore 的写入线程按批写入文件并落盘；
+ * 读取时映射段文件，按稀疏索引定位后顺序扫描，尚未写入文件的记录从内存缓冲区读取。
+ * 所有方法都可以在任意线程调用
+ */
+class MessageLog {
+public:
+    explicit MessageLog(std::string dir) : dir(std::move(dir)) {}
+
+    ~MessageLog();
+
+    MessageLog(const MessageLog &) = delete;
+
+    MessageLog &operator=(const MessageLog &) = delete;
+
+    /**
+     * 打开日志目录并恢复：扫描段文件建立索引，截掉末尾写了一半的记录
+     * @return 是否成功
+     */
+    bool Open();
+
+    /**
+     * 读取序列号大于 since 的消息
+     * @param since 已有的最后一条序列号，0 表示从头读取
+     * @param limit 最多读取的条数
+     * @param fn 逐条回调，返回 false 时停止；回调时不持有日志的锁
+     * @return 读取的条数
+     */
+    size_t Read(uint64_t since, size_t limit, const std::function<bool(const HistoryEntry &)> &fn);
+
+    // 最后一条消息的序列号，空日志为 0
+    uint64_t LastSeq();
+
+    // 离线收件箱已投递到的序列号
+    uint64_t Cursor();
+
+private:
+    friend class MessageStore;
+
+    struct Segment {
+        uint64_t firstSeq{};
+        uint64_t count{};            // 已写入文件的记录数
+        uint64_t size{};             // 已写入文件的字节数
+        std::string path;
+        std::vector<uint32_t> index; // 第 i 项为第 i * STORE_INDEX_INTERVAL 条记录的偏移
+    };
+
+    // 在一段连续编码的记录中读取，返回是否继续
+    static bool ScanRecords(const char *data, size_t size, uint64_t &next, size_t limit, size_t &count,
+                            const std::function<bool(const HistoryEntry &)> &fn);
+
+    // 把写入文件的一批记录计入段的条数、大小和索引，调用方持有锁
+    void Publish(Segment &segment, const std::string &batch);
+
+    std::string SegmentPath(uint64_t firstSeq) const;
+
+    std::mutex mutex;
+    std::string dir;
+    std::vector<Segment> segments;
+    uint64_t nextSeq{1};
+    std::string pending;         // 已追加、等待写入线程取走的记录
+    std::string writing;         // 写入线程正在写入文件的记录
+    bool dirty{false};           // 已在写入线程的待写列表中
+    uint64_t cursor{0};
+    uint64_t savedCursor{0};
+    // 以下只由写入线程访问
+    FileHandle file{INVALID_FILE};
+};
+
+using MessageLogPtr = std::shared_ptr<MessageLog>;
+
+/**
+ * 持久化的消息存储：群组、私聊和离线收件箱各一个 MessageLog，放在数据目录下按会话划分的子目录中。
+ * 写入线程做组提交：每批取出所有有新追加的日志，写入后每个文件只落盘一次，
+ * 落盘期间到达的追加合并到下一批
+ */
+class MessageStore {
+public:
+    explicit MessageStore(std::string dataDir) : dataDir(std::move(dataDir)) {}
+
+    ~MessageStore();
+
+    MessageStore(const MessageStore &) = delete;
+
+    MessageStore &operator=(const MessageStore &) = delete;
+
+    // 创建数据目录并启动写入线程
+    bool Open();
+
+    /**
+     * 取得群组、私聊或离线收件箱的日志，可在任意线程调用
+     * @param create 日志不存在时是否创建，为 false 且不存在时返回空指针
+     */
+    MessageLogPtr GroupLog(std::string_view group, bool create);
+
+    MessageLogPtr DirectLog(std::string_view userA, std::string_view userB, bool create);
+
+    MessageLogPtr InboxLog(std::string_view user, bool create);
+
+    /**
+     * 追加一条消息，只在内存中编码，由写入线程异步落盘
+     * @param ref 离线收件箱中为对应私聊会话的序列号
+     * @return 分配的序列号
+     */
+    uint64_t Append(const MessageLogPtr &log, std::string_view sender, std::string_view body, uint64_t ref = 0);
+
+    // 记录离线收件箱已投递到的序列号，由写入线程保存
+    void SetCursor(const MessageLogPtr &log, uint64_t seq);
+
+    // 等待此前的追加全部写入文件并落盘
+    void Sync();
+
+    // 追加的条数、写入的批数和落盘次数
+    uint64_t Appends() const { return appends.load(std::memory_order_relaxed); }
+
+    uint64_t Commits() const { return commits.load(std::memory_order_relaxed); }
+
+    uint64_t Syncs() const { return syncs.load(std::memory_order_relaxed); }
+
+private:
+    MessageLogPtr GetLog(const std::string &key, bool create);
+
+    // 把日志加入写入线程的待写列表
+    void MarkDirty(const MessageLogPtr &log);
+
+    void Run();
+
+    // 写入一批日志并落盘
+    void Commit(std::vector<MessageLogPtr> &batch);
+
+    std::string dataDir;
+    ConcurrentMap<MessageLogPtr> logs;
+    std::mutex openMutex;         // 串行化日志的创建，避免同一日志被打开两次
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::condition_variable synced;
+    std::vector<MessageLogPtr> dirtyLogs;
+    uint64_t syncRequested{0};
+    uint64_t syncDone{0};
+    bool running{false};
+    std::thread writer;
+    // 写入线程打开了段文件的日志，超过上限时关闭最早打开的一半
+    std::vector<MessageLogPtr> openFiles;
+    std::atomic<uint64_t> appends{0};
+    std::atomic<uint64_t> commits{0};
+    std::atomic<uint64_t> syncs{0};
+};
+
+#endif //ONLINECHAT_MESSAGESTORE_H
@@ -0,0 +1,138 @@
+#include "Metrics.h"
+#include "Log.h"
+#include <bit>
+
+int Histogram::BucketOf(uint64_t value) {
+    if (value < (1u << HISTOGRAM_SUB_BITS)) return (int) value;
+    int exponent = std::bit_width(value) - 1;
+    int group = exponent - HISTOGRAM_SUB_BITS + 1;
+    int sub = (int) (value >> (exponent - HISTOGRAM_SUB_BITS)) & ((1 << HISTOGRAM_SUB_BITS) - 1);
+    return (group << HISTOGRAM_SUB_BITS) + sub;
+}
+
+uint64_t Histogram::BucketLow(int bucket) {
+    int group = bucket >> HISTOGRAM_SUB_BITS;
+    uint64_t sub = bucket & ((1 << HISTOGRAM_SUB_BITS) - 1);
+    if (group == 0) return sub;
+    return (sub + (1u << HISTOGRAM_SUB_BITS)) << (group - 1);
+}
+
+uint64_t Histogram::BucketWidth(int bucket) {
+    int group = bucket >> HISTOGRAM_SUB_BITS;
+    return group == 0 ? 1 : (uint64_t) 1 << (group - 1);
+}
+
+void Histogram::Merge(const Histogram &other) {
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        Bump(buckets[i], other.buckets[i].load(std::memory_order_relaxed));
+    }
+    Bump(sum, other.Sum());
+    Bump(count, other.Count());
+}
+
+uint64_t Histogram::Quantile(double q) const {
+    // 采集与记录并发进行，总数按桶重新累加，保证能找到对应的桶
+    uint64_t total = 0;
+    for (const auto &bucket: buckets) total += bucket.load(std::memory_order_relaxed);
+    if (total == 0) return 0;
+    auto rank = (uint64_t) (q * (double) total);
+    if (rank < 1) rank = 1;
+    if (rank > total) rank = total;
+    uint64_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank) return BucketLow(i) + BucketWidth(i) / 2;
+    }
+    return BucketLow(HISTOGRAM_BUCKETS - 1);
+}
+
+MetricsServer::~MetricsServer() {
+    Stop();
+}
+
+bool MetricsServer::Start(int port, RenderCallback renderCallback) {
+    sListen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sListen == INVALID_SOCKET) {
+        LOG_ERROR << "Metrics socket failed !";
+        return false;
+    }
+    int reuse = 1;
+    setsockopt(sListen, SOL_SOCKET, SO_REUSEADDR, (const char *) &reuse, sizeof(reuse));
+    // 指标可能暴露内部状态，只允许本机访问
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(sListen, (sockaddr *) &addr, sizeof(addr)) == SOCKET_ERROR || listen(sListen, 16) == SOCKET_ERROR) {
+        LOG_ERROR << "Metrics bind failed on port " << port << " !";
+        closesocket(sListen);
+        sListen = INVALID_SOCKET;
+        return false;
+    }
+    render = std::move(renderCallback);
+    running = true;
+    thread = std::thread([this]() {
+        Logger::SetThreadName("metrics");
+        Serve();
+    });
+    return true;
+}
+
+void MetricsServer::Stop() {
+    if (!running.exchange(false)) return;
+    // 关闭监听套接字使阻塞中的 accept 返回
+#ifndef _WIN32
+    shutdown(sListen, SHUT_RDWR);
+#endif
+    closesocket(sListen);
+    sListen = INVALID_SOCKET;
+    if (thread.joinable()) thread.join();
+}
+
+// 设置阻塞读取的超时，避免不发送请求的连接一直占用服务线程
+static void SetReceiveTimeout(SOCKET s, int ms) {
+#ifdef _WIN32
+    DWORD timeout = (DWORD) ms;
+#else
+    timeval timeout{ms / 1000, (ms % 1000) * 1000};
+#endif
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char *) &timeout, sizeof(timeout));
+}
+
+static void SendAll(SOCKET s, const std::string &data) {
+    size_t offset = 0;
+    while (offset < data.size()) {
+        int n = (int) send(s, data.data() + offset, (int) (data.size() - offset), 0);
+        if (n <= 0) return;
+        offset += n;
+    }
+}
+
+void MetricsServer::Serve() {
+    while (running) {
+        SOCKET s = accept(sListen, nullptr, nullptr);
+        if (s == INVALID_SOCKET) {
+            if (!running) return;
+            continue;
+        }
+        SetReceiveTimeout(s, 2000);
+        // 只需要请求行，读到请求头结束或缓冲区满为止
+        std::string request;
+        char buf[1024];
+        while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+            int n = (int) recv(s, buf, sizeof(buf), 0);
+            if (n <= 0) break;
+            request.append(buf, n);
+        }
+        std::string response;
+        if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 13, "GET /metrics?") == 0) {
+            std::string body = render();
+            response = "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                       std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+        } else {
+            response = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        }
+        SendAll(s, response);
+        closesocket(s);
+    }
+}
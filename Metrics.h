@@ -0,0 +1,150 @@
+#ifndef ONLINECHAT_METRICS_H
+#define ONLINECHAT_METRICS_H
+
+#include "Platform.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+
+// 默认的指标端口，只监听本机地址
+#define METRICS_PORT 9991
+// 按命令统计时区分的操作码数，客户端命令的操作码都小于该值，其余计入 0 号（UNKNOWN）
+#define METRICS_OPCODES 32
+// 直方图每个 2 的幂区间划分的子区间数的位数，相对误差不超过 1/16
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS)
+
+// 单调时钟的纳秒数，用于延迟统计
+inline int64_t MonotonicNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * 单写者计数器：只由所属分片的线程写入，写入不需要原子的读-改-写指令；
+ * 其它线程采集时用 relaxed 读取，可能读到稍旧的值
+ */
+class Counter {
+public:
+    void Add(int64_t n = 1) { value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+
+    int64_t Get() const { return value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> value{0};
+};
+
+// 可增可减的当前值（队列深度等），同样只由所属分片的线程写入
+using Gauge = Counter;
+
+/**
+ * 单写者的对数线性直方图（HDR 风格）：每个 2 的幂区间再等分为 16 个子区间，
+ * 覆盖完整的 64 位取值范围，记录一次只需计算前导零并累加一个桶
+ */
+class Histogram {
+public:
+    void Record(uint64_t value) {
+        Bump(buckets[BucketOf(value)], 1);
+        Bump(sum, value);
+        Bump(count, 1);
+    }
+
+    // 把另一个直方图累加到本直方图，用于采集时合并各分片
+    void Merge(const Histogram &other);
+
+    uint64_t Count() const { return count.load(std::memory_order_relaxed); }
+
+    uint64_t Sum() const { return sum.load(std::memory_order_relaxed); }
+
+    // 分位数的估计值（所在桶的中点），没有数据时返回 0
+    uint64_t Quantile(double q) const;
+
+private:
+    static void Bump(std::atomic<uint64_t> &slot, uint64_t n) {
+        slot.store(slot.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    static int BucketOf(uint64_t value);
+
+    // 桶的下界和宽度
+    static uint64_t BucketLow(int bucket);
+
+    static uint64_t BucketWidth(int bucket);
+
+    std::atomic<uint64_t> buckets[HISTOGRAM_BUCKETS]{};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> count{0};
+};
+
+/**
+ * 一个分片的指标，只由该分片的事件循环线程写入，采集时合并所有分片。
+ * 按缓存行对齐，避免不同分片的计数器伪共享
+ */
+struct alignas(64) ShardMetrics {
+    Counter commands[METRICS_OPCODES];          // 按操作码统计的命令数
+    Histogram handlerLatency[METRICS_OPCODES];  // 命令处理函数的耗时（纳秒）
+    Histogram deliveryLatency;  // 消息从构造到完整写入套接字的耗时（纳秒）
+    Counter bytesIn;
+    Counter bytesOut;
+    Counter accepted;           // 接受的连接数
+    Counter closed;             // 关闭的连接数
+    Counter evictions;          // 因发送队列超过上限或持续拥塞被断开的连接数
+    Counter handshakeTimeouts;  // 未在限定时间内完成握手被断开的连接数
+    Counter heartbeatTimeouts;  // 没有回复心跳被断开的连接数
+    Counter connRateLimited;    // 超过连接的速率限制而暂停读取的次数
+    Counter userRateLimited;    // 超过用户的速率限制而暂停读取的次数
+    Counter rejectedPending;    // 握手中的连接过多时拒绝的连接数
+    Counter rejectedPerIp;      // 同一IP的连接过多时拒绝的连接数
+    Counter rejectedDescriptors; // 文件描述符用尽时拒绝的连接数
+    Counter multicastDatagrams; // 组播发送的群组消息数据报数
+    Counter multicastBytes;     // 组播发送的字节数
+    Counter multicastNaks;      // 收到的组播 NAK 数
+    Counter multicastRetransmits; // 通过TCP重传的组播消息数
+    Counter webSocketUpgrades;  // 完成 WebSocket 升级的连接数
+    Counter fileTransfers;      // 开始的文件上传数
+    Counter fileBytesReceived;  // 写入中转文件的上传数据
+    Counter fileBytesSpliced;   // 其中从套接字直接写入文件、没有复制到用户态的字节数
+    Counter fileBytesSent;      // 发给下载者的文件数据
+    Counter fileBytesSendfile;  // 其中由 sendfile 从页缓存直接发送的字节数
+    Gauge queuedBytes;          // 当前所有连接发送队列中的字节数
+    Gauge queuedFrames;         // 当前所有连接发送队列中的帧数
+    Gauge congested;            // 当前处于拥塞状态的连接数
+
+    // 操作码对应的统计下标，没有处理函数的命令应传入 0
+    static int OpcodeIndex(uint8_t opcode) { return opcode < METRICS_OPCODES ? opcode : 0; }
+};
+
+/**
+ * 只提供 GET /metrics 的最小 HTTP 服务，运行在独立线程中，
+ * 每个请求调用一次渲染函数生成 Prometheus 文本格式的响应，处理完即关闭连接
+ */
+class MetricsServer {
+public:
+    using RenderCallback = std::function<std::string()>;
+
+    ~MetricsServer();
+
+    /**
+     * 在本机地址上监听并启动服务线程
+     * @param port 端口
+     * @param render 生成指标文本
+     * @return 是否成功
+     */
+    bool Start(int port, RenderCallback render);
+
+    // 停止服务线程
+    void Stop();
+
+private:
+    void Serve();
+
+    SOCKET sListen{INVALID_SOCKET};
+    std::atomic<bool> running{false};
+    RenderCallback render;
+    std::thread thread;
+};
+
+#endif //ONLINECHAT_METRICS_H
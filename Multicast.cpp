@@ -0,0 +1,468 @@
+#include "Multicast.h"
+#include "Log.h"
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+
+// 把数字格式化到调用方提供的缓冲区
+static std::string_view FormatSeq(uint64_t value, char (&buf)[24]) {
+    auto result = std::to_chars(buf, buf + sizeof(buf), value);
+    return {buf, (size_t) (result.ptr - buf)};
+}
+
+static bool ParseSeq(std::string_view text, uint64_t &value) {
+    auto result = std::from_chars(text.data(), text.data() + text.size(), value);
+    return result.ec == std::errc() && result.ptr == text.data() + text.size();
+}
+
+// 按 FNV-1a 散列群组名，不依赖标准库实现，不同平台和版本的服务器得到相同的地址
+static uint32_t HashName(std::string_view name) {
+    uint32_t hash = 2166136261u;
+    for (char c: name) hash = (hash ^ (uint8_t) c) * 16777619u;
+    return hash;
+}
+
+static sockaddr_in ChannelAddress(std::string_view group) {
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(MULTICAST_PORT);
+    uint32_t base = ntohl(inet_addr(MULTICAST_BASE_ADDRESS));
+    addr.sin_addr.s_addr = htonl(base + HashName(group) % MULTICAST_ADDRESSES);
+    return addr;
+}
+
+MulticastSender::~MulticastSender() {
+    Close();
+}
+
+bool MulticastSender::Open(const std::string &interfaceAddress) {
+    sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock == INVALID_SOCKET) {
+        LOG_ERROR << "Failed to create the multicast socket: " << LastSocketError();
+        return false;
+    }
+    in_addr local{};
+    local.s_addr = inet_addr(interfaceAddress.c_str());
+    int ttl = MULTICAST_TTL;
+    // 本机上的接收方（包括在回环接口上测试）也需要收到
+    int loop = 1;
+    int sendBuffer = 4 * 1024 * 1024;
+    if (setsockopt(sock, IPPROTO_IP, IP_MULTICAST_IF, (const char *) &local, sizeof(local)) == SOCKET_ERROR ||
+        setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, (const char *) &ttl, sizeof(ttl)) == SOCKET_ERROR ||
+        setsockopt(sock, IPPROTO_IP, IP_MULTICAST_LOOP, (const char *) &loop, sizeof(loop)) == SOCKET_ERROR) {
+        LOG_ERROR << "Failed to configure multicast on " << interfaceAddress << ": " << LastSocketError();
+        closesocket(sock);
+        sock = INVALID_SOCKET;
+        return false;
+    }
+    setsockopt(sock, SOL_SOCKET, SO_SNDBUF, (const char *) &sendBuffer, sizeof(sendBuffer));
+    // 发送缓冲区满时丢弃数据报，由接收方的 NAK 补齐，不阻塞分片线程
+    SetNonBlocking(sock);
+    heartbeat = std::thread(&MulticastSender::HeartbeatLoop, this);
+    return true;
+}
+
+void MulticastSender::Close() {
+    {
+        std::lock_guard<std::mutex> lock(stopMutex);
+        stopping = true;
+    }
+    stopCond.notify_all();
+    if (heartbeat.joinable()) heartbeat.join();
+    if (sock != INVALID_SOCKET) closesocket(sock);
+    sock = INVALID_SOCKET;
+}
+
+std::string MulticastSender::AddressOf(std::string_view group) {
+    sockaddr_in addr = ChannelAddress(group);
+    return std::string(inet_ntoa(addr.sin_addr)) + ":" + std::to_string(MULTICAST_PORT);
+}
+
+std::shared_ptr<MulticastSender::Channel> MulticastSender::Find(std::string_view group) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto it = channels.find(std::string(group));
+    return it != channels.end() ? it->second : nullptr;
+}
+
+std::shared_ptr<MulticastSender::Channel> MulticastSender::Create(std::string_view group) {
+    std::shared_ptr<Channel> channel = Find(group);
+    if (channel) return channel;
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto &slot = channels[std::string(group)];
+    if (!slot) {
+        slot = std::make_shared<Channel>();
+        slot->name = std::string(group);
+        slot->addr = ChannelAddress(group);
+    }
+    return slot;
+}
+
+uint64_t MulticastSender::Subscribe(std::string_view group) {
+    std::shared_ptr<Channel> channel = Create(group);
+    std::lock_guard<std::mutex> lock(channel->mutex);
+    return channel->seq;
+}
+
+uint64_t MulticastSender::LastSeq(std::string_view group) const {
+    std::shared_ptr<Channel> channel = Find(group);
+    if (!channel) return 0;
+    std::lock_guard<std::mutex> lock(channel->mutex);
+    return channel->seq;
+}
+
+uint64_t MulticastSender::Send(std::string_view group, std::initializer_list<std::string_view> fields, size_t &bytes) {
+    bytes = 0;
+    if (sock == INVALID_SOCKET) return 0;
+    std::shared_ptr<Channel> channel = Find(group);
+    if (!channel) return 0;
+    std::string_view all[MAX_FIELDS];
+    char seqText[24];
+    size_t count = 2;
+    for (std::string_view field: fields) {
+        if (count < MAX_FIELDS) all[count++] = field;
+    }
+    all[0] = group;
+    // 序列号的分配和发送在同一把锁内，数据报按序列号顺序离开服务器
+    std::lock_guard<std::mutex> lock(channel->mutex);
+    uint64_t seq = channel->seq + 1;
+    all[1] = FormatSeq(seq, seqText);
+    size_t size = BinaryFrameSize(all, count);
+    if (size > MULTICAST_MAX_DATAGRAM) return 0;
+    channel->seq = seq;
+    size_t index = seq % MULTICAST_WINDOW;
+    if (channel->window.size() <= index) channel->window.resize(index + 1);
+    std::string &frame = channel->window[index];
+    frame.resize(size);
+    WriteBinaryFrame(&frame[0], OP_MULTICAST_DATA, all, count);
+    if (sendto(sock, frame.data(), (int) size, 0, (const sockaddr *) &channel->addr, sizeof(channel->addr)) < 0) {
+        LOG_SAMPLED(LOG_LEVEL_WARN) << "Multicast datagram " << seq << " of group " << group
+                                    << " was dropped: " << LastSocketError();
+    }
+    bytes = size;
+    return seq;
+}
+
+uint64_t MulticastSender::Retransmit(std::string_view group, uint64_t from, uint64_t to,
+                                     std::vector<std::string> &frames) const {
+    frames.clear();
+    std::shared_ptr<Channel> channel = Find(group);
+    if (!channel) return 0;
+    std::lock_guard<std::mutex> lock(channel->mutex);
+    // 窗口只保存本进程发送的数据报，热重启之前的序列号无法重传
+    uint64_t earliest = std::max(channel->firstSeq, channel->seq >= MULTICAST_WINDOW ?
+                                                    channel->seq - MULTICAST_WINDOW + 1 : 1);
+    from = std::max(from, earliest);
+    to = std::min(to, channel->seq);
+    for (uint64_t seq = from; seq <= to; seq++) frames.push_back(channel->window[seq % MULTICAST_WINDOW]);
+    return earliest;
+}
+
+void MulticastSender::Save(std::vector<std::string> &groups, std::vector<uint64_t> &seqs) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    for (const auto &entry: channels) {
+        std::lock_guard<std::mutex> channelLock(entry.second->mutex);
+        groups.push_back(entry.first);
+        seqs.push_back(entry.second->seq);
+    }
+}
+
+void MulticastSender::Restore(const std::vector<std::string> &groups, const std::vector<uint64_t> &seqs) {
+    for (size_t i = 0; i < groups.size() && i < seqs.size(); i++) {
+        std::shared_ptr<Channel> channel = Create(groups[i]);
+        std::lock_guard<std::mutex> lock(channel->mutex);
+        channel->seq = seqs[i];
+        channel->firstSeq = seqs[i] + 1;
+    }
+}
+
+void MulticastSender::HeartbeatLoop() {
+    Logger::SetThreadName("multicast");
+    std::vector<std::shared_ptr<Channel>> all;
+    std::string frame;
+    std::unique_lock<std::mutex> stopLock(stopMutex);
+    auto stopped = [this]() { return stopping; };
+    while (!stopCond.wait_for(stopLock, std::chrono::milliseconds(MULTICAST_HEARTBEAT_MS), stopped)) {
+        all.clear();
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            for (const auto &entry: channels) all.push_back(entry.second);
+        }
+        for (const auto &channel: all) {
+            std::lock_guard<std::mutex> lock(channel->mutex);
+            char seqText[24];
+            std::string_view fields[] = {channel->name, FormatSeq(channel->seq, seqText)};
+            frame.clear();
+            AppendBinaryFrame(frame, OP_MULTICAST_HEARTBEAT, fields, 2);
+            sendto(sock, frame.data(), (int) frame.size(), 0, (const sockaddr *) &channel->addr, sizeof(channel->addr));
+        }
+    }
+}
+
+MulticastReceiver::MulticastReceiver(DeliverCallback onDeliver, RequestCallback onRequest)
+        : onDeliver(std::move(onDeliver)), onRequest(std::move(onRequest)), buffer(65536) {}
+
+MulticastReceiver::~MulticastReceiver() {
+    if (sock != INVALID_SOCKET) closesocket(sock);
+}
+
+bool MulticastReceiver::Open(const std::string &interfaceAddress) {
+    localInterface.s_addr = inet_addr(interfaceAddress.c_str());
+    sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock == INVALID_SOCKET) return false;
+    // 同一台主机上的多个客户端共用组播端口
+    int reuse = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char *) &reuse, sizeof(reuse));
+#ifdef IP_MULTICAST_ALL
+    // 只接收本套接字加入的组播地址
+    int all = 0;
+    setsockopt(sock, IPPROTO_IP, IP_MULTICAST_ALL, &all, sizeof(all));
+#endif
+    int receiveBuffer = 4 * 1024 * 1024;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (const char *) &receiveBuffer, sizeof(receiveBuffer));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(MULTICAST_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(sock, (sockaddr *) &addr, sizeof(addr)) == SOCKET_ERROR || !SetNonBlocking(sock)) {
+        closesocket(sock);
+        sock = INVALID_SOCKET;
+        return false;
+    }
+    return true;
+}
+
+void MulticastReceiver::Join(uint32_t address) {
+    if (joined[address]++ > 0) return;
+    ip_mreq request{};
+    request.imr_multiaddr.s_addr = address;
+    request.imr_interface = localInterface;
+    setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, (const char *) &request, sizeof(request));
+}
+
+void MulticastReceiver::Drop(uint32_t address) {
+    auto it = joined.find(address);
+    if (it == joined.end() || --it->second > 0) return;
+    joined.erase(it);
+    ip_mreq request{};
+    request.imr_multiaddr.s_addr = address;
+    request.imr_interface = localInterface;
+    setsockopt(sock, IPPROTO_IP, IP_DROP_MEMBERSHIP, (const char *) &request, sizeof(request));
+}
+
+bool MulticastReceiver::OnServerCommand(const Command &cmd, uint64_t nowMs) {
+    std::lock_guard<std::mutex> lock(mutex);
+    uint64_t seq = 0;
+    switch (cmd.opcode) {
+        case OP_MULTICAST_INFO: {
+            if (cmd.fieldCount < 3 || !ParseSeq(cmd.fields[2], seq)) return true;
+            std::string group(cmd.fields[0]);
+            std::string address(cmd.fields[1].substr(0, cmd.fields[1].find(':')));
+            auto it = channels.find(group);
+            if (it != channels.end()) {
+                if (it->second.state != State::Left) return true;
+                channels.erase(it);
+            }
+            Channel &channel = channels[group];
+            channel.address = inet_addr(address.c_str());
+            channel.latest = seq;
+            channel.lastHeardMs = nowMs;
+            Join(channel.address);
+            return true;
+        }
+        case OP_MULTICAST_ACTIVE: {
+            auto it = channels.find(std::string(cmd.fields[0]));
+            if (cmd.fieldCount < 2 || !ParseSeq(cmd.fields[1], seq) || it == channels.end()) return true;
+            Channel &channel = it->second;
+            if (channel.state != State::Acked) return true;
+            // 之前的消息已通过TCP收到，缓冲的数据报中只保留之后的
+            channel.state = State::Active;
+            channel.next = seq;
+            channel.pending.erase(channel.pending.begin(), channel.pending.lower_bound(seq));
+            DeliverReady(channel);
+            return true;
+        }
+        case OP_MULTICAST_DATA:
+            OnData(cmd, true, nowMs);
+            return true;
+        case OP_MULTICAST_GAP: {
+            auto it = channels.find(std::string(cmd.fields[0]));
+            if (cmd.fieldCount < 2 || !ParseSeq(cmd.fields[1], seq) || it == channels.end()) return true;
+            // 无法重传的消息跳过
+            Channel &channel = it->second;
+            if (channel.next < seq) {
+                channel.next = seq;
+                channel.pending.erase(channel.pending.begin(), channel.pending.lower_bound(seq));
+                DeliverReady(channel);
+            }
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+void MulticastReceiver::ReadDatagrams(uint64_t nowMs) {
+    std::lock_guard<std::mutex> lock(mutex);
+    while (true) {
+        int n = (int) recvfrom(sock, buffer.data(), (int) buffer.size(), 0, nullptr, nullptr);
+        if (n <= 0) return;
+        Command cmd;
+        size_t size = 0;
+        if (DecodeBinary(buffer.data(), (size_t) n, cmd, size) != DecodeResult::Ok || size != (size_t) n ||
+            cmd.fieldCount < 2) {
+            continue;
+        }
+        if (cmd.opcode == OP_MULTICAST_DATA) {
+            OnData(cmd, false, nowMs);
+        } else if (cmd.opcode == OP_MULTICAST_HEARTBEAT) {
+            uint64_t seq = 0;
+            auto it = channels.find(std::string(cmd.fields[0]));
+            if (it != channels.end() && ParseSeq(cmd.fields[1], seq)) Heard(it->first, it->second, seq, nowMs);
+        }
+    }
+}
+
+void MulticastReceiver::Heard(const std::string &group, Channel &channel, uint64_t seq, uint64_t nowMs) {
+    if (channel.state == State::Left) return;
+    channel.lastHeardMs = nowMs;
+    channel.latest = std::max(channel.latest, seq);
+    if (channel.state == State::Probing) {
+        // 组播可达，请求服务器停止通过TCP投递
+        channel.state = State::Acked;
+        onRequest(OP_MULTICAST_ACK, {group});
+    }
+}
+
+void MulticastReceiver::OnData(const Command &cmd, bool repair, uint64_t nowMs) {
+    uint64_t seq = 0;
+    auto it = channels.find(std::string(cmd.fields[0]));
+    if (cmd.fieldCount < 4 || !ParseSeq(cmd.fields[1], seq) || it == channels.end()) return;
+    Channel &channel = it->second;
+    if (!repair) {
+        Heard(it->first, channel, seq, nowMs);
+    } else {
+        repaired++;
+    }
+    switch (channel.state) {
+        case State::Probing:
+            return;
+        case State::Acked:
+            // 还不知道哪些消息已通过TCP收到，先缓冲
+            if (!repair && channel.pending.size() < MULTICAST_WINDOW) {
+                std::string &frame = channel.pending[seq];
+                if (frame.empty()) AppendBinaryFrame(frame, OP_MULTICAST_DATA, cmd.fields, cmd.fieldCount);
+            }
+            return;
+        case State::Left:
+            // 退出后服务器按顺序重传缺失的消息，缓冲的数据报与之合并
+            if (!repair || seq < channel.next) return;
+            while (!channel.pending.empty() && channel.pending.begin()->first < seq) {
+                DeliverFrame(channel.pending.begin()->second);
+                channel.pending.erase(channel.pending.begin());
+            }
+            channel.pending.erase(seq);
+            onDeliver(cmd);
+            channel.next = seq + 1;
+            return;
+        case State::Active:
+            break;
+    }
+    if (seq < channel.next || channel.pending.count(seq) > 0) return;
+    if (seq == channel.next) {
+        onDeliver(cmd);
+        channel.next++;
+        DeliverReady(channel);
+        return;
+    }
+    // 前面还有缺失的消息，缓冲并等待乱序到达或重传
+    if (channel.pending.size() >= MULTICAST_WINDOW) return;
+    AppendBinaryFrame(channel.pending[seq], OP_MULTICAST_DATA, cmd.fields, cmd.fieldCount);
+    if (!repair) reordered++;
+}
+
+void MulticastReceiver::DeliverFrame(const std::string &frame) {
+    Command cmd;
+    size_t size = 0;
+    if (DecodeBinary(frame.data(), frame.size(), cmd, size) == DecodeResult::Ok) onDeliver(cmd);
+}
+
+void MulticastReceiver::DeliverReady(Channel &channel) {
+    while (!channel.pending.empty() && channel.pending.begin()->first <= channel.next) {
+        auto first = channel.pending.begin();
+        if (first->first == channel.next) {
+            DeliverFrame(first->second);
+            channel.next++;
+        }
+        channel.pending.erase(first);
+    }
+    if (channel.next > channel.latest) channel.gapSinceMs = 0;
+}
+
+void MulticastReceiver::Leave(const std::string &group, Channel &channel) {
+    char seqText[24];
+    // 确认前收到的数据报都不确定是否已通过TCP收到，由服务器从确认时的序列号开始重传
+    uint64_t last = channel.state == State::Active ? channel.next - 1 : 0;
+    if (channel.state == State::Acked) channel.pending.clear();
+    channel.state = State::Left;
+    Drop(channel.address);
+    onRequest(OP_MULTICAST_LEAVE, {group, FormatSeq(last, seqText)});
+}
+
+void MulticastReceiver::OnTick(uint64_t nowMs) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = channels.begin(); it != channels.end();) {
+        const std::string &group = it->first;
+        Channel &channel = it->second;
+        // 调用方的时间可能早于收到数据时传入的时间，只比较先后，不做可能下溢的减法
+        bool silent = nowMs > channel.lastHeardMs + MULTICAST_SILENCE_MS;
+        if (channel.state == State::Probing && silent) {
+            // 收不到组播，继续通过TCP接收
+            Drop(channel.address);
+            it = channels.erase(it);
+            continue;
+        }
+        if ((channel.state == State::Acked || channel.state == State::Active) && silent) {
+            Leave(group, channel);
+        } else if (channel.state == State::Active && channel.latest >= channel.next) {
+            // next 之前的都已交付，next 到已知的最新序列号之间除已缓冲的外都缺失。
+            // 已请求过的缺失按重发间隔重新请求，新发现的缺失在等待乱序报文后立即请求
+            if (channel.gapSinceMs == 0) channel.gapSinceMs = nowMs;
+            if (nowMs >= channel.gapSinceMs + MULTICAST_NAK_DELAY_MS) {
+                if (nowMs >= channel.nakSentMs + MULTICAST_NAK_RETRY_MS) {
+                    channel.nakSentMs = nowMs;
+                    RequestGaps(group, channel, channel.next);
+                } else if (channel.nakUntil < channel.latest) {
+                    RequestGaps(group, channel, std::max(channel.next, channel.nakUntil + 1));
+                }
+            }
+        }
+        ++it;
+    }
+}
+
+void MulticastReceiver::RequestGaps(const std::string &group, Channel &channel, uint64_t from) {
+    // 重传窗口之外的消息服务器已无法重传，不必请求
+    uint64_t last = std::min(channel.latest, channel.next + MULTICAST_WINDOW - 1);
+    auto it = channel.pending.lower_bound(from);
+    char fromText[24], toText[24];
+    for (int ranges = 0; from <= last && ranges < MULTICAST_NAK_RANGES; ranges++) {
+        // 跳过已缓冲的连续消息
+        while (it != channel.pending.end() && it->first == from) {
+            ++it;
+            from++;
+        }
+        if (from > last) break;
+        uint64_t to = it == channel.pending.end() ? last : std::min(last, it->first - 1);
+        onRequest(OP_MULTICAST_NAK, {group, FormatSeq(from, fromText), FormatSeq(to, toText)});
+        channel.nakUntil = std::max(channel.nakUntil, to);
+        from = to + 1;
+    }
+}
+
+void MulticastReceiver::Unsubscribe(std::string_view group) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = channels.find(std::string(group));
+    if (it == channels.end()) return;
+    if (it->second.state != State::Left) Drop(it->second.address);
+    channels.erase(it);
+}
@@ -0,0 +1,234 @@
+#ifndef ONLINECHAT_MULTICAST_H
+#define ONLINECHAT_MULTICAST_H
+
+#include "Platform.h"
+#include "Protocol.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// 群组按名称散列到的组播地址范围（组织内部范围 239.255.0.0/16）和组播端口
+#define MULTICAST_BASE_ADDRESS "239.255.77.0"
+#define MULTICAST_ADDRESSES 256
+#define MULTICAST_PORT 9992
+// 组播报文的生存时间，1 表示不跨越路由器，只在局域网内传播
+#define MULTICAST_TTL 1
+// 编码后超过该长度的群组消息不组播，仍通过TCP发给所有成员，避免IP分片放大丢包
+#define MULTICAST_MAX_DATAGRAM 1400
+// 每个群组的重传窗口保存最近的数据报数
+#define MULTICAST_WINDOW 4096
+// 服务器在每个组播群组上发送心跳的间隔（毫秒），接收方据此发现末尾的丢包和组播中断
+#define MULTICAST_HEARTBEAT_MS 1000
+// 接收方发现缺口后等待乱序报文的时间，以及重发 NAK 的间隔（毫秒）
+#define MULTICAST_NAK_DELAY_MS 20
+#define MULTICAST_NAK_RETRY_MS 200
+// 每次检查最多为多少段不连续的缺失发送 NAK
+#define MULTICAST_NAK_RANGES 16
+// 接收方超过该时间（毫秒）没有收到组播报文时退出组播，改由TCP接收
+#define MULTICAST_SILENCE_MS (3 * MULTICAST_HEARTBEAT_MS)
+
+/**
+ * 服务器端的组播发送：每个有成员订阅组播的群组一个通道，群组消息编码为
+ * OP_MULTICAST_DATA 帧后只发送一个数据报，服务器的出口流量与成员数无关。
+ * 每个通道的序列号连续，最近的数据报保存在重传窗口中，接收方发现缺口时通过TCP发送 NAK，
+ * 由收到 NAK 的分片从窗口中取出并通过该成员的TCP连接重传。
+ * 后台线程定期在每个通道上发送带最新序列号的心跳。所有方法都可以在任意线程调用
+ */
+class MulticastSender {
+public:
+    MulticastSender() = default;
+
+    ~MulticastSender();
+
+    MulticastSender(const MulticastSender &) = delete;
+
+    MulticastSender &operator=(const MulticastSender &) = delete;
+
+    /**
+     * 创建发送套接字并启动心跳线程
+     * @param interfaceAddress 发送组播的本机接口地址，例如局域网网卡的地址，在本机测试时为 127.0.0.1
+     * @return 是否成功
+     */
+    bool Open(const std::string &interfaceAddress);
+
+    // 群组对应的组播地址，格式为 地址:端口
+    static std::string AddressOf(std::string_view group);
+
+    /**
+     * 为群组创建通道（已存在时直接返回）
+     * @return 通道已分配的最后一个序列号
+     */
+    uint64_t Subscribe(std::string_view group);
+
+    // 通道已分配的最后一个序列号，没有通道时为 0
+    uint64_t LastSeq(std::string_view group) const;
+
+    /**
+     * 组播一条群组消息
+     * @param fields OP_MULTICAST_DATA 中序列号之后的字段：发送者、消息内容和可选的群组历史序列号
+     * @param bytes 输出，发送的数据报长度
+     * @return 分配的组播序列号，群组没有通道或消息过大时返回 0，由调用方通过TCP投递
+     */
+    uint64_t Send(std::string_view group, std::initializer_list<std::string_view> fields, size_t &bytes);
+
+    /**
+     * 取出重传窗口中序列号在 [from, to] 内的数据报
+     * @param frames 输出，按序列号排列的 OP_MULTICAST_DATA 帧
+     * @return 窗口中最早的序列号，小于该值的消息已无法重传；没有通道时为 0
+     */
+    uint64_t Retransmit(std::string_view group, uint64_t from, uint64_t to, std::vector<std::string> &frames) const;
+
+    // 热重启：导出和恢复各通道的序列号，新进程从旧进程的序列号继续编号
+    void Save(std::vector<std::string> &groups, std::vector<uint64_t> &seqs) const;
+
+    void Restore(const std::vector<std::string> &groups, const std::vector<uint64_t> &seqs);
+
+private:
+    struct Channel {
+        std::string name;
+        sockaddr_in addr{};
+        mutable std::mutex mutex;
+        uint64_t seq{};                  // 已分配的最后一个序列号
+        uint64_t firstSeq{1};            // 本进程发送的第一个序列号，热重启前的数据报不在窗口中
+        std::vector<std::string> window; // 按序列号取模的环形重传窗口，槽位的缓冲区复用
+    };
+
+    std::shared_ptr<Channel> Find(std::string_view group) const;
+
+    // 通道不存在时创建
+    std::shared_ptr<Channel> Create(std::string_view group);
+
+    // 在所有通道上发送心跳，直到 Close
+    void HeartbeatLoop();
+
+    void Close();
+
+    SOCKET sock{INVALID_SOCKET};
+    mutable std::shared_mutex mutex;
+    std::unordered_map<std::string, std::shared_ptr<Channel>> channels;
+    std::mutex stopMutex;
+    std::condition_variable stopCond;
+    bool stopping{false};
+    std::thread heartbeat;
+};
+
+/**
+ * 客户端的组播接收：处理服务器通过TCP发来的组播控制帧（MULTICAST_INFO、MULTICAST_ACTIVE、
+ * 重传的 MULTICAST_DATA、MULTICAST_GAP），读取组播数据报，按序列号排序后交给上层，
+ * 发现缺口时通过TCP发送 NAK，组播中断时发送 MULTICAST_LEAVE 退回TCP接收。
+ * 订阅流程：收到 MULTICAST_INFO 后加入组播地址，收到该群组的第一个数据报（心跳或消息）
+ * 证明组播可达后发送 MULTICAST_ACK，服务器回复 MULTICAST_ACTIVE 给出第一个只通过组播发送的序列号；
+ * 始终收不到组播的成员不会确认，继续通过TCP接收。
+ * 方法可以在不同线程调用，由内部的互斥锁串行化，回调在持有锁时调用，回调中不能再调用本对象
+ */
+class MulticastReceiver {
+public:
+    // 按序列号顺序交付 OP_MULTICAST_DATA 命令：群组名, 组播序列号, 发送者, 消息内容[, 群组历史序列号]
+    using DeliverCallback = std::function<void(const Command &cmd)>;
+    // 通过TCP向服务器发送组播控制命令
+    using RequestCallback = std::function<void(uint8_t opcode, std::initializer_list<std::string_view> fields)>;
+
+    MulticastReceiver(DeliverCallback onDeliver, RequestCallback onRequest);
+
+    ~MulticastReceiver();
+
+    MulticastReceiver(const MulticastReceiver &) = delete;
+
+    MulticastReceiver &operator=(const MulticastReceiver &) = delete;
+
+    /**
+     * 创建非阻塞的接收套接字并绑定组播端口
+     * @param interfaceAddress 加入组播的本机接口地址
+     * @return 是否成功
+     */
+    bool Open(const std::string &interfaceAddress);
+
+    // 接收套接字，供调用方等待可读
+    SOCKET Socket() const { return sock; }
+
+    /**
+     * 处理服务器通过TCP发来的命令
+     * @return 是否为组播相关的命令
+     */
+    bool OnServerCommand(const Command &cmd, uint64_t nowMs);
+
+    // 读取并处理套接字上所有已到达的数据报
+    void ReadDatagrams(uint64_t nowMs);
+
+    // 定期调用（建议每 MULTICAST_NAK_DELAY_MS 一次）：发送或重发 NAK，检查组播是否中断
+    void OnTick(uint64_t nowMs);
+
+    // 退出群组时停止接收该群组的组播
+    void Unsubscribe(std::string_view group);
+
+    // 乱序到达后被缓冲、以及通过TCP重传补齐的消息数
+    uint64_t Reordered() const { return reordered; }
+
+    uint64_t Repaired() const { return repaired; }
+
+private:
+    enum class State {
+        Probing, // 已加入组播地址，等待第一个数据报
+        Acked,   // 已确认，等待服务器给出第一个组播序列号，期间到达的数据报先缓冲
+        Active,  // 按序列号交付
+        Left     // 已退回TCP，只接受退出前缺失消息的重传
+    };
+
+    struct Channel {
+        State state{State::Probing};
+        uint32_t address{};          // 组播地址（网络字节序）
+        uint64_t next{1};            // 下一个应交付的序列号
+        uint64_t latest{};           // 已知的最新序列号（来自数据报和心跳）
+        uint64_t lastHeardMs{};      // 最近一次收到该群组数据报的时间
+        uint64_t gapSinceMs{};       // 发现当前缺口的时间，0 表示没有缺口
+        uint64_t nakSentMs{};        // 最近一次重新请求全部缺失消息的时间
+        uint64_t nakUntil{};         // 已请求重传的最大序列号，之后新发现的缺失不必等待重发间隔
+        std::map<uint64_t, std::string> pending; // 提前到达、等待交付的数据报
+    };
+
+    // 处理一条 OP_MULTICAST_DATA，repair 表示通过TCP重传
+    void OnData(const Command &cmd, bool repair, uint64_t nowMs);
+
+    // 收到群组的组播数据报，第一次收到时确认
+    void Heard(const std::string &group, Channel &channel, uint64_t seq, uint64_t nowMs);
+
+    // 依次交付从 next 开始连续的消息
+    void DeliverReady(Channel &channel);
+
+    // 交付缓冲的一条数据报
+    void DeliverFrame(const std::string &frame);
+
+    // 加入或退出组播地址，同一地址上的多个群组共享一次加入
+    void Join(uint32_t address);
+
+    void Drop(uint32_t address);
+
+    void Leave(const std::string &group, Channel &channel);
+
+    // 为 from 到已知最新序列号之间每段缺失（跳过已缓冲的）发送 NAK
+    void RequestGaps(const std::string &group, Channel &channel, uint64_t from);
+
+    DeliverCallback onDeliver;
+    RequestCallback onRequest;
+    SOCKET sock{INVALID_SOCKET};
+    in_addr localInterface{};
+    std::mutex mutex;
+    std::unordered_map<std::string, Channel> channels;
+    std::unordered_map<uint32_t, int> joined; // 组播地址的引用计数
+    std::vector<char> buffer; // 数据报的接收缓冲区
+    std::atomic<uint64_t> reordered{0};
+    std::atomic<uint64_t> repaired{0};
+};
+
+#endif //ONLINECHAT_MULTICAST_H
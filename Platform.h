@@ -0,0 +1,154 @@
+#ifndef ONLINECHAT_PLATFORM_H
+#define ONLINECHAT_PLATFORM_H
+
+/**
+ * 套接字平台适配层：在Windows下使用WinSock，在Linux/POSIX下提供同名的类型和函数，
+ * 使上层代码可以继续使用 SOCKET、INVALID_SOCKET、closesocket 等写法
+ */
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <csignal>
+#include <cerrno>
+#include <cstring>
+
+typedef int SOCKET;
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+#define strtok_s strtok_r
+
+inline int closesocket(SOCKET s) {
+    return close(s);
+}
+#endif
+
+/**
+ * 初始化网络库（Windows下调用WSAStartup，POSIX下忽略SIGPIPE）
+ * @return 初始化是否成功
+ */
+inline bool InitNetwork() {
+#ifdef _WIN32
+    WSADATA wsaData;
+    return WSAStartup(MAKEWORD(2, 2), &wsaData) == 0;
+#else
+    signal(SIGPIPE, SIG_IGN);
+    return true;
+#endif
+}
+
+// 释放网络库资源
+inline void CleanupNetwork() {
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+// 获取最近一次套接字错误码
+inline int LastSocketError() {
+#ifdef _WIN32
+    return WSAGetLastError();
+#else
+    return errno;
+#endif
+}
+
+// 判断错误码是否表示非阻塞操作暂时无法完成
+inline bool IsWouldBlock(int err) {
+#ifdef _WIN32
+    return err == WSAEWOULDBLOCK;
+#else
+    return err == EAGAIN || err == EWOULDBLOCK || err == EINTR;
+#endif
+}
+
+/**
+ * 将套接字设置为非阻塞模式
+ * @param s 套接字
+ * @return 设置是否成功
+ */
+inline bool SetNonBlocking(SOCKET s) {
+#ifdef _WIN32
+    u_long mode = 1;
+    return ioctlsocket(s, FIONBIO, &mode) == 0;
+#else
+    int flags = fcntl(s, F_GETFL, 0);
+    return flags != -1 && fcntl(s, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+/**
+ * 开启TCP保活：连接空闲 idleSec 秒后开始探测，每隔 intervalSec 秒一次，
+ * 连续 count 次没有响应时由内核断开连接。平台不支持的参数保持系统默认值
+ */
+inline void SetKeepAlive(SOCKET s, int idleSec, int intervalSec, int count) {
+    int on = 1;
+    setsockopt(s, SOL_SOCKET, SO_KEEPALIVE, (const char *) &on, sizeof(on));
+#if defined(TCP_KEEPIDLE)
+    setsockopt(s, IPPROTO_TCP, TCP_KEEPIDLE, (const char *) &idleSec, sizeof(idleSec));
+#elif defined(TCP_KEEPALIVE)
+    setsockopt(s, IPPROTO_TCP, TCP_KEEPALIVE, (const char *) &idleSec, sizeof(idleSec));
+#endif
+#ifdef TCP_KEEPINTVL
+    setsockopt(s, IPPROTO_TCP, TCP_KEEPINTVL, (const char *) &intervalSec, sizeof(intervalSec));
+#endif
+#ifdef TCP_KEEPCNT
+    setsockopt(s, IPPROTO_TCP, TCP_KEEPCNT, (const char *) &count, sizeof(count));
+#endif
+    (void) idleSec, (void) intervalSec, (void) count;
+}
+
+/**
+ * 分散发送的缓冲区描述，Windows下为 WSABUF，POSIX下为 iovec
+ */
+#ifdef _WIN32
+typedef WSABUF IoVec;
+
+inline void SetIoVec(IoVec &vec, const char *data, size_t len) {
+    vec.buf = (CHAR *) data;
+    vec.len = (ULONG) len;
+}
+#else
+typedef iovec IoVec;
+
+inline void SetIoVec(IoVec &vec, const char *data, size_t len) {
+    vec.iov_base = (void *) data;
+    vec.iov_len = len;
+}
+#endif
+
+/**
+ * 一次系统调用发送多个缓冲区
+ * @param more 后面紧接着还有数据（例如从文件发送的内容），Linux 下让内核等待后续数据再组成报文段
+ * @return 发送的字节数，出错时返回 -1
+ */
+inline long SendVector(SOCKET s, IoVec *vec, int count, bool more = false) {
+#ifdef _WIN32
+    (void) more;
+    DWORD sent = 0;
+    if (WSASend(s, vec, (DWORD) count, &sent, 0, nullptr, nullptr) == SOCKET_ERROR) return -1;
+    return (long) sent;
+#else
+    msghdr msg{};
+    msg.msg_iov = vec;
+    msg.msg_iovlen = count;
+    int flags = MSG_NOSIGNAL;
+#ifdef MSG_MORE
+    if (more) flags |= MSG_MORE;
+#else
+    (void) more;
+#endif
+    return (long) sendmsg(s, &msg, flags);
+#endif
+}
+
+#endif //ONLINECHAT_PLATFORM_H
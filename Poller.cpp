@@ -0,0 +1,187 @@
+#include "Poller.h"
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+// 每次 epoll_wait 最多取回的事件数
+#define MAX_EVENTS 256
+
+Poller::Poller() {
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epfd != -1 && wakeFd != -1) {
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.ptr = &wakeFd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, wakeFd, &ev);
+    }
+}
+
+Poller::~Poller() {
+    if (wakeFd != -1) close(wakeFd);
+    if (epfd != -1) close(epfd);
+}
+
+bool Poller::Valid() const {
+    return epfd != -1 && wakeFd != -1;
+}
+
+bool Poller::Add(SOCKET s, void *ptr) {
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = ptr;
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, s, &ev) == 0;
+}
+
+void Poller::SetWriteInterest(SOCKET, bool) {
+    // 边缘触发模式下 EPOLLOUT 只在发送缓冲区由满变为可写时通知一次，无需切换
+}
+
+void Poller::SetReadInterest(SOCKET, bool) {
+    // 边缘触发模式下暂停期间到达的数据不会重复通知，由调用方恢复时主动读取
+}
+
+void Poller::Remove(SOCKET s) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, s, nullptr);
+}
+
+int Poller::Wait(std::vector<PollEvent> &events, int timeoutMs) {
+    epoll_event ready[MAX_EVENTS];
+    events.clear();
+    int n = epoll_wait(epfd, ready, MAX_EVENTS, timeoutMs);
+    if (n < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+    for (int i = 0; i < n; i++) {
+        if (ready[i].data.ptr == &wakeFd) {
+            uint64_t value;
+            while (read(wakeFd, &value, sizeof(value)) > 0) {}
+            continue;
+        }
+        PollEvent ev;
+        ev.ptr = ready[i].data.ptr;
+        ev.readable = (ready[i].events & (EPOLLIN | EPOLLRDHUP)) != 0;
+        ev.writable = (ready[i].events & EPOLLOUT) != 0;
+        ev.error = (ready[i].events & (EPOLLERR | EPOLLHUP)) != 0;
+        events.push_back(ev);
+    }
+    return (int) events.size();
+}
+
+void Poller::Wakeup() {
+    uint64_t one = 1;
+    ssize_t ret = write(wakeFd, &one, sizeof(one));
+    (void) ret;
+}
+
+#else
+
+#ifdef _WIN32
+#define poll WSAPoll
+#endif
+
+Poller::Poller() {
+    // 使用一个连接到自身的回环UDP套接字作为唤醒通道
+    wakeSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (wakeSocket == INVALID_SOCKET) return;
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (bind(wakeSocket, (sockaddr *) &addr, sizeof(addr)) == SOCKET_ERROR ||
+        getsockname(wakeSocket, (sockaddr *) &addr, &len) == SOCKET_ERROR ||
+        connect(wakeSocket, (sockaddr *) &addr, sizeof(addr)) == SOCKET_ERROR) {
+        closesocket(wakeSocket);
+        wakeSocket = INVALID_SOCKET;
+        return;
+    }
+    SetNonBlocking(wakeSocket);
+    Add(wakeSocket, &wakeSocket);
+    SetWriteInterest(wakeSocket, false);
+}
+
+Poller::~Poller() {
+    if (wakeSocket != INVALID_SOCKET) closesocket(wakeSocket);
+}
+
+bool Poller::Valid() const {
+    return wakeSocket != INVALID_SOCKET;
+}
+
+bool Poller::Add(SOCKET s, void *ptr) {
+    pollfd pfd{};
+    pfd.fd = s;
+    pfd.events = POLLIN | POLLOUT;
+    index[s] = fds.size();
+    fds.push_back(pfd);
+    ptrs.push_back(ptr);
+    return true;
+}
+
+void Poller::SetWriteInterest(SOCKET s, bool enable) {
+    auto it = index.find(s);
+    if (it == index.end()) return;
+    if (enable) {
+        fds[it->second].events |= POLLOUT;
+    } else {
+        fds[it->second].events &= ~POLLOUT;
+    }
+}
+
+void Poller::SetReadInterest(SOCKET s, bool enable) {
+    auto it = index.find(s);
+    if (it == index.end()) return;
+    if (enable) {
+        fds[it->second].events |= POLLIN;
+    } else {
+        fds[it->second].events &= ~POLLIN;
+    }
+}
+
+void Poller::Remove(SOCKET s) {
+    auto it = index.find(s);
+    if (it == index.end()) return;
+    size_t pos = it->second;
+    index.erase(it);
+    // 与末尾元素交换后删除，保持数组紧凑
+    if (pos != fds.size() - 1) {
+        fds[pos] = fds.back();
+        ptrs[pos] = ptrs.back();
+        index[fds[pos].fd] = pos;
+    }
+    fds.pop_back();
+    ptrs.pop_back();
+}
+
+int Poller::Wait(std::vector<PollEvent> &events, int timeoutMs) {
+    events.clear();
+    int n = poll(fds.data(), (unsigned long) fds.size(), timeoutMs);
+    if (n <= 0) {
+        return n < 0 && !IsWouldBlock(LastSocketError()) ? -1 : 0;
+    }
+    // 回调中可能增删套接字，先收集再返回
+    for (size_t i = 0; i < fds.size(); i++) {
+        short re = fds[i].revents;
+        if (re == 0) continue;
+        if (ptrs[i] == &wakeSocket) {
+            char drain[64];
+            while (recv(wakeSocket, drain, sizeof(drain), 0) > 0) {}
+            continue;
+        }
+        PollEvent ev;
+        ev.ptr = ptrs[i];
+        ev.readable = (re & POLLIN) != 0;
+        ev.writable = (re & POLLOUT) != 0;
+        ev.error = (re & (POLLERR | POLLHUP | POLLNVAL)) != 0;
+        events.push_back(ev);
+    }
+    return (int) events.size();
+}
+
+void Poller::Wakeup() {
+    char one = 1;
+    send(wakeSocket, &one, 1, 0);
+}
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef ONLINECHAT_POLLER_H
+#define ONLINECHAT_POLLER_H
+
+#include "Platform.h"
+#include <vector>
+#include <unordered_map>
+
+#ifndef __linux__
+#ifdef _WIN32
+typedef WSAPOLLFD pollfd;
+#else
+#include <poll.h>
+#endif
+#endif
+
+/**
+ * 就绪事件，ptr 为注册套接字时关联的指针
+ */
+struct PollEvent {
+    void *ptr{};
+    bool readable{};
+    bool writable{};
+    bool error{};  // 挂断或出错
+};
+
+/**
+ * I/O多路复用后端：Linux下使用边缘触发的epoll，其它平台退化为WSAPoll/poll。
+ * 调用方必须在可读/可写事件中一直读写到 IsWouldBlock，两种后端的语义才一致。
+ */
+class Poller {
+public:
+    Poller();
+
+    ~Poller();
+
+    Poller(const Poller &) = delete;
+
+    Poller &operator=(const Poller &) = delete;
+
+    // 后端是否创建成功
+    bool Valid() const;
+
+    /**
+     * 注册套接字，同时关注可读和可写
+     * @param s 套接字
+     * @param ptr 事件回传的关联指针
+     * @return 注册是否成功
+     */
+    bool Add(SOCKET s, void *ptr);
+
+    /**
+     * 开启或关闭可写关注。边缘触发的epoll始终关注可写，只在非epoll后端生效
+     * @param s 套接字
+     * @param enable 是否关注可写
+     */
+    void SetWriteInterest(SOCKET s, bool enable);
+
+    /**
+     * 开启或关闭可读关注，用于暂停读取。边缘触发的epoll不切换，由调用方在暂停期间不读取，
+     * 恢复时主动读一次；只在非epoll后端生效
+     * @param s 套接字
+     * @param enable 是否关注可读
+     */
+    void SetReadInterest(SOCKET s, bool enable);
+
+    // 注销套接字，须在关闭套接字之前调用
+    void Remove(SOCKET s);
+
+    /**
+     * 等待就绪事件
+     * @param events 输出的事件列表（会先被清空）
+     * @param timeoutMs 超时时间（毫秒），-1 表示一直等待
+     * @return 就绪事件数，出错时返回 -1
+     */
+    int Wait(std::vector<PollEvent> &events, int timeoutMs);
+
+    // 从任意线程唤醒阻塞在 Wait 中的事件循环
+    void Wakeup();
+
+private:
+#ifdef __linux__
+    int epfd{-1};
+    int wakeFd{-1};
+#else
+    std::vector<pollfd> fds;
+    std::vector<void *> ptrs;
+    std::unordered_map<SOCKET, size_t> index;
+    SOCKET wakeSocket{INVALID_SOCKET};
+#endif
+};
+
+#endif //ONLINECHAT_POLLER_H
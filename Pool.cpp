@@ -0,0 +1,121 @@
+#include "Pool.h"
+#include <mutex>
+#include <new>
+
+#define POOL_CLASSES (POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1)
+
+/**
+ * 空闲块的头部，直接存放在空闲块内。同一批的块通过 next 相连，
+ * 仓库中的各批通过每批第一个块的 nextBatch 相连
+ */
+struct FreeBlock {
+    FreeBlock *next;
+    FreeBlock *nextBatch;
+    size_t count;  // 本批的块数，只在每批第一个块中有效
+};
+
+static_assert(sizeof(FreeBlock) <= ((size_t) 1 << POOL_MIN_SHIFT), "smallest class must hold a free block header");
+
+static int ClassOf(size_t size) {
+    int cls = 0;
+    while (((size_t) 1 << (POOL_MIN_SHIFT + cls)) < size) cls++;
+    return cls;
+}
+
+static size_t ClassSize(int cls) {
+    return (size_t) 1 << (POOL_MIN_SHIFT + cls);
+}
+
+// 每批转移的块数，大块至少两个一批
+static size_t BatchCount(int cls) {
+    size_t count = POOL_BATCH_BYTES / ClassSize(cls);
+    return count < 2 ? 2 : count;
+}
+
+/**
+ * 全局仓库，按分级保存线程缓存交回的整批空闲块
+ */
+struct PoolDepot {
+    std::mutex mutex;
+    FreeBlock *batches[POOL_CLASSES]{};
+
+    void Put(int cls, FreeBlock *batch) {
+        std::lock_guard<std::mutex> lock(mutex);
+        batch->nextBatch = batches[cls];
+        batches[cls] = batch;
+    }
+
+    FreeBlock *Take(int cls) {
+        std::lock_guard<std::mutex> lock(mutex);
+        FreeBlock *batch = batches[cls];
+        if (batch) batches[cls] = batch->nextBatch;
+        return batch;
+    }
+};
+
+// 仓库永不析构：其它线程的缓存可能在静态对象析构之后才把空闲块交回
+static PoolDepot &Depot() {
+    static auto *depot = new PoolDepot;
+    return *depot;
+}
+
+/**
+ * 线程私有的空闲块缓存，线程结束时把剩余的块交回仓库
+ */
+struct PoolThreadCache {
+    FreeBlock *head[POOL_CLASSES]{};
+    size_t count[POOL_CLASSES]{};
+
+    ~PoolThreadCache() {
+        for (int cls = 0; cls < POOL_CLASSES; cls++) {
+            if (head[cls] == nullptr) continue;
+            head[cls]->count = count[cls];
+            Depot().Put(cls, head[cls]);
+        }
+    }
+};
+
+static thread_local PoolThreadCache threadCache;
+
+void *BufferPool::Allocate(size_t size) {
+    if (size > ClassSize(POOL_CLASSES - 1)) return ::operator new(size);
+    int cls = ClassOf(size);
+    PoolThreadCache &cache = threadCache;
+    if (cache.head[cls] == nullptr) {
+        FreeBlock *batch = Depot().Take(cls);
+        if (batch == nullptr) return ::operator new(ClassSize(cls));
+        cache.head[cls] = batch;
+        cache.count[cls] = batch->count;
+    }
+    FreeBlock *block = cache.head[cls];
+    cache.head[cls] = block->next;
+    cache.count[cls]--;
+    return block;
+}
+
+void BufferPool::Free(void *p, size_t size) {
+    if (size > ClassSize(POOL_CLASSES - 1)) {
+        ::operator delete(p);
+        return;
+    }
+    int cls = ClassOf(size);
+    PoolThreadCache &cache = threadCache;
+    auto *block = static_cast<FreeBlock *>(p);
+    block->next = cache.head[cls];
+    cache.head[cls] = block;
+    size_t batchCount = BatchCount(cls);
+    if (++cache.count[cls] < 2 * batchCount) return;
+    // 缓存过多时把最近释放的一批交回仓库，供在其它线程分配的场景使用
+    FreeBlock *last = block;
+    for (size_t i = 1; i < batchCount; i++) last = last->next;
+    cache.head[cls] = last->next;
+    cache.count[cls] -= batchCount;
+    last->next = nullptr;
+    block->count = batchCount;
+    Depot().Put(cls, block);
+}
+
+size_t BufferPool::Capacity(size_t size) {
+    if (size > ClassSize(POOL_CLASSES - 1)) return size;
+    return ClassSize(ClassOf(size));
+}
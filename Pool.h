@@ -0,0 +1,39 @@
+#ifndef ONLINECHAT_POOL_H
+#define ONLINECHAT_POOL_H
+
+#include <cstddef>
+
+// 最小和最大分级的大小（2 的幂），超过最大分级的请求直接向系统申请
+#define POOL_MIN_SHIFT 6
+#define POOL_MAX_SHIFT 16
+// 线程缓存与全局仓库之间每批转移的字节数
+#define POOL_BATCH_BYTES (64 * 1024)
+
+/**
+ * 按大小分级的缓冲区池，用于接收缓冲区、编码后的帧和共享消息。
+ * 每个线程缓存各级的空闲块，分配和释放只操作线程私有的链表；
+ * 线程缓存超过两批时把一批交给全局仓库，缓存为空时从仓库取回一批，
+ * 因此在一个分片编码、在另一个分片释放的帧也能循环使用。
+ * 空闲块在进程结束前不归还给系统
+ */
+class BufferPool {
+public:
+    /**
+     * 分配至少 size 字节
+     * @param size 请求的字节数
+     * @return 内存块，大小为 Capacity(size)
+     */
+    static void *Allocate(size_t size);
+
+    /**
+     * 释放内存块，可以在任意线程调用
+     * @param p 内存块
+     * @param size 分配时请求的字节数
+     */
+    static void Free(void *p, size_t size);
+
+    // 请求 size 字节时实际分配的大小
+    static size_t Capacity(size_t size);
+};
+
+#endif //ONLINECHAT_POOL_H
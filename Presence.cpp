@@ -0,0 +1,58 @@
+#include "Presence.h"
+
+Presence::Presence(const Registry &registry, int windowMs) : registry(registry), windowMs(windowMs) {}
+
+bool Presence::Touch(const std::string &username) {
+    std::lock_guard<std::mutex> lock(mutex);
+    bool first = touched.empty();
+    touched.insert(username);
+    return first;
+}
+
+bool Presence::TakeDelta(PresenceDelta &delta) {
+    std::lock_guard<std::mutex> lock(mutex);
+    delta.joined.clear();
+    delta.left.clear();
+    for (const auto &username: touched) {
+        // 以发布时用户目录中的状态为准，不依赖各分片记录变更的先后顺序
+        ClientHandle handle;
+        bool isOnline = registry.FindUser(username, handle);
+        bool wasOnline = online.count(username) > 0;
+        if (isOnline && !wasOnline) {
+            online.insert(username);
+            delta.joined += username + " ";
+        } else if (!isOnline && wasOnline) {
+            online.erase(username);
+            delta.left += username + " ";
+        }
+    }
+    touched.clear();
+    if (delta.joined.empty() && delta.left.empty()) return false;
+    delta.seq = ++seq;
+    return true;
+}
+
+uint64_t Presence::Snapshot(std::string &users) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    users.clear();
+    for (const auto &username: online) {
+        users += username + " ";
+    }
+    return seq;
+}
+
+uint64_t Presence::Save(std::vector<std::string> &onlineUsers, std::vector<std::string> &touchedUsers) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    onlineUsers.assign(online.begin(), online.end());
+    touchedUsers.assign(touched.begin(), touched.end());
+    return seq;
+}
+
+bool Presence::Restore(uint64_t savedSeq, const std::vector<std::string> &onlineUsers,
+                       const std::vector<std::string> &touchedUsers) {
+    std::lock_guard<std::mutex> lock(mutex);
+    seq = savedSeq;
+    online.insert(onlineUsers.begin(), onlineUsers.end());
+    touched.insert(touchedUsers.begin(), touchedUsers.end());
+    return !touched.empty();
+}
@@ -0,0 +1,83 @@
+#ifndef ONLINECHAT_PRESENCE_H
+#define ONLINECHAT_PRESENCE_H
+
+#include "Registry.h"
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// 默认的在线状态合并窗口（毫秒）
+#define PRESENCE_WINDOW_MS 50
+
+/**
+ * 一次发布的在线状态增量，用户名以空格分隔
+ */
+struct PresenceDelta {
+    uint64_t seq{};
+    std::string joined;
+    std::string left;
+};
+
+/**
+ * 在线状态：记录窗口内发生变化的用户，窗口结束时与用户目录比较，
+ * 合并为一条带序列号的上线/下线增量。窗口内先上线后下线的用户不会出现在增量中。
+ * 客户端在注册或请求时收到带序列号的完整快照，之后只接收序列号更大的增量，
+ * 发现序列号不连续时重新请求快照
+ */
+class Presence {
+public:
+    /**
+     * @param registry 用户目录，发布增量时以其中的在线状态为准
+     * @param windowMs 合并窗口（毫秒）
+     */
+    Presence(const Registry &registry, int windowMs);
+
+    int WindowMs() const { return windowMs; }
+
+    /**
+     * 记录用户的在线状态可能发生了变化，可在任意线程调用
+     * @return 是否为本窗口的第一条变更，是时调用方需要在窗口结束后发布一次增量
+     */
+    bool Touch(const std::string &username);
+
+    /**
+     * 结束当前窗口，生成增量并更新已发布的在线用户集合
+     * @return 窗口内的变更相互抵消、没有需要发布的增量时返回 false
+     */
+    bool TakeDelta(PresenceDelta &delta);
+
+    /**
+     * 已发布的在线用户快照
+     * @param users 以空格分隔的在线用户名
+     * @return 快照对应的序列号
+     */
+    uint64_t Snapshot(std::string &users) const;
+
+    /**
+     * 导出全部状态，用于热重启时交给新进程
+     * @param online 输出已发布的在线用户
+     * @param touched 输出本窗口内尚未发布的变更
+     * @return 最近一次发布的序列号
+     */
+    uint64_t Save(std::vector<std::string> &online, std::vector<std::string> &touched) const;
+
+    /**
+     * 恢复旧进程导出的状态，客户端收到的序列号保持连续
+     * @return 是否有尚未发布的变更，是时调用方需要安排一次发布
+     */
+    bool Restore(uint64_t seq, const std::vector<std::string> &online, const std::vector<std::string> &touched);
+
+private:
+    const Registry &registry;
+    int windowMs;
+    mutable std::mutex mutex;
+    uint64_t seq{0};
+    // 已发布的在线用户
+    std::unordered_set<std::string> online;
+    // 本窗口内状态可能变化的用户
+    std::unordered_set<std::string> touched;
+};
+
+#endif //ONLINECHAT_PRESENCE_H
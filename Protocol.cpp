@@ -0,0 +1,363 @@
+#include "Protocol.h"
+#include <algorithm>
+#include <cstring>
+
+static uint32_t ReadU32(const char *p) {
+    auto *u = (const unsigned char *) p;
+    return ((uint32_t) u[0] << 24) | ((uint32_t) u[1] << 16) | ((uint32_t) u[2] << 8) | (uint32_t) u[3];
+}
+
+static uint16_t ReadU16(const char *p) {
+    auto *u = (const unsigned char *) p;
+    return (uint16_t) (((uint16_t) u[0] << 8) | u[1]);
+}
+
+ProtocolMode DetectProtocol(char firstByte) {
+    return firstByte == 0 ? PROTOCOL_BINARY : PROTOCOL_TEXT;
+}
+
+DecodeResult DecodeBinary(const char *data, size_t len, Command &cmd, size_t &size) {
+    if (len < 4) {
+        size = 4;
+        return DecodeResult::NeedMore;
+    }
+    size_t total = 4 + (size_t) ReadU32(data);
+    if (total < FRAME_HEADER_SIZE || total > MAX_FRAME_SIZE) return DecodeResult::Invalid;
+    if (len < total) {
+        size = total;
+        return DecodeResult::NeedMore;
+    }
+    cmd.version = (uint8_t) data[4];
+    cmd.opcode = (uint8_t) data[5];
+    cmd.fieldCount = ReadU16(data + 6);
+    if (cmd.fieldCount > MAX_FIELDS) return DecodeResult::Invalid;
+    size_t pos = FRAME_HEADER_SIZE;
+    for (int i = 0; i < cmd.fieldCount; i++) {
+        if (total - pos < 4) return DecodeResult::Invalid;
+        size_t fieldLen = ReadU32(data + pos);
+        pos += 4;
+        if (total - pos < fieldLen) return DecodeResult::Invalid;
+        cmd.fields[i] = std::string_view(data + pos, fieldLen);
+        pos += fieldLen;
+    }
+    if (pos != total) return DecodeResult::Invalid;
+    size = total;
+    return DecodeResult::Ok;
+}
+
+/**
+ * 文本命令的参数布局：跳过前 skip 个参数，再取 args 个以空格分隔的参数，
+ * rest 为 true 时行内剩余部分整体作为最后一个字段
+ */
+struct TextLayout {
+    const char *name;
+    uint8_t opcode;
+    int skip;
+    int args;
+    bool rest;
+};
+
+static const TextLayout textLayouts[] = {
+        {"REGISTER",      OP_REGISTER,      1, 1, false}, // REGISTER SERVER <用户名>
+        {"MESSAGE",       OP_MESSAGE,       0, 1, true},  // MESSAGE <用户> <内容>
+        {"CREATE_GROUP",  OP_CREATE_GROUP,  0, 1, false}, // CREATE_GROUP <群组>
+        {"JOIN_GROUP",    OP_JOIN_GROUP,    1, 1, false}, // JOIN_GROUP JOIN <群组>
+        {"GROUP_CHECK",   OP_GROUP_CHECK,   0, 1, false}, // GROUP_CHECK <群组>
+        {"GROUP_MESSAGE", OP_GROUP_MESSAGE, 1, 1, true},  // GROUP_MESSAGE GROUP <群组> <内容>
+        {"REMOVE",        OP_REMOVE,        0, 0, false}, // REMOVE SERVER <用户名>
+        {"PRESENCE_SYNC", OP_PRESENCE_SYNC, 0, 0, false}, // PRESENCE_SYNC
+        {"LEAVE_GROUP",   OP_LEAVE_GROUP,   1, 1, false}, // LEAVE_GROUP LEAVE <群组>
+        {"HISTORY",       OP_HISTORY,       0, 2, false}, // HISTORY <群组或用户> <序列号>
+        {"PING",          OP_PING,          0, 1, false}, // PING <令牌>
+        {"PONG",          OP_PONG,          0, 1, false}, // PONG <令牌>
+};
+
+// 取下一个以空格分隔的词，line 前进到词之后
+static std::string_view NextToken(std::string_view &line) {
+    size_t begin = line.find_first_not_of(' ');
+    if (begin == std::string_view::npos) {
+        line = {};
+        return {};
+    }
+    size_t end = line.find(' ', begin);
+    if (end == std::string_view::npos) end = line.size();
+    std::string_view token = line.substr(begin, end - begin);
+    line.remove_prefix(end);
+    return token;
+}
+
+DecodeResult DecodeText(const char *data, size_t len, bool lineMode, Command &cmd, size_t &size) {
+    const char *newline = (const char *) memchr(data, '\n', len);
+    if (newline == nullptr && lineMode) {
+        size = len + 1;
+        return DecodeResult::NeedMore;
+    }
+    size_t lineLen = newline ? (size_t) (newline - data) : len;
+    size = newline ? lineLen + 1 : len;
+    std::string_view line(data, lineLen);
+    while (!line.empty() && (line.back() == '\r' || line.back() == '\0')) line.remove_suffix(1);
+
+    cmd.version = 0;
+    cmd.opcode = 0;
+    cmd.fieldCount = 0;
+    std::string_view name = NextToken(line);
+    const TextLayout *layout = nullptr;
+    for (const auto &l: textLayouts) {
+        if (name == l.name) layout = &l;
+    }
+    // 未知命令保持 opcode 为 0，由上层忽略
+    if (layout == nullptr) return DecodeResult::Ok;
+    cmd.opcode = layout->opcode;
+
+    for (int i = 0; i < layout->skip; i++) {
+        std::string_view skipped = NextToken(line);
+        // 注册命令的第二段必须为 "SERVER"，否则不解析用户名，由上层回复格式错误
+        if (layout->opcode == OP_REGISTER && skipped != "SERVER") return DecodeResult::Ok;
+    }
+    for (int i = 0; i < layout->args; i++) {
+        std::string_view token = NextToken(line);
+        if (token.empty()) return DecodeResult::Ok;
+        cmd.fields[cmd.fieldCount++] = token;
+    }
+    if (layout->rest) {
+        size_t begin = line.find_first_not_of(' ');
+        if (begin == std::string_view::npos) return DecodeResult::Ok;
+        cmd.fields[cmd.fieldCount++] = line.substr(begin);
+    }
+    return DecodeResult::Ok;
+}
+
+const char *OpcodeName(uint8_t opcode) {
+    switch (opcode) {
+        case OP_HELLO:
+            return "HELLO";
+        case OP_REGISTER:
+            return "REGISTER";
+        case OP_MESSAGE:
+            return "MESSAGE";
+        case OP_CREATE_GROUP:
+            return "CREATE_GROUP";
+        case OP_JOIN_GROUP:
+            return "JOIN_GROUP";
+        case OP_GROUP_CHECK:
+            return "GROUP_CHECK";
+        case OP_GROUP_MESSAGE:
+            return "GROUP_MESSAGE";
+        case OP_REMOVE:
+            return "REMOVE";
+        case OP_PRESENCE_SYNC:
+            return "PRESENCE_SYNC";
+        case OP_LEAVE_GROUP:
+            return "LEAVE_GROUP";
+        case OP_HISTORY:
+            return "HISTORY";
+        case OP_PING:
+            return "PING";
+        case OP_PONG:
+            return "PONG";
+        case OP_MULTICAST_SUBSCRIBE:
+            return "MULTICAST_SUBSCRIBE";
+        case OP_MULTICAST_ACK:
+            return "MULTICAST_ACK";
+        case OP_MULTICAST_NAK:
+            return "MULTICAST_NAK";
+        case OP_MULTICAST_LEAVE:
+            return "MULTICAST_LEAVE";
+        case OP_SEND_FILE:
+            return "SEND_FILE";
+        case OP_GROUP_FILE:
+            return "GROUP_FILE";
+        case OP_FILE_CHUNK:
+            return "FILE_CHUNK";
+        case OP_FILE_GET:
+            return "FILE_GET";
+        case OP_FILE_CANCEL:
+            return "FILE_CANCEL";
+        default:
+            return "UNKNOWN";
+    }
+}
+
+static char *WriteU32(char *out, uint32_t v) {
+    out[0] = (char) (v >> 24);
+    out[1] = (char) (v >> 16);
+    out[2] = (char) (v >> 8);
+    out[3] = (char) v;
+    return out + 4;
+}
+
+size_t BinaryFrameSize(const std::string_view *fields, size_t count) {
+    size_t size = FRAME_HEADER_SIZE;
+    for (size_t i = 0; i < count; i++) size += 4 + fields[i].size();
+    return size;
+}
+
+void WriteBinaryFrame(char *out, uint8_t opcode, const std::string_view *fields, size_t count) {
+    out = WriteU32(out, (uint32_t) (BinaryFrameSize(fields, count) - 4));
+    *out++ = (char) PROTOCOL_VERSION;
+    *out++ = (char) opcode;
+    *out++ = (char) (count >> 8);
+    *out++ = (char) count;
+    for (size_t i = 0; i < count; i++) {
+        out = WriteU32(out, (uint32_t) fields[i].size());
+        memcpy(out, fields[i].data(), fields[i].size());
+        out += fields[i].size();
+    }
+}
+
+size_t BinaryHeadSize(const std::string_view *fields, size_t count) {
+    return BinaryFrameSize(fields, count) + 4;
+}
+
+void WriteBinaryHead(char *out, uint8_t opcode, const std::string_view *fields, size_t count, size_t lastSize) {
+    out = WriteU32(out, (uint32_t) (BinaryHeadSize(fields, count) + lastSize - 4));
+    *out++ = (char) PROTOCOL_VERSION;
+    *out++ = (char) opcode;
+    *out++ = (char) ((count + 1) >> 8);
+    *out++ = (char) (count + 1);
+    for (size_t i = 0; i < count; i++) {
+        out = WriteU32(out, (uint32_t) fields[i].size());
+        memcpy(out, fields[i].data(), fields[i].size());
+        out += fields[i].size();
+    }
+    WriteU32(out, (uint32_t) lastSize);
+}
+
+DecodeResult DecodeBinaryHead(const char *data, size_t len, Command &cmd, size_t &size) {
+    if (len < FRAME_HEADER_SIZE) return DecodeResult::NeedMore;
+    size_t total = 4 + (size_t) ReadU32(data);
+    if (total < FRAME_HEADER_SIZE || total > MAX_FRAME_SIZE) return DecodeResult::Invalid;
+    cmd.version = (uint8_t) data[4];
+    cmd.opcode = (uint8_t) data[5];
+    cmd.fieldCount = ReadU16(data + 6);
+    if (cmd.fieldCount == 0 || cmd.fieldCount > MAX_FIELDS) return DecodeResult::Invalid;
+    size_t available = std::min(len, total);
+    size_t pos = FRAME_HEADER_SIZE;
+    for (int i = 0; i < cmd.fieldCount; i++) {
+        if (available - pos < 4) return total - pos < 4 ? DecodeResult::Invalid : DecodeResult::NeedMore;
+        size_t fieldLen = ReadU32(data + pos);
+        pos += 4;
+        if (total - pos < fieldLen) return DecodeResult::Invalid;
+        bool last = i == cmd.fieldCount - 1;
+        if (last) {
+            // 最后一个字段必须延伸到帧尾
+            if (pos + fieldLen != total) return DecodeResult::Invalid;
+            fieldLen = std::min(fieldLen, available - pos);
+        } else if (available - pos < fieldLen) {
+            return DecodeResult::NeedMore;
+        }
+        cmd.fields[i] = std::string_view(data + pos, fieldLen);
+        pos += fieldLen;
+    }
+    size = total;
+    return DecodeResult::Ok;
+}
+
+void AppendBinaryFrame(std::string &out, uint8_t opcode, const std::string_view *fields, size_t count) {
+    size_t offset = out.size();
+    out.resize(offset + BinaryFrameSize(fields, count));
+    WriteBinaryFrame(&out[offset], opcode, fields, count);
+}
+
+// 文本协议的格式：字段之间插入固定的前缀和分隔符，最多 8 段
+#define MAX_TEXT_PIECES 8
+
+// 把消息拆成依次拼接的文本片段，返回片段数
+static size_t TextPieces(uint8_t opcode, const std::string_view *fields, size_t count, std::string_view *pieces) {
+    auto field = [&](size_t i) -> std::string_view {
+        return i < count ? fields[i] : std::string_view();
+    };
+    switch (opcode) {
+        case OP_DELIVER:
+            pieces[0] = field(0);
+            pieces[1] = ": ";
+            pieces[2] = field(1);
+            return 3;
+        case OP_GROUP_DELIVER:
+            pieces[0] = "(";
+            pieces[1] = field(0);
+            pieces[2] = ") ";
+            pieces[3] = field(1);
+            pieces[4] = ": ";
+            pieces[5] = field(2);
+            return 6;
+        case OP_ONLINE_USERS:
+            // 保持旧格式，文本客户端从在线状态增量中取得序列号
+            pieces[0] = "Server: Online users: ";
+            pieces[1] = field(0);
+            return 2;
+        case OP_GROUP_LIST:
+            pieces[0] = "Server: Group list: ";
+            pieces[1] = field(0);
+            return 2;
+        case OP_GROUP_MEMBERS:
+            pieces[0] = "Server: Group members: ";
+            pieces[1] = field(0);
+            return 2;
+        case OP_PRESENCE:
+            pieces[0] = "Server: Presence ";
+            pieces[1] = field(0);
+            pieces[2] = " joined: ";
+            pieces[3] = field(1);
+            pieces[4] = "left: ";
+            pieces[5] = field(2);
+            return 6;
+        case OP_HISTORY_MESSAGE:
+            pieces[0] = "[history ";
+            pieces[1] = field(0);
+            pieces[2] = " #";
+            pieces[3] = field(1);
+            pieces[4] = "] ";
+            pieces[5] = field(2);
+            pieces[6] = ": ";
+            pieces[7] = field(3);
+            return 8;
+        case OP_HISTORY_END:
+            pieces[0] = "Server: History ";
+            pieces[1] = field(0);
+            pieces[2] = " ";
+            pieces[3] = field(1);
+            pieces[4] = " ";
+            pieces[5] = field(2);
+            return 6;
+        case OP_SERVER_PING:
+            pieces[0] = field(0).empty() ? "PING" : "PING ";
+            pieces[1] = field(0);
+            return 2;
+        case OP_SERVER_PONG:
+            pieces[0] = field(0).empty() ? "PONG" : "PONG ";
+            pieces[1] = field(0);
+            return 2;
+        case OP_FILE_OFFER:
+            // 文本客户端不能下载，只提示有文件
+            pieces[0] = "Server: File from ";
+            pieces[1] = field(1);
+            pieces[2] = ": ";
+            pieces[3] = field(2);
+            pieces[4] = " (";
+            pieces[5] = field(3);
+            pieces[6] = " bytes), download requires the binary protocol.";
+            return 7;
+        default:
+            pieces[0] = field(0);
+            return 1;
+    }
+}
+
+size_t TextFrameSize(uint8_t opcode, const std::string_view *fields, size_t count, bool lineMode) {
+    std::string_view pieces[MAX_TEXT_PIECES];
+    size_t n = TextPieces(opcode, fields, count, pieces);
+    size_t size = lineMode ? 1 : 0;
+    for (size_t i = 0; i < n; i++) size += pieces[i].size();
+    return size;
+}
+
+void WriteTextFrame(char *out, uint8_t opcode, const std::string_view *fields, size_t count, bool lineMode) {
+    std::string_view pieces[MAX_TEXT_PIECES];
+    size_t n = TextPieces(opcode, fields, count, pieces);
+    for (size_t i = 0; i < n; i++) {
+        memcpy(out, pieces[i].data(), pieces[i].size());
+        out += pieces[i].size();
+    }
+    if (lineMode) *out = '\n';
+}
@@ -0,0 +1,165 @@
+#ifndef ONLINECHAT_PROTOCOL_H
+#define ONLINECHAT_PROTOCOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * 二进制帧格式（多字节整数均为网络字节序）：
+ *   u32 长度（不含长度字段本身） | u8 版本 | u8 操作码 | u16 字段数 | 字段...
+ *   每个字段为 u32 长度 + 内容
+ * 二进制客户端的第一帧必须是 HELLO，由于帧长度小于16MB，首字节总是 0；
+ * 首字节不为 0 的连接按旧的文本协议处理
+ */
+#define PROTOCOL_VERSION 1
+#define FRAME_HEADER_SIZE 8
+#define MAX_FRAME_SIZE (1 << 20)
+#define MAX_FIELDS 8
+// 文件传输：每个 FILE_CHUNK 和 FILE_DATA 帧最多携带的文件数据
+#define FILE_CHUNK_SIZE (64 * 1024)
+// 上传的初始窗口（字节），之后每写入一块数据归还同样多的窗口
+#define FILE_WINDOW (1024 * 1024)
+// 单个文件的最大长度
+#define FILE_MAX_SIZE (4ull * 1024 * 1024 * 1024)
+
+enum Opcode : uint8_t {
+    // 客户端 -> 服务器
+    OP_HELLO = 0x01,         // 无字段，帧头中的版本号即客户端协议版本
+    OP_REGISTER = 0x02,      // 用户名
+    OP_MESSAGE = 0x03,       // 目标用户, 消息内容
+    OP_CREATE_GROUP = 0x04,  // 群组名
+    OP_JOIN_GROUP = 0x05,    // 群组名
+    OP_GROUP_CHECK = 0x06,   // 群组名
+    OP_GROUP_MESSAGE = 0x07, // 群组名, 消息内容
+    OP_REMOVE = 0x08,        // 无字段
+    OP_PRESENCE_SYNC = 0x09, // 无字段，请求在线用户快照
+    OP_LEAVE_GROUP = 0x0A,   // 群组名
+    OP_HISTORY = 0x0B,       // 群组名或用户名, 已有的最后一条序列号（可省略，默认为 0）
+    OP_PING = 0x0C,          // 任意令牌（可省略），服务器用 PONG 原样返回
+    OP_PONG = 0x0D,          // 回复服务器的 PING，原样带回令牌
+    OP_MULTICAST_SUBSCRIBE = 0x0E, // 群组名，请求通过组播接收该群组的消息
+    OP_MULTICAST_ACK = 0x0F,       // 群组名，已收到该群组的组播数据报，可以停止TCP投递
+    OP_MULTICAST_NAK = 0x10,       // 群组名, 起始组播序列号, 结束组播序列号，请求通过TCP重传
+    OP_MULTICAST_LEAVE = 0x11,     // 群组名, 已连续收到的最后一个组播序列号，退回TCP接收
+    OP_SEND_FILE = 0x12,     // 目标用户, 文件名, 文件长度；服务器回复 FILE_ACCEPT 后按窗口发送 FILE_CHUNK
+    OP_GROUP_FILE = 0x13,    // 群组名, 文件名, 文件长度
+    OP_FILE_CHUNK = 0x14,    // 传输ID, 文件数据（按顺序，每块最多 FILE_CHUNK_SIZE 字节，不超过剩余窗口）
+    OP_FILE_GET = 0x15,      // 传输ID, 起始偏移（可省略，默认为 0），下载收到的 FILE_OFFER
+    OP_FILE_CANCEL = 0x16,   // 传输ID，取消上传或下载
+    // 服务器 -> 客户端
+    OP_HELLO_ACK = 0x81,     // 服务器协议版本
+    OP_NOTICE = 0x82,        // 服务器通知文本
+    OP_DELIVER = 0x83,       // 发送者, 消息内容, 私聊会话中的序列号（启用消息历史时）
+    OP_GROUP_DELIVER = 0x84, // 群组名, 发送者, 消息内容, 群组历史中的序列号（启用消息历史时）
+    OP_ONLINE_USERS = 0x85,  // 以空格分隔的在线用户名, 快照对应的在线状态序列号
+    OP_GROUP_LIST = 0x86,    // 以空格分隔的群组名
+    OP_GROUP_MEMBERS = 0x87, // 以空格分隔的成员名
+    OP_PRESENCE = 0x88,      // 在线状态序列号, 以空格分隔的上线用户, 以空格分隔的下线用户
+    OP_HISTORY_MESSAGE = 0x89, // 群组名或用户名, 序列号, 发送者, 消息内容, 发送时间（毫秒）
+    OP_HISTORY_END = 0x8A,   // 群组名或用户名, 本页最后一条序列号, 最新序列号
+    OP_SERVER_PING = 0x8B,   // 心跳令牌，连接空闲时发出，客户端应回复 PONG
+    OP_SERVER_PONG = 0x8C,   // 客户端 PING 中的令牌
+    OP_MULTICAST_INFO = 0x8D,   // 群组名, 组播地址:端口, 已分配的最后一个组播序列号
+    OP_MULTICAST_ACTIVE = 0x8E, // 群组名, 第一个只通过组播发送的序列号
+    OP_MULTICAST_DATA = 0x8F,   // 群组名, 组播序列号, 发送者, 消息内容, 群组历史中的序列号（可省略）；组播数据报或TCP重传
+    OP_MULTICAST_HEARTBEAT = 0x90, // 群组名, 已分配的最后一个组播序列号；只通过组播发送
+    OP_MULTICAST_GAP = 0x91,    // 群组名, 重传窗口中最早的序列号，更早的缺失消息已无法重传
+    OP_FILE_ACCEPT = 0x92,   // 传输ID, 初始窗口字节数
+    OP_FILE_CREDIT = 0x93,   // 传输ID, 归还的窗口字节数
+    OP_FILE_OFFER = 0x94,    // 传输ID, 发送者, 文件名, 文件长度, 群组名（私聊时省略）
+    OP_FILE_DATA = 0x95,     // 传输ID, 偏移, 文件数据
+    OP_FILE_END = 0x96,      // 传输ID, 结果：complete 表示上传或下载完成，其余为失败原因；ID 为 0 表示上传被拒绝
+};
+
+// 连接使用的协议
+enum ProtocolMode : uint8_t {
+    PROTOCOL_UNKNOWN,   // 尚未收到数据
+    PROTOCOL_TEXT,      // 旧文本协议：每次读到的数据为一条命令
+    PROTOCOL_TEXT_LINE, // 文本协议：命令以换行分隔，收到第一个换行后切换到此模式
+    PROTOCOL_BINARY,    // 长度前缀的二进制帧
+    PROTOCOL_WEBSOCKET_UPGRADE, // WebSocket 端口上的连接，等待 HTTP 升级请求
+    PROTOCOL_WEBSOCKET  // WebSocket：每个消息为一条文本协议命令
+};
+
+/**
+ * 解码得到的命令，字段指向接收缓冲区内部，在缓冲区被消费之前有效
+ */
+struct Command {
+    uint8_t version{};
+    uint8_t opcode{};
+    int fieldCount{};
+    std::string_view fields[MAX_FIELDS];
+};
+
+enum class DecodeResult {
+    Ok,       // 解出一条命令
+    NeedMore, // 数据不完整，needed 为至少需要的字节数
+    Invalid   // 格式错误，应断开连接
+};
+
+// 根据连接的首字节判断协议
+ProtocolMode DetectProtocol(char firstByte);
+
+/**
+ * 从缓冲区开头解码一个二进制帧
+ * @param data 可读数据
+ * @param len 可读数据长度
+ * @param cmd 输出的命令
+ * @param size 成功时为帧长度，数据不完整时为需要的总字节数
+ */
+DecodeResult DecodeBinary(const char *data, size_t len, Command &cmd, size_t &size);
+
+/**
+ * 从缓冲区开头解码一条文本命令
+ * @param lineMode 为 true 时命令必须以换行结束，否则没有换行时整段数据视为一条命令
+ * @param size 成功时为消费的字节数，数据不完整时为需要的总字节数
+ */
+DecodeResult DecodeText(const char *data, size_t len, bool lineMode, Command &cmd, size_t &size);
+
+// 命令名，用于日志
+const char *OpcodeName(uint8_t opcode);
+
+// 二进制帧的总长度
+size_t BinaryFrameSize(const std::string_view *fields, size_t count);
+
+// 把二进制帧写入 out，out 至少有 BinaryFrameSize 字节
+void WriteBinaryFrame(char *out, uint8_t opcode, const std::string_view *fields, size_t count);
+
+// 把一个二进制帧追加到 out
+void AppendBinaryFrame(std::string &out, uint8_t opcode, const std::string_view *fields, size_t count);
+
+/**
+ * 最后一个字段内容之前的帧头长度，用于只在内存中编码帧头、字段内容另行发送（例如直接从文件发送）
+ * @param fields 除最后一个字段以外的字段
+ * @param count 这些字段的字段数
+ */
+size_t BinaryHeadSize(const std::string_view *fields, size_t count);
+
+/**
+ * 写入帧头和前 count 个字段，帧共有 count + 1 个字段，最后一个字段长度为 lastSize，内容由调用方随后发送
+ * out 至少有 BinaryHeadSize 字节
+ */
+void WriteBinaryHead(char *out, uint8_t opcode, const std::string_view *fields, size_t count, size_t lastSize);
+
+/**
+ * 解码帧的开头：除最后一个字段以外的字段必须完整，最后一个字段的内容可以不完整，
+ * 用于在大帧完整到达之前处理已到达的部分
+ * @param cmd 输出的命令，最后一个字段为已到达的部分
+ * @param size 帧的总长度
+ * @return Ok 表示已解出，NeedMore 表示帧头不完整
+ */
+DecodeResult DecodeBinaryHead(const char *data, size_t len, Command &cmd, size_t &size);
+
+/**
+ * 文本协议编码后的长度，文本与旧服务器发送的内容一致
+ * @param lineMode 是否在末尾追加换行
+ */
+size_t TextFrameSize(uint8_t opcode, const std::string_view *fields, size_t count, bool lineMode);
+
+// 把文本协议编码写入 out，out 至少有 TextFrameSize 字节
+void WriteTextFrame(char *out, uint8_t opcode, const std::string_view *fields, size_t count, bool lineMode);
+
+#endif //ONLINECHAT_PROTOCOL_H
@@ -0,0 +1,643 @@
+#include "Reactor.h"
+#include "Log.h"
+#include <algorithm>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+// 每次直接写入文件或从文件读出的最大字节数，与默认的管道容量相同
+#define FILE_IO_CHUNK (64 * 1024)
+// 一次可读事件中直接写入文件的最大字节数，超过后留到下一轮，其它连接的命令不被大文件上传阻塞
+#define FILE_READ_BUDGET (256 * 1024)
+
+Reactor::~Reactor() {
+    // 关闭所有客户端连接
+    for (auto client: clients) {
+        poller.Remove(client->sclient);
+        closesocket(client->sclient);
+        clientSlab.Destroy(client->id);
+    }
+    clients.clear();
+    if (sListen != INVALID_SOCKET) {
+        closesocket(sListen);
+    }
+    if (sWebSocket != INVALID_SOCKET) {
+        closesocket(sWebSocket);
+    }
+#ifndef _WIN32
+    if (spareFd >= 0) close(spareFd);
+    if (splicePipe[0] >= 0) {
+        close(splicePipe[0]);
+        close(splicePipe[1]);
+    }
+#endif
+}
+
+// 预留一个描述符，用于描述符用尽时拒绝连接
+static int OpenSpareFd() {
+#ifdef _WIN32
+    return -1;
+#else
+    return open("/dev/null", O_RDONLY | O_CLOEXEC);
+#endif
+}
+
+// 立即重置连接（RST），不进入 TIME_WAIT，也不等待未发出的数据
+static void ResetConnection(SOCKET s) {
+    linger reset{1, 0};
+    setsockopt(s, SOL_SOCKET, SO_LINGER, (const char *) &reset, sizeof(reset));
+    closesocket(s);
+}
+
+bool Reactor::Listen(int port, bool reusePort) {
+    SOCKET s = OpenListener(port, reusePort);
+    return s != INVALID_SOCKET && AddListener(sListen, s);
+}
+
+bool Reactor::ListenWebSocket(int port, bool reusePort) {
+    SOCKET s = OpenListener(port, reusePort);
+    return s != INVALID_SOCKET && AddListener(sWebSocket, s);
+}
+
+SOCKET Reactor::OpenListener(int port, bool reusePort) {
+    SOCKET s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (s == INVALID_SOCKET) {
+        LOG_ERROR << "Socket failed !";
+        return INVALID_SOCKET;
+    }
+    int reuse = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char *) &reuse, sizeof(reuse));
+#ifdef SO_REUSEPORT
+    if (reusePort && setsockopt(s, SOL_SOCKET, SO_REUSEPORT, (const char *) &reuse, sizeof(reuse)) != 0) {
+        LOG_ERROR << "SO_REUSEPORT failed with error: " << LastSocketError();
+        closesocket(s);
+        return INVALID_SOCKET;
+    }
+#else
+    if (reusePort) {
+        LOG_ERROR << "SO_REUSEPORT is not supported on this platform !";
+        closesocket(s);
+        return INVALID_SOCKET;
+    }
+#endif
+
+    // 设置服务器地址信息并绑定
+    sockaddr_in addrServ{};
+    addrServ.sin_family = AF_INET;
+    addrServ.sin_port = htons(port);
+    addrServ.sin_addr.s_addr = INADDR_ANY;
+    if (bind(s, (sockaddr *) &addrServ, sizeof(addrServ)) == SOCKET_ERROR) {
+        LOG_ERROR << "Bind failed !";
+        closesocket(s);
+        return INVALID_SOCKET;
+    }
+    // 开始监听
+    if (listen(s, SOMAXCONN) == SOCKET_ERROR) {
+        LOG_ERROR << "Listen failed !";
+        closesocket(s);
+        return INVALID_SOCKET;
+    }
+    return s;
+}
+
+bool Reactor::AddListener(SOCKET &slot, SOCKET s) {
+    if (!poller.Valid()) {
+        LOG_ERROR << "Poller creation failed !";
+        closesocket(s);
+        return false;
+    }
+    slot = s;
+    SetNonBlocking(s);
+    // 以保存监听套接字的成员地址作为事件的关联指针，据此区分两个端口
+    poller.Add(s, &slot);
+    poller.SetWriteInterest(s, false);
+    if (spareFd < 0) spareFd = OpenSpareFd();
+    return true;
+}
+
+void Reactor::SetCallbacks(OpenCallback open, DataCallback data, CloseCallback close) {
+    onOpen = std::move(open);
+    onData = std::move(data);
+    onClose = std::move(close);
+}
+
+void Reactor::SetWaitCallbacks(BeforeWaitCallback before, AfterWaitCallback after) {
+    beforeWait = std::move(before);
+    afterWait = std::move(after);
+}
+
+void Reactor::SetCongestionCallback(CongestionCallback congestion) {
+    onCongestion = std::move(congestion);
+}
+
+void Reactor::SetFileCallbacks(SpliceCallback spliced, DrainCallback drain) {
+    onSpliced = std::move(spliced);
+    onDrain = std::move(drain);
+}
+
+void Reactor::SetAcceptCallback(AcceptCallback accept) {
+    onAccept = std::move(accept);
+}
+
+void Reactor::Run() {
+    std::vector<PollEvent> events;
+    running = true;
+    loopTimeMs = ClockMs();
+    while (running) {
+        // 先发出本轮所有待发送数据，发送队列中不会再留有即将释放的连接
+        FlushDirty();
+        bool released = !closedClients.empty();
+        if (released) ReleaseClosed();
+        // 发送和断开回调中向其它分片投递的消息（例如发送队列回落后恢复读取）在等待前回调中发出
+        int timeoutMs = beforeWait ? beforeWait() : -1;
+        int timerMs = timers.NextTimeout(ClockMs());
+        if (timerMs >= 0 && (timeoutMs < 0 || timerMs < timeoutMs)) timeoutMs = timerMs;
+        // 释放后立即进入下一轮，处理断开回调中产生的消息；等待前回调中关闭的连接也在下一轮释放
+        if (released || !closedClients.empty()) timeoutMs = 0;
+        // 有留到下一轮继续读取的连接时不阻塞等待
+        if (!resumedClients.empty()) timeoutMs = 0;
+        int n = poller.Wait(events, timeoutMs);
+        loopTimeMs = ClockMs();
+        if (afterWait) afterWait();
+        if (n < 0) {
+            LOG_ERROR << "Poller wait failed with error: " << LastSocketError();
+            break;
+        }
+        for (const auto &ev: events) {
+            if (ev.ptr == &sListen || ev.ptr == &sWebSocket) {
+                HandleAccept(*static_cast<SOCKET *>(ev.ptr));
+                continue;
+            }
+            auto *client = static_cast<ClientInfo *>(ev.ptr);
+            if (client->closing) continue;
+            if (ev.error && client->readPauses > 0) {
+                // 暂停读取期间连接出错，非epoll后端会持续报告该事件
+                Close(client);
+                continue;
+            }
+            if (ev.readable || ev.error) {
+                HandleRead(client);
+            }
+            if (ev.writable && !client->closing) {
+                Flush(client);
+            }
+        }
+        RunPendingTasks();
+        RunExpiredTimers();
+        RunResumed();
+    }
+}
+
+void Reactor::Stop() {
+    running = false;
+    poller.Wakeup();
+}
+
+void Reactor::Post(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(taskMutex);
+        tasks.push_back(std::move(task));
+    }
+    poller.Wakeup();
+}
+
+void Reactor::RunPendingTasks() {
+    std::vector<std::function<void()>> pending;
+    {
+        std::lock_guard<std::mutex> lock(taskMutex);
+        pending.swap(tasks);
+    }
+    for (auto &task: pending) {
+        task();
+    }
+}
+
+TimerId Reactor::RunAfter(int delayMs, std::function<void()> task) {
+    return timers.Add(loopTimeMs + (uint64_t) std::max(delayMs, 0), std::move(task));
+}
+
+void Reactor::RunExpiredTimers() {
+    loopTimeMs = ClockMs();
+    timers.Advance(loopTimeMs);
+}
+
+void Reactor::HandleAccept(SOCKET listener) {
+    // 边缘触发：一直accept到没有新的连接为止
+    while (true) {
+        sockaddr_in addrClient{};
+        socklen_t addrClientLen = sizeof(addrClient);
+        SOCKET sClient = accept(listener, (sockaddr *) &addrClient, &addrClientLen);
+        if (sClient == INVALID_SOCKET) {
+            int err = LastSocketError();
+#ifndef _WIN32
+            if ((err == EMFILE || err == ENFILE) && RejectWithSpare(listener)) continue;
+#endif
+            if (!IsWouldBlock(err)) {
+                LOG_ERROR << "Accept failed with error: " << err;
+            }
+            return;
+        }
+        // 超过准入限制的连接立即重置，不分配连接对象，也不等待下一轮
+        if (onAccept && !onAccept(addrClient)) {
+            ResetConnection(sClient);
+            continue;
+        }
+        SetNonBlocking(sClient);
+        int noDelay = 1;
+        setsockopt(sClient, IPPROTO_TCP, TCP_NODELAY, (const char *) &noDelay, sizeof(noDelay));
+        ClientInfo *clientInfo = AddClient(sClient, addrClient);
+        if (clientInfo == nullptr) continue;
+        // WebSocket 端口上的连接先完成 HTTP 升级，不按首字节判断协议
+        if (listener == sWebSocket) clientInfo->protocol = PROTOCOL_WEBSOCKET_UPGRADE;
+        if (onOpen) onOpen(clientInfo);
+    }
+}
+
+bool Reactor::RejectWithSpare(SOCKET listener) {
+#ifdef _WIN32
+    return false;
+#else
+    if (spareFd < 0) return false;
+    close(spareFd);
+    SOCKET s = accept(listener, nullptr, nullptr);
+    if (s != INVALID_SOCKET) {
+        ResetConnection(s);
+        metrics.rejectedDescriptors.Add();
+    }
+    spareFd = OpenSpareFd();
+    return s != INVALID_SOCKET;
+#endif
+}
+
+ClientInfo *Reactor::AddClient(SOCKET s, const sockaddr_in &addr) {
+    // 从对象池为新客户端分配
+    uint64_t id;
+    auto *clientInfo = clientSlab.Create(id);
+    if (clientInfo == nullptr) {
+        LOG_WARN << "Too many connections, rejecting.";
+        closesocket(s);
+        return nullptr;
+    }
+    clientInfo->id = id;
+    clientInfo->sclient = s;
+    clientInfo->addrClient = addr;
+    clientInfo->lastActiveMs = loopTimeMs;
+    if (!poller.Add(s, clientInfo)) {
+        LOG_ERROR << "Poller add failed with error: " << LastSocketError();
+        closesocket(s);
+        clientSlab.Destroy(id);
+        return nullptr;
+    }
+    poller.SetWriteInterest(s, false);
+    clientInfo->slot = clients.size();
+    clients.push_back(clientInfo);
+    metrics.accepted.Add();
+    return clientInfo;
+}
+
+bool Reactor::AdoptListener(SOCKET s) {
+    return AddListener(sListen, s);
+}
+
+bool Reactor::AdoptWebSocketListener(SOCKET s) {
+    return AddListener(sWebSocket, s);
+}
+
+ClientInfo *Reactor::Adopt(SOCKET s, const sockaddr_in &addr) {
+    ClientInfo *client = AddClient(s, addr);
+    if (client == nullptr) return nullptr;
+    // 与恢复读取相同：先处理已缓冲的命令，再读取移交期间到达内核缓冲区的数据
+    client->resumePending = true;
+    resumedClients.push_back(client);
+    return client;
+}
+
+void Reactor::HandleRead(ClientInfo *client) {
+    // 边缘触发：一直读到内核缓冲区为空，每次读到数据后交给上层解码；
+    // 上层暂停读取后剩余数据留在内核缓冲区，恢复时再读
+    size_t fileBytes = 0;
+    while (!client->closing && client->readPauses == 0) {
+        if (client->spliceRemaining > 0) {
+            if (fileBytes >= FILE_READ_BUDGET) {
+                // 与恢复读取相同，在本轮其它事件处理之后继续
+                if (!client->resumePending) {
+                    client->resumePending = true;
+                    resumedClients.push_back(client);
+                }
+                return;
+            }
+            size_t remaining = client->spliceRemaining;
+            if (!ReceiveToFile(client)) return;
+            fileBytes += remaining - client->spliceRemaining;
+            continue;
+        }
+        RingBuffer &in = client->inBuf;
+        in.PrepareWrite();
+        if (in.Writable() == 0) {
+            LOG_WARN << "Receive buffer of client [" << client->id << "] is full.";
+            Close(client);
+            return;
+        }
+        size_t want = in.Writable();
+        if (client->readLimit > 0) {
+            want = std::min(want, client->readLimit);
+            client->readLimit = 0;
+        }
+        int n = (int) recv(client->sclient, in.WritePtr(), (int) want, 0);
+        if (n > 0) {
+            in.Commit(n);
+            metrics.bytesIn.Add(n);
+            client->lastActiveMs = loopTimeMs;
+            if (onData) onData(client);
+            continue;
+        }
+        if (n < 0) {
+            int err = LastSocketError();
+            if (IsWouldBlock(err)) {
+                // 数据已全部处理时归还接收缓冲区，空闲连接不占用缓冲区
+                in.Release();
+                return;
+            }
+            LOG_WARN << "recv failed with error: " << err;
+        }
+        // 客户端断开连接
+        Close(client);
+        return;
+    }
+}
+
+void Reactor::SpliceToFile(ClientInfo *client, FileHandle file, uint64_t offset, size_t len, bool copy) {
+    client->spliceFile = file;
+    client->spliceOffset = offset;
+    client->spliceRemaining = len;
+    client->spliceCopy = copy;
+}
+
+bool Reactor::ReceiveToFile(ClientInfo *client) {
+    size_t want = std::min<size_t>(client->spliceRemaining, FILE_IO_CHUNK);
+    long n = -1;
+    bool spliced = false;
+#ifdef __linux__
+    if (client->spliceFile != INVALID_FILE && !client->spliceCopy &&
+        (splicePipe[0] >= 0 || pipe2(splicePipe, O_CLOEXEC) == 0)) {
+        // 套接字 -> 管道 -> 文件，数据只在内核的页之间移动
+        n = splice(client->sclient, nullptr, splicePipe[1], nullptr, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        int err = errno;
+        loff_t offset = (loff_t) client->spliceOffset;
+        for (long left = n; left > 0;) {
+            ssize_t w = splice(splicePipe[0], nullptr, client->spliceFile, &offset, (size_t) left, SPLICE_F_MOVE);
+            if (w < 0 && errno == EINTR) continue;
+            if (w > 0) {
+                left -= w;
+                continue;
+            }
+            // 文件不支持 splice（例如 EINVAL）：管道中的数据读回用户态写入，之后改为复制
+            LOG_WARN << "Splicing into file failed with error: " << errno << ", falling back to copying.";
+            client->spliceCopy = true;
+            fileBuffer.resize(FILE_IO_CHUNK);
+            while (left > 0) {
+                ssize_t r = read(splicePipe[0], fileBuffer.data(), (size_t) left);
+                if (r < 0 && errno == EINTR) continue;
+                if (r <= 0 || !WriteAt(client->spliceFile, fileBuffer.data(), (size_t) r, (uint64_t) offset)) {
+                    // 管道中残留的数据无法再使用，重新创建管道
+                    LOG_WARN << "Writing received file data failed with error: " << errno;
+                    close(splicePipe[0]);
+                    close(splicePipe[1]);
+                    splicePipe[0] = splicePipe[1] = -1;
+                    Close(client);
+                    return false;
+                }
+                left -= r;
+                offset += r;
+            }
+        }
+        if (n < 0 && !IsWouldBlock(err)) {
+            // 套接字不支持 splice（例如 EINVAL、ENOSYS），本次改为 recv，真正的连接错误由 recv 报告
+            LOG_WARN << "Splicing from socket failed with error: " << err << ", falling back to copying.";
+            client->spliceCopy = true;
+        } else {
+            errno = err;
+            spliced = true;
+        }
+    }
+#endif
+    if (!spliced) {
+        fileBuffer.resize(FILE_IO_CHUNK);
+        n = (long) recv(client->sclient, fileBuffer.data(), (int) want, 0);
+        if (n > 0 && client->spliceFile != INVALID_FILE &&
+            !WriteAt(client->spliceFile, fileBuffer.data(), (size_t) n, client->spliceOffset)) {
+            LOG_WARN << "Writing received file data failed with error: " << errno;
+            Close(client);
+            return false;
+        }
+    }
+    if (n > 0) {
+        client->spliceOffset += (uint64_t) n;
+        client->spliceRemaining -= (size_t) n;
+        metrics.bytesIn.Add(n);
+        if (spliced) metrics.fileBytesSpliced.Add(n);
+        client->lastActiveMs = loopTimeMs;
+        if (client->spliceRemaining == 0 && onSpliced) onSpliced(client);
+        return true;
+    }
+    if (n < 0) {
+        int err = LastSocketError();
+        if (IsWouldBlock(err)) {
+            client->inBuf.Release();
+            return false;
+        }
+        LOG_WARN << "recv failed with error: " << err;
+    }
+    Close(client);
+    return false;
+}
+
+long Reactor::SendFileRegion(ClientInfo *client, const FileRegion &region, size_t offset, size_t len) {
+#ifdef __linux__
+    off_t pos = (off_t) (region.offset + offset);
+    ssize_t n = sendfile(client->sclient, region.file, &pos, len);
+    if (n > 0) metrics.fileBytesSendfile.Add(n);
+    if (n == 0) errno = EIO;  // 文件比区间短
+    return n > 0 ? (long) n : -1;
+#else
+    fileBuffer.resize(FILE_IO_CHUNK);
+    long n = ReadAt(region.file, fileBuffer.data(), std::min<size_t>(len, FILE_IO_CHUNK), region.offset + offset);
+    if (n <= 0) return -1;
+    IoVec vec;
+    SetIoVec(vec, fileBuffer.data(), (size_t) n);
+    return SendVector(client->sclient, &vec, 1);
+#endif
+}
+
+void Reactor::Send(ClientInfo *client, FramePtr frame) {
+    if (client->closing || frame->Size() == 0) return;
+    FrameQueue &queue = client->outQueue;
+    metrics.queuedBytes.Add((int64_t) frame->Size());
+    metrics.queuedFrames.Add();
+    queue.Push(std::move(frame));
+    if (queue.Bytes() > OUT_MAX_BYTES) {
+        LOG_WARN << "Send queue of client [" << client->id << "] exceeded " << OUT_MAX_BYTES
+                 << " bytes, disconnecting.";
+        metrics.evictions.Add();
+        Close(client);
+        return;
+    }
+    if (!client->congested && (queue.Bytes() >= OUT_HIGH_BYTES || queue.Size() >= OUT_HIGH_FRAMES)) {
+        client->congested = true;
+        client->congestedSince = std::chrono::steady_clock::now();
+        metrics.congested.Add();
+        if (onCongestion) onCongestion(client, true);
+    }
+    if (!client->dirty) {
+        client->dirty = true;
+        dirtyClients.push_back(client);
+    }
+}
+
+void Reactor::FlushDirty() {
+    for (size_t i = 0; i < dirtyClients.size(); i++) {
+        ClientInfo *client = dirtyClients[i];
+        client->dirty = false;
+        if (!client->closing) Flush(client);
+    }
+    dirtyClients.clear();
+}
+
+// 每次分散发送最多包含的帧数
+#define MAX_IOV 64
+
+void Reactor::PopSent(ClientInfo *client, int64_t &now) {
+    FrameQueue &queue = client->outQueue;
+    const FramePtr &front = queue.At(0);
+    if (front->Origin() != 0) {
+        // 同一次发送弹出的帧共用一次时钟读取
+        if (now == 0) now = MonotonicNs();
+        metrics.deliveryLatency.Record((uint64_t) (now - front->Origin()));
+    }
+    metrics.queuedBytes.Add(-(int64_t) front->Size());
+    metrics.queuedFrames.Add(-1);
+    queue.Pop();
+}
+
+void Reactor::Flush(ClientInfo *client) {
+    FrameQueue &queue = client->outQueue;
+    int64_t now = 0;
+    while (!queue.Empty()) {
+        IoVec vec[MAX_IOV];
+        int count = 0;
+        size_t requested = 0;
+        bool fileNext = false;
+        for (size_t i = 0; i < queue.Size() && count < MAX_IOV; i++) {
+            const FramePtr &frame = queue.At(i);
+            // 文件帧单独发送，之前的内存帧先合并发出
+            if (frame->IsFile()) {
+                fileNext = true;
+                break;
+            }
+            size_t offset = i == 0 ? client->outOffset : 0;
+            SetIoVec(vec[count++], frame->Data() + offset, frame->Size() - offset);
+            requested += frame->Size() - offset;
+        }
+        long sent;
+        if (count == 0) {
+            const FramePtr &frame = queue.At(0);
+            requested = frame->Size() - client->outOffset;
+            sent = SendFileRegion(client, frame->Region(), client->outOffset, requested);
+        } else {
+            sent = SendVector(client->sclient, vec, count, fileNext);
+        }
+        if (sent < 0) {
+            int err = LastSocketError();
+            if (IsWouldBlock(err)) break;
+            LOG_WARN << "send failed with error: " << err;
+            metrics.queuedBytes.Add(-(int64_t) queue.Bytes());
+            metrics.queuedFrames.Add(-(int64_t) queue.Size());
+            queue.Clear();
+            Close(client);
+            return;
+        }
+        // 弹出已完整发送的帧，记录队首帧的发送进度
+        metrics.bytesOut.Add(sent);
+        client->outOffset += (size_t) sent;
+        while (!queue.Empty() && client->outOffset >= queue.At(0)->Size()) {
+            client->outOffset -= queue.At(0)->Size();
+            PopSent(client, now);
+        }
+        if ((size_t) sent < requested) break;  // 内核缓冲区已满，等待可写事件
+    }
+    poller.SetWriteInterest(client->sclient, !queue.Empty());
+    if (client->congested && !client->closing && queue.Bytes() <= OUT_LOW_BYTES && queue.Size() <= OUT_LOW_FRAMES) {
+        client->congested = false;
+        metrics.congested.Add(-1);
+        if (onCongestion) onCongestion(client, false);
+    }
+    if (client->drainBelow > 0 && !client->closing && queue.Bytes() <= client->drainBelow) {
+        client->drainBelow = 0;
+        if (onDrain) onDrain(client);
+    }
+}
+
+void Reactor::PauseRead(ClientInfo *client) {
+    if (client->readPauses++ == 0) {
+        poller.SetReadInterest(client->sclient, false);
+    }
+}
+
+void Reactor::ResumeRead(ClientInfo *client) {
+    if (client->readPauses == 0 || --client->readPauses > 0) return;
+    poller.SetReadInterest(client->sclient, true);
+    // 边缘触发不会再通知暂停期间到达的数据，在本轮事件处理结束后主动读取
+    if (!client->closing && !client->resumePending) {
+        client->resumePending = true;
+        resumedClients.push_back(client);
+    }
+}
+
+void Reactor::RunResumed() {
+    std::vector<ClientInfo *> resumed;
+    resumed.swap(resumedClients);
+    for (auto client: resumed) {
+        client->resumePending = false;
+        if (client->closing || client->readPauses > 0) continue;
+        // 先处理暂停前已缓冲但尚未处理的命令
+        if (onData && client->inBuf.Readable() > 0) onData(client);
+        HandleRead(client);
+    }
+}
+
+void Reactor::Close(ClientInfo *client) {
+    if (client->closing) return;
+    client->closing = true;
+    closedClients.push_back(client);
+}
+
+void Reactor::ReleaseClosed() {
+    // 先通知上层再释放，回调中可能向其他客户端发送数据或关闭更多连接
+    for (size_t i = 0; i < closedClients.size(); i++) {
+        ClientInfo *client = closedClients[i];
+        if (onClose) onClose(client);
+    }
+    for (auto client: closedClients) {
+        // 尽力发出关闭前排队的数据（例如错误通知），不再等待可写事件
+        if (!client->outQueue.Empty()) Flush(client);
+        if (client->resumePending) {
+            resumedClients.erase(std::find(resumedClients.begin(), resumedClients.end(), client));
+        }
+        // 关闭回调中向该连接发送的数据使它重新进入待发送列表，释放后不能再被 FlushDirty 访问
+        if (client->dirty) {
+            dirtyClients.erase(std::find(dirtyClients.begin(), dirtyClients.end(), client));
+        }
+        metrics.queuedBytes.Add(-(int64_t) client->outQueue.Bytes());
+        metrics.queuedFrames.Add(-(int64_t) client->outQueue.Size());
+        if (client->congested) metrics.congested.Add(-1);
+        metrics.closed.Add();
+        poller.Remove(client->sclient);
+        closesocket(client->sclient);
+        // 与末尾元素交换后删除，避免大量连接时的线性查找
+        clients[client->slot] = clients.back();
+        clients[client->slot]->slot = client->slot;
+        clients.pop_back();
+        clientSlab.Destroy(client->id);
+    }
+    closedClients.clear();
+}
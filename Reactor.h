@@ -0,0 +1,313 @@
+#ifndef ONLINECHAT_REACTOR_H
+#define ONLINECHAT_REACTOR_H
+
+#include "Platform.h"
+#include "Poller.h"
+#include "File.h"
+#include "Frame.h"
+#include "Limiter.h"
+#include "Metrics.h"
+#include "Protocol.h"
+#include "RingBuffer.h"
+#include "Slab.h"
+#include "TimerWheel.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// 定义缓冲区大小
+#define BUF_SIZE 4096
+// 发送队列的高低水位：超过任一高水位时连接进入拥塞状态，字节数和帧数都回落到低水位以下才解除
+#define OUT_HIGH_BYTES (1024 * 1024)
+#define OUT_LOW_BYTES (256 * 1024)
+#define OUT_HIGH_FRAMES 8192
+#define OUT_LOW_FRAMES 2048
+// 发送队列的硬上限，超过时直接断开连接
+#define OUT_MAX_BYTES (8 * 1024 * 1024)
+
+/**
+ * 客户端信息结构体，包含客户端的ID、套接字、地址、接收缓冲区和发送队列。
+ * 由事件循环的对象池分配，其它对象只通过ID引用连接
+ */
+struct ClientInfo {
+    uint64_t id{};         // 带代数的句柄，连接释放后旧ID查找不到新连接
+    SOCKET sclient{INVALID_SOCKET};
+    sockaddr_in addrClient{};
+    RingBuffer inBuf{BUF_SIZE};  // 接收缓冲区，可能包含多条命令或不完整的命令
+    ProtocolMode protocol{PROTOCOL_UNKNOWN};
+    uint8_t protocolVersion{};   // 二进制客户端通过 HELLO 协商的协议版本
+    size_t messageOffset{};      // 接收缓冲区开头的 WebSocket 消息中已处理的命令字节数
+    std::string username;  // 新增用户名字段
+    FrameQueue outQueue;   // 待发送的共享帧
+    size_t outOffset{};    // 队首帧已发送的字节数
+    bool dirty{false};     // 本轮事件循环中有新入队的帧，等待合并发送
+    bool closing{false};   // 已请求关闭，等待本轮事件处理结束后释放
+    bool presenceStale{false}; // 拥塞时跳过了在线状态增量，恢复后需要发送快照
+    bool congested{false}; // 发送队列超过高水位，尚未回落到低水位
+    std::chrono::steady_clock::time_point congestedSince; // 最近一次进入拥塞状态的时间
+    int readPauses{0};     // 暂停读取的次数，为 0 时才读取和处理命令
+    bool resumePending{false}; // 已恢复读取，等待本轮事件处理结束后读取暂停期间到达的数据
+    size_t slot{};         // 在事件循环连接列表中的下标
+    uint64_t lastActiveMs{}; // 最近一次收到数据的时间（事件循环时钟）
+    TimerId timer{};       // 上层为连接安排的握手或心跳定时任务
+    bool heartbeat{false}; // 客户端会回复服务器发出的 PING
+    bool pingSent{false};  // 已发出 PING，等待客户端的任何数据
+    bool handshakePending{false}; // 计入准入控制的握手中连接数，尚未完成握手
+    bool rateLimited{false};      // 超过速率限制而暂停读取，等待令牌补充
+    TokenBucket messageTokens;    // 连接的消息数令牌桶
+    TokenBucket byteTokens;       // 连接的字节数令牌桶
+    FileHandle spliceFile{INVALID_FILE}; // 接下来 spliceRemaining 字节不进入接收缓冲区，直接写入该文件，无效时丢弃
+    uint64_t spliceOffset{};      // 下一个字节写入文件的位置
+    size_t spliceRemaining{};     // 还需直接写入文件的字节数
+    bool spliceCopy{false};       // 经用户态缓冲区复制写入文件，请求时指定或 splice 失败后置位
+    size_t drainBelow{};          // 发送队列回落到不超过该字节数时调用排空回调，为 0 时不需要
+    size_t readLimit{};           // 下一次 recv 最多读取的字节数，为 0 时不限制
+};
+
+/**
+ * 单线程事件循环：在一个线程内处理监听套接字的accept以及所有连接的读写就绪事件，
+ * 通过回调把连接建立、数据到达和连接断开交给上层的命令处理逻辑
+ */
+class Reactor {
+public:
+    using OpenCallback = std::function<void(ClientInfo *)>;
+    // 数据到达回调，上层从 inBuf 中解码并消费完整的命令
+    using DataCallback = std::function<void(ClientInfo *)>;
+    using CloseCallback = std::function<void(ClientInfo *)>;
+    // 阻塞等待前、发出本轮待发送数据和释放已关闭连接之后调用，返回本次等待的超时时间（毫秒，-1 表示一直等待）
+    using BeforeWaitCallback = std::function<int()>;
+    // 等待返回后调用
+    using AfterWaitCallback = std::function<void()>;
+    // 连接进入或解除拥塞状态时调用
+    using CongestionCallback = std::function<void(ClientInfo *, bool congested)>;
+    // 接受连接后、分配连接对象之前调用，返回 false 时立即重置连接
+    using AcceptCallback = std::function<bool(const sockaddr_in &)>;
+    // SpliceToFile 请求的数据全部写入文件时调用
+    using SpliceCallback = std::function<void(ClientInfo *)>;
+    // NotifyDrain 请求的发送队列回落时调用
+    using DrainCallback = std::function<void(ClientInfo *)>;
+
+    Reactor() = default;
+
+    ~Reactor();
+
+    Reactor(const Reactor &) = delete;
+
+    Reactor &operator=(const Reactor &) = delete;
+
+    /**
+     * 创建非阻塞监听套接字并注册到事件循环
+     * @param port 监听端口
+     * @param reusePort 是否开启 SO_REUSEPORT，让多个事件循环各自监听同一端口
+     * @return 是否成功
+     */
+    bool Listen(int port, bool reusePort = false);
+
+    // 使用热重启时旧进程移交的监听套接字，代替 Listen
+    bool AdoptListener(SOCKET s);
+
+    // 监听套接字，未监听时为 INVALID_SOCKET
+    SOCKET ListenSocket() const { return sListen; }
+
+    /**
+     * 在同一事件循环中监听 WebSocket 端口，接受的连接协议为 PROTOCOL_WEBSOCKET_UPGRADE
+     * @param port 监听端口
+     * @param reusePort 是否开启 SO_REUSEPORT
+     * @return 是否成功
+     */
+    bool ListenWebSocket(int port, bool reusePort = false);
+
+    // 使用热重启时旧进程移交的 WebSocket 监听套接字，代替 ListenWebSocket
+    bool AdoptWebSocketListener(SOCKET s);
+
+    // WebSocket 监听套接字，未监听时为 INVALID_SOCKET
+    SOCKET WebSocketSocket() const { return sWebSocket; }
+
+    /**
+     * 接管旧进程移交的已连接套接字，不调用连接建立回调。
+     * 事件循环开始后先处理调用方放入 inBuf 的数据，再读取套接字
+     * @return 连接，失败时套接字被关闭并返回 nullptr
+     */
+    ClientInfo *Adopt(SOCKET s, const sockaddr_in &addr);
+
+    // 设置连接建立、数据到达和连接断开的回调
+    void SetCallbacks(OpenCallback onOpen, DataCallback onData, CloseCallback onClose);
+
+    // 设置每轮等待前后的回调，用于处理分片之间的消息队列
+    void SetWaitCallbacks(BeforeWaitCallback beforeWait, AfterWaitCallback afterWait);
+
+    void SetCongestionCallback(CongestionCallback onCongestion);
+
+    void SetAcceptCallback(AcceptCallback onAccept);
+
+    void SetFileCallbacks(SpliceCallback onSpliced, DrainCallback onDrain);
+
+    // 唤醒阻塞中的事件循环，可在任意线程调用
+    void Wakeup() { poller.Wakeup(); }
+
+    // 运行事件循环，直到 Stop 被调用
+    void Run();
+
+    // 请求停止事件循环，可在任意线程调用
+    void Stop();
+
+    // 把任务投递到事件循环线程执行，可在任意线程调用
+    void Post(std::function<void()> task);
+
+    /**
+     * 在指定时间后于事件循环线程执行任务，只能在事件循环线程中调用
+     * @param delayMs 延迟（毫秒）
+     * @param task 任务
+     * @return 定时任务的句柄，用于取消
+     */
+    TimerId RunAfter(int delayMs, std::function<void()> task);
+
+    // 取消尚未执行的定时任务，只能在事件循环线程中调用
+    bool CancelTimer(TimerId id) { return timers.Cancel(id); }
+
+    // 尚未执行的定时任务数
+    size_t TimerCount() const { return timers.Size(); }
+
+    // 事件循环时钟（毫秒），每轮等待返回和执行定时任务前更新
+    uint64_t NowMs() const { return loopTimeMs; }
+
+    /**
+     * 把帧加入客户端的发送队列。同一轮事件循环中入队的帧在阻塞等待之前
+     * 用一次分散发送（writev/sendmsg）合并发出，内核缓冲区满时等可写事件继续发送。
+     * 队列超过高水位时连接进入拥塞状态，超过硬上限时断开连接
+     * @param client 客户端
+     * @param frame 共享帧
+     */
+    void Send(ClientInfo *client, FramePtr frame);
+
+    /**
+     * 把客户端接下来的 len 字节直接从套接字写入文件（Linux 下经管道 splice，数据不复制到用户态），
+     * 写完后调用 SpliceCallback，之后的数据照常进入接收缓冲区。
+     * 只在数据到达回调中、接收缓冲区中的数据已全部消费时调用
+     * @param file 文件，INVALID_FILE 表示读取后丢弃
+     * @param offset 写入文件的位置
+     * @param len 字节数
+     * @param copy 是否不使用 splice，直接 recv 后写入文件；splice 失败时自动改为复制并置位 client->spliceCopy
+     */
+    void SpliceToFile(ClientInfo *client, FileHandle file, uint64_t offset, size_t len, bool copy);
+
+    // 下一次只读取 bytes 字节，用于只读入下一个帧的帧头，使其后的大段数据可以直接写入文件
+    void LimitNextRead(ClientInfo *client, size_t bytes) { client->readLimit = bytes; }
+
+    // 发送队列回落到不超过 bytes 字节时调用一次 DrainCallback，用于按发送进度继续产生数据（例如文件下载）
+    void NotifyDrain(ClientInfo *client, size_t bytes) { client->drainBelow = bytes; }
+
+    // 暂停读取客户端的数据，可以嵌套，用于对向拥塞连接发送数据的客户端施加背压
+    void PauseRead(ClientInfo *client);
+
+    // 恢复读取，与 PauseRead 成对调用，全部恢复后处理暂停期间缓冲和到达的数据
+    void ResumeRead(ClientInfo *client);
+
+    // 关闭客户端连接，连接在本轮事件处理结束后才被释放
+    void Close(ClientInfo *client);
+
+    // 当前连接数
+    size_t ConnectionCount() const { return clients.size(); }
+
+    // 按ID查找连接，连接已关闭或ID已过期时返回 nullptr
+    ClientInfo *Find(uint64_t clientId) const {
+        ClientInfo *client = clientSlab.Get(clientId);
+        return client && !client->closing ? client : nullptr;
+    }
+
+    /**
+     * 发送本轮事件循环中所有有新入队帧的客户端。发送可能触发拥塞回调（例如向其它分片投递恢复读取），
+     * 等待前回调处理完分片间消息后应再调用一次，再发出回调中产生的投递
+     */
+    void FlushDirty();
+
+    // 所有连接，包括已请求关闭但尚未释放的连接
+    const std::vector<ClientInfo *> &Clients() const { return clients; }
+
+    // 本事件循环的指标，只在事件循环线程中写入，可在任意线程读取
+    ShardMetrics &Metrics() { return metrics; }
+
+private:
+    // 创建并绑定监听套接字，失败时返回 INVALID_SOCKET
+    static SOCKET OpenListener(int port, bool reusePort);
+
+    // 把监听套接字保存到 slot 并注册到事件循环，失败时关闭套接字
+    bool AddListener(SOCKET &slot, SOCKET s);
+
+    void HandleAccept(SOCKET listener);
+
+    // 描述符用尽时用预留的描述符接受并重置一个连接，否则它一直留在 backlog 中，边缘触发不会再通知
+    bool RejectWithSpare(SOCKET listener);
+
+    // 为已连接的套接字分配连接对象并注册到事件循环，失败时关闭套接字
+    ClientInfo *AddClient(SOCKET s, const sockaddr_in &addr);
+
+    void HandleRead(ClientInfo *client);
+
+    // 按 SpliceToFile 的请求把套接字中的数据写入文件，返回 false 表示暂时没有数据或连接已关闭
+    bool ReceiveToFile(ClientInfo *client);
+
+    /**
+     * 发送文件帧的一部分：Linux 下用 sendfile 由内核从页缓存直接发送，其它平台读入缓冲区后发送
+     * @return 发送的字节数，出错时返回 -1
+     */
+    long SendFileRegion(ClientInfo *client, const FileRegion &region, size_t offset, size_t len);
+
+    // 用分散发送尽量发出客户端发送队列中的帧
+    void Flush(ClientInfo *client);
+
+    void RunPendingTasks();
+
+    // 读取恢复读取的连接在暂停期间收到的数据
+    void RunResumed();
+
+    // 更新事件循环时钟并执行到期的定时任务
+    void RunExpiredTimers();
+
+    void ReleaseClosed();
+
+    // 单调时钟的毫秒数
+    static uint64_t ClockMs() { return (uint64_t) MonotonicNs() / 1000000; }
+
+    // 发送队列弹出一个完整发送的帧，更新队列深度并统计投递延迟
+    void PopSent(ClientInfo *client, int64_t &now);
+
+    Poller poller;
+    ShardMetrics metrics;
+    SOCKET sListen{INVALID_SOCKET};
+    SOCKET sWebSocket{INVALID_SOCKET};
+    std::atomic<bool> running{false};
+    // 连接对象池，释放后槽位按后进先出复用
+    Slab<ClientInfo> clientSlab;
+    std::vector<ClientInfo *> clients;
+    std::vector<ClientInfo *> closedClients;
+    std::vector<ClientInfo *> dirtyClients;
+    std::vector<ClientInfo *> resumedClients;
+    OpenCallback onOpen;
+    DataCallback onData;
+    CloseCallback onClose;
+    BeforeWaitCallback beforeWait;
+    AfterWaitCallback afterWait;
+    CongestionCallback onCongestion;
+    AcceptCallback onAccept;
+    SpliceCallback onSpliced;
+    DrainCallback onDrain;
+    // 套接字到文件的 splice 经过的管道，第一次使用时创建
+    int splicePipe[2]{-1, -1};
+    // 不支持零复制时文件数据经过的缓冲区
+    std::vector<char> fileBuffer;
+    // 预留的描述符，描述符用尽时释放出来接受并拒绝连接
+    int spareFd{-1};
+    std::mutex taskMutex;
+    std::vector<std::function<void()>> tasks;
+    // 事件循环时钟，避免每个定时任务和每次读取都读取系统时钟
+    uint64_t loopTimeMs{ClockMs()};
+    // 定时任务：每个连接一个握手或心跳定时任务，以及拥塞超时和在线状态合并窗口
+    TimerWheel timers{loopTimeMs};
+};
+
+#endif //ONLINECHAT_REACTOR_H
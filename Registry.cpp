@@ -0,0 +1,168 @@
+#include "Registry.h"
+#include "GroupStore.h"
+#include "Log.h"
+#include <algorithm>
+#include <chrono>
+
+Registry::Registry() : memberships(new MembershipStripe[MEMBERSHIP_STRIPES]) {}
+
+Registry::~Registry() = default;
+
+bool Registry::Open(const std::string &dir) {
+    auto start = std::chrono::steady_clock::now();
+    store = std::make_unique<GroupStore>(dir);
+    // 快照和日志中创建的群组先收集起来，最后批量插入，避免每个群组重建一次分段
+    std::vector<std::string> created;
+    auto replay = [&](GroupLogOp op, std::string_view group, std::string_view user) {
+        switch (op) {
+            case GROUP_OP_CREATE:
+                created.emplace_back(group);
+                break;
+            case GROUP_OP_JOIN:
+                AddMembership(group, user, false);
+                break;
+            case GROUP_OP_LEAVE:
+                RemoveMembership(group, user, false);
+                break;
+        }
+    };
+    if (!store->Open(replay, [this](GroupSnapshotWriter &writer) { Dump(writer); })) {
+        store.reset();
+        return false;
+    }
+    size_t groups = groupMap.InsertAll(created, [](const std::string &name) { return std::make_shared<Group>(name); });
+    size_t users = 0;
+    for (size_t i = 0; i < MEMBERSHIP_STRIPES; i++) users += memberships[i].groups.size();
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    LOG_INFO << "Loaded " << groups << " groups and the memberships of " << users << " users from " << dir
+             << " in " << (int64_t) ms << " ms.";
+    return true;
+}
+
+Registry::MembershipStripe &Registry::StripeOf(std::string_view username) {
+    return memberships[std::hash<std::string_view>()(username) % MEMBERSHIP_STRIPES];
+}
+
+bool Registry::AddMembership(std::string_view groupName, std::string_view username, bool log) {
+    MembershipStripe &stripe = StripeOf(username);
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    std::vector<std::string> &groups = stripe.groups[std::string(username)];
+    if (std::find(groups.begin(), groups.end(), groupName) != groups.end()) return false;
+    groups.emplace_back(groupName);
+    // 在分段锁内写入日志，同一用户的变更在日志中的顺序与内存中一致
+    if (log) store->Append(GROUP_OP_JOIN, groupName, username);
+    return true;
+}
+
+bool Registry::RemoveMembership(std::string_view groupName, std::string_view username, bool log) {
+    MembershipStripe &stripe = StripeOf(username);
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    auto it = stripe.groups.find(std::string(username));
+    if (it == stripe.groups.end()) return false;
+    std::vector<std::string> &groups = it->second;
+    auto pos = std::find(groups.begin(), groups.end(), groupName);
+    if (pos == groups.end()) return false;
+    *pos = std::move(groups.back());
+    groups.pop_back();
+    if (groups.empty()) stripe.groups.erase(it);
+    if (log) store->Append(GROUP_OP_LEAVE, groupName, username);
+    return true;
+}
+
+void Registry::RejoinGroups(const GroupMember &member, std::vector<GroupPtr> &joined) {
+    joined.clear();
+    if (!store || member.username.empty()) return;
+    std::vector<std::string> names;
+    {
+        MembershipStripe &stripe = StripeOf(member.username);
+        std::lock_guard<std::mutex> lock(stripe.mutex);
+        auto it = stripe.groups.find(member.username);
+        if (it == stripe.groups.end()) return;
+        names = it->second;
+    }
+    GroupPtr group;
+    for (const auto &name: names) {
+        if (groupMap.Find(name, group) && group->Add(member)) joined.push_back(group);
+    }
+}
+
+void Registry::Dump(GroupSnapshotWriter &writer) {
+    // 成员关系先于群组写入：快照中出现的成员关系，其群组一定已经创建
+    // 每段在锁内复制后再写入文件，磁盘写入不阻塞同一段用户的加入和退出
+    std::vector<std::pair<std::string, std::vector<std::string>>> copied;
+    for (size_t i = 0; i < MEMBERSHIP_STRIPES; i++) {
+        copied.clear();
+        {
+            std::lock_guard<std::mutex> lock(memberships[i].mutex);
+            copied.assign(memberships[i].groups.begin(), memberships[i].groups.end());
+        }
+        for (const auto &[username, groups]: copied) writer.AddMembership(username, groups);
+    }
+    groupMap.ForEach([&](const std::string &name, const GroupPtr &) { writer.AddGroup(name); });
+}
+
+void Registry::AddUser(const std::string &username, ClientHandle handle) {
+    userMap.Set(username, handle);
+}
+
+bool Registry::RemoveUser(const std::string &username, ClientHandle handle) {
+    return userMap.EraseIf(username, [&](const ClientHandle &current) { return current == handle; });
+}
+
+bool Registry::FindUser(std::string_view username, ClientHandle &handle) const {
+    return userMap.Find(username, handle);
+}
+
+bool Registry::CreateGroup(const std::string &groupName, const GroupMember &creator, GroupPtr &group) {
+    auto created = std::make_shared<Group>(groupName);
+    created->Add(creator);
+    if (!groupMap.Insert(groupName, created)) return false;
+    if (store) {
+        store->Append(GROUP_OP_CREATE, groupName, {});
+        if (!creator.username.empty()) AddMembership(groupName, creator.username, true);
+    }
+    group = std::move(created);
+    return true;
+}
+
+Registry::JoinResult Registry::JoinGroup(std::string_view groupName, const GroupMember &member, GroupPtr &group) {
+    if (!groupMap.Find(groupName, group)) return JoinResult::GroupNotFound;
+    bool added = group->Add(member);
+    if (store && !member.username.empty()) AddMembership(groupName, member.username, true);
+    return added ? JoinResult::Joined : JoinResult::AlreadyMember;
+}
+
+Registry::LeaveResult Registry::LeaveGroup(std::string_view groupName, const GroupMember &member, GroupPtr &group) {
+    if (!groupMap.Find(groupName, group)) return LeaveResult::GroupNotFound;
+    bool removed = group->Remove(member.handle);
+    if (store && !member.username.empty() && RemoveMembership(groupName, member.username, true)) removed = true;
+    return removed ? LeaveResult::Left : LeaveResult::NotMember;
+}
+
+bool Registry::FindGroup(std::string_view groupName, GroupPtr &group) const {
+    return groupMap.Find(groupName, group);
+}
+
+std::string Registry::GroupList() const {
+    std::string groupList;
+    groupMap.ForEach([&](const std::string &name, const GroupPtr &) {
+        groupList += name + " ";
+    });
+    return groupList;
+}
+
+std::vector<std::string> Registry::GroupNames() const {
+    std::vector<std::string> names;
+    groupMap.ForEach([&](const std::string &name, const GroupPtr &) { names.push_back(name); });
+    return names;
+}
+
+std::vector<std::string> Registry::UserNames() const {
+    std::vector<std::string> names;
+    userMap.ForEach([&](const std::string &name, const ClientHandle &) { names.push_back(name); });
+    return names;
+}
+
+void Registry::AddGroups(const std::vector<std::string> &groupNames) {
+    groupMap.InsertAll(groupNames, [](const std::string &name) { return std::make_shared<Group>(name); });
+}
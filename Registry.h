@@ -0,0 +1,139 @@
+#ifndef ONLINECHAT_REGISTRY_H
+#define ONLINECHAT_REGISTRY_H
+
+#include "ConcurrentMap.h"
+#include "Group.h"
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+class GroupStore;
+class GroupSnapshotWriter;
+
+// 持久成员关系按用户名划分的分段数
+#define MEMBERSHIP_STRIPES 256
+
+/**
+ * 所有分片共享的用户和群组目录。用户名和群组名的查找是无等待的（见 ConcurrentMap），
+ * 消息路由路径上不加锁；目录中只保存客户端句柄，连接对象始终只由所属分片访问和释放，
+ * 投递时由目标分片按ID查找，已断开的连接查不到，不会访问已释放的对象
+ */
+class Registry {
+public:
+    Registry();
+
+    ~Registry();
+
+    /**
+     * 从目录加载持久化的群组和成员关系，之后的变更写入该目录。
+     * 启用后群组成员关系属于用户名：连接断开后保留，用户注册时自动重新加入
+     * @return 是否成功，失败时不持久化
+     */
+    bool Open(const std::string &dir);
+
+    // 持久化存储，未启用时为空指针
+    GroupStore *Store() { return store.get(); }
+
+    // 注册用户，同名用户会被覆盖
+    void AddUser(const std::string &username, ClientHandle handle);
+
+    /**
+     * 移除用户，只有句柄一致时才移除，避免误删同名的新连接
+     * @return 是否移除
+     */
+    bool RemoveUser(const std::string &username, ClientHandle handle);
+
+    /**
+     * 查找用户
+     * @param username 用户名
+     * @param handle 输出的客户端句柄
+     * @return 用户是否在线
+     */
+    bool FindUser(std::string_view username, ClientHandle &handle) const;
+
+    /**
+     * 创建群组，创建者自动成为成员
+     * @param group 输出创建的群组
+     * @return 群组已存在时返回 false
+     */
+    bool CreateGroup(const std::string &groupName, const GroupMember &creator, GroupPtr &group);
+
+    // 加入或退出群组的结果
+    enum class JoinResult {
+        Joined, AlreadyMember, GroupNotFound
+    };
+
+    enum class LeaveResult {
+        Left, NotMember, GroupNotFound
+    };
+
+    /**
+     * 加入群组，O(1)
+     * @param group 群组存在时输出该群组
+     */
+    JoinResult JoinGroup(std::string_view groupName, const GroupMember &member, GroupPtr &group);
+
+    /**
+     * 退出群组，O(1)，同时删除用户的持久成员关系
+     * @param group 群组存在时输出该群组
+     */
+    LeaveResult LeaveGroup(std::string_view groupName, const GroupMember &member, GroupPtr &group);
+
+    /**
+     * 把用户的连接加入其持久成员关系中的所有群组
+     * @param joined 输出本次加入的群组
+     */
+    void RejoinGroups(const GroupMember &member, std::vector<GroupPtr> &joined);
+
+    /**
+     * 查找群组，无等待
+     * @return 群组是否存在
+     */
+    bool FindGroup(std::string_view groupName, GroupPtr &group) const;
+
+    // 以空格分隔的群组名
+    std::string GroupList() const;
+
+    // 所有群组名
+    std::vector<std::string> GroupNames() const;
+
+    // 所有在线用户名的快照
+    std::vector<std::string> UserNames() const;
+
+    // 批量创建不存在的群组，不写入日志，用于热重启时接收旧进程未持久化的群组
+    void AddGroups(const std::vector<std::string> &groupNames);
+
+private:
+    // 一段用户的持久成员关系：用户名到其加入的群组名
+    struct alignas(64) MembershipStripe {
+        std::mutex mutex;
+        std::unordered_map<std::string, std::vector<std::string>> groups;
+    };
+
+    MembershipStripe &StripeOf(std::string_view username);
+
+    /**
+     * 增加或删除一条持久成员关系
+     * @param log 是否写入日志，加载时为 false
+     * @return 是否发生变化
+     */
+    bool AddMembership(std::string_view groupName, std::string_view username, bool log);
+
+    bool RemoveMembership(std::string_view groupName, std::string_view username, bool log);
+
+    // 写入快照：先写入所有成员关系，再写入所有群组名
+    void Dump(GroupSnapshotWriter &writer);
+
+    // 用户名到客户端句柄的映射
+    ConcurrentMap<ClientHandle> userMap;
+    //群组名与群组的映射
+    ConcurrentMap<GroupPtr> groupMap;
+    std::unique_ptr<MembershipStripe[]> memberships;
+    // 最后声明，最先析构：快照线程结束前不能释放上面的目录
+    std::unique_ptr<GroupStore> store;
+};
+
+#endif //ONLINECHAT_REGISTRY_H
@@ -0,0 +1,100 @@
+#ifndef ONLINECHAT_RINGBUFFER_H
+#define ONLINECHAT_RINGBUFFER_H
+
+#include "Pool.h"
+#include <cstddef>
+#include <cstring>
+
+/**
+ * 每个连接的接收缓冲区。写入位置到达末尾时把未消费的数据移回开头，
+ * 保证可读区域始终连续，解码器可以直接返回指向缓冲区内部的 string_view。
+ * 可读数据为空时读写位置直接归零，正常情况下不需要移动数据。
+ * 内存从缓冲区池中按需取得，连接空闲时归还，空闲连接不占用接收缓冲区
+ */
+class RingBuffer {
+public:
+    explicit RingBuffer(size_t capacity = 4096) : baseCapacity(capacity), capacity(capacity) {}
+
+    ~RingBuffer() { Release(); }
+
+    RingBuffer(const RingBuffer &) = delete;
+
+    RingBuffer &operator=(const RingBuffer &) = delete;
+
+    const char *ReadPtr() const { return data + readPos; }
+
+    // 可读数据的可写指针，用于原地解码（例如去除 WebSocket 掩码）
+    char *MutableReadPtr() { return data + readPos; }
+
+    size_t Readable() const { return writePos - readPos; }
+
+    char *WritePtr() { return data + writePos; }
+
+    size_t Writable() const { return data ? capacity - writePos : 0; }
+
+    size_t Capacity() const { return capacity; }
+
+    // 确认写入了 n 字节
+    void Commit(size_t n) { writePos += n; }
+
+    // 消费 n 字节，可读数据为空时归零读写位置
+    void Consume(size_t n) {
+        readPos += n;
+        if (readPos == writePos) {
+            readPos = writePos = 0;
+        }
+    }
+
+    // 准备写入：没有内存时从缓冲区池取得，写入位置到达末尾时把未消费的数据移回开头
+    void PrepareWrite() {
+        if (!data) {
+            data = static_cast<char *>(BufferPool::Allocate(capacity));
+        } else if (writePos == capacity && readPos > 0) {
+            Compact();
+        }
+    }
+
+    // 保证缓冲区至少能容纳 n 字节的连续可读数据，不够时扩容
+    void Reserve(size_t n) {
+        if (n <= capacity) {
+            if (data && readPos + n > capacity) Compact();
+            return;
+        }
+        // 按池的分级取整，多出的部分也可以使用
+        n = BufferPool::Capacity(n);
+        auto *larger = static_cast<char *>(BufferPool::Allocate(n));
+        size_t readable = Readable();
+        if (data) {
+            memcpy(larger, ReadPtr(), readable);
+            BufferPool::Free(data, capacity);
+        }
+        writePos = readable;
+        readPos = 0;
+        data = larger;
+        capacity = n;
+    }
+
+    // 没有未消费的数据时把内存归还缓冲区池，下次写入前按初始容量重新取得
+    void Release() {
+        if (!data || Readable() > 0) return;
+        BufferPool::Free(data, capacity);
+        data = nullptr;
+        capacity = baseCapacity;
+    }
+
+private:
+    void Compact() {
+        size_t n = Readable();
+        memmove(data, ReadPtr(), n);
+        readPos = 0;
+        writePos = n;
+    }
+
+    char *data{};
+    size_t baseCapacity;
+    size_t capacity;
+    size_t readPos{0};
+    size_t writePos{0};
+};
+
+#endif //ONLINECHAT_RINGBUFFER_H
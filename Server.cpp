@@ -1,422 +1,224 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
 #include <iostream>
-#include <winsock2.h>
-#include <windows.h>
-#include <vector>
-#include <mutex>
-#include <atomic>
-#include <thread>
-#include <algorithm>
-#include <unordered_map>
 #include <string>
-
-// 定义缓冲区大小
-#define BUF_SIZE 4096
-
-/**
- * 客户端信息结构体，包含客户端的ID、套接字、地址、重叠结构体和缓冲区
- */
-struct ClientInfo {
-    int id{};
-    SOCKET sclient{};
-    sockaddr_in addrClient{};
-    OVERLAPPED overlapped{};
-    char buf[BUF_SIZE]{};
-    std::string username;  // 新增用户名字段
-};
-
-// 全局互斥锁，用于线程安全访问
-std::mutex connectionMutex;
-// 连接计数器，原子类型，用于线程安全操作
-std::atomic<int> connectionCount(0);
-// 下一个客户端ID，原子类型，用于线程安全操作
-std::atomic<int> nextClientId(1);
-// 客户端列表，存储客户端信息指针
-std::vector<ClientInfo *> clients;
-// 用户名到客户端信息的映射，用于快速查找
-std::unordered_map<std::string, ClientInfo *> userMap;  // 用户名与ClientInfo的映射
-//群组与ClientInfo的映射
-std::unordered_map<std::string, std::vector<ClientInfo *>> groupMap;
-
-// 函数声明
-void ProcessClient(ClientInfo *clientInfo);
+#include <thread>
+#include <vector>
+#include "Handoff.h"
+#include "Log.h"
+#include "Metrics.h"
+#include "Platform.h"
+#include "Shard.h"
 
 // 键盘输入线程函数，用于接收控制台输入并发送给所有客户端
-DWORD WINAPI KeyboardThread(LPVOID);
+void KeyboardThread(ShardSet &shards);
 
-// 清理函数，用于关闭套接字和释放资源
-void Cleanup();
+static double Milliseconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
 
-void SendToClient(SOCKET sclient, const char *data, int len, int i) {
-    WSABUF buffer;
-    buffer.buf = (CHAR*)data;
-    buffer.len = len;
-    DWORD bytesSent;
-    OVERLAPPED ol;
-    ZeroMemory(&ol, sizeof(ol));
-    int result = WSASend(sclient, &buffer, 1, &bytesSent, 0, &ol, NULL);
-    if (result == SOCKET_ERROR && WSAGetLastError() != WSA_IO_PENDING) {
-        std::cerr << "WSASend failed with error: " << WSAGetLastError() << std::endl;
+/**
+ * 把服务交给发出请求的新进程：停止所有分片，导出状态并连同套接字一起发送，等待新进程确认后答复由它服务
+ * @return 新进程已接管时返回 true，否则恢复服务并返回 false
+ */
+static bool HandOver(ShardSet &shards, SOCKET conn, MetricsServer &metrics, const std::function<void()> &startMetrics) {
+    auto start = std::chrono::steady_clock::now();
+    LOG_INFO << "Handing over to a new process ...";
+    // 新进程需要使用同一个指标端口
+    metrics.Stop();
+    shards.Stop();
+    shards.Join();
+    HandoffState state;
+    shards.Export(state);
+    bool acked = SendHandoff(conn, state) && WaitHandoffAck(conn, HANDOFF_ACK_TIMEOUT_MS);
+    if (acked && SendHandoffDecision(conn, true)) {
+        closesocket(conn);
+        LOG_INFO << "Handed " << state.clients.size() << " connections over in " << (int64_t) Milliseconds(start)
+                 << " ms, exiting.";
+        return true;
     }
+    // 新进程可能仍在打开数据目录或稍后才确认：通知它放弃，等它退出后再恢复，避免两个进程同时服务
+    LOG_ERROR << "Handoff failed, waiting for the new process to exit ...";
+    SendHandoffDecision(conn, false);
+    WaitHandoffClosed(conn);
+    closesocket(conn);
+    // 套接字仍由本进程持有，新进程没有开始处理，恢复事件循环即可
+    LOG_INFO << "Resuming service.";
+    shards.Start();
+    startMetrics();
+    return false;
 }
 
-int main() {
-    WSADATA wsaData;
-    SOCKET sServer;
-    int retVal;
-
-    // 初始化Winsock
-    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+/**
+ * 用法: Server [分片数] [在线状态合并窗口毫秒] [指标端口] [数据目录] [--takeover] [--multicast 接口地址] [--port 端口]
+ *        [--node 节点ID --cluster 节点列表 --cluster-secret 密钥] [--websocket 端口]，分片数默认为CPU核心数，
+ * 合并窗口默认50毫秒，指标端口默认9991（只监听本机地址，0 表示不提供指标），数据目录默认为 data（none 表示不保存消息历史）。
+ * --takeover 表示热重启：从正在运行的服务器接管监听套接字和所有连接，分片数与旧进程相同。
+ * --multicast 表示在该本机接口上为订阅的二进制客户端组播群组消息，热重启的新进程需要同样指定。
+ * --port 为客户端端口，默认9990。
+ * --cluster 表示多节点联邦，节点列表形如 1=10.0.0.1:7001,2=10.0.0.2:7001（节点ID=地址:节点间端口），
+ * 所有节点使用同一列表，--node 指定本节点在列表中的ID；用户可以连接任意节点，私聊和群组消息在节点之间转发。
+ * 节点间端口只监听列表中本节点的地址，连入的节点须来自列表中它的地址并给出相同的 --cluster-secret（也可用环境变量
+ * ONLINECHAT_CLUSTER_SECRET 指定，避免出现在进程列表中）。
+ * --websocket 表示在该端口上接受网页客户端的 WebSocket 连接，与 TCP 客户端共用事件循环和命令处理；
+ * 热重启时沿用旧进程的 WebSocket 端口，旧进程没有监听时才按该选项监听
+ */
+int main(int argc, char **argv) {
+    // 初始化网络库
+    if (!InitNetwork()) {
         std::cerr << "WSAStartup failed !" << std::endl;
         return 1;
     }
 
-    // 创建服务器套接字
-    sServer = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if (sServer == INVALID_SOCKET) {
-        std::cerr << "Socket failed !" << std::endl;
-        WSACleanup();
-        return -1;
-    }
-
-    // 设置服务器地址信息并绑定
-    sockaddr_in addrServ{};
-    addrServ.sin_family = AF_INET;
+    Logger::SetThreadName("main");
+    bool takeover = false;
+    std::string multicastInterface;
+    std::string clusterSpec;
+    const char *secretEnv = getenv("ONLINECHAT_CLUSTER_SECRET");
+    std::string clusterSecret = secretEnv != nullptr ? secretEnv : "";
     int port = 9990;
-    addrServ.sin_port = htons(port);
-    addrServ.sin_addr.S_un.S_addr = INADDR_ANY;
-
-    retVal = bind(sServer, (sockaddr *) &addrServ, sizeof(addrServ));
-    if (retVal == SOCKET_ERROR) {
-        std::cerr << "Bind failed !" << std::endl;
-        closesocket(sServer);
-        WSACleanup();
-        return -1;
-    }
-
-    // 开始监听
-    retVal = listen(sServer, SOMAXCONN);
-    if (retVal == SOCKET_ERROR) {
-        std::cerr << "Listen failed !" << std::endl;
-        closesocket(sServer);
-        WSACleanup();
-        return -1;
+    int webSocketPort = 0;
+    int nodeId = -1;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) == "--takeover") takeover = true;
+        else if (std::string(argv[i]) == "--multicast" && i + 1 < argc) multicastInterface = argv[++i];
+        else if (std::string(argv[i]) == "--port" && i + 1 < argc) port = std::stoi(argv[++i]);
+        else if (std::string(argv[i]) == "--node" && i + 1 < argc) nodeId = std::stoi(argv[++i]);
+        else if (std::string(argv[i]) == "--cluster" && i + 1 < argc) clusterSpec = argv[++i];
+        else if (std::string(argv[i]) == "--cluster-secret" && i + 1 < argc) clusterSecret = argv[++i];
+        else if (std::string(argv[i]) == "--websocket" && i + 1 < argc) webSocketPort = std::stoi(argv[++i]);
+        else args.emplace_back(argv[i]);
     }
-
-    // 创建键盘输入线程
-    CreateThread(nullptr, 0, KeyboardThread, nullptr, 0, nullptr);
-
-    std::cout << "Server is listening on port " << port << " ..." << std::endl;
-
-    // 循环等待客户端连接
-    while (true) {
-        sockaddr_in addrClient{};
-        int addrClientLen = sizeof(addrClient);
-        SOCKET sClient = accept(sServer, (sockaddr *) &addrClient, &addrClientLen);
-        if (sClient == INVALID_SOCKET) {
-            int err = WSAGetLastError();
-            if (err != WSAEWOULDBLOCK) {
-                std::cerr << "Accept failed with error: " << err << std::endl;
-                break;
-            }
-            Sleep(100);
-            continue;
-        }
-
-        // 为新客户端分配内存
-        auto *clientInfo = new ClientInfo;
-        clientInfo->sclient = sClient;
-        clientInfo->addrClient = addrClient;
-        clientInfo->id = nextClientId++;
-        ZeroMemory(&clientInfo->overlapped, sizeof(clientInfo->overlapped));
-
-        // 创建线程处理客户端请求
-        std::thread(ProcessClient, clientInfo).detach();
+    std::vector<ClusterNode> clusterNodes;
+    if (!clusterSpec.empty() && (nodeId < 0 || !Cluster::ParseNodes(clusterSpec, clusterNodes))) {
+        std::cerr << "Invalid --node or --cluster option." << std::endl;
+        return 1;
     }
-
-    // 服务结束后的清理工作
-    Cleanup();
-    return 0;
-}
-
-/**
- * 处理客户端连接的函数，每个客户端连接都会创建一个线程调用此函数
- * @param clientInfo 客户端信息指针
- */
-void ProcessClient(ClientInfo *clientInfo) {
-    // 创建事件对象并关联到OVERLAPPED结构体
-    clientInfo->overlapped.hEvent = WSACreateEvent();
-    if (clientInfo->overlapped.hEvent == nullptr) {
-        std::cerr << "WSACreateEvent failed with error: " << WSAGetLastError() << std::endl;
-        delete clientInfo;
-        return;
+    if (!clusterSpec.empty() && clusterSecret.empty()) {
+        std::cerr << "--cluster requires --cluster-secret or ONLINECHAT_CLUSTER_SECRET." << std::endl;
+        return 1;
     }
-
-    // 客户端连接信息
+    int shardCount = args.size() > 0 ? std::stoi(args[0]) : 0;
+    int presenceWindowMs = args.size() > 1 ? std::stoi(args[1]) : PRESENCE_WINDOW_MS;
+    int metricsPort = args.size() > 2 ? std::stoi(args[2]) : METRICS_PORT;
+    std::string dataDir = args.size() > 3 ? args[3] : "data";
+    if (dataDir == "none") dataDir.clear();
+    char handoffPath[64];
+    snprintf(handoffPath, sizeof(handoffPath), HANDOFF_PATH_FORMAT, port);
     {
-        std::lock_guard<std::mutex> lock(connectionMutex);
-        connectionCount++;
-        std::cout << "Client [" << clientInfo->id << "] connected from "
-                  << inet_ntoa(clientInfo->addrClient.sin_addr) << ":" << ntohs(clientInfo->addrClient.sin_port)
-                  << std::endl;
-        clients.push_back(clientInfo);
-        std::cout << "Total connections: " << connectionCount.load() << std::endl;
-    }
-
-    // 进入通信循环
-    while (true) {
-        DWORD bytesReceived;
-        DWORD flags = 0;
-        WSABUF dataBuf;
-        dataBuf.buf = clientInfo->buf;
-        dataBuf.len = BUF_SIZE;
-
-        int retVal = WSARecv(clientInfo->sclient, &dataBuf, 1, &bytesReceived, &flags, &clientInfo->overlapped,
-                             nullptr);
-        if (retVal == SOCKET_ERROR) {
-            int err = WSAGetLastError();
-            if (err != WSA_IO_PENDING) {
-                std::cerr << "WSARecv failed with error: " << err << std::endl;
-                break;
+        // 热重启时先取得旧进程的状态，旧进程此时已停止并把存储落盘，之后才能打开数据目录
+        HandoffState handoff;
+        SOCKET oldServer = INVALID_SOCKET;
+        auto takeoverStart = std::chrono::steady_clock::now();
+        if (takeover) {
+            oldServer = HandoffConnect(handoffPath);
+            if (oldServer == INVALID_SOCKET || !ReceiveHandoff(oldServer, handoff)) {
+                if (oldServer != INVALID_SOCKET) closesocket(oldServer);
+                Logger::Flush();
+                CleanupNetwork();
+                return -1;
             }
+            if (shardCount > 0 && shardCount != (int) handoff.listeners.size()) {
+                LOG_WARN << "Using the " << handoff.listeners.size() << " shards of the running server.";
+            }
+            shardCount = (int) handoff.listeners.size();
         }
 
-        // 等待接收完成
-        DWORD waitRet = WSAWaitForMultipleEvents(1, &clientInfo->overlapped.hEvent, TRUE, INFINITE, FALSE);
-        if (waitRet == WSA_WAIT_FAILED) {
-            std::cerr << "WSAWaitForMultipleEvents failed with error: " << WSAGetLastError() << std::endl;
-            break;
+        // 每个分片一个事件循环线程，各自监听同一端口并独占自己接受的连接
+        ShardSet shards(shardCount, presenceWindowMs, dataDir);
+        bool multicastOk = multicastInterface.empty() || shards.EnableMulticast(multicastInterface);
+        // 旧进程在移交之前已关闭节点间端口，新进程重新监听，其它节点自动重连
+        bool clusterOk = clusterNodes.empty() || shards.EnableCluster(nodeId, clusterNodes, clusterSecret);
+        bool listenOk = takeover ? shards.Import(handoff) : shards.Listen(port);
+        if (listenOk && webSocketPort > 0 && handoff.webSocketListeners.empty()) {
+            listenOk = shards.ListenWebSocket(webSocketPort);
+        }
+        // 接管失败时不关闭与旧进程的连接，进程退出时才关闭，旧进程看到连接关闭后才恢复服务和写数据目录
+        if (!multicastOk || !clusterOk || !listenOk) {
+            Logger::Flush();
+            CleanupNetwork();
+            return -1;
+        }
+        if (takeover) {
+            // 旧进程确认超时后已决定恢复服务，新进程不能处理任何连接
+            if (!SendHandoffAck(oldServer) || !WaitHandoffCommit(oldServer)) {
+                LOG_ERROR << "The running server did not commit the handoff, exiting.";
+                Logger::Flush();
+                CleanupNetwork();
+                return -1;
+            }
+            closesocket(oldServer);
+            LOG_INFO << "Took over " << handoff.clients.size() << " connections in "
+                     << (int64_t) Milliseconds(takeoverStart) << " ms.";
         }
 
-        // 检查接收操作是否已完成
-        WSAGetOverlappedResult(clientInfo->sclient, &clientInfo->overlapped, &bytesReceived, FALSE, &flags);
+        // 指标服务在分片之前析构，停止后不再读取分片的指标
+        MetricsServer metrics;
+        auto startMetrics = [&]() {
+            if (metricsPort > 0 && metrics.Start(metricsPort, [&shards]() { return shards.RenderMetrics(); })) {
+                LOG_INFO << "Metrics are served on http://127.0.0.1:" << metricsPort << "/metrics";
+            }
+        };
+        startMetrics();
 
-        // 处理接收到的数据
-        if (bytesReceived > 0) {
-            clientInfo->buf[bytesReceived] = '\0';
-            std::cout << "Received from [" << clientInfo->id << "][" << inet_ntoa(clientInfo->addrClient.sin_addr)
-                      << ":" << ntohs(clientInfo->addrClient.sin_port) << "]: " << clientInfo->buf << std::endl;
+        // 创建键盘输入线程
+        std::thread(KeyboardThread, std::ref(shards)).detach();
 
-            // 解析消息并处理
-            char *token;
-            char *context = nullptr;
-            token = strtok_s(clientInfo->buf, " ", &context);
-            std::string cmd(token);
+        LOG_INFO << "Server is listening on port " << port << " with " << shards.Count() << " shards ...";
+        if (webSocketPort > 0) LOG_INFO << "WebSocket clients are accepted on port " << webSocketPort << ".";
+        if (!clusterNodes.empty()) LOG_INFO << "Cluster node " << nodeId << " of " << clusterNodes.size() << " nodes.";
+        shards.Start();
 
-            // 注册命令处理
-            if (cmd == "REGISTER") {
-                token = strtok_s(nullptr, " ", &context); // 第二段
-                if (strcmp(token, "SERVER") == 0) { // 验证是否为 "SERVER"
-                    token = strtok_s(nullptr, " ", &context); // 用户名
-                    if (token != nullptr) {
-                        std::string username(token);
-                        clientInfo->username = username;
-                        {
-                            std::lock_guard<std::mutex> lock(connectionMutex);
-                            userMap[username] = clientInfo;
-                            std::cout << "User registered: " << username << std::endl;
-                            // 通知客户端注册成功
-                            SendToClient(clientInfo->sclient, "Server: Registered.", 19, 0);
-                            // 向所有在线用户发送在线用户列表
-                            std::string userList = "Server: Online users: ";
-                            for (const auto &pair: userMap) {
-                                userList += pair.first + " ";
-                            }
-                            for (auto client: clients) {
-                                SendToClient(client->sclient, userList.c_str(), (int) userList.length(), 0);
-                            }
-                        }
-                    }
-                } else {
-                    std::cerr << "Invalid registration command format." << std::endl;
-                    // 通知客户端注册失败
-                    SendToClient(clientInfo->sclient, "Server: Invalid registration command format.", 41, 0);
-                }
-            } else if (cmd == "MESSAGE") {// 消息发送命令处理
-                token = strtok_s(nullptr, " ", &context);
-                std::string target(token);
-                std::string message(context);
-                if (target == "SERVER") {
-                    std::cout << "Message to SERVER: " << message << std::endl;
-                } else {
-                    std::lock_guard<std::mutex> lock(connectionMutex);
-                    if (userMap.find(target) != userMap.end()) {
-                        //在消息前加上发送者的用户名
-                        message = clientInfo->username + ": " + context;
-                        SendToClient(userMap[target]->sclient, message.c_str(), (int) message.length(), 0);
-                        // 通知客户端消息已发送
-                        SendToClient(clientInfo->sclient, "Server: Message sent.", 21, 0);
-                    } else {
-                        std::cout << "User not found: " << target << std::endl;
-                        // 通知客户端用户不存在
-                        SendToClient(clientInfo->sclient, "Server: User not found.", 23, 0);
-                    }
-                }
-            } else if (cmd == "CREATE_GROUP") {// 创建群组命令处理
-                //创建群组
-                token = strtok_s(nullptr, " ", &context);
-                std::string groupName(token);
-                //检查群组是否已存在
-                if (groupMap.find(groupName) != groupMap.end()) {
-                    std::cout << "Group already exists: " << groupName << std::endl;
-                    // 通知客户端群组已存在
-                    SendToClient(clientInfo->sclient, "Server: Group already exists.", 27, 0);
-                } else {
-                    //创建群xxx
-                    groupMap[groupName] = std::vector<ClientInfo *>();
-                    groupMap[groupName].push_back(clientInfo);
-                    std::cout << "Group created: " << groupName << std::endl;
-                    // 通知客户端群组创建成功
-                    SendToClient(clientInfo->sclient, "Server: Group created.", 23, 0);
-                    //广播所有用户群组数量和名字
-                    std::string groupList = "Server: Group list: ";
-                    for (const auto &pair: groupMap) {
-                        groupList += pair.first + " ";
-                    }
-                    for (auto client: clients) {
-                        SendToClient(client->sclient, groupList.c_str(), (int) groupList.length(), 0);
-                    }
-                }
-            } else if (cmd == "JOIN_GROUP") {// 加入群组命令处理
-                //加入群组
-                token = strtok_s(nullptr, " ", &context);
-                token = strtok_s(nullptr, " ", &context);
-                std::string groupName(token);
-                //检查群组是否存在
-                if (groupMap.find(groupName) != groupMap.end()) {
-                    //检查用户是否已在群组中
-                    if (std::find(groupMap[groupName].begin(), groupMap[groupName].end(), clientInfo) !=
-                        groupMap[groupName].end()) {
-                        std::cout << "User already in group: " << groupName << std::endl;
-                        // 通知客户端用户已在群组中
-                        SendToClient(clientInfo->sclient, "Server: User already in group.", 27, 0);
-                    } else {
-                        groupMap[groupName].push_back(clientInfo);
-                        std::cout << "User joined group: " << groupName << std::endl;
-                        // 通知客户端加入群组成功
-                        SendToClient(clientInfo->sclient, "Server: Joined group.", 21, 0);
-                    }
-                } else {
-                    std::cout << "Group not found: " << groupName << std::endl;
-                    // 通知客户端群组不存在
-                    SendToClient(clientInfo->sclient, "Server: Group not found.", 23, 0);
-                }
-            } else if (cmd == "GROUP_CHECK") {// 检查群组成员命令处理
-                //查看群组成员
-                token = strtok_s(nullptr, " ", &context);
-                std::cout << token << std::endl;
-                std::string groupName(token);
-                //查看群组是否存在并输出成员名称
-                if (groupMap.find(groupName) != groupMap.end()) {
-                    std::string groupMembers = "Server: Group members: ";
-                    for (auto member: groupMap[groupName]) {
-                        groupMembers += member->username + " ";
-                    }
-                    SendToClient(clientInfo->sclient, groupMembers.c_str(), (int) groupMembers.length(), 0);
-                } else {
-                    std::cout << "Group not found: " << groupName << std::endl;
-                    // 通知客户端群组不存在
-                    SendToClient(clientInfo->sclient, "Server: Group not found.", 23, 0);
-                }
-            } else if (cmd == "GROUP_MESSAGE") {// 群组消息发送命令处理
-                //群组消息
-                token = strtok_s(nullptr, " ", &context);
-                token = strtok_s(nullptr, " ", &context);
-                std::cout << token << std::endl;
-                std::string groupName(token);
-                token = strtok_s(nullptr, " ", &context);
-                std::cout << token << std::endl;
-                std::string message(token);
-                //检查群组是否存在
-                if (groupMap.find(groupName) != groupMap.end()) {
-                    //检查用户是否在群组中
-                    if (std::find(groupMap[groupName].begin(), groupMap[groupName].end(), clientInfo) !=
-                        groupMap[groupName].end()) {
-                        //在消息前加上发送者的用户名
-                        message = "(" + groupName + ") " + clientInfo->username + ": " + message;
-                        for (auto member: groupMap[groupName]) {
-                            SendToClient(member->sclient, message.c_str(), (int) message.length(), 0);
-                        }
-                        // 通知客户端消息已发送
-                        SendToClient(clientInfo->sclient, "Server: Group message sent.", 27, 0);
-                    }
-                } else {
-                    std::cout << "Group not found: " << groupName << std::endl;
-                    // 通知客户端群组不存在
-                    SendToClient(clientInfo->sclient, "Server: Group not found.", 23, 0);
-                }
-            } else if (cmd == "REMOVE") {// 移除用户命令处理
-                {
-                    std::lock_guard<std::mutex> lock(connectionMutex);
-                    userMap.erase(clientInfo->username);
-                    std::cout << "User removed: " << clientInfo->username << std::endl;
-                    // 向所有在线用户发送在线用户列表
-                    std::string userList = "Server: Online users: ";
-                    for (const auto &pair: userMap) {
-                        userList += pair.first + " ";
-                    }
-                    for (auto client: clients) {
-                        SendToClient(client->sclient, userList.c_str(), (int) userList.length(), 0);
-                    }
-                }
-            }
+        // 等待下一个进程接管，不支持热重启时一直运行到分片结束
+        SOCKET handoffListener = HandoffListen(handoffPath);
+        if (handoffListener == INVALID_SOCKET) {
+            shards.Join();
         } else {
-            // 客户端断开连接
-            std::cout << "Client [" << clientInfo->id << "] disconnected." << std::endl;
-            {
-                std::lock_guard<std::mutex> lock(connectionMutex);
-                connectionCount--;
-                clients.erase(std::remove(clients.begin(), clients.end(), clientInfo), clients.end());
-                userMap.erase(clientInfo->username);
-                std::cout << "Total connections: " << connectionCount.load() << std::endl;
-                // 向所有在线用户发送在线用户列表
-                std::string userList = "Server: Online users: ";
-                for (const auto &pair: userMap) {
-                    userList += pair.first + " ";
-                }
-                for (auto client: clients) {
-                    SendToClient(client->sclient, userList.c_str(), (int) userList.length(), 0);
+            while (true) {
+                SOCKET conn = HandoffAccept(handoffListener);
+                if (conn == INVALID_SOCKET) {
+                    shards.Join();
+                    break;
                 }
+                if (HandOver(shards, conn, metrics, startMetrics)) break;
             }
-            break;
+            // 路径已属于新进程，只关闭套接字
+            closesocket(handoffListener);
         }
-
-        // 重置事件对象，准备下一次接收
-        WSAResetEvent(clientInfo->overlapped.hEvent);
     }
 
-    // 关闭事件对象
-    WSACloseEvent(clientInfo->overlapped.hEvent);
-
-    // 关闭套接字并清理内存
-    closesocket(clientInfo->sclient);
-
-    delete clientInfo;
+    // 服务结束后的清理工作
+    Logger::Flush();
+    CleanupNetwork();
+    return 0;
 }
-// 键盘输入线程实现，允许服务器通过控制台向所有客户端发送消息
-DWORD WINAPI KeyboardThread(LPVOID) {
-    char input[BUF_SIZE];
-    while (true) {
-        std::cin.getline(input, BUF_SIZE);
-        if (strcmp(input, "exit") == 0) break;
 
-        std::lock_guard<std::mutex> lock(connectionMutex);
-        for (auto client: clients) {
-            std::cout << "Sending to [" << client->id << "]: " << input << std::endl;
-            SendToClient(client->sclient, input, (int) strlen(input), 0);
+// 键盘输入线程实现，允许服务器通过控制台向所有客户端发送消息，输入 queues 查看发送队列深度，输入 log 调整日志
+void KeyboardThread(ShardSet &shards) {
+    Logger::SetThreadName("console");
+    std::string input;
+    while (std::getline(std::cin, input)) {
+        if (input == "exit") break;
+        if (input == "queues") {
+            shards.ReportQueues();
+            continue;
         }
+        // log <debug|info|warn|error|off> 设置日志级别，log sample <n> 设置逐条消息日志的采样间隔
+        if (input.rfind("log ", 0) == 0) {
+            std::string arg = input.substr(4);
+            LogLevel level;
+            if (arg.rfind("sample ", 0) == 0) {
+                Logger::SetSampleEvery(std::atoi(arg.c_str() + 7));
+            } else if (Logger::ParseLevel(arg, level)) {
+                Logger::SetLevel(level);
+            } else {
+                std::cout << "Usage: log <debug|info|warn|error|off> | log sample <n>" << std::endl;
+            }
+            continue;
+        }
+        shards.Broadcast(input);
     }
-    return 0;
-}
-// 清理资源，确保程序退出时释放所有资源
-void Cleanup() {
-    // 关闭所有客户端连接
-    std::lock_guard<std::mutex> lock(connectionMutex);
-    for (auto client: clients) {
-        closesocket(client->sclient);
-        delete client;
-    }
-    clients.clear();
-    userMap.clear();  // 清理用户映射
-
-    WSACleanup();// 关闭服务器套接字
 }
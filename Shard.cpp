@@ -0,0 +1,434 @@
+#include "Shard.h"
+#include "GroupStore.h"
+#include "Log.h"
+#include <cstring>
+#include <cstdio>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+Shard::Shard(ShardSet &set, int index) : set(set), index(index) {
+    server = std::make_unique<ChatServer>(*this);
+    for (int i = 0; i < set.Count(); i++) {
+        inbox.push_back(std::make_unique<SpscQueue<ShardMessage>>(MAILBOX_CAPACITY));
+    }
+    overflow.resize(set.Count());
+    pendingWake.resize(set.Count(), 0);
+    reactor.SetWaitCallbacks([this]() { return BeforeWait(); }, [this]() { AfterWait(); });
+}
+
+void Shard::PostTo(int target, ShardMessage &&msg) {
+    if (target == index) {
+        server->OnShardMessage(msg);
+        return;
+    }
+    // 前面有暂存的消息时也只能排在后面，保证同一对分片之间的顺序
+    if (!overflow[target].empty() || !set.At(target).inbox[index]->TryPush(std::move(msg))) {
+        overflow[target].push_back(std::move(msg));
+    }
+    pendingWake[target] = 1;
+}
+
+bool Shard::DrainInbox() {
+    bool any = false;
+    ShardMessage msg;
+    for (auto &queue: inbox) {
+        while (queue->TryPop(msg)) {
+            server->OnShardMessage(msg);
+            any = true;
+        }
+    }
+    return any;
+}
+
+bool Shard::FlushOutbox() {
+    bool blocked = false;
+    for (int target = 0; target < set.Count(); target++) {
+        auto &pending = overflow[target];
+        while (!pending.empty() && set.At(target).inbox[index]->TryPush(std::move(pending.front()))) {
+            pending.pop_front();
+        }
+        if (!pending.empty()) blocked = true;
+        if (pendingWake[target]) {
+            pendingWake[target] = 0;
+            Shard &peer = set.At(target);
+            // 入队是 release 写入，之后的读取可能被提前到写入之前；全屏障与消费者设置 sleeping 后
+            // 再检查队列配合：要么消费者看到新消息，要么这里看到 sleeping，不会丢失唤醒
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (peer.sleeping.load(std::memory_order_seq_cst)) {
+                peer.reactor.Wakeup();
+            }
+        }
+    }
+    return blocked;
+}
+
+int Shard::BeforeWait() {
+    // 处理收到的消息可能产生新的投递，循环直到队列为空
+    while (DrainInbox()) {
+        FlushOutbox();
+    }
+    // 发出收到的消息产生的数据；接收者因此回落到低水位时向发送者所在分片投递的恢复读取由下面一并发出，
+    // 不会留在发件箱中等到下一次事件
+    reactor.FlushDirty();
+    bool blocked = FlushOutbox();
+    sleeping.store(true, std::memory_order_seq_cst);
+    for (auto &queue: inbox) {
+        if (!queue->Empty()) {
+            return 0;
+        }
+    }
+    // 目标队列已满时稍后重试
+    return blocked ? 1 : -1;
+}
+
+void Shard::AfterWait() {
+    sleeping.store(false, std::memory_order_relaxed);
+}
+
+void Shard::Start() {
+    thread = std::thread([this]() {
+        Logger::SetThreadName("shard-" + std::to_string(index));
+        reactor.Run();
+    });
+}
+
+void Shard::Join() {
+    if (thread.joinable()) thread.join();
+}
+
+size_t Shard::InboxSize() const {
+    size_t total = 0;
+    for (const auto &queue: inbox) total += queue->Size();
+    return total;
+}
+
+ShardSet::ShardSet(int shardCount, int presenceWindowMs, const std::string &dataDir)
+        : presence(registry, presenceWindowMs) {
+    if (!dataDir.empty()) {
+        if (!registry.Open(dataDir + "/groups")) LOG_ERROR << "Groups will not be persisted.";
+        store = std::make_unique<MessageStore>(dataDir);
+        if (!store->Open()) {
+            LOG_ERROR << "Message history is disabled.";
+            store.reset();
+        }
+    }
+    std::error_code ec;
+    std::string spoolDir = dataDir.empty() ? fs::temp_directory_path(ec).string() : dataDir + "/spool";
+    if (!dataDir.empty()) fs::create_directories(spoolDir, ec);
+    if (spoolDir.empty()) spoolDir = ".";
+    files = std::make_unique<FileRelay>(spoolDir);
+    if (shardCount <= 0) {
+        shardCount = (int) std::thread::hardware_concurrency();
+        if (shardCount <= 0) shardCount = 1;
+    }
+    // 先确定分片数再创建分片，分片构造时需要知道总数
+    shards.resize(shardCount);
+    for (int i = 0; i < shardCount; i++) {
+        shards[i] = std::make_unique<Shard>(*this, i);
+    }
+}
+
+bool ShardSet::Listen(int port) {
+    for (auto &shard: shards) {
+        if (!shard->GetReactor().Listen(port, shards.size() > 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ShardSet::ListenWebSocket(int port) {
+    for (auto &shard: shards) {
+        if (!shard->GetReactor().ListenWebSocket(port, shards.size() > 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void ShardSet::Start() {
+    for (auto &shard: shards) shard->Start();
+    // 停止后重新启动时再次监听节点间端口
+    if (cluster && cluster->Listen()) cluster->Start();
+}
+
+void ShardSet::Join() {
+    for (auto &shard: shards) shard->Join();
+}
+
+void ShardSet::Stop() {
+    // 先断开节点间连接，不再向分片投递消息
+    if (cluster) cluster->Stop();
+    for (auto &shard: shards) shard->GetReactor().Stop();
+}
+
+void ShardSet::Export(HandoffState &state) {
+    for (auto &shard: shards) shard->Server().FailTransfers();
+    // 投递一条消息可能产生新的消息（例如拥塞时的 PAUSE_READ），循环直到所有队列为空
+    bool pending = true;
+    while (pending) {
+        pending = false;
+        for (auto &shard: shards) pending |= shard->DrainInbox();
+        for (auto &shard: shards) pending |= shard->FlushOutbox();
+        for (auto &shard: shards) pending |= shard->InboxSize() > 0;
+    }
+    // 先落盘再等待快照：落盘可能触发一次快照，之后不再有变更
+    if (GroupStore *groups = registry.Store()) {
+        groups->Sync();
+        groups->WaitCompaction();
+    } else {
+        state.groups = registry.GroupNames();
+    }
+    if (store) store->Sync();
+    if (multicast) multicast->Save(state.multicastGroups, state.multicastSeqs);
+    state.presenceSeq = presence.Save(state.online, state.touched);
+    for (auto &shard: shards) {
+        state.listeners.push_back(shard->GetReactor().ListenSocket());
+        SOCKET webSocket = shard->GetReactor().WebSocketSocket();
+        if (webSocket != INVALID_SOCKET) state.webSocketListeners.push_back(webSocket);
+        shard->Server().ExportClients(state.clients);
+    }
+}
+
+bool ShardSet::Import(HandoffState &state) {
+    if (state.listeners.size() != shards.size()) {
+        LOG_ERROR << "Expected " << shards.size() << " listening sockets, received " << state.listeners.size();
+        return false;
+    }
+    if (!state.groups.empty()) registry.AddGroups(state.groups);
+    // 新进程未启用组播时，成员的组播范围被忽略，客户端发现组播中断后退回TCP
+    if (multicast) multicast->Restore(state.multicastGroups, state.multicastSeqs);
+    if (!state.webSocketListeners.empty() && state.webSocketListeners.size() != shards.size()) {
+        LOG_ERROR << "Expected " << shards.size() << " WebSocket listening sockets, received "
+                  << state.webSocketListeners.size();
+        return false;
+    }
+    for (size_t i = 0; i < shards.size(); i++) {
+        if (!shards[i]->GetReactor().AdoptListener(state.listeners[i])) return false;
+        if (!state.webSocketListeners.empty() &&
+            !shards[i]->GetReactor().AdoptWebSocketListener(state.webSocketListeners[i])) {
+            return false;
+        }
+    }
+    // 各分片在自己的线程中注册连接，分片之间只共享线程安全的目录
+    std::vector<std::vector<const HandoffClient *>> byShard(shards.size());
+    for (const auto &client: state.clients) byShard[client.shard % shards.size()].push_back(&client);
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < shards.size(); i++) {
+        workers.emplace_back([this, i, &byShard]() {
+            for (const HandoffClient *client: byShard[i]) shards[i]->Server().AdoptClient(*client);
+        });
+    }
+    for (auto &worker: workers) worker.join();
+    if (presence.Restore(state.presenceSeq, state.online, state.touched)) SchedulePresence();
+    return true;
+}
+
+bool ShardSet::EnableMulticast(const std::string &interfaceAddress) {
+    auto sender = std::make_unique<MulticastSender>();
+    if (!sender->Open(interfaceAddress)) return false;
+    multicast = std::move(sender);
+    return true;
+}
+
+bool ShardSet::EnableCluster(int nodeId, const std::vector<ClusterNode> &nodes, const std::string &secret) {
+    auto node = std::make_unique<Cluster>(*this, nodeId, nodes, secret);
+    if (!node->Listen()) return false;
+    cluster = std::move(node);
+    return true;
+}
+
+void ShardSet::Broadcast(const std::string &message) {
+    for (auto &shard: shards) {
+        Shard *target = shard.get();
+        target->GetReactor().Post([target, message]() { target->Server().Broadcast(message); });
+    }
+}
+
+void ShardSet::ReportQueues() {
+    for (auto &shard: shards) {
+        Shard *target = shard.get();
+        target->GetReactor().Post([target]() { target->Server().ReportQueues(); });
+    }
+}
+
+void ShardSet::SchedulePresence() {
+    // 增量只由一个分片编号和发布，各分片按队列顺序收到，序列号不会乱序
+    Shard *owner = shards[0].get();
+    int windowMs = presence.WindowMs();
+    owner->GetReactor().Post([owner, windowMs]() {
+        owner->GetReactor().RunAfter(windowMs, [owner]() { owner->Server().PublishPresence(); });
+    });
+}
+
+// 输出一个直方图的分位数、总和与次数，数值从纳秒换算为秒
+static void RenderSummary(std::string &out, const char *name, const std::string &labels, const Histogram &histogram) {
+    static const char *quantiles[] = {"0.5", "0.9", "0.99", "0.999"};
+    char line[256];
+    std::string prefix = labels.empty() ? "" : labels + ",";
+    for (const char *q: quantiles) {
+        snprintf(line, sizeof(line), "%s{%squantile=\"%s\"} %.9g\n", name, prefix.c_str(), q,
+                 (double) histogram.Quantile(atof(q)) / 1e9);
+        out += line;
+    }
+    std::string braces = labels.empty() ? "" : "{" + labels + "}";
+    snprintf(line, sizeof(line), "%s_sum%s %.9g\n%s_count%s %llu\n", name, braces.c_str(),
+             (double) histogram.Sum() / 1e9, name, braces.c_str(), (unsigned long long) histogram.Count());
+    out += line;
+}
+
+static void RenderHeader(std::string &out, const char *name, const char *type, const char *help) {
+    out += std::string("# HELP ") + name + " " + help + "\n# TYPE " + name + " " + type + "\n";
+}
+
+static void RenderValue(std::string &out, const char *name, const std::string &labels, int64_t value) {
+    out += name;
+    if (!labels.empty()) out += "{" + labels + "}";
+    out += " " + std::to_string(value) + "\n";
+}
+
+std::string ShardSet::RenderMetrics() {
+    // 合并后的直方图较大，放在堆上
+    auto total = std::make_unique<ShardMetrics>();
+    int64_t bytesIn = 0, bytesOut = 0, accepted = 0, evictions = 0, handshakeTimeouts = 0, heartbeatTimeouts = 0;
+    int64_t connRateLimited = 0, userRateLimited = 0, rejectedPending = 0, rejectedPerIp = 0, rejectedDescriptors = 0;
+    int64_t multicastDatagrams = 0, multicastBytes = 0, multicastNaks = 0, multicastRetransmits = 0;
+    int64_t webSocketUpgrades = 0;
+    int64_t fileTransfers = 0, fileBytesReceived = 0, fileBytesSpliced = 0, fileBytesSent = 0, fileBytesSendfile = 0;
+    for (auto &shard: shards) {
+        ShardMetrics &m = shard->GetReactor().Metrics();
+        for (int i = 0; i < METRICS_OPCODES; i++) {
+            total->commands[i].Add(m.commands[i].Get());
+            total->handlerLatency[i].Merge(m.handlerLatency[i]);
+        }
+        total->deliveryLatency.Merge(m.deliveryLatency);
+        bytesIn += m.bytesIn.Get();
+        bytesOut += m.bytesOut.Get();
+        accepted += m.accepted.Get();
+        evictions += m.evictions.Get();
+        handshakeTimeouts += m.handshakeTimeouts.Get();
+        heartbeatTimeouts += m.heartbeatTimeouts.Get();
+        connRateLimited += m.connRateLimited.Get();
+        userRateLimited += m.userRateLimited.Get();
+        rejectedPending += m.rejectedPending.Get();
+        rejectedPerIp += m.rejectedPerIp.Get();
+        rejectedDescriptors += m.rejectedDescriptors.Get();
+        multicastDatagrams += m.multicastDatagrams.Get();
+        multicastBytes += m.multicastBytes.Get();
+        multicastNaks += m.multicastNaks.Get();
+        multicastRetransmits += m.multicastRetransmits.Get();
+        webSocketUpgrades += m.webSocketUpgrades.Get();
+        fileTransfers += m.fileTransfers.Get();
+        fileBytesReceived += m.fileBytesReceived.Get();
+        fileBytesSpliced += m.fileBytesSpliced.Get();
+        fileBytesSent += m.fileBytesSent.Get();
+        fileBytesSendfile += m.fileBytesSendfile.Get();
+    }
+    // 有处理函数的命令才有名称，其余都计入 UNKNOWN
+    std::vector<int> commands;
+    for (int i = 0; i < METRICS_OPCODES; i++) {
+        if (i == 0 || strcmp(OpcodeName((uint8_t) i), "UNKNOWN") != 0) commands.push_back(i);
+    }
+
+    std::string out;
+    RenderHeader(out, "chat_commands_total", "counter", "Commands received, by command.");
+    for (int i: commands) {
+        RenderValue(out, "chat_commands_total", std::string("command=\"") + OpcodeName((uint8_t) i) + "\"",
+                    total->commands[i].Get());
+    }
+    RenderHeader(out, "chat_handler_latency_seconds", "summary", "Command handler latency, by command.");
+    for (int i: commands) {
+        RenderSummary(out, "chat_handler_latency_seconds", std::string("command=\"") + OpcodeName((uint8_t) i) + "\"",
+                      total->handlerLatency[i]);
+    }
+    RenderHeader(out, "chat_delivery_latency_seconds", "summary",
+                 "Time from building a chat message to writing it to a recipient socket.");
+    RenderSummary(out, "chat_delivery_latency_seconds", "", total->deliveryLatency);
+    RenderHeader(out, "chat_bytes_received_total", "counter", "Bytes read from client sockets.");
+    RenderValue(out, "chat_bytes_received_total", "", bytesIn);
+    RenderHeader(out, "chat_bytes_sent_total", "counter", "Bytes written to client sockets.");
+    RenderValue(out, "chat_bytes_sent_total", "", bytesOut);
+    RenderHeader(out, "chat_connections_accepted_total", "counter", "Accepted client connections.");
+    RenderValue(out, "chat_connections_accepted_total", "", accepted);
+    RenderHeader(out, "chat_websocket_upgrades_total", "counter", "Connections upgraded to WebSocket.");
+    RenderValue(out, "chat_websocket_upgrades_total", "", webSocketUpgrades);
+    RenderHeader(out, "chat_evictions_total", "counter", "Clients disconnected for an oversized or stalled send queue.");
+    RenderValue(out, "chat_evictions_total", "", evictions);
+    RenderHeader(out, "chat_timeouts_total", "counter", "Clients disconnected for a missed handshake or heartbeat.");
+    RenderValue(out, "chat_timeouts_total", "kind=\"handshake\"", handshakeTimeouts);
+    RenderValue(out, "chat_timeouts_total", "kind=\"heartbeat\"", heartbeatTimeouts);
+    RenderHeader(out, "chat_rate_limited_total", "counter",
+                 "Times a client's reads were paused for exceeding a token bucket, by scope.");
+    RenderValue(out, "chat_rate_limited_total", "scope=\"connection\"", connRateLimited);
+    RenderValue(out, "chat_rate_limited_total", "scope=\"user\"", userRateLimited);
+    RenderHeader(out, "chat_connections_rejected_total", "counter", "Connections reset on accept, by reason.");
+    RenderValue(out, "chat_connections_rejected_total", "reason=\"pending_handshakes\"", rejectedPending);
+    RenderValue(out, "chat_connections_rejected_total", "reason=\"per_ip\"", rejectedPerIp);
+    RenderValue(out, "chat_connections_rejected_total", "reason=\"descriptors\"", rejectedDescriptors);
+    RenderHeader(out, "chat_pending_handshakes", "gauge", "Connections that have not completed the handshake.");
+    RenderValue(out, "chat_pending_handshakes", "", admission.Pending());
+    RenderHeader(out, "chat_multicast_datagrams_total", "counter", "Group messages sent as one multicast datagram.");
+    RenderValue(out, "chat_multicast_datagrams_total", "", multicastDatagrams);
+    RenderHeader(out, "chat_multicast_bytes_total", "counter", "Bytes of multicast group message datagrams.");
+    RenderValue(out, "chat_multicast_bytes_total", "", multicastBytes);
+    RenderHeader(out, "chat_multicast_naks_total", "counter", "Multicast NAKs received from clients.");
+    RenderValue(out, "chat_multicast_naks_total", "", multicastNaks);
+    RenderHeader(out, "chat_multicast_retransmits_total", "counter", "Multicast messages retransmitted over TCP.");
+    RenderValue(out, "chat_multicast_retransmits_total", "", multicastRetransmits);
+    RenderHeader(out, "chat_file_transfers_total", "counter", "File uploads started.");
+    RenderValue(out, "chat_file_transfers_total", "", fileTransfers);
+    RenderHeader(out, "chat_file_bytes_received_total", "counter", "File bytes written to spool files, by path.");
+    RenderValue(out, "chat_file_bytes_received_total", "path=\"splice\"", fileBytesSpliced);
+    RenderValue(out, "chat_file_bytes_received_total", "path=\"copy\"", fileBytesReceived - fileBytesSpliced);
+    RenderHeader(out, "chat_file_bytes_sent_total", "counter", "File bytes sent to downloading clients, by path.");
+    RenderValue(out, "chat_file_bytes_sent_total", "path=\"sendfile\"", fileBytesSendfile);
+    RenderValue(out, "chat_file_bytes_sent_total", "path=\"copy\"", fileBytesSent - fileBytesSendfile);
+    if (cluster) {
+        RenderHeader(out, "chat_cluster_frames_sent_total", "counter", "Frames queued to other cluster nodes.");
+        RenderValue(out, "chat_cluster_frames_sent_total", "", cluster->FramesSent());
+        RenderHeader(out, "chat_cluster_frames_received_total", "counter", "Frames received from other cluster nodes.");
+        RenderValue(out, "chat_cluster_frames_received_total", "", cluster->FramesReceived());
+        RenderHeader(out, "chat_cluster_bytes_sent_total", "counter", "Bytes sent to other cluster nodes.");
+        RenderValue(out, "chat_cluster_bytes_sent_total", "", cluster->BytesSent());
+        RenderHeader(out, "chat_cluster_send_calls_total", "counter", "send() calls on cluster links.");
+        RenderValue(out, "chat_cluster_send_calls_total", "", cluster->SendCalls());
+        RenderHeader(out, "chat_cluster_dropped_total", "counter", "Cluster messages dropped while a link was down.");
+        RenderValue(out, "chat_cluster_dropped_total", "", cluster->Dropped());
+        RenderHeader(out, "chat_cluster_group_fanout_total", "counter",
+                     "Local member deliveries of group messages received from other nodes.");
+        RenderValue(out, "chat_cluster_group_fanout_total", "", cluster->GroupFanout());
+        RenderHeader(out, "chat_cluster_links_up", "gauge", "Connected outbound cluster links.");
+        RenderValue(out, "chat_cluster_links_up", "", cluster->LinksUp());
+        RenderHeader(out, "chat_cluster_remote_users", "gauge", "Users online on other cluster nodes.");
+        RenderValue(out, "chat_cluster_remote_users", "", (int64_t) cluster->RemoteUsers());
+    }
+
+    // 各分片的当前值
+    struct ShardGauge {
+        const char *name;
+        const char *help;
+        std::function<int64_t(Shard &)> value;
+    };
+    const ShardGauge gauges[] = {
+            {"chat_connections", "Open client connections.", [](Shard &s) {
+                ShardMetrics &m = s.GetReactor().Metrics();
+                return m.accepted.Get() - m.closed.Get();
+            }},
+            {"chat_send_queue_bytes", "Bytes waiting in client send queues.",
+             [](Shard &s) { return s.GetReactor().Metrics().queuedBytes.Get(); }},
+            {"chat_send_queue_frames", "Frames waiting in client send queues.",
+             [](Shard &s) { return s.GetReactor().Metrics().queuedFrames.Get(); }},
+            {"chat_congested_connections", "Connections above the send queue high watermark.",
+             [](Shard &s) { return s.GetReactor().Metrics().congested.Get(); }},
+            {"chat_mailbox_messages", "Messages from other shards waiting to be processed.",
+             [](Shard &s) { return (int64_t) s.InboxSize(); }},
+    };
+    for (const auto &gauge: gauges) {
+        RenderHeader(out, gauge.name, "gauge", gauge.help);
+        for (auto &shard: shards) {
+            RenderValue(out, gauge.name, "shard=\"" + std::to_string(shard->Index()) + "\"", gauge.value(*shard));
+        }
+    }
+    return out;
+}
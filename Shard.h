@@ -0,0 +1,224 @@
+#ifndef ONLINECHAT_SHARD_H
+#define ONLINECHAT_SHARD_H
+
+#include "Reactor.h"
+#include "Registry.h"
+#include "Mailbox.h"
+#include "Presence.h"
+#include "ChatServer.h"
+#include "MessageStore.h"
+#include "Handoff.h"
+#include "Limiter.h"
+#include "Multicast.h"
+#include "Cluster.h"
+#include "FileRelay.h"
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 每个分片消息队列的容量
+#define MAILBOX_CAPACITY 4096
+
+/**
+ * 分片之间传递的消息
+ */
+struct ShardMessage {
+    enum Kind {
+        DELIVER,   // 发送给本地客户端 target
+        GROUP_DELIVER, // 发送给 group 在本分片上的所有成员
+        BROADCAST, // 发送给本分片的所有客户端
+        PRESENCE,  // 在线状态增量，发送给本分片所有未拥塞的客户端
+        PAUSE_READ,  // 暂停读取本地客户端 target，背压来自其它分片的拥塞连接
+        RESUME_READ, // 恢复读取本地客户端 target
+        FILE_READY   // 本地客户端 target 等待的中转文件有新数据，继续下载
+    };
+    Kind kind{DELIVER};
+    MessagePtr data;                          // 所有目标共享的待发送消息
+    uint64_t target{};                        // 目标客户端ID
+    GroupPtr group;                           // 群组消息的目标群组
+    ClientHandle sender;                      // 触发该消息的客户端，用于背压，服务器消息为空句柄
+    uint64_t multicastSeq{};                  // 群组消息的组播序列号，已通过组播收到的成员被跳过
+};
+
+class ShardSet;
+
+/**
+ * 一个分片：独占一个事件循环线程、一个 SO_REUSEPORT 监听套接字和该套接字接受的所有连接。
+ * 发往其它分片连接的消息通过每对分片之间的无锁单生产者单消费者队列传递
+ */
+class Shard {
+public:
+    Shard(ShardSet &set, int index);
+
+    int Index() const { return index; }
+
+    ShardSet &Set() { return set; }
+
+    Reactor &GetReactor() { return reactor; }
+
+    ChatServer &Server() { return *server; }
+
+    /**
+     * 向目标分片投递消息，只能在本分片的事件循环线程中调用。
+     * 队列满时消息暂存在本地，下一轮事件循环再尝试投递
+     * @param target 目标分片
+     * @param msg 消息
+     */
+    void PostTo(int target, ShardMessage &&msg);
+
+    // 启动事件循环线程
+    void Start();
+
+    // 等待事件循环线程结束
+    void Join();
+
+    // 接收队列中尚未处理的消息数，可在任意线程调用
+    size_t InboxSize() const;
+
+private:
+    // 热重启导出时在所有分片停止后处理残留的分片消息
+    friend class ShardSet;
+
+    int BeforeWait();
+
+    void AfterWait();
+
+    // 处理其它分片发来的消息
+    bool DrainInbox();
+
+    // 投递暂存的消息并唤醒有新消息的目标分片
+    bool FlushOutbox();
+
+    ShardSet &set;
+    int index;
+    Reactor reactor;
+    std::unique_ptr<ChatServer> server;
+    std::thread thread;
+    // 按源分片划分的接收队列，inbox[i] 只由分片 i 写入
+    std::vector<std::unique_ptr<SpscQueue<ShardMessage>>> inbox;
+    // 按目标分片划分的暂存队列，目标队列满时使用
+    std::vector<std::deque<ShardMessage>> overflow;
+    // 本轮事件循环中投递过消息、需要检查是否唤醒的目标分片
+    std::vector<char> pendingWake;
+    // 是否即将或正在阻塞等待，生产者据此决定是否需要唤醒
+    std::atomic<bool> sleeping{false};
+};
+
+/**
+ * 全部分片及其共享的用户和群组目录
+ */
+class ShardSet {
+public:
+    /**
+     * @param shardCount 分片数，0 表示每个CPU核心一个分片
+     * @param presenceWindowMs 在线状态变更的合并窗口（毫秒）
+     * @param dataDir 消息历史的数据目录，为空时不保存消息历史
+     */
+    explicit ShardSet(int shardCount, int presenceWindowMs = PRESENCE_WINDOW_MS, const std::string &dataDir = "");
+
+    // 每个分片各自监听同一端口
+    bool Listen(int port);
+
+    // 每个分片在同一事件循环中监听 WebSocket 端口，在 Start 之前调用
+    bool ListenWebSocket(int port);
+
+    // 启动所有分片的事件循环线程
+    void Start();
+
+    // 等待所有分片结束
+    void Join();
+
+    // 停止所有分片
+    void Stop();
+
+    /**
+     * 热重启的旧进程：导出监听套接字、所有连接和共享状态，只在所有分片停止后调用。
+     * 先处理分片之间尚未投递的消息，再等待存储落盘，新进程随后从数据目录加载最新的状态
+     */
+    void Export(HandoffState &state);
+
+    /**
+     * 热重启的新进程：在 Start 之前代替 Listen 调用，接管旧进程移交的监听套接字和连接
+     * @return 是否成功，监听套接字数与分片数不一致时失败
+     */
+    bool Import(HandoffState &state);
+
+    // 向所有客户端发送服务器广播消息，可在任意线程调用
+    void Broadcast(const std::string &message);
+
+    // 以 INFO 级别日志输出各分片连接的发送队列深度，可在任意线程调用
+    void ReportQueues();
+
+    // 合并所有分片的指标，生成 Prometheus 文本格式，可在任意线程调用
+    std::string RenderMetrics();
+
+    int Count() const { return (int) shards.size(); }
+
+    Shard &At(int i) { return *shards[i]; }
+
+    Registry &GetRegistry() { return registry; }
+
+    Presence &GetPresence() { return presence; }
+
+    // 消息历史存储，未启用时为空指针
+    MessageStore *Store() { return store.get(); }
+
+    // 在合并窗口结束后由分片0发布在线状态增量，可在任意线程调用
+    void SchedulePresence();
+
+    // 设置速率限制和连接准入参数，在 Start 之前调用
+    void SetLimits(const Limits &newLimits) { limits = newLimits; }
+
+    const Limits &GetLimits() const { return limits; }
+
+    UserLimiter &GetUserLimiter() { return userLimiter; }
+
+    Admission &GetAdmission() { return admission; }
+
+    /**
+     * 启用组播传输，在 Listen 或 Import 之前调用
+     * @param interfaceAddress 发送组播的本机接口地址
+     * @return 是否成功
+     */
+    bool EnableMulticast(const std::string &interfaceAddress);
+
+    // 组播发送，未启用时为空指针
+    MulticastSender *Multicast() { return multicast.get(); }
+
+    /**
+     * 加入多节点集群并监听节点间连接的端口，在 Start 之前调用
+     * @param nodeId 本节点ID
+     * @param nodes 所有节点，包括本节点
+     * @param secret 所有节点共享的集群密钥
+     * @return 是否成功
+     */
+    bool EnableCluster(int nodeId, const std::vector<ClusterNode> &nodes, const std::string &secret);
+
+    // 集群，未启用时为空指针
+    Cluster *GetCluster() { return cluster.get(); }
+
+    // 文件传输的中转，中转文件放在数据目录的 spool 子目录，没有数据目录时放在系统临时目录
+    FileRelay &Files() { return *files; }
+
+    // 连接计数器，原子类型，用于线程安全操作
+    std::atomic<int> connectionCount{0};
+
+private:
+    Registry registry;
+    Presence presence;
+    Limits limits;
+    UserLimiter userLimiter;
+    Admission admission;
+    // 在分片之后析构，分片线程结束后才停止写入线程
+    std::unique_ptr<MessageStore> store;
+    std::unique_ptr<MulticastSender> multicast;
+    std::unique_ptr<FileRelay> files;
+    std::vector<std::unique_ptr<Shard>> shards;
+    // 在分片之前析构，集群线程向分片投递消息
+    std::unique_ptr<Cluster> cluster;
+};
+
+#endif //ONLINECHAT_SHARD_H
@@ -0,0 +1,116 @@
+#ifndef ONLINECHAT_SLAB_H
+#define ONLINECHAT_SLAB_H
+
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+// 最多的槽位数，句柄的低32位为槽位号，高32位为代数
+#define SLAB_MAX_SLOTS (1u << 20)
+// 每次向系统申请的槽位数
+#define SLAB_BLOCK_SLOTS 1024
+
+/**
+ * 定长对象的分块分配器：对象存放在按块申请、地址固定的槽位中，释放的槽位进入空闲链表，
+ * 后进先出地复用，新对象大多落在刚释放、仍在缓存中的槽位上。
+ * 对象用64位带代数的句柄引用：低32位是槽位号，高32位是槽位被复用的次数。
+ * 对象释放后代数加一，旧句柄再查找时得到空指针，不会指向复用该槽位的新对象；
+ * 代数用尽的槽位不再复用，因此同一句柄不会分配两次。句柄不为 0。只能在一个线程中使用
+ */
+template<typename T>
+class Slab {
+public:
+    Slab() = default;
+
+    ~Slab() {
+        for (uint32_t i = 0; i < slotCount; i++) {
+            Slot &slot = At(i);
+            if (slot.used) slot.Object()->~T();
+        }
+    }
+
+    Slab(const Slab &) = delete;
+
+    Slab &operator=(const Slab &) = delete;
+
+    /**
+     * 在空闲槽位上构造对象
+     * @param handle 输出对象的句柄
+     * @param args 构造参数
+     * @return 对象，槽位用尽时返回 nullptr
+     */
+    template<typename... Args>
+    T *Create(uint64_t &handle, Args &&...args) {
+        uint32_t index;
+        if (freeHead != NO_SLOT) {
+            index = freeHead;
+            freeHead = At(index).nextFree;
+        } else {
+            if (slotCount == MAX_SLOTS) return nullptr;
+            if (slotCount % SLAB_BLOCK_SLOTS == 0) blocks.emplace_back(new Slot[SLAB_BLOCK_SLOTS]);
+            index = slotCount++;
+        }
+        Slot &slot = At(index);
+        T *object = new(slot.storage) T(std::forward<Args>(args)...);
+        slot.used = true;
+        handle = (uint64_t) slot.generation << 32 | index;
+        live++;
+        return object;
+    }
+
+    // 析构句柄对应的对象并回收槽位，句柄无效时忽略
+    void Destroy(uint64_t handle) {
+        Slot *slot = Find(handle);
+        if (slot == nullptr) return;
+        slot->Object()->~T();
+        slot->used = false;
+        live--;
+        // 代数用尽时槽位退役，不进入空闲链表，旧句柄永远不会与新对象重合
+        if (slot->generation == MAX_GENERATION) return;
+        slot->generation++;
+        slot->nextFree = freeHead;
+        freeHead = (uint32_t) handle;
+    }
+
+    // 句柄对应的对象，对象已释放或句柄过期时返回 nullptr
+    T *Get(uint64_t handle) const {
+        Slot *slot = Find(handle);
+        return slot ? slot->Object() : nullptr;
+    }
+
+    // 存活的对象数
+    size_t Size() const { return live; }
+
+private:
+    static constexpr uint32_t MAX_SLOTS = SLAB_MAX_SLOTS;
+    static constexpr uint32_t MAX_GENERATION = ~0u;
+    static constexpr uint32_t NO_SLOT = ~0u;
+
+    struct Slot {
+        alignas(T) unsigned char storage[sizeof(T)];
+        uint32_t generation{1};
+        uint32_t nextFree{NO_SLOT};
+        bool used{false};
+
+        T *Object() { return std::launder(reinterpret_cast<T *>(storage)); }
+    };
+
+    Slot &At(uint32_t index) const { return blocks[index / SLAB_BLOCK_SLOTS][index % SLAB_BLOCK_SLOTS]; }
+
+    Slot *Find(uint64_t handle) const {
+        auto index = (uint32_t) handle;
+        if (index >= slotCount) return nullptr;
+        Slot &slot = At(index);
+        if (!slot.used || slot.generation != (uint32_t) (handle >> 32)) return nullptr;
+        return &slot;
+    }
+
+    std::vector<std::unique_ptr<Slot[]>> blocks;
+    uint32_t freeHead{NO_SLOT};
+    uint32_t slotCount{0};
+    size_t live{0};
+};
+
+#endif //ONLINECHAT_SLAB_H
@@ -0,0 +1,150 @@
+#include "TimerWheel.h"
+#include <algorithm>
+#include <bit>
+#include <climits>
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+// 最高层能表示的最远到期时间
+#define MAX_DELAY ((1ull << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1)
+
+/**
+ * 位图中从 from 开始循环查找的第一个非空槽位
+ * @return 与 from 的距离，没有非空槽位时返回 -1
+ */
+static int NextOccupied(const uint64_t *bits, int from) {
+    for (int d = 0; d < TIMER_WHEEL_SLOTS;) {
+        int index = (from + d) & SLOT_MASK;
+        uint64_t word = bits[index / 64] >> (index % 64);
+        if (word != 0) return d + std::countr_zero(word);
+        d += 64 - index % 64;
+    }
+    return -1;
+}
+
+TimerWheel::TimerWheel(uint64_t nowMs) : current(nowMs) {}
+
+TimerId TimerWheel::Add(uint64_t expireMs, Task task) {
+    TimerId id;
+    Node *node = nodes.Create(id);
+    if (node == nullptr) return 0;
+    node->expire = expireMs;
+    node->id = id;
+    node->task = std::move(task);
+    Place(node);
+    return id;
+}
+
+bool TimerWheel::Cancel(TimerId id) {
+    Node *node = nodes.Get(id);
+    if (node == nullptr) return false;
+    Unlink(node);
+    nodes.Destroy(id);
+    return true;
+}
+
+void TimerWheel::Place(Node *node) {
+    // 已经过期的任务放入下一个要处理的槽位
+    if (node->expire < current) node->expire = current;
+    if (node->expire - current > MAX_DELAY) node->expire = current + MAX_DELAY;
+    uint64_t delta = node->expire - current;
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >> (TIMER_WHEEL_BITS * (level + 1)) != 0) level++;
+    int index = (int) (node->expire >> (TIMER_WHEEL_BITS * level)) & SLOT_MASK;
+    node->slot = level * TIMER_WHEEL_SLOTS + index;
+    // 加到链表末尾，同一槽位的任务按加入顺序执行
+    Link &head = slots[node->slot];
+    node->prev = head.prev;
+    node->next = &head;
+    head.prev->next = node;
+    head.prev = node;
+    occupied[level][index / 64] |= 1ull << (index % 64);
+}
+
+void TimerWheel::Unlink(Node *node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    if (node->slot < 0) return;
+    Link &head = slots[node->slot];
+    if (head.next == &head) {
+        int level = node->slot / TIMER_WHEEL_SLOTS, index = node->slot % TIMER_WHEEL_SLOTS;
+        occupied[level][index / 64] &= ~(1ull << (index % 64));
+    }
+}
+
+void TimerWheel::Detach(int slot, Link &list) {
+    Link &head = slots[slot];
+    if (head.next == &head) return;
+    list.next = head.next;
+    list.prev = head.prev;
+    list.next->prev = &list;
+    list.prev->next = &list;
+    head.next = head.prev = &head;
+    int level = slot / TIMER_WHEEL_SLOTS, index = slot % TIMER_WHEEL_SLOTS;
+    occupied[level][index / 64] &= ~(1ull << (index % 64));
+}
+
+void TimerWheel::Cascade(int level) {
+    Link list;
+    int index = (int) (current >> (TIMER_WHEEL_BITS * level)) & SLOT_MASK;
+    Detach(level * TIMER_WHEEL_SLOTS + index, list);
+    while (list.next != &list) {
+        auto *node = static_cast<Node *>(list.next);
+        list.next = node->next;
+        node->next->prev = &list;
+        Place(node);
+    }
+}
+
+void TimerWheel::RunSlot(int index) {
+    // 执行中的任务可能取消同一槽位中的其它任务，先移到局部链表，取消时直接摘下
+    Link list;
+    Detach(index, list);
+    for (Link *link = list.next; link != &list; link = link->next) static_cast<Node *>(link)->slot = -1;
+    while (list.next != &list) {
+        auto *node = static_cast<Node *>(list.next);
+        Unlink(node);
+        Task task = std::move(node->task);
+        nodes.Destroy(node->id);
+        task();
+    }
+}
+
+void TimerWheel::Advance(uint64_t nowMs) {
+    while (current <= nowMs) {
+        if (nodes.Size() == 0) {
+            current = nowMs + 1;
+            return;
+        }
+        if ((current & SLOT_MASK) == 0) {
+            // 进入高层的一个新槽位，把其中的任务分配到低层
+            for (int level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+                if ((current & ((1ull << (TIMER_WHEEL_BITS * level)) - 1)) == 0) Cascade(level);
+            }
+        }
+        if (std::all_of(occupied[0], occupied[0] + WORDS, [](uint64_t word) { return word == 0; })) {
+            // 第 0 层没有任务，直接跳到下一次分配或 nowMs 之后
+            current = std::min((current | SLOT_MASK) + 1, nowMs + 1);
+            continue;
+        }
+        // 先推进刻度，任务中加入的已到期任务在下一个刻度执行
+        int index = (int) (current++ & SLOT_MASK);
+        RunSlot(index);
+    }
+}
+
+int TimerWheel::NextTimeout(uint64_t nowMs) const {
+    if (nodes.Size() == 0) return -1;
+    uint64_t next = UINT64_MAX;
+    int distance = NextOccupied(occupied[0], (int) (current & SLOT_MASK));
+    if (distance >= 0) next = current + distance;
+    for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        int shift = TIMER_WHEEL_BITS * level;
+        uint64_t block = current >> shift;
+        // 刻度正好在槽位边界上时该槽位尚未分配，否则下一次分配在下一个槽位
+        if ((current & ((1ull << shift) - 1)) != 0) block++;
+        distance = NextOccupied(occupied[level], (int) (block & SLOT_MASK));
+        if (distance >= 0) next = std::min(next, (block + distance) << shift);
+    }
+    if (next <= nowMs) return 0;
+    return (int) std::min<uint64_t>(next - nowMs, INT_MAX);
+}
@@ -0,0 +1,93 @@
+#ifndef ONLINECHAT_TIMERWHEEL_H
+#define ONLINECHAT_TIMERWHEEL_H
+
+#include "Slab.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+// 每层的槽位数为 2^TIMER_WHEEL_BITS，刻度为 1 毫秒
+#define TIMER_WHEEL_BITS 8
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+// 层数，四层覆盖 2^32 毫秒（约 49 天），更远的到期时间按上限处理
+#define TIMER_WHEEL_LEVELS 4
+
+// 定时任务的句柄，0 表示没有定时任务
+using TimerId = uint64_t;
+
+/**
+ * 分层时间轮：第 0 层每个槽位对应 1 毫秒，第 n 层每个槽位对应 256^n 毫秒。
+ * 定时任务按距到期的时间放入对应层的槽位，高层槽位轮到时把其中的任务按剩余时间
+ * 重新分配到低层，最终在第 0 层的槽位中执行。槽位是侵入式双向链表，节点由对象池分配，
+ * 加入和取消都是 O(1)，与定时任务的数量无关。句柄带代数，任务执行或取消后旧句柄失效。
+ * 每层用位图记录非空槽位，用于计算事件循环的等待时间。只能在一个线程中使用
+ */
+class TimerWheel {
+public:
+    using Task = std::function<void()>;
+
+    // nowMs 为当前时间（毫秒），之后的时间都以同一时钟计
+    explicit TimerWheel(uint64_t nowMs = 0);
+
+    TimerWheel(const TimerWheel &) = delete;
+
+    TimerWheel &operator=(const TimerWheel &) = delete;
+
+    /**
+     * 加入定时任务，到期时间不晚于当前刻度时在下一次 Advance 中执行
+     * @param expireMs 到期时间（毫秒）
+     * @param task 任务
+     * @return 句柄，节点用尽时返回 0
+     */
+    TimerId Add(uint64_t expireMs, Task task);
+
+    // 取消尚未执行的定时任务，句柄已失效时返回 false
+    bool Cancel(TimerId id);
+
+    // 执行到 nowMs 为止到期的所有定时任务，任务中可以加入或取消定时任务
+    void Advance(uint64_t nowMs);
+
+    // 距下一个槽位需要处理的毫秒数，没有定时任务时返回 -1
+    int NextTimeout(uint64_t nowMs) const;
+
+    // 尚未执行的定时任务数
+    size_t Size() const { return nodes.Size(); }
+
+private:
+    struct Link {
+        Link *prev{this};
+        Link *next{this};
+    };
+
+    struct Node : Link {
+        uint64_t expire{};
+        TimerId id{};
+        int slot{-1};  // 所在槽位（层号 * 槽位数 + 下标），正在执行的槽位中为 -1
+        Task task;
+    };
+
+    // 按到期时间放入槽位
+    void Place(Node *node);
+
+    // 从所在链表中摘下节点，槽位变空时清除位图
+    void Unlink(Node *node);
+
+    // 把槽位中的节点全部移到 list，清空槽位
+    void Detach(int slot, Link &list);
+
+    // 把高层当前槽位中的任务重新分配到低层
+    void Cascade(int level);
+
+    // 执行第 0 层槽位中的所有任务
+    void RunSlot(int index);
+
+    static constexpr int WORDS = TIMER_WHEEL_SLOTS / 64;
+
+    Slab<Node> nodes;
+    Link slots[TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS];
+    uint64_t occupied[TIMER_WHEEL_LEVELS][WORDS]{};
+    // 下一个要处理的刻度
+    uint64_t current;
+};
+
+#endif //ONLINECHAT_TIMERWHEEL_H
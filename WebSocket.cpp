@@ -0,0 +1,247 @@
+#include "WebSocket.h"
+#include <cctype>
+#include <cstring>
+
+// 握手响应中与 Sec-WebSocket-Key 拼接的固定 GUID
+static const char *WEBSOCKET_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+static uint32_t RotateLeft(uint32_t value, int bits) {
+    return (value << bits) | (value >> (32 - bits));
+}
+
+// SHA-1 摘要，只用于计算握手响应，不用于安全用途
+static void Sha1(std::string_view data, uint8_t digest[20]) {
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    std::string message(data);
+    uint64_t bitLength = (uint64_t) data.size() * 8;
+    message += (char) 0x80;
+    while (message.size() % 64 != 56) message += '\0';
+    for (int i = 7; i >= 0; i--) message += (char) (bitLength >> (i * 8));
+    for (size_t chunk = 0; chunk < message.size(); chunk += 64) {
+        uint32_t w[80];
+        for (int i = 0; i < 16; i++) {
+            const auto *p = reinterpret_cast<const uint8_t *>(message.data() + chunk + i * 4);
+            w[i] = (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+        }
+        for (int i = 16; i < 80; i++) w[i] = RotateLeft(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; i++) {
+            uint32_t f, k;
+            if (i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            } else if (i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            } else if (i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+            uint32_t temp = RotateLeft(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = RotateLeft(b, 30);
+            b = a;
+            a = temp;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+    for (int i = 0; i < 5; i++) {
+        for (int j = 0; j < 4; j++) digest[i * 4 + j] = (uint8_t) (h[i] >> (24 - j * 8));
+    }
+}
+
+static std::string Base64(const uint8_t *data, size_t len) {
+    static const char *table = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t n = (uint32_t) data[i] << 16;
+        if (i + 1 < len) n |= (uint32_t) data[i + 1] << 8;
+        if (i + 2 < len) n |= data[i + 2];
+        out += table[(n >> 18) & 63];
+        out += table[(n >> 12) & 63];
+        out += i + 1 < len ? table[(n >> 6) & 63] : '=';
+        out += i + 2 < len ? table[n & 63] : '=';
+    }
+    return out;
+}
+
+// 不区分大小写比较 ASCII 字符串
+static bool EqualsIgnoreCase(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (tolower((unsigned char) a[i]) != tolower((unsigned char) b[i])) return false;
+    }
+    return true;
+}
+
+// 逗号分隔的头部值中是否包含 token，不区分大小写
+static bool HasToken(std::string_view value, std::string_view token) {
+    while (!value.empty()) {
+        size_t comma = value.find(',');
+        std::string_view item = value.substr(0, comma);
+        while (!item.empty() && item.front() == ' ') item.remove_prefix(1);
+        while (!item.empty() && item.back() == ' ') item.remove_suffix(1);
+        if (EqualsIgnoreCase(item, token)) return true;
+        if (comma == std::string_view::npos) break;
+        value.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+DecodeResult ParseUpgradeRequest(const char *data, size_t len, std::string &response, size_t &size) {
+    std::string_view request(data, len);
+    size_t end = request.find("\r\n\r\n");
+    if (end == std::string_view::npos) {
+        size = len + 1;
+        return len >= WEBSOCKET_MAX_REQUEST ? DecodeResult::Invalid : DecodeResult::NeedMore;
+    }
+    size = end + 4;
+    request = request.substr(0, end);
+
+    bool upgrade = false, connection = false, version = false;
+    std::string_view key;
+    size_t lineEnd = request.find("\r\n");
+    bool isGet = request.substr(0, 4) == "GET ";
+    while (lineEnd != std::string_view::npos) {
+        request.remove_prefix(lineEnd + 2);
+        lineEnd = request.find("\r\n");
+        std::string_view line = request.substr(0, lineEnd);
+        size_t colon = line.find(':');
+        if (colon == std::string_view::npos) continue;
+        std::string_view name = line.substr(0, colon);
+        std::string_view value = line.substr(colon + 1);
+        while (!value.empty() && value.front() == ' ') value.remove_prefix(1);
+        while (!value.empty() && value.back() == ' ') value.remove_suffix(1);
+        if (EqualsIgnoreCase(name, "Upgrade")) upgrade = HasToken(value, "websocket");
+        else if (EqualsIgnoreCase(name, "Connection")) connection = HasToken(value, "upgrade");
+        else if (EqualsIgnoreCase(name, "Sec-WebSocket-Version")) version = value == "13";
+        else if (EqualsIgnoreCase(name, "Sec-WebSocket-Key")) key = value;
+    }
+    if (!isGet || !upgrade || !connection || !version || key.empty()) {
+        response = "HTTP/1.1 400 Bad Request\r\nSec-WebSocket-Version: 13\r\nContent-Length: 0\r\n"
+                   "Connection: close\r\n\r\n";
+        return DecodeResult::Invalid;
+    }
+    uint8_t digest[20];
+    Sha1(std::string(key) + WEBSOCKET_GUID, digest);
+    response = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+               "Sec-WebSocket-Accept: " + Base64(digest, sizeof(digest)) + "\r\n\r\n";
+    return DecodeResult::Ok;
+}
+
+DecodeResult DecodeWebSocket(char *data, size_t len, WebSocketFrame &frame, size_t &size) {
+    if (len < 2) {
+        size = 2;
+        return DecodeResult::NeedMore;
+    }
+    auto *bytes = reinterpret_cast<uint8_t *>(data);
+    bool fin = bytes[0] & 0x80;
+    frame.opcode = bytes[0] & 0x0F;
+    bool masked = bytes[1] & 0x80;
+    uint64_t length = bytes[1] & 0x7F;
+    size_t header = 2;
+    if (length == 126) header += 2;
+    else if (length == 127) header += 8;
+    if (!masked || (bytes[0] & 0x70) != 0 || !fin || frame.opcode == WS_CONTINUATION) return DecodeResult::Invalid;
+    header += 4;
+    if (len < header) {
+        size = header;
+        return DecodeResult::NeedMore;
+    }
+    if (length == 126) {
+        length = (uint64_t) bytes[2] << 8 | bytes[3];
+    } else if (length == 127) {
+        length = 0;
+        for (int i = 0; i < 8; i++) length = length << 8 | bytes[2 + i];
+    }
+    bool control = frame.opcode >= WS_CLOSE;
+    if ((control && length > 125) || length > MAX_FRAME_SIZE) return DecodeResult::Invalid;
+    size = header + (size_t) length;
+    if (len < size) return DecodeResult::NeedMore;
+    uint8_t *mask = bytes + header - 4;
+    uint8_t *payload = bytes + header;
+    for (size_t i = 0; i < length; i++) payload[i] ^= mask[i & 3];
+    memset(mask, 0, 4);
+    frame.payload = data + header;
+    frame.length = (size_t) length;
+    return DecodeResult::Ok;
+}
+
+size_t WebSocketHeaderSize(size_t payloadSize) {
+    return payloadSize < 126 ? 2 : payloadSize <= 0xFFFF ? 4 : 10;
+}
+
+char *WriteWebSocketHeader(char *out, uint8_t opcode, size_t payloadSize) {
+    auto *bytes = reinterpret_cast<uint8_t *>(out);
+    bytes[0] = 0x80 | opcode;
+    if (payloadSize < 126) {
+        bytes[1] = (uint8_t) payloadSize;
+        return out + 2;
+    }
+    if (payloadSize <= 0xFFFF) {
+        bytes[1] = 126;
+        bytes[2] = (uint8_t) (payloadSize >> 8);
+        bytes[3] = (uint8_t) payloadSize;
+        return out + 4;
+    }
+    bytes[1] = 127;
+    for (int i = 0; i < 8; i++) bytes[2 + i] = (uint8_t) ((uint64_t) payloadSize >> (56 - i * 8));
+    return out + 10;
+}
+
+bool IsValidUtf8(const char *data, size_t len) {
+    auto *bytes = reinterpret_cast<const uint8_t *>(data);
+    size_t i = 0;
+    while (i < len) {
+        // 聊天内容大多是 ASCII，每次检查 8 字节
+        if (i + 8 <= len) {
+            uint64_t word;
+            memcpy(&word, bytes + i, 8);
+            if ((word & 0x8080808080808080ULL) == 0) {
+                i += 8;
+                continue;
+            }
+        }
+        uint8_t c = bytes[i];
+        if (c < 0x80) {
+            i++;
+            continue;
+        }
+        size_t n;
+        uint8_t low = 0x80, high = 0xBF;  // 第二个字节的范围，排除过长编码、代理项和超出范围的码点
+        if (c >= 0xC2 && c <= 0xDF) {
+            n = 2;
+        } else if (c >= 0xE0 && c <= 0xEF) {
+            n = 3;
+            if (c == 0xE0) low = 0xA0;
+            else if (c == 0xED) high = 0x9F;
+        } else if (c >= 0xF0 && c <= 0xF4) {
+            n = 4;
+            if (c == 0xF0) low = 0x90;
+            else if (c == 0xF4) high = 0x8F;
+        } else {
+            return false;
+        }
+        if (i + n > len || bytes[i + 1] < low || bytes[i + 1] > high) return false;
+        for (size_t k = 2; k < n; k++) {
+            if ((bytes[i + k] & 0xC0) != 0x80) return false;
+        }
+        i += n;
+    }
+    return true;
+}
+
+FramePtr MakeWebSocketFrame(uint8_t opcode, std::string_view payload) {
+    SharedFrame *frame = SharedFrame::Create(WebSocketHeaderSize(payload.size()) + payload.size());
+    char *body = WriteWebSocketHeader(frame->MutableData(), opcode, payload.size());
+    memcpy(body, payload.data(), payload.size());
+    return FramePtr(frame);
+}
@@ -0,0 +1,67 @@
+#ifndef ONLINECHAT_WEBSOCKET_H
+#define ONLINECHAT_WEBSOCKET_H
+
+#include "Frame.h"
+#include "Protocol.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/**
+ * WebSocket（RFC 6455）服务器端：HTTP 升级握手和帧的编解码。
+ * 网页客户端在 WebSocket 端口上连接，每个文本或二进制消息的内容是一条文本协议命令
+ * （与 TCP 文本客户端相同，例如 "MESSAGE bob hello"，多条命令以换行分隔），服务器发出的每条消息是一个帧，
+ * 内容与发给 TCP 文本客户端的相同，不带换行；内容是合法 UTF-8 时为文本帧，否则为二进制帧，
+ * 浏览器收到不合法 UTF-8 的文本帧会断开连接
+ */
+
+// 升级请求的最大长度，超过时拒绝
+#define WEBSOCKET_MAX_REQUEST 8192
+// 帧头的最大长度：2 字节基本头 + 8 字节扩展长度 + 4 字节掩码
+#define WEBSOCKET_MAX_HEADER 14
+
+enum WebSocketOpcode : uint8_t {
+    WS_CONTINUATION = 0x0,
+    WS_TEXT = 0x1,
+    WS_BINARY = 0x2,
+    WS_CLOSE = 0x8,
+    WS_PING = 0x9,
+    WS_PONG = 0xA
+};
+
+// 解码得到的帧，内容指向接收缓冲区内部并已去除掩码
+struct WebSocketFrame {
+    uint8_t opcode{};
+    const char *payload{};
+    size_t length{};
+};
+
+/**
+ * 解析 HTTP 升级请求
+ * @param response 成功时为 101 响应，格式错误时为 400 响应
+ * @param size 成功时为请求的长度，数据不完整时为需要的总字节数
+ */
+DecodeResult ParseUpgradeRequest(const char *data, size_t len, std::string &response, size_t &size);
+
+/**
+ * 从缓冲区开头解码一个客户端帧，并在缓冲区中原地去除掩码。
+ * 去除掩码后帧头中的掩码被置零，同一帧再次解码（例如命令因速率限制未被消费）得到相同的内容。
+ * 客户端帧必须带掩码；不支持分片消息，控制帧的内容不超过125字节
+ * @param size 成功时为帧长度，数据不完整时为需要的总字节数
+ */
+DecodeResult DecodeWebSocket(char *data, size_t len, WebSocketFrame &frame, size_t &size);
+
+// 服务器帧（不带掩码）的帧头长度
+size_t WebSocketHeaderSize(size_t payloadSize);
+
+// 写入服务器帧的帧头，out 至少有 WebSocketHeaderSize 字节，返回帧头之后的位置
+char *WriteWebSocketHeader(char *out, uint8_t opcode, size_t payloadSize);
+
+// 是否为合法的 UTF-8（不允许过长编码、代理项和超出 U+10FFFF 的码点）
+bool IsValidUtf8(const char *data, size_t len);
+
+// 构造一个完整的服务器帧，用于控制帧
+FramePtr MakeWebSocketFrame(uint8_t opcode, std::string_view payload);
+
+#endif //ONLINECHAT_WEBSOCKET_H
@@ -0,0 +1,175 @@
+#ifndef ONLINECHAT_BENCHUTIL_H
+#define ONLINECHAT_BENCHUTIL_H
+
+/**
+ * 性能测试公用的工具函数：子进程启动服务器、建立连接、读取进程内存和CPU时间、闭环收发消息
+ */
+#include "Platform.h"
+#include <sys/epoll.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct ProcMemory {
+    long rssKb{};
+    long vmKb{};
+    long threads{};
+};
+
+// 读取进程的 VmRSS、VmSize 和线程数
+inline ProcMemory ReadProcMemory(pid_t pid) {
+    ProcMemory mem;
+    std::ifstream in("/proc/" + std::to_string(pid) + "/status");
+    std::string key;
+    while (in >> key) {
+        if (key == "VmRSS:") in >> mem.rssKb;
+        else if (key == "VmSize:") in >> mem.vmKb;
+        else if (key == "Threads:") in >> mem.threads;
+        in.ignore(1 << 20, '\n');
+    }
+    return mem;
+}
+
+// 以阻塞方式连接本机端口，成功后开启 TCP_NODELAY
+inline SOCKET ConnectTo(int port) {
+    SOCKET s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(s, (sockaddr *) &addr, sizeof(addr)) == SOCKET_ERROR) {
+        closesocket(s);
+        return INVALID_SOCKET;
+    }
+    int noDelay = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    return s;
+}
+
+/**
+ * 在子进程中运行服务器并等待其开始监听，子进程的标准输出被丢弃
+ * @param port 服务器端口
+ * @param run 子进程中运行的服务器函数
+ * @return 子进程ID
+ */
+inline pid_t StartServerProcess(int port, const std::function<void()> &run) {
+    // 避免父进程缓冲区中的输出被子进程重复写出
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (!freopen("/dev/null", "w", stdout)) _exit(1);
+        InitNetwork();
+        run();
+        _exit(0);
+    }
+    for (int i = 0; i < 250; i++) {
+        SOCKET s = ConnectTo(port);
+        if (s != INVALID_SOCKET) {
+            closesocket(s);
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    return pid;
+}
+
+// 读取进程已使用的CPU时间（微秒）
+inline double ProcCpuMicros(pid_t pid) {
+    std::ifstream in("/proc/" + std::to_string(pid) + "/stat");
+    std::string field;
+    long utime = 0, stime = 0;
+    for (int i = 1; in >> field; i++) {
+        if (i == 14) utime = std::stol(field);
+        if (i == 15) {
+            stime = std::stol(field);
+            break;
+        }
+    }
+    return (double) (utime + stime) * 1e6 / sysconf(_SC_CLK_TCK);
+}
+
+inline void StopServerProcess(pid_t pid) {
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+}
+
+// 统计 marker 在数据流中出现的次数，tail 保存上次数据的末尾以处理跨读边界的情况
+inline int CountMarker(std::string &tail, const char *data, size_t len, const std::string &marker) {
+    tail.append(data, len);
+    int count = 0;
+    size_t pos = 0;
+    while ((pos = tail.find(marker, pos)) != std::string::npos) {
+        count++;
+        pos += marker.size();
+    }
+    size_t keep = std::min(tail.size(), marker.size() - 1);
+    tail.erase(0, tail.size() - keep);
+    return count;
+}
+
+// 依次注册用户 u0..u(n-1)，每个注册都等待确认，避免与后续命令在TCP流中粘连
+inline void RegisterUsers(const std::vector<SOCKET> &sockets, int count) {
+    for (int i = 0; i < count; i++) {
+        std::string reg = "REGISTER SERVER u" + std::to_string(i);
+        send(sockets[i], reg.data(), reg.size(), 0);
+        std::string tail;
+        char buf[4096];
+        while (true) {
+            int r = (int) recv(sockets[i], buf, sizeof(buf), 0);
+            if (r <= 0 || CountMarker(tail, buf, r, "Registered.") > 0) break;
+        }
+    }
+}
+
+/**
+ * 让前 active 个已注册的连接两两配对互发 MESSAGE，每个连接收到发送确认后才发送下一条
+ * @return 每秒送达的消息数
+ */
+inline double ClosedLoopThroughput(const std::vector<SOCKET> &sockets, int active, int payloadSize, int seconds) {
+    int ep = epoll_create1(0);
+    std::vector<std::string> tails(active);
+    for (int i = 0; i < active; i++) {
+        SetNonBlocking(sockets[i]);
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        epoll_ctl(ep, EPOLL_CTL_ADD, sockets[i], &ev);
+    }
+    std::string payload(payloadSize, 'x');
+    auto sendOne = [&](int i) {
+        std::string msg = "MESSAGE u" + std::to_string(i ^ 1) + " " + payload;
+        send(sockets[i], msg.data(), msg.size(), 0);
+    };
+    for (int i = 0; i < active; i++) sendOne(i);
+
+    long delivered = 0;
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::seconds(seconds);
+    epoll_event events[256];
+    std::vector<char> buf(65536);
+    while (std::chrono::steady_clock::now() < deadline) {
+        int k = epoll_wait(ep, events, 256, 100);
+        for (int e = 0; e < k; e++) {
+            int i = (int) events[e].data.u32;
+            while (true) {
+                int r = (int) recv(sockets[i], buf.data(), buf.size(), 0);
+                if (r <= 0) break;
+                int acks = CountMarker(tails[i], buf.data(), r, "Message sent.");
+                delivered += acks;
+                for (int a = 0; a < acks; a++) sendOne(i);
+            }
+        }
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    close(ep);
+    return delivered / elapsed;
+}
+
+#endif //ONLINECHAT_BENCHUTIL_H
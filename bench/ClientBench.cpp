@@ -0,0 +1,176 @@
+/**
+ * 客户端库测试：服务器运行在子进程中（启用消息历史），两个 ChatClient 分别作为发送者和接收者。
+ * 1. 发送者从应用线程连续发送 messages 条私聊消息，统计每次 send 系统调用合并的命令数和端到端吞吐量；
+ * 2. 接收者停止后发送者发送群组消息和私聊消息，接收者重新启动后检查自动重新注册、重新加入群组
+ *    并按序列号恢复会话，每条消息恰好收到一次；
+ * 3. 杀掉服务器并在 downtime 毫秒后用同一数据目录重新启动，测量两个客户端自动重连所需的时间，
+ *    以及重连后群组消息是否仍能送达。
+ * 用法: ClientBench [--messages N] [--offline N] [--downtime 毫秒] [--port N] [--dir 父目录]
+ */
+#include "BenchUtil.h"
+#include "ChatClient.h"
+#include "Shard.h"
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <set>
+#include <string>
+
+using Clock = std::chrono::steady_clock;
+
+static double Seconds(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// 一个客户端收到的消息，回调在事件循环线程中记录，测试线程等待
+struct Received {
+    std::mutex mutex;
+    std::condition_variable cv;
+    long direct{};
+    long group{};
+    long duplicates{};
+    long notices{};
+    bool connected{};
+    Clock::time_point connectedAt;
+    std::set<std::string> bodies;
+
+    void Attach(ChatClient &client) {
+        client.SetMessageCallback([this](const Command &cmd) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (cmd.opcode == OP_DELIVER || cmd.opcode == OP_GROUP_DELIVER) {
+                std::string_view body = cmd.fields[cmd.opcode == OP_DELIVER ? 1 : 2];
+                if (!bodies.emplace(body).second) duplicates++;
+                (cmd.opcode == OP_DELIVER ? direct : group)++;
+            } else if (cmd.opcode == OP_NOTICE) {
+                notices++;
+            }
+            cv.notify_all();
+        });
+        client.SetStateCallback([this](bool up) {
+            std::lock_guard<std::mutex> lock(mutex);
+            connected = up;
+            if (up) connectedAt = Clock::now();
+            cv.notify_all();
+        });
+    }
+
+    // 等待条件成立，超时返回 false
+    template<typename Pred>
+    bool Wait(Pred pred, int seconds = 30) {
+        std::unique_lock<std::mutex> lock(mutex);
+        return cv.wait_for(lock, std::chrono::seconds(seconds), [&]() { return pred(*this); });
+    }
+};
+
+static pid_t StartServer(int port, const std::string &dir) {
+    return StartServerProcess(port, [&]() {
+        ShardSet shards(1, PRESENCE_WINDOW_MS, dir);
+        // 测量客户端本身，不启用速率限制和连接准入
+        shards.SetLimits(Limits::Unlimited());
+        if (!shards.Listen(port)) return;
+        shards.Start();
+        shards.Join();
+    });
+}
+
+int main(int argc, char **argv) {
+    long messages = 200000;
+    long offline = 1000;
+    int downtime = 500;
+    int port = 9400;
+    std::string parent = "/tmp";
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string key = argv[i];
+        std::string value = argv[i + 1];
+        if (key == "--messages") messages = std::stol(value);
+        else if (key == "--offline") offline = std::stol(value);
+        else if (key == "--downtime") downtime = std::stoi(value);
+        else if (key == "--port") port = std::stoi(value);
+        else if (key == "--dir") parent = value;
+    }
+    InitNetwork();
+    std::string dir = parent + "/clientbench-" + std::to_string(getpid());
+    printf("messages=%ld offline=%ld downtime=%dms dir=%s\n", messages, offline, downtime, dir.c_str());
+    pid_t pid = StartServer(port, dir);
+
+    Received senderInbox, receiverInbox;
+    ChatClient sender("127.0.0.1", port), receiver("127.0.0.1", port);
+    senderInbox.Attach(sender);
+    receiverInbox.Attach(receiver);
+    sender.Start();
+    receiver.Start();
+    sender.Register("alice");
+    receiver.Register("bob");
+    sender.CreateGroup("room");
+    // 等待群组创建后再加入
+    senderInbox.Wait([](Received &r) { return r.notices >= 2; });
+    receiver.JoinGroup("room");
+    receiverInbox.Wait([](Received &r) { return r.notices >= 2; });
+
+    // 1. 高速发送：命令在发送队列中合并，每次系统调用发出多条
+    uint64_t commandsBefore = sender.CommandsSent();
+    uint64_t callsBefore = sender.SendCalls();
+    auto start = Clock::now();
+    for (long i = 0; i < messages; i++) sender.Message("bob", "d" + std::to_string(i));
+    bool complete = receiverInbox.Wait([&](Received &r) { return r.direct >= messages; }, 120);
+    double elapsed = Seconds(start);
+    uint64_t commands = sender.CommandsSent() - commandsBefore;
+    uint64_t calls = std::max<uint64_t>(sender.SendCalls() - callsBefore, 1);
+    printf("pipelined send:  %10.0f msgs/s delivered, %llu commands in %llu send calls (%.1f per call)%s\n",
+           receiverInbox.direct / elapsed, (unsigned long long) commands, (unsigned long long) calls,
+           (double) commands / (double) calls, complete ? "" : ", INCOMPLETE");
+
+    // 2. 接收者离线期间的群组消息和私聊消息在重连后按序列号补齐
+    senderInbox.Wait([&](Received &r) { return r.notices >= 2 + messages; });
+    long noticesBefore = senderInbox.notices;
+    sender.GroupMessage("room", "g-first");
+    receiverInbox.Wait([](Received &r) { return r.group >= 1; });
+    receiver.Stop();
+    for (long i = 0; i < offline; i++) {
+        sender.GroupMessage("room", "g" + std::to_string(i));
+        sender.Message("bob", "o" + std::to_string(i));
+    }
+    // 等待服务器处理完全部消息（每条消息都有发送确认）
+    senderInbox.Wait([&](Received &r) { return r.notices >= noticesBefore + 1 + 2 * offline; }, 60);
+    long directBefore = receiverInbox.direct;
+    long groupBefore = receiverInbox.group;
+    start = Clock::now();
+    receiver.Start();
+    complete = receiverInbox.Wait([&](Received &r) {
+        return r.direct - directBefore >= offline && r.group - groupBefore >= offline;
+    });
+    elapsed = Seconds(start);
+    // 稍后再检查一次，确认没有重复投递
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    {
+        std::lock_guard<std::mutex> lock(receiverInbox.mutex);
+        printf("resume:          %ld/%ld group and %ld/%ld direct messages in %.1f ms, %ld duplicates%s\n",
+               receiverInbox.group - groupBefore, offline, receiverInbox.direct - directBefore, offline,
+               elapsed * 1e3, receiverInbox.duplicates, complete ? "" : ", INCOMPLETE");
+    }
+
+    // 3. 服务器重启：两个客户端按退避间隔重试，服务器恢复后自动重连并恢复会话
+    StopServerProcess(pid);
+    receiverInbox.Wait([](Received &r) { return !r.connected; });
+    senderInbox.Wait([](Received &r) { return !r.connected; });
+    std::this_thread::sleep_for(std::chrono::milliseconds(downtime));
+    auto restart = Clock::now();
+    pid = StartServer(port, dir);
+    bool reconnected = receiverInbox.Wait([](Received &r) { return r.connected; }) &&
+                       senderInbox.Wait([](Received &r) { return r.connected; });
+    double lastConnect = std::max(std::chrono::duration<double>(receiverInbox.connectedAt - restart).count(),
+                                  std::chrono::duration<double>(senderInbox.connectedAt - restart).count());
+    groupBefore = receiverInbox.group;
+    sender.GroupMessage("room", "g-after-restart");
+    bool delivered = receiverInbox.Wait([&](Received &r) { return r.group > groupBefore; }, 10);
+    printf("server restart:  reconnected %.1f ms after the new server process started, "
+           "%llu + %llu reconnects, group message after restart %s\n",
+           reconnected ? lastConnect * 1e3 : -1.0, (unsigned long long) sender.Reconnects(),
+           (unsigned long long) receiver.Reconnects(), delivered ? "delivered" : "LOST");
+
+    sender.Stop();
+    receiver.Stop();
+    StopServerProcess(pid);
+    std::filesystem::remove_all(dir);
+    return 0;
+}
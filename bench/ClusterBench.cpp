@@ -0,0 +1,227 @@
+/**
+ * 多节点联邦测试：在本进程中启动 nodes 个节点（各自的分片、客户端端口和节点间端口，都在本机回环接口上），
+ * 每个节点连接 users 个 ChatClient，所有用户加入同一个群组。
+ * 1. 逐条发送私聊消息（消息内容为发送时刻），分别测量同一节点和跨节点投递的延迟；
+ * 2. 逐条发送群组消息，测量本地成员和其它节点成员收到的延迟；
+ * 3. 连续发送 messages 条群组消息，统计投递吞吐量，以及每条群组消息在节点间连接上发送的帧数
+ *    与其它节点上成员投递数之比，即本地扇出节省的跨节点流量。
+ * 用法: ClusterBench [--nodes N] [--users N] [--samples N] [--messages N] [--port N]
+ */
+#include "BenchUtil.h"
+#include "ChatClient.h"
+#include "Log.h"
+#include "Shard.h"
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+static int64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+// 所有客户端收到的消息，回调在各客户端的事件循环线程中记录
+struct Inbox {
+    std::mutex mutex;
+    std::condition_variable cv;
+    long direct{};
+    long group{};
+    long notices{};
+    // 按接收者所在节点是否与发送者相同分别记录延迟（微秒）
+    std::vector<double> localLatency;
+    std::vector<double> remoteLatency;
+    bool recordLatency{};
+
+    void Attach(ChatClient &client, int node) {
+        client.SetMessageCallback([this, node](const Command &cmd) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (cmd.opcode == OP_DELIVER || cmd.opcode == OP_GROUP_DELIVER) {
+                // 消息内容为 "发送节点:发送时刻"
+                std::string_view body = cmd.fields[cmd.opcode == OP_DELIVER ? 1 : 2];
+                size_t colon = body.find(':');
+                if (recordLatency && colon != std::string_view::npos) {
+                    int from = std::stoi(std::string(body.substr(0, colon)));
+                    double us = (double) (NowNs() - std::stoll(std::string(body.substr(colon + 1)))) / 1e3;
+                    (from == node ? localLatency : remoteLatency).push_back(us);
+                }
+                (cmd.opcode == OP_DELIVER ? direct : group)++;
+            } else if (cmd.opcode == OP_NOTICE) {
+                notices++;
+            }
+            cv.notify_all();
+        });
+    }
+
+    template<typename Pred>
+    bool Wait(Pred pred, int seconds = 30) {
+        std::unique_lock<std::mutex> lock(mutex);
+        return cv.wait_for(lock, std::chrono::seconds(seconds), [&]() { return pred(*this); });
+    }
+};
+
+static double Percentile(std::vector<double> values, double p) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, (size_t) (p * (double) values.size()))];
+}
+
+static void PrintLatency(const char *name, const std::vector<double> &values) {
+    printf("%-28s %6zu samples  p50 %8.1f us  p99 %8.1f us\n", name, values.size(), Percentile(values, 0.5),
+           Percentile(values, 0.99));
+}
+
+// 等待条件成立，用于等待集群目录同步
+template<typename Pred>
+static bool WaitFor(Pred pred, int seconds = 10) {
+    auto deadline = Clock::now() + std::chrono::seconds(seconds);
+    while (!pred()) {
+        if (Clock::now() > deadline) return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    int nodeCount = 3;
+    int users = 4;
+    long samples = 2000;
+    long messages = 20000;
+    int port = 9500;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string key = argv[i];
+        std::string value = argv[i + 1];
+        if (key == "--nodes") nodeCount = std::stoi(value);
+        else if (key == "--users") users = std::stoi(value);
+        else if (key == "--samples") samples = std::stol(value);
+        else if (key == "--messages") messages = std::stol(value);
+        else if (key == "--port") port = std::stoi(value);
+    }
+    InitNetwork();
+    Logger::SetLevel(LOG_LEVEL_WARN);
+    printf("nodes=%d users=%d per node samples=%ld messages=%ld\n", nodeCount, users, samples, messages);
+
+    // 客户端端口 port+i，节点间端口 port+100+i
+    std::vector<ClusterNode> nodes;
+    for (int i = 0; i < nodeCount; i++) nodes.push_back(ClusterNode{i, "127.0.0.1", port + 100 + i});
+    std::vector<std::unique_ptr<ShardSet>> sets;
+    for (int i = 0; i < nodeCount; i++) {
+        auto set = std::make_unique<ShardSet>(1);
+        set->SetLimits(Limits::Unlimited());
+        if (!set->EnableCluster(i, nodes, "bench-secret") || !set->Listen(port + i)) {
+            fprintf(stderr, "node %d failed to listen\n", i);
+            return 1;
+        }
+        set->Start();
+        sets.push_back(std::move(set));
+    }
+    bool linked = WaitFor([&]() {
+        for (auto &set: sets) {
+            if (set->GetCluster()->LinksUp() != nodeCount - 1) return false;
+        }
+        return true;
+    });
+    if (!linked) fprintf(stderr, "cluster links are not all up\n");
+
+    Inbox inbox;
+    std::vector<std::unique_ptr<ChatClient>> clients;
+    for (int i = 0; i < nodeCount * users; i++) {
+        int node = i % nodeCount;
+        auto client = std::make_unique<ChatClient>("127.0.0.1", port + node);
+        inbox.Attach(*client, node);
+        client->Start();
+        client->Register("u" + std::to_string(i));
+        clients.push_back(std::move(client));
+    }
+    clients[0]->CreateGroup("room");
+    // 群组创建广播到其它节点后再加入
+    WaitFor([&]() {
+        GroupPtr group;
+        for (auto &set: sets) {
+            if (!set->GetRegistry().FindGroup("room", group)) return false;
+        }
+        return true;
+    });
+    for (size_t i = 1; i < clients.size(); i++) clients[i]->JoinGroup("room");
+    // 等待用户目录和群组成员节点同步到所有节点
+    uint64_t allRemote = ((1ull << nodeCount) - 1);
+    bool synced = WaitFor([&]() {
+        for (int i = 0; i < nodeCount; i++) {
+            GroupPtr group;
+            if (sets[i]->GetCluster()->RemoteUsers() != (size_t) ((nodeCount - 1) * users)) return false;
+            if (!sets[i]->GetRegistry().FindGroup("room", group) || group->Size() != (size_t) users) return false;
+            if (group->RemoteNodes() != (allRemote & ~(1ull << i))) return false;
+        }
+        return true;
+    });
+    if (!synced) fprintf(stderr, "cluster directory did not converge\n");
+
+    // 1. 私聊延迟：u0 在节点0上，u<nodeCount> 也在节点0上，u1 在节点1上
+    {
+        std::lock_guard<std::mutex> lock(inbox.mutex);
+        inbox.recordLatency = true;
+    }
+    for (long i = 0; i < samples; i++) {
+        int target = (i % 2 == 0 && nodeCount > 1) ? 1 : nodeCount;
+        long before = inbox.direct;
+        clients[0]->Message("u" + std::to_string(target), "0:" + std::to_string(NowNs()));
+        inbox.Wait([&](Inbox &b) { return b.direct > before; }, 5);
+    }
+    {
+        std::lock_guard<std::mutex> lock(inbox.mutex);
+        PrintLatency("direct, same node:", inbox.localLatency);
+        PrintLatency("direct, cross node:", inbox.remoteLatency);
+        inbox.localLatency.clear();
+        inbox.remoteLatency.clear();
+    }
+
+    // 2. 群组延迟：每条消息等待所有成员收到后再发下一条
+    long members = (long) clients.size();
+    for (long i = 0; i < samples / 4; i++) {
+        long before = inbox.group;
+        clients[0]->GroupMessage("room", "0:" + std::to_string(NowNs()));
+        inbox.Wait([&](Inbox &b) { return b.group >= before + members; }, 5);
+    }
+    {
+        std::lock_guard<std::mutex> lock(inbox.mutex);
+        PrintLatency("group, same node members:", inbox.localLatency);
+        PrintLatency("group, other node members:", inbox.remoteLatency);
+        inbox.recordLatency = false;
+    }
+
+    // 3. 群组吞吐量和跨节点帧数
+    Cluster *origin = sets[0]->GetCluster();
+    int64_t framesBefore = origin->FramesSent();
+    int64_t bytesBefore = origin->BytesSent();
+    int64_t callsBefore = origin->SendCalls();
+    std::vector<int64_t> fanoutBefore;
+    for (auto &set: sets) fanoutBefore.push_back(set->GetCluster()->GroupFanout());
+    long groupBefore = inbox.group;
+    auto start = Clock::now();
+    for (long i = 0; i < messages; i++) clients[0]->GroupMessage("room", "x" + std::to_string(i));
+    bool complete = inbox.Wait([&](Inbox &b) { return b.group >= groupBefore + messages * members; }, 120);
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    int64_t frames = origin->FramesSent() - framesBefore;
+    int64_t remoteDeliveries = 0;
+    for (int i = 1; i < nodeCount; i++) remoteDeliveries += sets[i]->GetCluster()->GroupFanout() - fanoutBefore[i];
+    printf("group throughput:            %10.0f deliveries/s (%ld members)%s\n",
+           (double) (inbox.group - groupBefore) / elapsed, members, complete ? "" : ", INCOMPLETE");
+    printf("cross-node frames:           %.2f link frames per group message for %.2f remote member deliveries "
+           "(%.1fx fewer than per-member forwarding)\n",
+           (double) frames / (double) messages, (double) remoteDeliveries / (double) messages,
+           frames > 0 ? (double) remoteDeliveries / (double) frames : 0.0);
+    printf("link batching:               %.1f frames and %.0f bytes per send call on node 0\n",
+           (double) frames / (double) std::max<int64_t>(origin->SendCalls() - callsBefore, 1),
+           (double) (origin->BytesSent() - bytesBefore) / (double) std::max<int64_t>(origin->SendCalls() - callsBefore, 1));
+    for (int i = 1; i < nodeCount; i++) {
+        printf("node %d local fan-out:         %.2f deliveries per received group frame\n", i,
+               (double) (sets[i]->GetCluster()->GroupFanout() - fanoutBefore[i]) / (double) messages);
+    }
+
+    for (auto &client: clients) client->Stop();
+    for (auto &set: sets) set->Stop();
+    for (auto &set: sets) set->Join();
+    return 0;
+}
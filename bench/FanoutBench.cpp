@@ -0,0 +1,174 @@
+/**
+ * 群组消息扇出测试：一个群组有 members 个成员，发送者每次连续发送 burst 条群组消息，
+ * 统计每条群组消息在服务器上产生的内存分配次数、发送系统调用次数和CPU时间，
+ * 以及建群阶段每次加入群组的平均耗时。
+ * 服务器运行在子进程中，通过替换 operator new 和 send/sendmsg 计数，计数器放在共享内存中。
+ * 用法: FanoutBench [--members N] [--messages N] [--burst N] [--payload N] [--port N]
+ */
+#include "BenchUtil.h"
+#include "Shard.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct Counters {
+    std::atomic<long> allocations;
+    std::atomic<long> sendCalls;
+};
+
+static Counters *counters;
+static bool counting = false;
+
+void *operator new(size_t size) {
+    if (counting) counters->allocations.fetch_add(1, std::memory_order_relaxed);
+    void *p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+extern "C" ssize_t send(int fd, const void *buf, size_t len, int flags) {
+    if (counting) counters->sendCalls.fetch_add(1, std::memory_order_relaxed);
+    return syscall(SYS_sendto, fd, buf, len, flags, nullptr, 0);
+}
+
+extern "C" ssize_t sendmsg(int fd, const struct msghdr *msg, int flags) {
+    if (counting) counters->sendCalls.fetch_add(1, std::memory_order_relaxed);
+    return syscall(SYS_sendmsg, fd, msg, flags);
+}
+
+// 发送一行命令并等待包含 marker 的回复
+static void Request(SOCKET s, const std::string &line, const std::string &marker) {
+    send(s, line.data(), line.size(), 0);
+    std::string tail;
+    char buf[4096];
+    while (true) {
+        int r = (int) recv(s, buf, sizeof(buf), 0);
+        if (r <= 0 || CountMarker(tail, buf, r, marker) > 0) return;
+    }
+}
+
+int main(int argc, char **argv) {
+    int members = 5000;
+    int messages = 400;
+    int burst = 16;
+    int payload = 64;
+    int port = 21990;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string key = argv[i];
+        int value = std::stoi(argv[i + 1]);
+        if (key == "--members") members = value;
+        else if (key == "--messages") messages = value;
+        else if (key == "--burst") burst = value;
+        else if (key == "--payload") payload = value;
+        else if (key == "--port") port = value;
+    }
+    messages = messages / burst * burst;
+    counters = (Counters *) mmap(nullptr, sizeof(Counters), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    new(counters) Counters();
+    InitNetwork();
+
+    pid_t pid = StartServerProcess(port, [&]() {
+        counting = true;
+        ShardSet shards(1);
+        // 测量服务器本身的吞吐量，不启用速率限制和连接准入
+        shards.SetLimits(Limits::Unlimited());
+        if (!shards.Listen(port)) return;
+        shards.Start();
+        shards.Join();
+    });
+
+    // 第一个连接创建群组并作为发送者，其余连接加入群组
+    std::vector<SOCKET> sockets;
+    double joinCpuBefore = ProcCpuMicros(pid);
+    auto joinStart = std::chrono::steady_clock::now();
+    for (int i = 0; i < members; i++) {
+        SOCKET s = ConnectTo(port);
+        if (s == INVALID_SOCKET) {
+            std::cerr << "connect failed: " << strerror(errno) << std::endl;
+            return 1;
+        }
+        sockets.push_back(s);
+        if (i == 0) Request(s, "CREATE_GROUP g\n", "Group created.");
+        else Request(s, "JOIN_GROUP JOIN g\n", "Joined group.");
+    }
+    double joinElapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - joinStart).count();
+    double joinCpu = ProcCpuMicros(pid) - joinCpuBefore;
+
+    // 接收线程统计除发送者以外所有成员收到的群组消息
+    std::atomic<long> delivered{0};
+    std::thread reader([&]() {
+        int ep = epoll_create1(0);
+        for (int i = 1; i < members; i++) {
+            SetNonBlocking(sockets[i]);
+            epoll_event ev{};
+            ev.events = EPOLLIN;
+            ev.data.u32 = i;
+            epoll_ctl(ep, EPOLL_CTL_ADD, sockets[i], &ev);
+        }
+        std::vector<std::string> tails(members);
+        std::vector<char> buf(65536);
+        epoll_event events[256];
+        long target = (long) messages * (members - 1);
+        while (delivered.load() < target) {
+            int k = epoll_wait(ep, events, 256, 100);
+            for (int e = 0; e < k; e++) {
+                int i = (int) events[e].data.u32;
+                while (true) {
+                    int r = (int) recv(sockets[i], buf.data(), buf.size(), 0);
+                    if (r <= 0) break;
+                    delivered += CountMarker(tails[i], buf.data(), r, "(g) ");
+                }
+            }
+        }
+        close(ep);
+    });
+
+    long allocBefore = counters->allocations.load();
+    long sendBefore = counters->sendCalls.load();
+    double cpuBefore = ProcCpuMicros(pid);
+    auto start = std::chrono::steady_clock::now();
+    std::string line = "GROUP_MESSAGE GROUP g " + std::string(payload, 'x') + "\n";
+    std::string batch;
+    for (int i = 0; i < burst; i++) batch += line;
+    std::string tail;
+    std::vector<char> buf(65536);
+    for (int sent = 0; sent < messages; sent += burst) {
+        send(sockets[0], batch.data(), batch.size(), 0);
+        int acks = 0;
+        while (acks < burst) {
+            int r = (int) recv(sockets[0], buf.data(), buf.size(), 0);
+            if (r <= 0) break;
+            acks += CountMarker(tail, buf.data(), r, "Group message sent.");
+        }
+    }
+    reader.join();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double cpu = ProcCpuMicros(pid) - cpuBefore;
+    long allocs = counters->allocations.load() - allocBefore;
+    long sends = counters->sendCalls.load() - sendBefore;
+
+    printf("members=%d messages=%d burst=%d payload=%d\n", members, messages, burst, payload);
+    printf("deliveries/s=%.0f allocs/msg=%.1f sends/msg=%.1f server_cpu/msg=%.0f us\n",
+           (double) messages * (members - 1) / elapsed, (double) allocs / messages, (double) sends / messages,
+           cpu / messages);
+    printf("join_time/member=%.1f us join_server_cpu/member=%.1f us\n", joinElapsed * 1e6 / members,
+           joinCpu / members);
+    for (auto s: sockets) closesocket(s);
+    StopServerProcess(pid);
+    return 0;
+}
@@ -0,0 +1,311 @@
+/**
+ * 文件传输测试：服务器在子进程中运行，分别在零复制模式（splice 写入中转文件、sendfile 发送）
+ * 和复制模式（数据经过用户态缓冲区）下测试：
+ * 1. 私聊文件：一个接收者边上传边下载，统计吞吐量和每 GB 的服务器CPU时间，
+ *    上传期间另一对客户端逐条发送私聊消息，与没有上传时比较延迟；
+ * 2. 群组文件：recipients 个成员从同一个中转文件下载。
+ * 接收者逐字节检查收到的数据。
+ * 用法: FileBench [--size MB] [--recipients N] [--samples N] [--port N]
+ */
+#include "BenchUtil.h"
+#include "Log.h"
+#include "Shard.h"
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 文件内容按偏移取自该长度的重复图案，长度不是块大小的整数倍，错位的数据会被发现
+#define PATTERN_SIZE (1024 * 1024 + 7)
+
+static std::vector<char> pattern;
+
+static void SendFrame(SOCKET s, uint8_t opcode, std::initializer_list<std::string_view> fields) {
+    std::string frame;
+    AppendBinaryFrame(frame, opcode, fields.begin(), fields.size());
+    send(s, frame.data(), frame.size(), 0);
+}
+
+// 阻塞读取二进制帧的连接
+struct BinaryConn {
+    SOCKET s{INVALID_SOCKET};
+    std::vector<char> buf = std::vector<char>(4 * 1024 * 1024);
+    size_t begin{};
+    size_t end{};
+    size_t consumed{};
+
+    // 读取下一帧，字段在下一次调用之前有效，回复服务器心跳
+    bool Next(Command &cmd) {
+        begin += consumed;
+        consumed = 0;
+        while (true) {
+            size_t size = 0;
+            DecodeResult result = DecodeBinary(buf.data() + begin, end - begin, cmd, size);
+            if (result == DecodeResult::Ok) {
+                consumed = size;
+                if (cmd.opcode != OP_SERVER_PING) return true;
+                SendFrame(s, OP_PONG, {cmd.fields[0]});
+                begin += consumed;
+                consumed = 0;
+                continue;
+            }
+            if (result == DecodeResult::Invalid) return false;
+            memmove(buf.data(), buf.data() + begin, end - begin);
+            end -= begin;
+            begin = 0;
+            long n = recv(s, buf.data() + end, buf.size() - end, 0);
+            if (n <= 0) return false;
+            end += (size_t) n;
+        }
+    }
+
+    // 跳过其它帧直到收到 opcode
+    bool Await(uint8_t opcode, Command &cmd) {
+        while (Next(cmd)) {
+            if (cmd.opcode == opcode) return true;
+        }
+        return false;
+    }
+
+    // 跳过其它帧直到收到包含 text 的通知
+    bool AwaitNotice(const char *text) {
+        Command cmd;
+        while (Next(cmd)) {
+            if (cmd.opcode == OP_NOTICE && cmd.fields[0].find(text) != std::string_view::npos) return true;
+        }
+        return false;
+    }
+};
+
+static bool Connect(BinaryConn &conn, int port, const std::string &username) {
+    conn.s = ConnectTo(port);
+    if (conn.s == INVALID_SOCKET) return false;
+    SendFrame(conn.s, OP_HELLO, {});
+    SendFrame(conn.s, OP_REGISTER, {username});
+    return conn.AwaitNotice("Registered.");
+}
+
+static uint64_t ToNumber(std::string_view text) {
+    return std::stoull(std::string(text));
+}
+
+/**
+ * 按服务器归还的窗口上传文件
+ * @return 是否收到完成的 FILE_END
+ */
+static bool Upload(BinaryConn &conn, uint64_t size) {
+    Command cmd;
+    if (!conn.Await(OP_FILE_ACCEPT, cmd)) return false;
+    std::string id(cmd.fields[0]);
+    uint64_t credit = ToNumber(cmd.fields[1]);
+    uint64_t sent = 0;
+    std::string frame;
+    while (true) {
+        while (sent < size) {
+            size_t len = (size_t) std::min<uint64_t>(size - sent, FILE_CHUNK_SIZE);
+            if (credit < len) break;
+            // 图案在末尾折返时分两段复制
+            std::string data(len, '\0');
+            for (size_t done = 0; done < len;) {
+                size_t at = (size_t) ((sent + done) % PATTERN_SIZE);
+                size_t n = std::min(len - done, (size_t) PATTERN_SIZE - at);
+                memcpy(&data[done], pattern.data() + at, n);
+                done += n;
+            }
+            frame.clear();
+            std::string_view fields[2] = {id, data};
+            AppendBinaryFrame(frame, OP_FILE_CHUNK, fields, 2);
+            for (size_t off = 0; off < frame.size();) {
+                long n = send(conn.s, frame.data() + off, frame.size() - off, 0);
+                if (n <= 0) return false;
+                off += (size_t) n;
+            }
+            sent += len;
+            credit -= len;
+        }
+        if (!conn.Next(cmd)) return false;
+        if (cmd.opcode == OP_FILE_CREDIT) credit += ToNumber(cmd.fields[1]);
+        else if (cmd.opcode == OP_FILE_END) return cmd.fields[1] == "complete" && sent == size;
+    }
+}
+
+/**
+ * 等待文件通知后下载并逐字节检查
+ * @return 收到的字节数，数据错误或没有完成时返回 -1
+ */
+static long long Download(BinaryConn &conn) {
+    Command cmd;
+    if (!conn.Await(OP_FILE_OFFER, cmd)) return -1;
+    std::string id(cmd.fields[0]);
+    uint64_t size = ToNumber(cmd.fields[3]);
+    SendFrame(conn.s, OP_FILE_GET, {id});
+    uint64_t received = 0;
+    while (conn.Next(cmd)) {
+        if (cmd.opcode == OP_FILE_END && cmd.fields[0] == id) {
+            return cmd.fields[1] == "complete" && received == size ? (long long) received : -1;
+        }
+        if (cmd.opcode != OP_FILE_DATA || cmd.fields[0] != id) continue;
+        if (ToNumber(cmd.fields[1]) != received) return -1;
+        std::string_view data = cmd.fields[2];
+        for (size_t done = 0; done < data.size();) {
+            size_t at = (size_t) ((received + done) % PATTERN_SIZE);
+            size_t n = std::min(data.size() - done, (size_t) PATTERN_SIZE - at);
+            if (memcmp(data.data() + done, pattern.data() + at, n) != 0) return -1;
+            done += n;
+        }
+        received += data.size();
+    }
+    return -1;
+}
+
+static double Percentile(std::vector<double> values, double p) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, (size_t) (p * (double) values.size()))];
+}
+
+/**
+ * 逐条发送私聊消息并等待接收者收到，直到 stop 为 true 或达到 samples 条
+ * @return 每条消息的延迟（微秒）
+ */
+static std::vector<double> ChatLatency(BinaryConn &from, BinaryConn &to, const std::string &target, int samples,
+                                       const std::atomic<bool> &stop) {
+    std::vector<double> latency;
+    Command cmd;
+    while ((int) latency.size() < samples && !stop) {
+        auto start = std::chrono::steady_clock::now();
+        SendFrame(from.s, OP_MESSAGE, {target, "ping"});
+        if (!to.Await(OP_DELIVER, cmd)) break;
+        latency.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+        // 发送者收到的确认留在缓冲区，用完再读出，避免阻塞服务器
+        if (latency.size() % 64 == 0) {
+            for (int i = 0; i < 64; i++) from.AwaitNotice("Message sent.");
+        }
+    }
+    return latency;
+}
+
+struct ModeResult {
+    double directMBps{};
+    double directCpuPerGB{};
+    double groupMBps{};
+    double groupCpuPerGB{};
+    double idleP50{}, idleP99{};
+    double busyP50{}, busyP99{};
+    bool ok{};
+};
+
+static bool RunMode(bool zeroCopy, int port, uint64_t size, int recipients, int samples, ModeResult &result) {
+    pid_t pid = StartServerProcess(port, [&]() {
+        Logger::SetLevel(LOG_LEVEL_WARN);
+        ShardSet shards(1);
+        shards.SetLimits(Limits::Unlimited());
+        shards.Files().SetZeroCopy(zeroCopy);
+        if (!shards.Listen(port)) return;
+        shards.Start();
+        shards.Join();
+    });
+    BinaryConn sender, receiver, chatFrom, chatTo;
+    std::vector<BinaryConn> members(recipients);
+    bool ok = Connect(sender, port, "sender") && Connect(receiver, port, "receiver") &&
+              Connect(chatFrom, port, "chatFrom") && Connect(chatTo, port, "chatTo");
+    for (int i = 0; ok && i < recipients; i++) ok = Connect(members[i], port, "m" + std::to_string(i));
+    if (ok) {
+        SendFrame(sender.s, OP_CREATE_GROUP, {"files"});
+        ok = sender.AwaitNotice("Group created.");
+        for (int i = 0; ok && i < recipients; i++) {
+            SendFrame(members[i].s, OP_JOIN_GROUP, {"files"});
+            ok = members[i].AwaitNotice("Joined group.");
+        }
+    }
+    if (!ok) {
+        StopServerProcess(pid);
+        return false;
+    }
+    std::atomic<bool> stop{false};
+    std::vector<double> idle = ChatLatency(chatFrom, chatTo, "chatTo", samples, stop);
+    result.idleP50 = Percentile(idle, 0.5);
+    result.idleP99 = Percentile(idle, 0.99);
+
+    // 1. 私聊文件，上传期间测量聊天延迟
+    std::vector<double> busy;
+    double cpuBefore = ProcCpuMicros(pid);
+    auto start = std::chrono::steady_clock::now();
+    SendFrame(sender.s, OP_SEND_FILE, {"receiver", "direct.bin", std::to_string(size)});
+    long long received = 0;
+    std::thread downloader([&]() { received = Download(receiver); });
+    std::thread chat([&]() { busy = ChatLatency(chatFrom, chatTo, "chatTo", 1 << 30, stop); });
+    bool uploaded = Upload(sender, size);
+    downloader.join();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double cpu = ProcCpuMicros(pid) - cpuBefore;
+    stop = true;
+    chat.join();
+    result.busyP50 = Percentile(busy, 0.5);
+    result.busyP99 = Percentile(busy, 0.99);
+    result.directMBps = (double) size / elapsed / 1e6;
+    result.directCpuPerGB = cpu / 1000 / ((double) size / 1e9);
+    ok = uploaded && received == (long long) size;
+
+    // 2. 群组文件：发送者自己也收到通知，只统计其它成员的下载
+    cpuBefore = ProcCpuMicros(pid);
+    start = std::chrono::steady_clock::now();
+    SendFrame(sender.s, OP_GROUP_FILE, {"files", "group.bin", std::to_string(size)});
+    std::vector<long long> got(recipients);
+    std::vector<std::thread> readers;
+    for (int i = 0; i < recipients; i++) {
+        readers.emplace_back([&, i]() { got[i] = Download(members[i]); });
+    }
+    uploaded = Upload(sender, size);
+    for (auto &reader: readers) reader.join();
+    elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    cpu = ProcCpuMicros(pid) - cpuBefore;
+    double delivered = (double) size * recipients;
+    result.groupMBps = delivered / elapsed / 1e6;
+    result.groupCpuPerGB = cpu / 1000 / (delivered / 1e9);
+    ok = ok && uploaded;
+    for (long long n: got) ok = ok && n == (long long) size;
+    result.ok = ok;
+
+    for (BinaryConn *conn: {&sender, &receiver, &chatFrom, &chatTo}) closesocket(conn->s);
+    for (auto &member: members) closesocket(member.s);
+    StopServerProcess(pid);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    int sizeMB = 256;
+    int recipients = 8;
+    int samples = 2000;
+    int port = 23010;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string key = argv[i];
+        int value = std::stoi(argv[i + 1]);
+        if (key == "--size") sizeMB = value;
+        else if (key == "--recipients") recipients = value;
+        else if (key == "--samples") samples = value;
+        else if (key == "--port") port = value;
+    }
+    recipients = std::max(recipients, 1);
+    InitNetwork();
+    pattern.resize(PATTERN_SIZE);
+    for (size_t i = 0; i < pattern.size(); i++) pattern[i] = (char) (i * 131 + (i >> 13));
+    uint64_t size = (uint64_t) sizeMB * 1024 * 1024;
+
+    printf("size=%d MB recipients=%d samples=%d\n", sizeMB, recipients, samples);
+    for (bool zeroCopy: {true, false}) {
+        ModeResult result;
+        if (!RunMode(zeroCopy, zeroCopy ? port : port + 1, size, recipients, samples, result)) {
+            printf("%-9s setup failed\n", zeroCopy ? "zerocopy" : "copy");
+            continue;
+        }
+        printf("%-9s direct %7.0f MB/s  server_cpu %6.0f ms/GB   group %7.0f MB/s delivered  server_cpu %6.0f ms/GB%s\n",
+               zeroCopy ? "zerocopy" : "copy", result.directMBps, result.directCpuPerGB, result.groupMBps,
+               result.groupCpuPerGB, result.ok ? "" : "  DATA MISMATCH OR INCOMPLETE");
+        printf("          chat latency idle p50 %6.1f us  p99 %7.1f us   during upload p50 %6.1f us  p99 %7.1f us\n",
+               result.idleP50, result.idleP99, result.busyP50, result.busyP99);
+    }
+    return 0;
+}
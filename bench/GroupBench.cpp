@@ -0,0 +1,152 @@
+/**
+ * 群组持久化测试（不使用套接字）：写入大量群组和成员关系的日志（超过阈值时自动生成快照），测量启动耗时；
+ * 之后在后台生成快照，同时测量加入和退出群组的耗时，与没有快照生成时对比；
+ * 最后测量从快照加上少量日志启动的耗时。
+ * 用法: GroupBench [--groups N] [--users N] [--joins 每个用户加入的群组数] [--dir 父目录]
+ * 数据写入父目录（默认 /tmp）下的临时目录，结束时删除
+ */
+#include "GroupStore.h"
+#include "Log.h"
+#include "Registry.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+static double Milliseconds(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static uintmax_t DirectoryBytes(const std::string &dir) {
+    uintmax_t bytes = 0;
+    for (const auto &item: std::filesystem::directory_iterator(dir)) {
+        if (item.is_regular_file()) bytes += item.file_size();
+    }
+    return bytes;
+}
+
+// 从目录启动一个新的目录服务，返回耗时（毫秒）
+static double OpenRegistry(Registry &registry, const std::string &dir) {
+    auto start = Clock::now();
+    if (!registry.Open(dir)) return -1;
+    return Milliseconds(start);
+}
+
+/**
+ * 反复加入再退出群组，每次操作都写入日志
+ * @param stop 返回 true 时结束
+ * @return 每次操作耗时（微秒），已排序
+ */
+template<typename Stop>
+static std::vector<double> JoinLeave(Registry &registry, long groups, Stop stop) {
+    std::mt19937 rng(7);
+    std::vector<double> samples;
+    GroupPtr group;
+    for (int i = 0; !stop(i); i++) {
+        std::string name = "group" + std::to_string(rng() % groups);
+        GroupMember member{ClientHandle{0, (uint64_t) i}, "bench" + std::to_string(i % 1000)};
+        auto start = Clock::now();
+        registry.JoinGroup(name, member, group);
+        registry.LeaveGroup(name, member, group);
+        samples.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count() / 2);
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples;
+}
+
+static void PrintLatency(const char *name, const std::vector<double> &samples) {
+    if (samples.empty()) return;
+    printf("%-28s %8zu ops, p50 %6.2f us, p99 %7.2f us, max %8.1f us\n", name, samples.size(),
+           samples[samples.size() / 2], samples[samples.size() * 99 / 100], samples.back());
+}
+
+int main(int argc, char **argv) {
+    long groups = 1000000;
+    long users = 200000;
+    int joins = 5;
+    std::string parent = "/tmp";
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string key = argv[i];
+        std::string value = argv[i + 1];
+        if (key == "--groups") groups = std::stol(value);
+        else if (key == "--users") users = std::stol(value);
+        else if (key == "--joins") joins = std::stoi(value);
+        else if (key == "--dir") parent = value;
+    }
+    std::string dir = parent + "/groupbench-" + std::to_string(getpid());
+    printf("groups=%ld users=%ld joins per user=%d dir=%s\n", groups, users, joins, dir.c_str());
+    Logger::SetLevel(LOG_LEVEL_WARN);
+
+    // 依次生成所有群组和成员关系，写入日志和生成快照时使用同一份数据
+    auto generate = [&](auto &&onGroup, auto &&onMembership) {
+        for (long i = 0; i < groups; i++) onGroup("group" + std::to_string(i));
+        std::mt19937 rng(1);
+        std::vector<std::string> joined;
+        for (long u = 0; u < users; u++) {
+            joined.clear();
+            for (int j = 0; j < joins; j++) joined.push_back("group" + std::to_string(rng() % groups));
+            onMembership("user" + std::to_string(u), joined);
+        }
+    };
+    {
+        // 直接写入日志，相当于服务器运行期间陆续创建群组和加入群组；日志超过阈值时按同样的数据生成快照
+        GroupStore store(dir);
+        auto dump = [&](GroupSnapshotWriter &writer) {
+            std::vector<std::string> names;
+            generate([&](const std::string &name) { names.push_back(name); },
+                     [&](const std::string &user, const std::vector<std::string> &joined) {
+                         writer.AddMembership(user, joined);
+                     });
+            for (const auto &name: names) writer.AddGroup(name);
+        };
+        if (!store.Open([](GroupLogOp, std::string_view, std::string_view) {}, dump)) return 1;
+        auto start = Clock::now();
+        generate([&](const std::string &name) { store.Append(GROUP_OP_CREATE, name, {}); },
+                 [&](const std::string &user, const std::vector<std::string> &joined) {
+                     for (const auto &name: joined) store.Append(GROUP_OP_JOIN, name, user);
+                 });
+        store.Sync();
+        long records = groups + users * joins;
+        double ms = Milliseconds(start);
+        store.WaitCompaction();
+        printf("write-ahead log:             %ld records in %.0f ms (%.0f records/s), %.1f MB on disk, "
+               "%llu snapshots\n", records, ms, records / ms * 1e3, DirectoryBytes(dir) / 1e6,
+               (unsigned long long) store.Compactions());
+    }
+
+    {
+        Registry registry;
+        printf("start after writing:         %8.0f ms\n", OpenRegistry(registry, dir));
+        // 启动时重放的日志超过阈值会立即在后台生成快照，等它结束后再测量
+        registry.Store()->WaitCompaction();
+        uint64_t compactions = registry.Store()->Compactions();
+        auto idle = JoinLeave(registry, groups, [](int i) { return i >= 20000; });
+        PrintLatency("join/leave, idle:", idle);
+        // 生成快照期间继续加入和退出群组
+        auto start = Clock::now();
+        registry.Store()->Compact();
+        bool done = false;
+        auto busy = JoinLeave(registry, groups, [&](int i) {
+            if (i % 256 == 0) done = registry.Store()->Compactions() > compactions;
+            return done;
+        });
+        registry.Store()->WaitCompaction();
+        printf("snapshot in background:      %8.0f ms, %.1f MB\n", Milliseconds(start), DirectoryBytes(dir) / 1e6);
+        PrintLatency("join/leave, during snapshot:", busy);
+    }
+
+    Registry registry;
+    printf("start from snapshot + log:   %8.0f ms\n", OpenRegistry(registry, dir));
+    GroupPtr group;
+    printf("group%ld %s\n", groups - 1,
+           registry.FindGroup("group" + std::to_string(groups - 1), group) ? "loaded" : "missing");
+
+    std::filesystem::remove_all(dir);
+    return 0;
+}
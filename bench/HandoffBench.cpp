@@ -0,0 +1,243 @@
+/**
+ * 热重启测试：旧服务器接受大量连接（其中一部分注册用户并加入群组）后，把监听套接字和所有连接移交给
+ * 另一个进程中的新服务器，分阶段测量移交耗时；客户端进程在移交开始时向每个连接发送一条命令，
+ * 测量所有连接都收到新服务器回复的时间，即客户端感受到的停顿。
+ * 用法: HandoffBench [--connections N] [--shards N] [--registered-every N] [--port 端口]
+ * 每个进程需要约 N 个描述符，超过 ulimit -n 时减少连接数
+ */
+#include "Handoff.h"
+#include "Log.h"
+#include "Shard.h"
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+using Clock = std::chrono::steady_clock;
+
+static double Milliseconds(Clock::time_point start, Clock::time_point end = Clock::now()) {
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// 同一台机器上各进程的单调时钟一致，用纳秒数在进程之间传递时间点
+static int64_t ToNs(Clock::time_point t) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+}
+
+static Clock::time_point FromNs(int64_t ns) {
+    return Clock::time_point(std::chrono::nanoseconds(ns));
+}
+
+static void WriteValue(int fd, int64_t value) {
+    if (write(fd, &value, sizeof(value)) != sizeof(value)) perror("write");
+}
+
+static int64_t ReadValue(int fd) {
+    int64_t value = -1;
+    if (read(fd, &value, sizeof(value)) != sizeof(value)) return -1;
+    return value;
+}
+
+// 统计连接上收到的回复数（按行计数）
+static int CountReplies(const char *data, ssize_t n, const char *marker) {
+    int count = 0;
+    std::string_view text(data, (size_t) n);
+    for (size_t pos = text.find(marker); pos != std::string_view::npos; pos = text.find(marker, pos + 1)) count++;
+    return count;
+}
+
+/**
+ * 客户端进程：建立所有连接，每个连接发送一条命令并等待回复；收到移交开始的时间后
+ * 立即在每个连接上再发送一条命令，等待全部回复
+ */
+static int RunClients(int port, int connections, int registeredEvery, int startPipe, int readyPipe) {
+    std::vector<int> sockets;
+    std::vector<int> replies(connections, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    for (int i = 0; i < connections; i++) {
+        int s = socket(AF_INET, SOCK_STREAM, 0);
+        while (connect(s, (sockaddr *) &addr, sizeof(addr)) != 0) {
+            close(s);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            s = socket(AF_INET, SOCK_STREAM, 0);
+        }
+        std::string commands;
+        if (i % registeredEvery == 0) {
+            commands = "REGISTER SERVER user" + std::to_string(i) + "\n";
+            commands += i == 0 ? "CREATE_GROUP bench\n" : "JOIN_GROUP JOIN bench\n";
+        }
+        commands += "GROUP_CHECK missing\n";
+        if (send(s, commands.data(), commands.size(), 0) != (ssize_t) commands.size()) return 1;
+        sockets.push_back(s);
+        if (i == 0) {
+            // 群组创建后其它用户才能加入，否则加入失败的回复与计数的回复相同
+            std::string reply;
+            char chunk[4096];
+            while (reply.find("Group created") == std::string::npos) {
+                ssize_t n = recv(s, chunk, sizeof(chunk), 0);
+                if (n <= 0) return 1;
+                reply.append(chunk, (size_t) n);
+            }
+            replies[0] = CountReplies(reply.data(), (ssize_t) reply.size(), "Group not found");
+        }
+    }
+
+    // 等待每个连接累计收到 count 条“群组不存在”的回复
+    char buf[65536];
+    int epfd = epoll_create1(0);
+    for (int i = 0; i < connections; i++) {
+        epoll_event ev{EPOLLIN, {}};
+        ev.data.u32 = (uint32_t) i;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, sockets[i], &ev);
+    }
+    auto waitReplies = [&](int count) {
+        int pending = 0;
+        for (int i = 0; i < connections; i++) pending += replies[i] < count;
+        epoll_event events[256];
+        while (pending > 0) {
+            int ready = epoll_wait(epfd, events, 256, 10000);
+            if (ready <= 0) {
+                fprintf(stderr, "%d connections did not answer\n", pending);
+                return false;
+            }
+            for (int k = 0; k < ready; k++) {
+                int i = (int) events[k].data.u32;
+                ssize_t n = recv(sockets[i], buf, sizeof(buf), MSG_DONTWAIT);
+                if (n == 0) {
+                    fprintf(stderr, "connection %d was closed\n", i);
+                    return false;
+                }
+                if (n < 0) continue;
+                bool was = replies[i] < count;
+                replies[i] += CountReplies(buf, n, "Group not found");
+                if (was && replies[i] >= count) pending--;
+            }
+        }
+        return true;
+    };
+    if (!waitReplies(1)) return 1;
+    WriteValue(readyPipe, 1);
+
+    int64_t startNs = ReadValue(startPipe);
+    if (startNs < 0) return 1;
+    const char ping[] = "GROUP_CHECK missing\n";
+    for (int s: sockets) {
+        if (send(s, ping, sizeof(ping) - 1, 0) != (ssize_t) sizeof(ping) - 1) return 1;
+    }
+    if (!waitReplies(2)) return 1;
+    printf("client-observed pause:       %8.1f ms (all %d connections answered)\n", Milliseconds(FromNs(startNs)),
+           connections);
+    return 0;
+}
+
+// 新服务器进程：接收状态和套接字，恢复后确认，旧进程答复后一直服务到被结束
+static int RunNewServer(int conn, int presenceWindowMs) {
+    HandoffState state;
+    if (!ReceiveHandoff(conn, state)) return 1;
+    auto received = Clock::now();
+    ShardSet shards((int) state.listeners.size(), presenceWindowMs);
+    // 测量服务器本身的吞吐量，不启用速率限制和连接准入
+    shards.SetLimits(Limits::Unlimited());
+    auto created = Clock::now();
+    if (!shards.Import(state)) return 1;
+    auto imported = Clock::now();
+    if (!SendHandoffAck(conn) || !WaitHandoffCommit(conn)) return 1;
+    shards.Start();
+    printf("new process: create shards  %8.1f ms\n", Milliseconds(received, created));
+    printf("new process: import         %8.1f ms (%zu clients)\n", Milliseconds(created, imported),
+           state.clients.size());
+    fflush(stdout);
+    char unused;
+    // 父进程关闭套接字时结束
+    while (read(conn, &unused, 1) > 0) {}
+    shards.Stop();
+    shards.Join();
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int connections = 10000;
+    int shardCount = 2;
+    int registeredEvery = 100;
+    int port = 9996;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string key = argv[i];
+        int value = std::stoi(argv[i + 1]);
+        if (key == "--connections") connections = value;
+        else if (key == "--shards") shardCount = value;
+        else if (key == "--registered-every") registeredEvery = value;
+        else if (key == "--port") port = value;
+    }
+    rlimit limit{};
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    printf("connections=%d shards=%d registered=1/%d open file limit=%llu\n", connections, shardCount,
+           registeredEvery, (unsigned long long) limit.rlim_cur);
+    fflush(stdout);
+    InitNetwork();
+    // 客户端进程退出时未读完的连接被重置，不输出这类警告
+    Logger::SetLevel(LOG_LEVEL_ERROR);
+
+    // 在启动任何线程之前创建子进程
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0) return 1;
+    pid_t newServer = fork();
+    if (newServer == 0) {
+        close(pair[0]);
+        return RunNewServer(pair[1], PRESENCE_WINDOW_MS);
+    }
+    close(pair[1]);
+    int startPipe[2], readyPipe[2];
+    if (pipe(startPipe) != 0 || pipe(readyPipe) != 0) return 1;
+    pid_t clients = fork();
+    if (clients == 0) {
+        close(pair[0]);
+        return RunClients(port, connections, registeredEvery, startPipe[0], readyPipe[1]);
+    }
+
+    int status = 1;
+    {
+        ShardSet shards(shardCount);
+        // 测量服务器本身的吞吐量，不启用速率限制和连接准入
+        shards.SetLimits(Limits::Unlimited());
+        if (!shards.Listen(port)) return 1;
+        shards.Start();
+        if (ReadValue(readyPipe[0]) != 1) {
+            fprintf(stderr, "clients failed to connect\n");
+        } else {
+            // 与 Server 中的移交步骤相同
+            auto start = Clock::now();
+            WriteValue(startPipe[1], ToNs(start));
+            shards.Stop();
+            shards.Join();
+            auto stopped = Clock::now();
+            HandoffState state;
+            shards.Export(state);
+            auto exported = Clock::now();
+            bool sent = SendHandoff(pair[0], state);
+            auto sentAt = Clock::now();
+            bool acked = sent && WaitHandoffAck(pair[0], HANDOFF_ACK_TIMEOUT_MS) && SendHandoffDecision(pair[0], true);
+            auto end = Clock::now();
+            printf("old process: stop shards    %8.1f ms\n", Milliseconds(start, stopped));
+            printf("old process: export         %8.1f ms\n", Milliseconds(stopped, exported));
+            printf("old process: send           %8.1f ms (%zu sockets)\n", Milliseconds(exported, sentAt),
+                   state.clients.size() + state.listeners.size());
+            printf("handover until ack:          %8.1f ms %s\n", Milliseconds(start, end), acked ? "" : "(failed)");
+            fflush(stdout);
+        }
+        waitpid(clients, &status, 0);
+    }
+    close(pair[0]);
+    int newStatus = 1;
+    waitpid(newServer, &newStatus, 0);
+    return status == 0 && newStatus == 0 ? 0 : 1;
+}
@@ -0,0 +1,145 @@
+/**
+ * 消息历史测试（不使用套接字）：多个线程模拟分片向同一群组日志追加消息，测量组提交的追加吞吐量
+ * 和每次落盘合并的追加数，并与每条消息各落盘一次对比；之后重新打开日志测量恢复耗时，
+ * 再测量在日志开头、中间和末尾取回一页历史的延迟以及逐页取回全部消息的速度。
+ * 用法: HistoryBench [--messages N] [--payload 字节] [--writers N] [--page N] [--dir 父目录]
+ * 数据写入父目录（默认 /tmp）下的临时目录，结束时删除
+ */
+#include "MessageStore.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+static double Seconds(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// 每条消息追加后立即落盘的吞吐量，作为组提交的对照
+static double SyncEachRate(const std::string &dir, const std::string &body, int count) {
+    std::string path = dir + "/sync-each.log";
+    FileHandle file = OpenAppendFile(path);
+    if (file == INVALID_FILE) return 0;
+    auto start = Clock::now();
+    for (int i = 0; i < count; i++) {
+        WriteAll(file, body.data(), body.size());
+        SyncFile(file);
+    }
+    double rate = count / Seconds(start);
+    CloseFile(file);
+    std::filesystem::remove(path);
+    return rate;
+}
+
+/**
+ * 重复取回同一位置开始的一页历史
+ * @return 每次取回耗时的中位数和最大值（微秒）
+ */
+static std::pair<double, double> PageLatency(MessageLog &log, uint64_t since, size_t page, int rounds) {
+    std::vector<double> samples;
+    size_t bytes = 0;
+    for (int r = 0; r < rounds; r++) {
+        auto start = Clock::now();
+        log.Read(since, page, [&](const HistoryEntry &entry) {
+            bytes += entry.body.size();
+            return true;
+        });
+        samples.push_back(Seconds(start) * 1e6);
+    }
+    std::sort(samples.begin(), samples.end());
+    return {samples[samples.size() / 2], samples.back()};
+}
+
+int main(int argc, char **argv) {
+    long messages = 1000000;
+    int payload = 64;
+    int writers = 4;
+    size_t page = HISTORY_PAGE_SIZE;
+    std::string parent = "/tmp";
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string key = argv[i];
+        std::string value = argv[i + 1];
+        if (key == "--messages") messages = std::stol(value);
+        else if (key == "--payload") payload = std::stoi(value);
+        else if (key == "--writers") writers = std::stoi(value);
+        else if (key == "--page") page = std::stoul(value);
+        else if (key == "--dir") parent = value;
+    }
+    std::string dir = parent + "/historybench-" + std::to_string(getpid());
+    std::string body(payload, 'x');
+    printf("messages=%ld payload=%d writers=%d page=%zu dir=%s\n", messages, payload, writers, page, dir.c_str());
+
+    {
+        MessageStore store(dir);
+        if (!store.Open()) return 1;
+        printf("sync each append:  %10.0f msgs/s\n", SyncEachRate(dir, body, 2000));
+
+        MessageLogPtr log = store.GroupLog("bench", true);
+        auto start = Clock::now();
+        std::vector<std::thread> threads;
+        for (int t = 0; t < writers; t++) {
+            threads.emplace_back([&, t]() {
+                std::string sender = "user" + std::to_string(t);
+                for (long i = t; i < messages; i += writers) store.Append(log, sender, body);
+            });
+        }
+        for (auto &thread: threads) thread.join();
+        double appendSeconds = Seconds(start);
+        store.Sync();
+        double totalSeconds = Seconds(start);
+        uintmax_t bytes = 0;
+        for (const auto &item: std::filesystem::recursive_directory_iterator(dir)) {
+            if (item.is_regular_file()) bytes += item.file_size();
+        }
+        printf("group commit:      %10.0f msgs/s appended, %.0f msgs/s durable, %.1f MB/s, "
+               "%llu commits, %.0f appends per fsync\n",
+               messages / appendSeconds, messages / totalSeconds,
+               (double) bytes / totalSeconds / 1e6, (unsigned long long) store.Commits(),
+               (double) store.Appends() / (double) std::max<uint64_t>(store.Syncs(), 1));
+    }
+
+    // 重新打开：扫描段文件、校验记录并重建稀疏索引
+    MessageStore store(dir);
+    if (!store.Open()) return 1;
+    auto start = Clock::now();
+    MessageLogPtr log = store.GroupLog("bench", false);
+    printf("reopen:            %10.1f ms, last seq %llu\n", Seconds(start) * 1e3,
+           (unsigned long long) (log ? log->LastSeq() : 0));
+    if (!log) return 1;
+
+    uint64_t last = log->LastSeq();
+    struct {
+        const char *name;
+        uint64_t since;
+    } positions[] = {
+            {"head",   0},
+            {"middle", last / 2},
+            {"tail",   last > page ? last - page : 0},
+    };
+    for (const auto &position: positions) {
+        auto latency = PageLatency(*log, position.since, page, 50);
+        printf("page at %-7s    p50 %8.1f us, max %8.1f us\n", position.name, latency.first, latency.second);
+    }
+
+    // 逐页取回全部消息，模拟离线很久的客户端追赶
+    start = Clock::now();
+    uint64_t since = 0;
+    while (since < last) {
+        log->Read(since, page, [&](const HistoryEntry &entry) {
+            since = entry.seq;
+            return true;
+        });
+    }
+    double replaySeconds = Seconds(start);
+    printf("full catch-up:     %10.0f msgs/s (%.1f ms for %llu messages)\n", last / replaySeconds,
+           replaySeconds * 1e3, (unsigned long long) last);
+
+    std::filesystem::remove_all(dir);
+    return 0;
+}
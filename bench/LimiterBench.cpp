@@ -0,0 +1,90 @@
+/**
+ * 速率限制和连接准入的组件级测试，输出每次操作的纳秒数：
+ *   bucket     连接令牌桶的检查和扣除（消息数和字节数各一个桶），即每条命令在分发前的额外开销
+ *   user       按用户名的令牌桶，多个线程（模拟分片）同时为不同用户扣除
+ *   admission  接受连接时的检查、计数和关闭时的释放，多个线程同时进行
+ * 用法: LimiterBench [--ops N] [--users N] [--threads N]
+ */
+#include "Limiter.h"
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+static double Nanoseconds(Clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+}
+
+static void Report(const char *op, int threads, double ns, size_t count) {
+    printf("%-10s threads=%-3d %10.1f ns/op\n", op, threads, ns / (double) count);
+}
+
+// 每个线程执行 ops 次操作，返回总耗时
+template<typename Work>
+static double RunThreads(int threads, Work work) {
+    std::vector<std::thread> workers;
+    auto start = Clock::now();
+    for (int t = 0; t < threads; t++) workers.emplace_back(work, t);
+    for (auto &worker: workers) worker.join();
+    return Nanoseconds(start);
+}
+
+int main(int argc, char **argv) {
+    size_t ops = 10000000;
+    int users = 100000, threads = 4;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string key = argv[i];
+        if (key == "--ops") ops = std::stoul(argv[i + 1]);
+        else if (key == "--users") users = std::stoi(argv[i + 1]);
+        else if (key == "--threads") threads = std::stoi(argv[i + 1]);
+    }
+    Limits limits;
+    size_t allowed = 0;
+
+    // 时钟每次操作前进 1 毫秒，令牌始终足够，测量的是正常命令的开销
+    TokenBucket messageTokens, byteTokens;
+    auto start = Clock::now();
+    for (size_t i = 0; i < ops; i++) {
+        uint64_t now = 1 + i;
+        if (messageTokens.Check(limits.connMessages, 1, now) == 0 &&
+            byteTokens.Check(limits.connBytes, 64, now) == 0) {
+            messageTokens.Take(1);
+            byteTokens.Take(64);
+            allowed++;
+        }
+    }
+    Report("bucket", 1, Nanoseconds(start), ops);
+
+    std::vector<std::string> names((size_t) users);
+    for (int i = 0; i < users; i++) names[(size_t) i] = "user" + std::to_string(i);
+    UserLimiter userLimiter;
+    size_t perThread = ops / (size_t) threads;
+    double ns = RunThreads(threads, [&](int t) {
+        for (size_t i = 0; i < perThread; i++) {
+            const std::string &name = names[(i * (size_t) threads + (size_t) t) % names.size()];
+            userLimiter.Take(name, limits, 1, 64, 1 + i / 1000);
+        }
+    });
+    Report("user", threads, ns, perThread * (size_t) threads);
+
+    // 地址分布在 users 个远端IP上，关闭时释放，计数保持在较低水平
+    Admission admission;
+    ns = RunThreads(threads, [&](int t) {
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        for (size_t i = 0; i < perThread; i++) {
+            addr.sin_addr.s_addr = htonl(0x0A000000u + (uint32_t) ((i * (size_t) threads + (size_t) t) % (size_t) users));
+            if (admission.Check(addr, limits) != Admission::Result::Accepted) continue;
+            admission.Add(addr, true);
+            admission.HandshakeDone();
+            admission.Release(addr, false);
+        }
+    });
+    Report("admission", threads, ns, perThread * (size_t) threads);
+    if (admission.Pending() != 0) fprintf(stderr, "pending handshakes leaked: %d\n", admission.Pending());
+    fprintf(stderr, "bucket allowed %zu of %zu\n", allowed, ops);
+    return 0;
+}
@@ -0,0 +1,337 @@
+/**
+ * 端到端负载生成器：建立 N 个连接，注册用户，创建并加入群组，
+ * 按目标速率以开环方式发送私聊和群组消息的混合负载，
+ * 根据消息中嵌入的计划发送时间统计投递延迟的 p50/p99/p999，
+ * 同时报告建立连接、注册和加入群组的速率。
+ * 默认在子进程中启动服务器，--external 1 时连接本机已运行的服务器。
+ * 指定 --max-p99-us 时 p99 超过阈值或有消息未送达则以非 0 状态退出，可用于发布前的回归检查。
+ * 用法: LoadGen [--connections N] [--groups N] [--rate N] [--group-percent N] [--seconds N]
+ *               [--warmup N] [--payload N] [--threads N] [--shards N] [--port N] [--external 0|1]
+ *               [--max-p99-us N]
+ */
+#include "BenchUtil.h"
+#include "Shard.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct Options {
+    int connections = 1000;
+    int groups = 10;
+    int rate = 10000;        // 每秒发送的消息数（所有线程合计）
+    int groupPercent = 20;   // 群组消息所占的百分比
+    int seconds = 10;
+    int warmup = 1;          // 预热时间（秒），期间发送的消息不计入统计
+    int payload = 64;
+    int threads = 1;
+    int shards = 1;
+    int port = 24990;
+    bool external = false;
+    long maxP99Us = 0;       // 大于 0 时作为 p99 延迟的上限
+};
+
+/**
+ * 一个客户端连接：按行解析收到的数据，发送不完的数据暂存在 out 中
+ */
+struct Conn {
+    SOCKET s{INVALID_SOCKET};
+    std::string in;
+    std::string out;
+    int pending{};  // 准备阶段中尚未收到的确认数
+};
+
+static int64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 尽量发出暂存的数据，内核缓冲区满时留到下次
+static void FlushOut(Conn &c) {
+    while (!c.out.empty()) {
+        int n = (int) send(c.s, c.out.data(), c.out.size(), MSG_NOSIGNAL);
+        if (n <= 0) return;
+        c.out.erase(0, n);
+    }
+}
+
+static void SendLine(Conn &c, const std::string &line) {
+    c.out += line;
+    FlushOut(c);
+}
+
+// 读取所有可读数据，对每一行完整的数据调用 onLine
+template<typename F>
+static void ReadLines(Conn &c, std::vector<char> &buf, F &&onLine) {
+    while (true) {
+        int r = (int) recv(c.s, buf.data(), buf.size(), 0);
+        if (r <= 0) break;
+        c.in.append(buf.data(), r);
+    }
+    size_t start = 0, pos;
+    while ((pos = c.in.find('\n', start)) != std::string::npos) {
+        onLine(std::string_view(c.in).substr(start, pos - start));
+        start = pos + 1;
+    }
+    c.in.erase(0, start);
+}
+
+/**
+ * 准备阶段：向 conns[first, last) 各发送一行命令，等待每个连接都收到包含 marker 的回复
+ * @return 耗时（秒）
+ */
+static double RunPhase(std::vector<Conn> &conns, int first, int last, int ep,
+                       const std::function<std::string(int)> &command, const char *marker, const char *altMarker) {
+    auto start = std::chrono::steady_clock::now();
+    int waiting = 0;
+    for (int i = first; i < last; i++) {
+        conns[i].pending = 1;
+        waiting++;
+        SendLine(conns[i], command(i));
+    }
+    std::vector<char> buf(65536);
+    epoll_event events[256];
+    while (waiting > 0) {
+        int k = epoll_wait(ep, events, 256, 1000);
+        if (k == 0) {
+            std::cerr << waiting << " connections did not answer " << marker << std::endl;
+            break;
+        }
+        for (int e = 0; e < k; e++) {
+            Conn &c = conns[events[e].data.u32];
+            FlushOut(c);
+            ReadLines(c, buf, [&](std::string_view line) {
+                if (c.pending == 0) return;
+                if (line.find(marker) != std::string_view::npos ||
+                    (altMarker && line.find(altMarker) != std::string_view::npos)) {
+                    c.pending = 0;
+                    waiting--;
+                }
+            });
+        }
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * 一个发送和接收线程，负责下标满足 i % threads == index 的连接
+ */
+struct Worker {
+    std::vector<int> conns;
+    std::vector<uint32_t> latencies;  // 预热之后发送的消息的投递延迟（微秒）
+    long sent{};
+    long expected{};
+    long delivered{};
+};
+
+static void RunWorker(const Options &opt, std::vector<Conn> &conns, Worker &worker, int index,
+                      int64_t measureStart, int64_t sendEnd) {
+    int ep = epoll_create1(0);
+    for (int i: worker.conns) {
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        ev.data.u32 = i;
+        epoll_ctl(ep, EPOLL_CTL_ADD, conns[i].s, &ev);
+    }
+    std::mt19937 rng(index + 1);
+    std::uniform_int_distribution<int> pickSender(0, (int) worker.conns.size() - 1);
+    std::uniform_int_distribution<int> pickUser(0, opt.connections - 1);
+    std::uniform_int_distribution<int> pickPercent(0, 99);
+    std::string pad(opt.payload, 'x');
+    // 每个线程分担总速率，按计划时间发送，落后时立即补发，延迟从计划时间算起
+    int64_t interval = (int64_t) 1e9 * opt.threads / std::max(opt.rate, 1);
+    int64_t nextSend = NowNs();
+    int64_t lastDelivery = NowNs();
+    std::vector<char> buf(65536);
+    epoll_event events[256];
+
+    auto onLine = [&](std::string_view line) {
+        // 服务器通知（发送确认、在线状态等）不是投递
+        if (line.substr(0, 7) == "Server:") return;
+        size_t pos = line.find(": T");
+        if (pos == std::string_view::npos) return;
+        int64_t ts = 0;
+        for (size_t i = pos + 3; i < line.size() && line[i] >= '0' && line[i] <= '9'; i++) {
+            ts = ts * 10 + (line[i] - '0');
+        }
+        int64_t now = NowNs();
+        lastDelivery = now;
+        if (ts < measureStart) return;
+        worker.delivered++;
+        worker.latencies.push_back((uint32_t) std::min<int64_t>((now - ts) / 1000, UINT32_MAX));
+    };
+
+    while (true) {
+        int64_t now = NowNs();
+        if (now < sendEnd) {
+            while (nextSend <= now && nextSend < sendEnd) {
+                int sender = worker.conns[pickSender(rng)];
+                std::string line;
+                bool toGroup = opt.groups > 0 && pickPercent(rng) < opt.groupPercent;
+                std::string body = "T" + std::to_string(nextSend) + " " + pad + "\n";
+                int fanout = 1;
+                if (toGroup) {
+                    int group = sender % opt.groups;
+                    line = "GROUP_MESSAGE GROUP g" + std::to_string(group) + " " + body;
+                    // 群组成员为下标对群组数取模相同的所有连接，包括发送者
+                    fanout = opt.connections / opt.groups + (group < opt.connections % opt.groups ? 1 : 0);
+                } else {
+                    line = "MESSAGE lu" + std::to_string(pickUser(rng)) + " " + body;
+                }
+                if (nextSend >= measureStart) {
+                    worker.sent++;
+                    worker.expected += fanout;
+                }
+                SendLine(conns[sender], line);
+                nextSend += interval;
+            }
+        } else if (now - lastDelivery > 1000000000LL || now - sendEnd > 5000000000LL) {
+            // 发送结束后等待在途的消息，1 秒内没有新的投递或总共等待 5 秒后结束
+            break;
+        }
+        int timeoutMs = now < sendEnd ? (int) std::max<int64_t>(0, (nextSend - now) / 1000000) : 100;
+        int k = epoll_wait(ep, events, 256, timeoutMs);
+        for (int e = 0; e < k; e++) {
+            Conn &c = conns[events[e].data.u32];
+            if (events[e].events & EPOLLOUT) FlushOut(c);
+            if (events[e].events & EPOLLIN) ReadLines(c, buf, onLine);
+        }
+    }
+    close(ep);
+}
+
+static double Percentile(const std::vector<uint32_t> &sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t i = std::min(sorted.size() - 1, (size_t) (p * (double) sorted.size()));
+    return sorted[i];
+}
+
+int main(int argc, char **argv) {
+    Options opt;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string key = argv[i];
+        long value = std::stol(argv[i + 1]);
+        if (key == "--connections") opt.connections = (int) value;
+        else if (key == "--groups") opt.groups = (int) value;
+        else if (key == "--rate") opt.rate = (int) value;
+        else if (key == "--group-percent") opt.groupPercent = (int) value;
+        else if (key == "--seconds") opt.seconds = (int) value;
+        else if (key == "--warmup") opt.warmup = (int) value;
+        else if (key == "--payload") opt.payload = (int) value;
+        else if (key == "--threads") opt.threads = (int) value;
+        else if (key == "--shards") opt.shards = (int) value;
+        else if (key == "--port") opt.port = (int) value;
+        else if (key == "--external") opt.external = value != 0;
+        else if (key == "--max-p99-us") opt.maxP99Us = value;
+    }
+    opt.threads = std::max(1, std::min(opt.threads, opt.connections));
+    opt.groups = std::min(opt.groups, opt.connections);
+    InitNetwork();
+
+    pid_t pid = -1;
+    if (!opt.external) {
+        pid = StartServerProcess(opt.port, [&]() {
+            ShardSet shards(opt.shards);
+            // 测量服务器本身的吞吐量，不启用速率限制和连接准入
+            shards.SetLimits(Limits::Unlimited());
+            if (!shards.Listen(opt.port)) return;
+            shards.Start();
+            shards.Join();
+        });
+    }
+
+    // 建立连接
+    std::vector<Conn> conns(opt.connections);
+    auto connectStart = std::chrono::steady_clock::now();
+    for (int i = 0; i < opt.connections; i++) {
+        conns[i].s = ConnectTo(opt.port);
+        if (conns[i].s == INVALID_SOCKET) {
+            std::cerr << "connect failed at " << i << ": " << strerror(errno) << std::endl;
+            if (pid > 0) StopServerProcess(pid);
+            return 1;
+        }
+        SetNonBlocking(conns[i].s);
+    }
+    double connectSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - connectStart).count();
+
+    int ep = epoll_create1(0);
+    for (int i = 0; i < opt.connections; i++) {
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        ev.data.u32 = i;
+        epoll_ctl(ep, EPOLL_CTL_ADD, conns[i].s, &ev);
+    }
+    // 注册用户 lu0..lu(N-1)，命令以换行结束，服务器按行协议回复
+    double registerSeconds = RunPhase(conns, 0, opt.connections, ep, [](int i) {
+        return "REGISTER SERVER lu" + std::to_string(i) + "\n";
+    }, "Server: Registered.", nullptr);
+    // 前 groups 个连接各创建一个群组，其余连接加入下标对群组数取模对应的群组
+    double joinSeconds = 0;
+    if (opt.groups > 0) {
+        joinSeconds += RunPhase(conns, 0, opt.groups, ep, [](int i) {
+            return "CREATE_GROUP g" + std::to_string(i) + "\n";
+        }, "Server: Group created.", "Server: Group already exists.");
+        joinSeconds += RunPhase(conns, opt.groups, opt.connections, ep, [&](int i) {
+            return "JOIN_GROUP JOIN g" + std::to_string(i % opt.groups) + "\n";
+        }, "Server: Joined group.", "Server: User already in group.");
+    }
+    // 丢弃准备阶段剩余的通知，例如合并窗口结束后的在线状态增量
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    std::vector<char> buf(65536);
+    for (auto &c: conns) {
+        ReadLines(c, buf, [](std::string_view) {});
+        c.in.clear();
+    }
+    close(ep);
+
+    // 开环发送
+    std::vector<Worker> workers(opt.threads);
+    for (int i = 0; i < opt.connections; i++) workers[i % opt.threads].conns.push_back(i);
+    int64_t start = NowNs();
+    int64_t measureStart = start + (int64_t) opt.warmup * 1000000000LL;
+    int64_t sendEnd = measureStart + (int64_t) opt.seconds * 1000000000LL;
+    std::vector<std::thread> threads;
+    for (int w = 0; w < opt.threads; w++) {
+        threads.emplace_back(RunWorker, std::cref(opt), std::ref(conns), std::ref(workers[w]), w, measureStart,
+                             sendEnd);
+    }
+    for (auto &t: threads) t.join();
+
+    long sent = 0, expected = 0, delivered = 0;
+    std::vector<uint32_t> latencies;
+    for (auto &w: workers) {
+        sent += w.sent;
+        expected += w.expected;
+        delivered += w.delivered;
+        latencies.insert(latencies.end(), w.latencies.begin(), w.latencies.end());
+    }
+    std::sort(latencies.begin(), latencies.end());
+    double p50 = Percentile(latencies, 0.50);
+    double p99 = Percentile(latencies, 0.99);
+    double p999 = Percentile(latencies, 0.999);
+    double maxLatency = latencies.empty() ? 0 : latencies.back();
+
+    printf("connections=%d groups=%d rate=%d group_percent=%d payload=%d threads=%d shards=%d\n", opt.connections,
+           opt.groups, opt.rate, opt.groupPercent, opt.payload, opt.threads, opt.shards);
+    printf("connect/s=%.0f register/s=%.0f join/s=%.0f\n", opt.connections / connectSeconds,
+           opt.connections / registerSeconds, opt.groups > 0 ? opt.connections / joinSeconds : 0.0);
+    printf("sent/s=%.0f delivered/s=%.0f delivered=%ld expected=%ld\n", (double) sent / opt.seconds,
+           (double) delivered / opt.seconds, delivered, expected);
+    printf("latency_us p50=%.0f p99=%.0f p999=%.0f max=%.0f\n", p50, p99, p999, maxLatency);
+    fflush(stdout);
+
+    for (auto &c: conns) closesocket(c.s);
+    if (pid > 0) StopServerProcess(pid);
+
+    if (opt.maxP99Us > 0 && (p99 > (double) opt.maxP99Us || delivered < expected)) {
+        std::cerr << "regression: p99=" << p99 << " us (limit " << opt.maxP99Us << "), delivered " << delivered
+                  << " of " << expected << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,116 @@
+/**
+ * 连接内存与路由路径分配测试：子进程运行服务器，父进程建立 connections 个连接，
+ * 每个连接发送一条命令后保持空闲，测量服务器每个连接的常驻内存；
+ * 再让 active 个连接两两配对以闭环方式互发 MESSAGE，预热后统计每条消息在服务器上的内存分配次数。
+ * 分配次数通过替换 operator new 统计，计数器放在共享内存中。
+ * 用法: MemoryBench [--connections N] [--active N] [--shards N] [--seconds N] [--payload N] [--port N]
+ */
+#include "BenchUtil.h"
+#include "Shard.h"
+#include <sys/mman.h>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+static std::atomic<long> *allocations;
+static bool counting = false;
+
+void *operator new(size_t size) {
+    if (counting) allocations->fetch_add(1, std::memory_order_relaxed);
+    void *p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+int main(int argc, char **argv) {
+    int connections = 10000;
+    int active = 100;
+    int shardCount = 1;
+    int seconds = 3;
+    int payload = 64;
+    int port = 22990;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string key = argv[i];
+        int value = std::stoi(argv[i + 1]);
+        if (key == "--connections") connections = value;
+        else if (key == "--active") active = value;
+        else if (key == "--shards") shardCount = value;
+        else if (key == "--seconds") seconds = value;
+        else if (key == "--payload") payload = value;
+        else if (key == "--port") port = value;
+    }
+    allocations = (std::atomic<long> *) mmap(nullptr, sizeof(std::atomic<long>), PROT_READ | PROT_WRITE,
+                                             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    new(allocations) std::atomic<long>(0);
+    InitNetwork();
+
+    pid_t pid = StartServerProcess(port, [&]() {
+        counting = true;
+        ShardSet shards(shardCount);
+        // 测量服务器本身的吞吐量，不启用速率限制和连接准入
+        shards.SetLimits(Limits::Unlimited());
+        if (!shards.Listen(port)) return;
+        shards.Start();
+        shards.Join();
+    });
+    ProcMemory before = ReadProcMemory(pid);
+
+    // 每个连接发送一条发给服务器的消息，服务器为它读取过数据后连接保持空闲
+    std::vector<SOCKET> sockets;
+    sockets.reserve(connections);
+    std::string hello = "MESSAGE SERVER hello\n";
+    for (int i = 0; i < connections; i++) {
+        SOCKET s = ConnectTo(port);
+        if (s == INVALID_SOCKET) {
+            std::cerr << "connect failed at " << i << ": " << strerror(errno) << std::endl;
+            break;
+        }
+        send(s, hello.data(), hello.size(), 0);
+        sockets.push_back(s);
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    ProcMemory idle = ReadProcMemory(pid);
+    size_t n = sockets.size();
+    double rssPerConn = n ? (double) (idle.rssKb - before.rssKb) * 1024 / n : 0;
+
+    // 新建 active 个连接注册用户并互发消息，先预热一秒让缓冲区池和发送队列达到稳定状态
+    active &= ~1;
+    std::vector<SOCKET> pairs;
+    for (int i = 0; i < active; i++) {
+        SOCKET s = ConnectTo(port);
+        if (s == INVALID_SOCKET) {
+            std::cerr << "connect failed: " << strerror(errno) << std::endl;
+            return 1;
+        }
+        pairs.push_back(s);
+    }
+    RegisterUsers(pairs, active);
+    ClosedLoopThroughput(pairs, active, payload, 1);
+    // 等待预热阶段在途的消息处理完
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    long allocBefore = allocations->load();
+    double throughput = ClosedLoopThroughput(pairs, active, payload, seconds);
+    long allocs = allocations->load() - allocBefore;
+    double messages = throughput * seconds;
+
+    printf("shards=%d connections=%zu rss/conn=%.0f B server_rss=%ld KB\n", shardCount, n, rssPerConn, idle.rssKb);
+    printf("active=%d throughput=%.0f msg/s allocs/msg=%.3f\n", active, throughput,
+           messages > 0 ? allocs / messages : 0.0);
+    for (auto s: sockets) closesocket(s);
+    for (auto s: pairs) closesocket(s);
+    StopServerProcess(pid);
+    return 0;
+}
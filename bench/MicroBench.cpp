@@ -0,0 +1,235 @@
+/**
+ * 热点路径的组件级测试，不使用套接字，直接调用服务器的各个组件：
+ *   parse_text        DecodeText 解析一条换行分隔的 MESSAGE 命令
+ *   parse_binary      DecodeBinary 解析一个 MESSAGE 二进制帧
+ *   find_user         在 users 个在线用户中按用户名查找（命中）
+ *   find_user_miss    查找不存在的用户
+ *   find_group        在 users/group-size 个群组中按群组名查找
+ *   presence_snapshot 生成 users 个在线用户的快照
+ *   presence_delta    窗口内 1% 的用户上下线后生成增量
+ *   group_contains    group-size 个成员的群组中检查成员资格
+ *   encode            构造消息并编码为文本和二进制帧
+ *   group_fanout      一条群组消息扇出到 group-size 个成员的发送队列（一半文本一半二进制客户端）
+ * 每个用例先预热，再取多轮中的最好成绩，输出每次操作的纳秒数，便于逐个提交比较。
+ * 用法: MicroBench [--users N] [--group-size N] [--message-size N] [--filter 名称子串]
+ */
+#include "Frame.h"
+#include "Presence.h"
+#include "Protocol.h"
+#include "Reactor.h"
+#include "Registry.h"
+#include "Slab.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+static volatile size_t sink;
+static std::string filter;
+
+/**
+ * 运行一个用例：调整每轮的次数使一轮至少 50ms，预热一轮后取 5 轮中的最好成绩
+ * @param name 用例名
+ * @param unit 每次操作包含的单位数（例如扇出的成员数），大于 1 时额外输出每单位的纳秒数
+ * @param fn 执行 n 次操作
+ */
+template<typename F>
+static void Measure(const char *name, size_t unit, F &&fn) {
+    if (!filter.empty() && std::string(name).find(filter) == std::string::npos) return;
+    size_t n = 1;
+    while (true) {
+        auto start = std::chrono::steady_clock::now();
+        fn(n);
+        if (std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(50) || n >= (1u << 30)) break;
+        n *= 2;
+    }
+    double best = 1e18;
+    for (int round = 0; round < 5; round++) {
+        auto start = std::chrono::steady_clock::now();
+        fn(n);
+        best = std::min(best, std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count());
+    }
+    double perOp = best / (double) n;
+    if (unit > 1) {
+        printf("%-18s %12.1f ns/op %10.3f M op/s %10.2f ns/unit\n", name, perOp, 1e3 / perOp, perOp / (double) unit);
+    } else {
+        printf("%-18s %12.1f ns/op %10.3f M op/s\n", name, perOp, 1e3 / perOp);
+    }
+}
+
+static std::string UserName(int i) {
+    return "user" + std::to_string(i);
+}
+
+int main(int argc, char **argv) {
+    int users = 10000;
+    int groupSize = 1000;
+    size_t messageSize = 64;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string key = argv[i];
+        std::string value = argv[i + 1];
+        if (key == "--users") users = std::stoi(value);
+        else if (key == "--group-size") groupSize = std::stoi(value);
+        else if (key == "--message-size") messageSize = std::stoul(value);
+        else if (key == "--filter") filter = value;
+    }
+    users = std::max(users, 1);
+    groupSize = std::max(groupSize, 1);
+    printf("users=%d group_size=%d message_size=%zu\n", users, groupSize, messageSize);
+    std::string body(messageSize, 'x');
+    std::mt19937 rng(1);
+
+    // 命令解析
+    std::string textCmd = "MESSAGE " + UserName(users / 2) + " " + body + "\n";
+    std::string_view msgFields[2] = {UserName(users / 2), body};
+    std::string binaryCmd;
+    AppendBinaryFrame(binaryCmd, OP_MESSAGE, msgFields, 2);
+    Measure("parse_text", 1, [&](size_t n) {
+        Command cmd;
+        size_t size = 0, total = 0;
+        for (size_t i = 0; i < n; i++) {
+            DecodeText(textCmd.data(), textCmd.size(), true, cmd, size);
+            total += cmd.fields[1].size();
+        }
+        sink = total;
+    });
+    Measure("parse_binary", 1, [&](size_t n) {
+        Command cmd;
+        size_t size = 0, total = 0;
+        for (size_t i = 0; i < n; i++) {
+            DecodeBinary(binaryCmd.data(), binaryCmd.size(), cmd, size);
+            total += cmd.fields[1].size();
+        }
+        sink = total;
+    });
+
+    // 用户和群组目录：每 groupSize 个用户一个群组
+    Registry registry;
+    std::vector<std::string> names;
+    for (int i = 0; i < users; i++) {
+        names.push_back(UserName(i));
+        registry.AddUser(names.back(), ClientHandle{i % 4, (uint64_t) i + 1});
+    }
+    int groupCount = std::max(1, users / groupSize);
+    std::vector<std::string> groupNames;
+    for (int g = 0; g < groupCount; g++) {
+        groupNames.push_back("group" + std::to_string(g));
+        GroupPtr group;
+        registry.CreateGroup(groupNames.back(), GroupMember{ClientHandle{0, (uint64_t) g + 1}, names[g % users]}, group);
+    }
+    // 预先生成随机的查找顺序，避免测量随机数生成
+    std::vector<std::string_view> lookups(4096), misses(4096), groupLookups(4096);
+    std::uniform_int_distribution<int> pickUser(0, users - 1), pickGroup(0, groupCount - 1);
+    std::vector<std::string> missNames;
+    for (size_t i = 0; i < lookups.size(); i++) missNames.push_back("nobody" + std::to_string(i));
+    for (size_t i = 0; i < lookups.size(); i++) {
+        lookups[i] = names[pickUser(rng)];
+        misses[i] = missNames[i];
+        groupLookups[i] = groupNames[pickGroup(rng)];
+    }
+    Measure("find_user", 1, [&](size_t n) {
+        ClientHandle handle;
+        size_t found = 0;
+        for (size_t i = 0; i < n; i++) found += registry.FindUser(lookups[i & 4095], handle);
+        sink = found;
+    });
+    Measure("find_user_miss", 1, [&](size_t n) {
+        ClientHandle handle;
+        size_t found = 0;
+        for (size_t i = 0; i < n; i++) found += registry.FindUser(misses[i & 4095], handle);
+        sink = found;
+    });
+    Measure("find_group", 1, [&](size_t n) {
+        GroupPtr group;
+        size_t found = 0;
+        for (size_t i = 0; i < n; i++) found += registry.FindGroup(groupLookups[i & 4095], group);
+        sink = found;
+    });
+
+    // 在线状态：所有用户已发布为在线
+    Presence presence(registry, PRESENCE_WINDOW_MS);
+    for (const auto &name: names) presence.Touch(name);
+    PresenceDelta initial;
+    presence.TakeDelta(initial);
+    Measure("presence_snapshot", (size_t) users, [&](size_t n) {
+        std::string snapshot;
+        size_t total = 0;
+        for (size_t i = 0; i < n; i++) {
+            presence.Snapshot(snapshot);
+            total += snapshot.size();
+        }
+        sink = total;
+    });
+    // 每个窗口 1% 的用户交替下线和上线
+    size_t churn = std::max(1, users / 100);
+    bool online = true;
+    Measure("presence_delta", churn, [&](size_t n) {
+        PresenceDelta delta;
+        size_t total = 0;
+        for (size_t i = 0; i < n; i++) {
+            for (size_t u = 0; u < churn; u++) {
+                if (online) registry.RemoveUser(names[u], ClientHandle{(int) u % 4, u + 1});
+                else registry.AddUser(names[u], ClientHandle{(int) u % 4, u + 1});
+                presence.Touch(names[u]);
+            }
+            online = !online;
+            presence.TakeDelta(delta);
+            total += delta.joined.size() + delta.left.size();
+        }
+        sink = total;
+    });
+
+    // 群组：groupSize 个成员的本地客户端，一半使用文本协议，一半使用二进制协议
+    Slab<ClientInfo> clients;
+    Group group("bench");
+    for (int i = 0; i < groupSize; i++) {
+        uint64_t id;
+        ClientInfo *client = clients.Create(id);
+        client->id = id;
+        client->protocol = i % 2 ? PROTOCOL_BINARY : PROTOCOL_TEXT_LINE;
+        group.Add(GroupMember{ClientHandle{0, id}, names[i % users]});
+    }
+    std::vector<uint64_t> memberIds;
+    group.MembersOn(0, memberIds);
+    std::vector<ClientHandle> checks(4096);
+    std::uniform_int_distribution<int> pickMember(0, groupSize - 1);
+    for (auto &handle: checks) handle = ClientHandle{0, memberIds[pickMember(rng)]};
+    Measure("group_contains", 1, [&](size_t n) {
+        size_t found = 0;
+        for (size_t i = 0; i < n; i++) found += group.Contains(checks[i & 4095]);
+        sink = found;
+    });
+
+    Measure("encode", 1, [&](size_t n) {
+        size_t total = 0;
+        for (size_t i = 0; i < n; i++) {
+            MessagePtr msg = MakeMessage(OP_GROUP_DELIVER, {groupNames[0], names[0], body});
+            total += msg->Encode(ENCODING_TEXT_LINE)->Size() + msg->Encode(ENCODING_BINARY)->Size();
+        }
+        sink = total;
+    });
+
+    // 与 ChatServer 投递群组消息的路径一致：取本分片成员、按ID查找连接、按协议取共享帧入队；
+    // 每条消息之后清空发送队列，相当于一次发送全部完成
+    std::vector<uint64_t> targets;
+    Measure("group_fanout", (size_t) groupSize, [&](size_t n) {
+        size_t total = 0;
+        for (size_t i = 0; i < n; i++) {
+            MessagePtr msg = MakeMessage(OP_GROUP_DELIVER, {groupNames[0], names[0], body});
+            group.MembersOn(0, targets);
+            for (uint64_t id: targets) {
+                ClientInfo *client = clients.Get(id);
+                if (client) client->outQueue.Push(msg->Encode(EncodingOf(client->protocol)));
+            }
+            for (uint64_t id: targets) {
+                ClientInfo *client = clients.Get(id);
+                total += client->outQueue.Bytes();
+                client->outQueue.Clear();
+            }
+        }
+        sink = total;
+    });
+    return 0;
+}
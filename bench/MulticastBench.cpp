@@ -0,0 +1,304 @@
+/**
+ * 组播传输测试：一个群组有 members 个使用二进制协议的成员，发送者每次连续发送 burst 条群组消息，
+ * 分别在只用TCP和启用组播（回环接口 127.0.0.1）两种方式下统计服务器每条群组消息的发送字节数、
+ * 发送系统调用次数和CPU时间，以及投递吞吐量。启用组播时成员在接收端按 loss 百分比随机丢弃数据报，
+ * 由 NAK 通过TCP重传补齐；两种方式都检查每个成员恰好收到每条消息一次。
+ * 服务器运行在子进程中，通过替换 send/sendmsg/sendto 计数，计数器放在共享内存中。
+ * 用法: MulticastBench [--members N] [--messages N] [--burst N] [--payload N] [--loss 百分比] [--port N]
+ */
+#include "BenchUtil.h"
+#include "Log.h"
+#include "Multicast.h"
+#include "Shard.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+struct Counters {
+    std::atomic<long> sendCalls;
+    std::atomic<long> sendBytes;
+};
+
+static Counters *counters;
+static bool counting = false;
+// 接收端按百分比丢弃组播数据报，只作用于标记过的组播套接字
+static std::vector<char> lossySocket(65536);
+static int lossPercent = 0;
+static std::mt19937 lossRng(3);
+static long dropped = 0;
+
+static ssize_t Counted(ssize_t n) {
+    if (counting) {
+        counters->sendCalls.fetch_add(1, std::memory_order_relaxed);
+        if (n > 0) counters->sendBytes.fetch_add(n, std::memory_order_relaxed);
+    }
+    return n;
+}
+
+extern "C" ssize_t send(int fd, const void *buf, size_t len, int flags) {
+    return Counted(syscall(SYS_sendto, fd, buf, len, flags, nullptr, 0));
+}
+
+extern "C" ssize_t sendmsg(int fd, const struct msghdr *msg, int flags) {
+    return Counted(syscall(SYS_sendmsg, fd, msg, flags));
+}
+
+extern "C" ssize_t sendto(int fd, const void *buf, size_t len, int flags, const sockaddr *addr, socklen_t addrLen) {
+    return Counted(syscall(SYS_sendto, fd, buf, len, flags, addr, addrLen));
+}
+
+extern "C" ssize_t recvfrom(int fd, void *buf, size_t len, int flags, sockaddr *addr, socklen_t *addrLen) {
+    while (true) {
+        ssize_t n = syscall(SYS_recvfrom, fd, buf, len, flags, addr, addrLen);
+        if (n < 0 || fd >= (int) lossySocket.size() || !lossySocket[fd] || (int) (lossRng() % 100) >= lossPercent) {
+            return n;
+        }
+        dropped++;
+    }
+}
+
+static uint64_t NowMs() {
+    return (uint64_t) std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void SendFrame(SOCKET s, uint8_t opcode, std::initializer_list<std::string_view> fields) {
+    std::string frame;
+    AppendBinaryFrame(frame, opcode, fields.begin(), fields.size());
+    send(s, frame.data(), frame.size(), 0);
+}
+
+// 一个成员：TCP连接、未组成完整帧的数据、组播接收和每条消息的收到次数
+struct Member {
+    SOCKET sock{INVALID_SOCKET};
+    std::string in;
+    std::unique_ptr<MulticastReceiver> multicast;
+    std::vector<uint8_t> received;
+    bool active{};
+};
+
+struct Result {
+    double deliveriesPerSec{};
+    double bytesPerMsg{};
+    double sendsPerMsg{};
+    double cpuPerMsg{};
+    long missing{};
+    long duplicates{};
+    uint64_t repaired{};
+    uint64_t reordered{};
+};
+
+// 消息内容以 "编号:" 开头，记录成员收到该编号的次数
+static void Count(Member &member, std::string_view text, long &delivered) {
+    size_t k = (size_t) std::stoul(std::string(text.substr(0, text.find(':'))));
+    if (k < member.received.size() && member.received[k]++ == 0) delivered++;
+}
+
+// 处理成员TCP连接上的所有完整帧，返回收到的 NOTICE 中 marker 出现的次数
+static int ReadFrames(Member &member, const std::string &marker, int &activated, long &delivered) {
+    int notices = 0;
+    size_t offset = 0;
+    Command cmd;
+    size_t size = 0;
+    while (DecodeBinary(member.in.data() + offset, member.in.size() - offset, cmd, size) == DecodeResult::Ok) {
+        offset += size;
+        if (cmd.opcode == OP_NOTICE && cmd.fields[0].find(marker) != std::string_view::npos) notices++;
+        else if (cmd.opcode == OP_GROUP_DELIVER) Count(member, cmd.fields[2], delivered);
+        else if (cmd.opcode == OP_SERVER_PING) SendFrame(member.sock, OP_PONG, {cmd.fields[0]});
+        else if (member.multicast) {
+            if (cmd.opcode == OP_MULTICAST_ACTIVE && !member.active) {
+                member.active = true;
+                activated++;
+            }
+            member.multicast->OnServerCommand(cmd, NowMs());
+        }
+    }
+    member.in.erase(0, offset);
+    return notices;
+}
+
+// 阻塞等待连接收到包含 marker 的通知
+static void Await(Member &member, const std::string &marker) {
+    int activated = 0;
+    long delivered = 0;
+    char buf[4096];
+    while (ReadFrames(member, marker, activated, delivered) == 0) {
+        int r = (int) recv(member.sock, buf, sizeof(buf), 0);
+        if (r <= 0) return;
+        member.in.append(buf, r);
+    }
+}
+
+static Result Run(int port, bool multicast, int members, int messages, int burst, int payload) {
+    pid_t pid = StartServerProcess(port, [&]() {
+        counting = true;
+        ShardSet shards(1, PRESENCE_WINDOW_MS, "");
+        // 测量服务器本身的吞吐量，不启用速率限制和连接准入
+        shards.SetLimits(Limits::Unlimited());
+        if (multicast && !shards.EnableMulticast("127.0.0.1")) return;
+        if (!shards.Listen(port)) return;
+        shards.Start();
+        shards.Join();
+    });
+
+    long delivered = 0;
+    int activated = 0;
+    std::vector<Member> group(members);
+    for (int i = 0; i < members; i++) {
+        Member &member = group[i];
+        member.sock = ConnectTo(port);
+        if (member.sock == INVALID_SOCKET) {
+            std::cerr << "connect failed: " << strerror(errno) << std::endl;
+            exit(1);
+        }
+        member.received.assign(messages, 0);
+        SendFrame(member.sock, OP_HELLO, {});
+        SendFrame(member.sock, OP_REGISTER, {"u" + std::to_string(i)});
+        Await(member, "Registered.");
+        if (i == 0) {
+            SendFrame(member.sock, OP_CREATE_GROUP, {"g"});
+            Await(member, "Group created.");
+        } else {
+            SendFrame(member.sock, OP_JOIN_GROUP, {"g"});
+            Await(member, "Joined group.");
+        }
+        SetNonBlocking(member.sock);
+        if (!multicast) continue;
+        SOCKET sock = member.sock;
+        member.multicast = std::make_unique<MulticastReceiver>(
+                [&member, &delivered](const Command &cmd) { Count(member, cmd.fields[3], delivered); },
+                [sock](uint8_t opcode, std::initializer_list<std::string_view> fields) {
+                    SendFrame(sock, opcode, fields);
+                });
+        if (!member.multicast->Open("127.0.0.1")) {
+            std::cerr << "multicast receiver failed" << std::endl;
+            exit(1);
+        }
+        lossySocket[member.multicast->Socket()] = 1;
+        SendFrame(member.sock, OP_MULTICAST_SUBSCRIBE, {"g"});
+    }
+
+    int ep = epoll_create1(0);
+    for (int i = 0; i < members; i++) {
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.u64 = (uint64_t) i << 1;
+        epoll_ctl(ep, EPOLL_CTL_ADD, group[i].sock, &ev);
+        if (!multicast) continue;
+        ev.data.u64 = ((uint64_t) i << 1) | 1;
+        epoll_ctl(ep, EPOLL_CTL_ADD, group[i].multicast->Socket(), &ev);
+    }
+    std::vector<char> buf(65536);
+    epoll_event events[256];
+    int acks = 0;
+    uint64_t lastTick = 0;
+    auto poll = [&]() {
+        int k = epoll_wait(ep, events, 256, MULTICAST_NAK_DELAY_MS);
+        uint64_t now = NowMs();
+        for (int e = 0; e < k; e++) {
+            Member &member = group[events[e].data.u64 >> 1];
+            if (events[e].data.u64 & 1) {
+                member.multicast->ReadDatagrams(now);
+                continue;
+            }
+            while (true) {
+                int r = (int) recv(member.sock, buf.data(), buf.size(), 0);
+                if (r <= 0) break;
+                member.in.append(buf.data(), r);
+            }
+            acks += ReadFrames(member, "Group message sent.", activated, delivered);
+        }
+        if (multicast && now - lastTick >= MULTICAST_NAK_DELAY_MS) {
+            for (auto &member: group) member.multicast->OnTick(now);
+            lastTick = now;
+        }
+    };
+    // 成员收到第一个组播心跳后确认，服务器回复 MULTICAST_ACTIVE
+    auto waitStart = std::chrono::steady_clock::now();
+    while (multicast && activated < members &&
+           std::chrono::steady_clock::now() - waitStart < std::chrono::milliseconds(5 * MULTICAST_HEARTBEAT_MS)) {
+        poll();
+    }
+    if (multicast && activated < members) printf("only %d of %d members activated multicast\n", activated, members);
+
+    long sendBefore = counters->sendCalls.load();
+    long bytesBefore = counters->sendBytes.load();
+    double cpuBefore = ProcCpuMicros(pid);
+    auto start = std::chrono::steady_clock::now();
+    std::string body(payload, 'x');
+    long target = (long) messages * members;
+    int sent = 0;
+    auto deadline = start + std::chrono::seconds(60);
+    while (delivered < target && std::chrono::steady_clock::now() < deadline) {
+        if (acks == sent && sent < messages) {
+            for (int i = 0; i < burst && sent < messages; i++, sent++) {
+                SendFrame(group[0].sock, OP_GROUP_MESSAGE, {"g", std::to_string(sent) + ":" + body});
+            }
+        }
+        poll();
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    Result result;
+    result.deliveriesPerSec = (double) delivered / elapsed;
+    result.bytesPerMsg = (double) (counters->sendBytes.load() - bytesBefore) / messages;
+    result.sendsPerMsg = (double) (counters->sendCalls.load() - sendBefore) / messages;
+    result.cpuPerMsg = (ProcCpuMicros(pid) - cpuBefore) / messages;
+    for (auto &member: group) {
+        for (uint8_t count: member.received) {
+            if (count == 0) result.missing++;
+            else result.duplicates += count - 1;
+        }
+        if (!member.multicast) continue;
+        result.repaired += member.multicast->Repaired();
+        result.reordered += member.multicast->Reordered();
+        lossySocket[member.multicast->Socket()] = 0;
+    }
+    close(ep);
+    for (auto &member: group) closesocket(member.sock);
+    StopServerProcess(pid);
+    return result;
+}
+
+static void Print(const char *name, const Result &r) {
+    printf("%-10s deliveries/s=%.0f server_bytes/msg=%.0f sends/msg=%.1f server_cpu/msg=%.0f us "
+           "missing=%ld duplicates=%ld repaired=%llu reordered=%llu\n", name, r.deliveriesPerSec, r.bytesPerMsg,
+           r.sendsPerMsg, r.cpuPerMsg, r.missing, r.duplicates, (unsigned long long) r.repaired,
+           (unsigned long long) r.reordered);
+}
+
+int main(int argc, char **argv) {
+    int members = 200;
+    int messages = 2000;
+    int burst = 16;
+    int payload = 64;
+    int port = 22990;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string key = argv[i];
+        int value = std::stoi(argv[i + 1]);
+        if (key == "--members") members = value;
+        else if (key == "--messages") messages = value;
+        else if (key == "--burst") burst = value;
+        else if (key == "--payload") payload = value;
+        else if (key == "--loss") lossPercent = value;
+        else if (key == "--port") port = value;
+    }
+    counters = (Counters *) mmap(nullptr, sizeof(Counters), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    new(counters) Counters();
+    InitNetwork();
+    Logger::SetLevel(LOG_LEVEL_WARN);
+
+    printf("members=%d messages=%d burst=%d payload=%d loss=%d%%\n", members, messages, burst, payload, lossPercent);
+    Result tcp = Run(port, false, members, messages, burst, payload);
+    Print("tcp", tcp);
+    Result udp = Run(port + 1, true, members, messages, burst, payload);
+    Print("multicast", udp);
+    printf("dropped datagrams=%ld, server egress reduced %.1fx\n", dropped,
+           udp.bytesPerMsg > 0 ? tcp.bytesPerMsg / udp.bytesPerMsg : 0.0);
+    return 0;
+}
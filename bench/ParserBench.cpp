@@ -0,0 +1,128 @@
+/**
+ * 命令解析吞吐量测试（MB/s）：
+ *   strtok    旧实现，每条命令复制到缓冲区后用 strtok_s 切分
+ *   text      换行分隔的文本协议，DecodeText 直接返回 string_view
+ *   binary    连续缓冲区中的二进制帧，DecodeBinary
+ *   streaming 二进制帧按随机大小分片写入 RingBuffer 后解码，模拟TCP拆包和粘包
+ * 用法: ParserBench [--size 消息长度] [--mb 每轮数据量]
+ */
+#include "Platform.h"
+#include "Protocol.h"
+#include "RingBuffer.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+static volatile size_t sink;
+
+template<typename F>
+static void Measure(const char *name, size_t bytes, size_t commands, F &&fn) {
+    // 先预热一轮，再取多轮中的最好成绩
+    fn();
+    double best = 1e9;
+    for (int round = 0; round < 5; round++) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    printf("%-10s %8.0f MB/s %10.2f M cmd/s\n", name, bytes / best / 1e6, commands / best / 1e6);
+}
+
+int main(int argc, char **argv) {
+    size_t bodySize = 64;
+    size_t totalMb = 64;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string key = argv[i];
+        if (key == "--size") bodySize = std::stoul(argv[i + 1]);
+        else if (key == "--mb") totalMb = std::stoul(argv[i + 1]);
+    }
+    std::string body(bodySize, 'x');
+    std::string textCmd = "MESSAGE user12345 " + body;
+    std::string_view fields[2] = {"user12345", body};
+    std::string binaryFrame;
+    AppendBinaryFrame(binaryFrame, OP_MESSAGE, fields, 2);
+
+    size_t count = totalMb * 1000000 / binaryFrame.size();
+    std::string textStream, binaryStream;
+    for (size_t i = 0; i < count; i++) {
+        textStream += textCmd;
+        textStream += '\n';
+        binaryStream += binaryFrame;
+    }
+    printf("body=%zu B commands=%zu\n", bodySize, count);
+
+    Measure("strtok", textStream.size(), count, [&]() {
+        char buf[4096];
+        size_t total = 0;
+        for (size_t i = 0; i < count; i++) {
+            memcpy(buf, textCmd.data(), textCmd.size());
+            buf[textCmd.size()] = '\0';
+            char *context = nullptr;
+            char *token = strtok_s(buf, " ", &context);
+            token = strtok_s(nullptr, " ", &context);
+            std::string target(token);
+            std::string message(context);
+            total += target.size() + message.size();
+        }
+        sink = total;
+    });
+
+    Measure("text", textStream.size(), count, [&]() {
+        size_t pos = 0, total = 0, size = 0;
+        Command cmd;
+        while (pos < textStream.size()) {
+            DecodeText(textStream.data() + pos, textStream.size() - pos, true, cmd, size);
+            total += cmd.fields[0].size() + cmd.fields[1].size();
+            pos += size;
+        }
+        sink = total;
+    });
+
+    Measure("binary", binaryStream.size(), count, [&]() {
+        size_t pos = 0, total = 0, size = 0;
+        Command cmd;
+        while (pos < binaryStream.size()) {
+            DecodeBinary(binaryStream.data() + pos, binaryStream.size() - pos, cmd, size);
+            total += cmd.fields[0].size() + cmd.fields[1].size();
+            pos += size;
+        }
+        sink = total;
+    });
+
+    // 预先生成随机分片大小，模拟每次 recv 读到的字节数
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<size_t> chunkDist(1, 4096);
+    std::vector<size_t> chunks;
+    for (size_t covered = 0; covered < binaryStream.size();) {
+        chunks.push_back(chunkDist(rng));
+        covered += chunks.back();
+    }
+    Measure("streaming", binaryStream.size(), count, [&]() {
+        RingBuffer in(4096);
+        size_t pos = 0, total = 0, decoded = 0;
+        for (size_t c = 0; pos < binaryStream.size(); c++) {
+            in.PrepareWrite();
+            size_t n = std::min({chunks[c % chunks.size()], in.Writable(), binaryStream.size() - pos});
+            memcpy(in.WritePtr(), binaryStream.data() + pos, n);
+            in.Commit(n);
+            pos += n;
+            Command cmd;
+            size_t size = 0;
+            while (in.Readable() > 0) {
+                if (DecodeBinary(in.ReadPtr(), in.Readable(), cmd, size) != DecodeResult::Ok) {
+                    in.Reserve(size);
+                    break;
+                }
+                total += cmd.fields[0].size() + cmd.fields[1].size();
+                decoded++;
+                in.Consume(size);
+            }
+        }
+        sink = total + decoded;
+    });
+    return 0;
+}
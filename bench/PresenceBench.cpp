@@ -0,0 +1,86 @@
+/**
+ * 登录风暴测试：users 个连接先全部建立，然后同时注册，统计所有客户端为此收到的字节数、
+ * 最后一个字节到达所需的时间和服务器CPU时间，衡量在线状态通知的开销。
+ * 用法: PresenceBench [--users N] [--shards N] [--port N]
+ */
+#include "BenchUtil.h"
+#include "Shard.h"
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+int main(int argc, char **argv) {
+    int users = 2000;
+    int shardCount = 1;
+    int port = 22990;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string key = argv[i];
+        int value = std::stoi(argv[i + 1]);
+        if (key == "--users") users = value;
+        else if (key == "--shards") shardCount = value;
+        else if (key == "--port") port = value;
+    }
+    InitNetwork();
+
+    pid_t pid = StartServerProcess(port, [&]() {
+        ShardSet shards(shardCount);
+        // 测量服务器本身的吞吐量，不启用速率限制和连接准入
+        shards.SetLimits(Limits::Unlimited());
+        if (!shards.Listen(port)) return;
+        shards.Start();
+        shards.Join();
+    });
+
+    std::vector<SOCKET> sockets;
+    int ep = epoll_create1(0);
+    for (int i = 0; i < users; i++) {
+        SOCKET s = ConnectTo(port);
+        if (s == INVALID_SOCKET) {
+            std::cerr << "connect failed: " << strerror(errno) << std::endl;
+            return 1;
+        }
+        SetNonBlocking(s);
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        epoll_ctl(ep, EPOLL_CTL_ADD, s, &ev);
+        sockets.push_back(s);
+    }
+
+    double cpuBefore = ProcCpuMicros(pid);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < users; i++) {
+        std::string reg = "REGISTER SERVER u" + std::to_string(i) + "\n";
+        send(sockets[i], reg.data(), reg.size(), 0);
+    }
+
+    // 一直读到所有连接安静 500 毫秒为止
+    long long received = 0;
+    auto lastByte = start;
+    std::vector<char> buf(65536);
+    epoll_event events[256];
+    while (true) {
+        int k = epoll_wait(ep, events, 256, 500);
+        if (k <= 0) break;
+        for (int e = 0; e < k; e++) {
+            SOCKET s = sockets[events[e].data.u32];
+            while (true) {
+                int r = (int) recv(s, buf.data(), buf.size(), 0);
+                if (r <= 0) break;
+                received += r;
+                lastByte = std::chrono::steady_clock::now();
+            }
+        }
+    }
+    double settle = std::chrono::duration<double>(lastByte - start).count();
+    double cpu = ProcCpuMicros(pid) - cpuBefore;
+
+    printf("users=%d shards=%d\n", users, shardCount);
+    printf("bytes=%lld bytes/login=%.0f settle=%.3f s server_cpu=%.0f ms\n", received,
+           (double) received / users, settle, cpu / 1000);
+    close(ep);
+    for (auto s: sockets) closesocket(s);
+    StopServerProcess(pid);
+    return 0;
+}
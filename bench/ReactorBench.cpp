@@ -0,0 +1,172 @@
+/**
+ * 事件循环与每连接一个线程模型的对比测试。
+ * 子进程运行服务器，父进程建立大量空闲连接后测量服务器每个连接的内存占用，
+ * 再让少量活跃客户端以闭环方式互发 MESSAGE，统计每秒送达的消息数。
+ * 用法: ReactorBench [--mode reactor|threaded|both] [--connections N] [--active N]
+ *                    [--seconds N] [--payload N] [--port N]
+ */
+#include "BenchUtil.h"
+#include "Shard.h"
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct Options {
+    std::string mode = "both";
+    int connections = 10000;
+    int active = 100;
+    int seconds = 5;
+    int payload = 64;
+    int port = 19990;
+};
+
+// ---------------- 对照组：每连接一个线程、全局互斥锁的旧模型 ----------------
+
+std::mutex threadedMutex;
+std::vector<SOCKET> threadedClients;
+std::unordered_map<std::string, SOCKET> threadedUsers;
+
+static void ThreadedSend(SOCKET s, const std::string &data) {
+    send(s, data.data(), data.size(), 0);
+}
+
+static void ThreadedProcessClient(SOCKET s) {
+    char buf[BUF_SIZE];
+    std::string username;
+    {
+        std::lock_guard<std::mutex> lock(threadedMutex);
+        threadedClients.push_back(s);
+        std::cout << "Total connections: " << threadedClients.size() << std::endl;
+    }
+    while (true) {
+        int n = (int) recv(s, buf, BUF_SIZE - 1, 0);
+        if (n <= 0) break;
+        buf[n] = '\0';
+        std::cout << "Received: " << buf << std::endl;
+        char *context = nullptr;
+        char *token = strtok_s(buf, " ", &context);
+        if (token == nullptr) continue;
+        if (strcmp(token, "REGISTER") == 0) {
+            strtok_s(nullptr, " ", &context);
+            token = strtok_s(nullptr, " ", &context);
+            if (token == nullptr) continue;
+            username = token;
+            std::lock_guard<std::mutex> lock(threadedMutex);
+            threadedUsers[username] = s;
+            ThreadedSend(s, "Server: Registered.");
+            std::string userList = "Server: Online users: ";
+            for (const auto &pair: threadedUsers) userList += pair.first + " ";
+            for (auto client: threadedClients) ThreadedSend(client, userList);
+        } else if (strcmp(token, "MESSAGE") == 0) {
+            token = strtok_s(nullptr, " ", &context);
+            if (token == nullptr || context == nullptr) continue;
+            std::lock_guard<std::mutex> lock(threadedMutex);
+            auto it = threadedUsers.find(token);
+            if (it != threadedUsers.end()) {
+                ThreadedSend(it->second, username + ": " + context);
+                ThreadedSend(s, "Server: Message sent.");
+            } else {
+                ThreadedSend(s, "Server: User not found.");
+            }
+        }
+    }
+    std::lock_guard<std::mutex> lock(threadedMutex);
+    threadedClients.erase(std::find(threadedClients.begin(), threadedClients.end(), s));
+    closesocket(s);
+}
+
+static void RunThreadedServer(int port) {
+    SOCKET sServer = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    int reuse = 1;
+    setsockopt(sServer, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = INADDR_ANY;
+    if (bind(sServer, (sockaddr *) &addr, sizeof(addr)) == SOCKET_ERROR || listen(sServer, SOMAXCONN) == SOCKET_ERROR) {
+        std::cerr << "threaded server bind/listen failed" << std::endl;
+        return;
+    }
+    while (true) {
+        SOCKET s = accept(sServer, nullptr, nullptr);
+        if (s == INVALID_SOCKET) continue;
+        std::thread(ThreadedProcessClient, s).detach();
+    }
+}
+
+static void RunReactorServer(int port) {
+    ShardSet shards(1);
+    // 测量服务器本身的吞吐量，不启用速率限制和连接准入
+    shards.SetLimits(Limits::Unlimited());
+    if (!shards.Listen(port)) return;
+    shards.Start();
+    shards.Join();
+}
+
+// ---------------- 客户端驱动 ----------------
+
+static void RunClients(const Options &opt, const std::string &mode, pid_t server) {
+    ProcMemory before = ReadProcMemory(server);
+
+    std::vector<SOCKET> sockets;
+    sockets.reserve(opt.connections);
+    for (int i = 0; i < opt.connections; i++) {
+        SOCKET s = ConnectTo(opt.port);
+        if (s == INVALID_SOCKET) {
+            std::cerr << "connect failed at " << i << ": " << strerror(errno) << std::endl;
+            break;
+        }
+        sockets.push_back(s);
+    }
+    // 等待服务器处理完所有连接
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    ProcMemory idle = ReadProcMemory(server);
+    size_t n = sockets.size();
+    double rssPerConn = n ? (double) (idle.rssKb - before.rssKb) * 1024 / n : 0;
+    double vmPerConn = n ? (double) (idle.vmKb - before.vmKb) * 1024 / n : 0;
+
+    // 前 active 个连接注册用户，两两配对互发消息
+    int active = std::min<int>(opt.active, (int) n) & ~1;
+    RegisterUsers(sockets, active);
+    double throughput = ClosedLoopThroughput(sockets, active, opt.payload, opt.seconds);
+
+    printf("%-9s connections=%zu threads=%ld rss/conn=%.0f B vsz/conn=%.0f B active=%d throughput=%.0f msg/s\n",
+           mode.c_str(), n, idle.threads, rssPerConn, vmPerConn, active, throughput);
+    fflush(stdout);
+
+    for (auto s: sockets) closesocket(s);
+}
+
+static void RunMode(const Options &opt, const std::string &mode) {
+    pid_t pid = StartServerProcess(opt.port, [&]() {
+        if (mode == "threaded") RunThreadedServer(opt.port);
+        else RunReactorServer(opt.port);
+    });
+    RunClients(opt, mode, pid);
+    StopServerProcess(pid);
+}
+
+int main(int argc, char **argv) {
+    Options opt;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string key = argv[i];
+        std::string value = argv[i + 1];
+        if (key == "--mode") opt.mode = value;
+        else if (key == "--connections") opt.connections = std::stoi(value);
+        else if (key == "--active") opt.active = std::stoi(value);
+        else if (key == "--seconds") opt.seconds = std::stoi(value);
+        else if (key == "--payload") opt.payload = std::stoi(value);
+        else if (key == "--port") opt.port = std::stoi(value);
+    }
+    InitNetwork();
+    if (opt.mode == "both" || opt.mode == "threaded") RunMode(opt, "threaded");
+    if (opt.mode == "both" || opt.mode == "reactor") {
+        opt.port++;
+        RunMode(opt, "reactor");
+    }
+    return 0;
+}
@@ -0,0 +1,143 @@
+/**
+ * 用户目录并发测试：多个线程按比例混合执行用户查找（消息路由路径）和注册/移除，
+ * 对比旧服务器的单互斥锁目录、读写锁目录和当前的无等待读目录的总吞吐量。
+ * 用法: RegistryBench [--threads 1,4,16,32] [--users N] [--writes 百分比] [--seconds N]
+ */
+#include "Registry.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// 旧服务器的设计：所有表共用一个互斥锁
+class MutexDirectory {
+public:
+    void AddUser(const std::string &username, ClientHandle handle) {
+        std::lock_guard<std::mutex> lock(mutex);
+        users[username] = handle;
+    }
+
+    void RemoveUser(const std::string &username, ClientHandle) {
+        std::lock_guard<std::mutex> lock(mutex);
+        users.erase(username);
+    }
+
+    bool FindUser(const std::string &username, ClientHandle &handle) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = users.find(username);
+        if (it == users.end()) return false;
+        handle = it->second;
+        return true;
+    }
+
+private:
+    std::mutex mutex;
+    std::unordered_map<std::string, ClientHandle> users;
+};
+
+// 上一版目录：读写锁
+class SharedMutexDirectory {
+public:
+    void AddUser(const std::string &username, ClientHandle handle) {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        users[username] = handle;
+    }
+
+    void RemoveUser(const std::string &username, ClientHandle) {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        users.erase(username);
+    }
+
+    bool FindUser(const std::string &username, ClientHandle &handle) {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        auto it = users.find(username);
+        if (it == users.end()) return false;
+        handle = it->second;
+        return true;
+    }
+
+private:
+    std::shared_mutex mutex;
+    std::unordered_map<std::string, ClientHandle> users;
+};
+
+/**
+ * 运行一轮测试
+ * @return 每秒完成的操作数
+ */
+template<typename Directory>
+static double Run(Directory &directory, const std::vector<std::string> &names, int threads, int writePercent,
+                  int seconds) {
+    for (size_t i = 0; i < names.size(); i++) directory.AddUser(names[i], ClientHandle{0, i});
+    std::atomic<bool> stop{false};
+    std::atomic<long> total{0};
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            std::mt19937 rng(t + 1);
+            long ops = 0;
+            ClientHandle handle;
+            while (!stop.load(std::memory_order_relaxed)) {
+                for (int k = 0; k < 64; k++) {
+                    const std::string &name = names[rng() % names.size()];
+                    if ((int) (rng() % 100) < writePercent) {
+                        // 模拟重新登录：移除后立即以新的句柄注册
+                        directory.RemoveUser(name, handle);
+                        directory.AddUser(name, ClientHandle{t, (uint64_t) ops});
+                    } else {
+                        directory.FindUser(name, handle);
+                    }
+                    ops++;
+                }
+            }
+            total += ops;
+        });
+    }
+    auto start = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    stop = true;
+    for (auto &w: workers) w.join();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return total.load() / elapsed;
+}
+
+int main(int argc, char **argv) {
+    std::vector<int> threadCounts{1, 4, 16, 32};
+    int users = 10000;
+    int writePercent = 1;
+    int seconds = 2;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string key = argv[i];
+        std::string value = argv[i + 1];
+        if (key == "--threads") {
+            threadCounts.clear();
+            std::stringstream ss(value);
+            std::string item;
+            while (std::getline(ss, item, ',')) threadCounts.push_back(std::stoi(item));
+        } else if (key == "--users") users = std::stoi(value);
+        else if (key == "--writes") writePercent = std::stoi(value);
+        else if (key == "--seconds") seconds = std::stoi(value);
+    }
+    std::vector<std::string> names;
+    for (int i = 0; i < users; i++) names.push_back("user" + std::to_string(i));
+
+    printf("users=%d writes=%d%% hardware_threads=%u\n", users, writePercent, std::thread::hardware_concurrency());
+    printf("%8s %16s %16s %16s\n", "threads", "mutex ops/s", "rwlock ops/s", "registry ops/s");
+    for (int threads: threadCounts) {
+        MutexDirectory mutexDirectory;
+        SharedMutexDirectory sharedDirectory;
+        Registry registry;
+        double a = Run(mutexDirectory, names, threads, writePercent, seconds);
+        double b = Run(sharedDirectory, names, threads, writePercent, seconds);
+        double c = Run(registry, names, threads, writePercent, seconds);
+        printf("%8d %16.0f %16.0f %16.0f\n", threads, a, b, c);
+    }
+    return 0;
+}
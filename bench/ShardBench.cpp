@@ -0,0 +1,63 @@
+/**
+ * 分片扩展性测试：分别以 1、2、4、8 个分片启动服务器，
+ * 活跃客户端两两配对闭环互发 MESSAGE（配对双方大多落在不同分片上），统计每秒送达的消息数。
+ * 用法: ShardBench [--shards 1,2,4,8] [--active N] [--seconds N] [--payload N] [--port N]
+ */
+#include "BenchUtil.h"
+#include "Shard.h"
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+int main(int argc, char **argv) {
+    std::vector<int> shardCounts{1, 2, 4, 8};
+    int active = 400;
+    int seconds = 5;
+    int payload = 64;
+    int port = 20990;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string key = argv[i];
+        std::string value = argv[i + 1];
+        if (key == "--shards") {
+            shardCounts.clear();
+            std::stringstream ss(value);
+            std::string item;
+            while (std::getline(ss, item, ',')) shardCounts.push_back(std::stoi(item));
+        } else if (key == "--active") active = std::stoi(value);
+        else if (key == "--seconds") seconds = std::stoi(value);
+        else if (key == "--payload") payload = std::stoi(value);
+        else if (key == "--port") port = std::stoi(value);
+    }
+    InitNetwork();
+    active &= ~1;
+    printf("cpus=%u active=%d payload=%d\n", std::thread::hardware_concurrency(), active, payload);
+    for (int count: shardCounts) {
+        pid_t pid = StartServerProcess(port, [&]() {
+            ShardSet shards(count);
+            // 测量服务器本身的吞吐量，不启用速率限制和连接准入
+            shards.SetLimits(Limits::Unlimited());
+            if (!shards.Listen(port)) return;
+            shards.Start();
+            shards.Join();
+        });
+        std::vector<SOCKET> sockets;
+        for (int i = 0; i < active; i++) {
+            SOCKET s = ConnectTo(port);
+            if (s == INVALID_SOCKET) {
+                std::cerr << "connect failed: " << strerror(errno) << std::endl;
+                break;
+            }
+            sockets.push_back(s);
+        }
+        RegisterUsers(sockets, (int) sockets.size());
+        double throughput = ClosedLoopThroughput(sockets, (int) sockets.size() & ~1, payload, seconds);
+        printf("shards=%d throughput=%.0f msg/s\n", count, throughput);
+        fflush(stdout);
+        for (auto s: sockets) closesocket(s);
+        StopServerProcess(pid);
+        port++;
+    }
+    return 0;
+}
@@ -0,0 +1,111 @@
+/**
+ * 慢消费者测试：一个客户端持续向一个从不读取的客户端发送私聊消息，同时另一对客户端闭环互发消息。
+ * 统计服务器内存峰值、发送者在背压下被内核接受的数据量、慢消费者是否被断开以及正常客户端的吞吐量。
+ * 用法: SlowConsumerBench [--seconds N] [--payload N] [--port N]
+ */
+#include "BenchUtil.h"
+#include "Shard.h"
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+int main(int argc, char **argv) {
+    int seconds = 15;
+    int payload = 1024;
+    int port = 23990;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string key = argv[i];
+        int value = std::stoi(argv[i + 1]);
+        if (key == "--seconds") seconds = value;
+        else if (key == "--payload") payload = value;
+        else if (key == "--port") port = value;
+    }
+    InitNetwork();
+
+    pid_t pid = StartServerProcess(port, [&]() {
+        ShardSet shards(1);
+        // 测量服务器本身的吞吐量，不启用速率限制和连接准入
+        shards.SetLimits(Limits::Unlimited());
+        if (!shards.Listen(port)) return;
+        shards.Start();
+        shards.Join();
+    });
+    long baseRss = ReadProcMemory(pid).rssKb;
+
+    // u0 和 u1 为正常客户端，u2 为慢消费者，u3 为发送者
+    std::vector<SOCKET> sockets;
+    for (int i = 0; i < 4; i++) {
+        SOCKET s = ConnectTo(port);
+        if (s == INVALID_SOCKET) {
+            std::cerr << "connect failed: " << strerror(errno) << std::endl;
+            return 1;
+        }
+        sockets.push_back(s);
+    }
+    int rcvBuf = 4096;
+    setsockopt(sockets[2], SOL_SOCKET, SO_RCVBUF, &rcvBuf, sizeof(rcvBuf));
+    RegisterUsers(sockets, 4);
+
+    std::atomic<bool> stop{false};
+    double healthy = 0;
+    std::thread pair([&]() { healthy = ClosedLoopThroughput(sockets, 2, 64, seconds); });
+
+    // 发送者尽量快地发送，同时丢弃自己收到的回复
+    long long accepted = 0;
+    std::thread flooder([&]() {
+        SOCKET s = sockets[3];
+        SetNonBlocking(s);
+        std::string msg = "MESSAGE u2 " + std::string(payload, 'x') + "\n";
+        std::string batch;
+        for (int i = 0; i < 64; i++) batch += msg;
+        size_t offset = 0;
+        std::vector<char> buf(65536);
+        while (!stop) {
+            int n = (int) send(s, batch.data() + offset, batch.size() - offset, 0);
+            if (n > 0) {
+                accepted += n;
+                offset = (offset + n) % batch.size();
+            } else {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            while (recv(s, buf.data(), buf.size(), 0) > 0) {}
+        }
+    });
+
+    long peakRss = 0;
+    for (int i = 0; i < seconds * 10; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        peakRss = std::max(peakRss, ReadProcMemory(pid).rssKb);
+    }
+    stop = true;
+    pair.join();
+    flooder.join();
+
+    // 慢消费者被断开后其用户名下线，向它发送私聊会收到用户不存在
+    SetNonBlocking(sockets[0]);
+    std::vector<char> buf(65536);
+    while (recv(sockets[0], buf.data(), buf.size(), 0) > 0) {}
+    timeval timeout{2, 0};
+    setsockopt(sockets[0], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    int flags = fcntl(sockets[0], F_GETFL, 0);
+    fcntl(sockets[0], F_SETFL, flags & ~O_NONBLOCK);
+    std::string probe = "MESSAGE u2 ping\n";
+    send(sockets[0], probe.data(), probe.size(), 0);
+    std::string reply;
+    while (reply.find("User not found.") == std::string::npos && reply.find("Message sent.") == std::string::npos) {
+        int r = (int) recv(sockets[0], buf.data(), buf.size(), 0);
+        if (r <= 0) break;
+        reply.append(buf.data(), r);
+    }
+    bool evicted = reply.find("User not found.") != std::string::npos;
+
+    printf("seconds=%d payload=%d\n", seconds, payload);
+    printf("healthy_pair_msg/s=%.0f server_rss_growth=%ld KB flood_accepted=%.1f MB slow_consumer_evicted=%s\n",
+           healthy, peakRss - baseRss, accepted / 1048576.0, evicted ? "yes" : "no");
+    for (auto s: sockets) closesocket(s);
+    StopServerProcess(pid);
+    return 0;
+}
@@ -0,0 +1,176 @@
+/**
+ * 定时任务的组件级测试：在已有 N 个定时任务（到期时间均匀分布在一个心跳周期内）的情况下，
+ * 比较时间轮与原来的二叉堆（std::priority_queue，不支持取消）和可取消的有序树（std::multimap）：
+ *   add     加入 N 个定时任务
+ *   cancel  按随机顺序取消全部定时任务（二叉堆不支持）
+ *   rearm   取消一个定时任务并推迟一个周期重新加入，即每个连接推迟一次心跳检查
+ *   expire  推进时钟直到全部到期，按每个到期任务计
+ *   tick    N 个定时任务都未到期时，事件循环每轮计算等待时间并推进 1 毫秒的开销
+ * 输出每次操作的纳秒数。用法: TimerBench [--timers N,N,...] [--span 毫秒]
+ */
+#include "TimerWheel.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <queue>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+static size_t fired;
+
+static double Nanoseconds(Clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+}
+
+static void Report(const char *impl, const char *op, size_t timers, double ns, size_t count) {
+    printf("%-8s %-8s timers=%-8zu %10.1f ns/op\n", impl, op, timers, ns / (double) count);
+}
+
+// 原来的事件循环定时任务：按到期时间和加入顺序排序的二叉堆
+struct HeapTimer {
+    uint64_t deadline;
+    uint64_t seq;
+    std::function<void()> task;
+
+    bool operator>(const HeapTimer &other) const {
+        return deadline != other.deadline ? deadline > other.deadline : seq > other.seq;
+    }
+};
+
+static void BenchWheel(const std::vector<uint64_t> &delays, uint64_t span) {
+    size_t n = delays.size();
+    uint64_t now = 1000;
+    TimerWheel wheel(now);
+    std::vector<TimerId> ids(n);
+    auto task = []() { fired++; };
+
+    auto start = Clock::now();
+    for (size_t i = 0; i < n; i++) ids[i] = wheel.Add(now + delays[i], task);
+    Report("wheel", "add", n, Nanoseconds(start), n);
+
+    std::mt19937 rng(7);
+    std::vector<size_t> order(n);
+    for (size_t i = 0; i < n; i++) order[i] = i;
+    std::shuffle(order.begin(), order.end(), rng);
+    start = Clock::now();
+    for (size_t i: order) wheel.Cancel(ids[i]);
+    Report("wheel", "cancel", n, Nanoseconds(start), n);
+
+    for (size_t i = 0; i < n; i++) ids[i] = wheel.Add(now + delays[i], task);
+    start = Clock::now();
+    for (size_t i: order) {
+        wheel.Cancel(ids[i]);
+        ids[i] = wheel.Add(now + span + delays[i], task);
+    }
+    Report("wheel", "rearm", n, Nanoseconds(start), n);
+
+    // 推迟后的定时任务都在一个周期之后到期
+    start = Clock::now();
+    for (int i = 0; i < 1000; i++) {
+        if (wheel.NextTimeout(now) != 0) now++;
+        wheel.Advance(now);
+    }
+    Report("wheel", "tick", n, Nanoseconds(start), 1000);
+
+    fired = 0;
+    size_t pending = wheel.Size();
+    start = Clock::now();
+    while (wheel.Size() > 0) {
+        int timeout = wheel.NextTimeout(now);
+        now += timeout > 0 ? (uint64_t) timeout : 1;
+        wheel.Advance(now);
+    }
+    Report("wheel", "expire", n, Nanoseconds(start), pending);
+    if (fired != pending) fprintf(stderr, "wheel fired %zu of %zu timers\n", fired, pending);
+}
+
+static void BenchHeap(const std::vector<uint64_t> &delays) {
+    size_t n = delays.size();
+    uint64_t now = 1000, seq = 0;
+    std::priority_queue<HeapTimer, std::vector<HeapTimer>, std::greater<>> heap;
+    auto task = []() { fired++; };
+
+    auto start = Clock::now();
+    for (size_t i = 0; i < n; i++) heap.push(HeapTimer{now + delays[i], seq++, task});
+    Report("heap", "add", n, Nanoseconds(start), n);
+
+    fired = 0;
+    start = Clock::now();
+    while (!heap.empty()) {
+        now = heap.top().deadline;
+        while (!heap.empty() && heap.top().deadline <= now) {
+            std::function<void()> t = std::move(const_cast<HeapTimer &>(heap.top()).task);
+            heap.pop();
+            t();
+        }
+    }
+    Report("heap", "expire", n, Nanoseconds(start), n);
+}
+
+static void BenchTree(const std::vector<uint64_t> &delays, uint64_t span) {
+    size_t n = delays.size();
+    uint64_t now = 1000;
+    using Tree = std::multimap<uint64_t, std::function<void()>>;
+    Tree tree;
+    std::vector<Tree::iterator> ids(n);
+    auto task = []() { fired++; };
+
+    auto start = Clock::now();
+    for (size_t i = 0; i < n; i++) ids[i] = tree.emplace(now + delays[i], task);
+    Report("tree", "add", n, Nanoseconds(start), n);
+
+    std::mt19937 rng(7);
+    std::vector<size_t> order(n);
+    for (size_t i = 0; i < n; i++) order[i] = i;
+    std::shuffle(order.begin(), order.end(), rng);
+    start = Clock::now();
+    for (size_t i: order) tree.erase(ids[i]);
+    Report("tree", "cancel", n, Nanoseconds(start), n);
+
+    for (size_t i = 0; i < n; i++) ids[i] = tree.emplace(now + delays[i], task);
+    start = Clock::now();
+    for (size_t i: order) {
+        tree.erase(ids[i]);
+        ids[i] = tree.emplace(now + span + delays[i], task);
+    }
+    Report("tree", "rearm", n, Nanoseconds(start), n);
+
+    fired = 0;
+    start = Clock::now();
+    while (!tree.empty()) {
+        auto it = tree.begin();
+        std::function<void()> t = std::move(it->second);
+        tree.erase(it);
+        t();
+    }
+    Report("tree", "expire", n, Nanoseconds(start), n);
+}
+
+int main(int argc, char **argv) {
+    std::string timerList = "100000,1000000";
+    uint64_t span = 30000;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string key = argv[i];
+        if (key == "--timers") timerList = argv[i + 1];
+        else if (key == "--span") span = std::stoull(argv[i + 1]);
+    }
+    std::stringstream list(timerList);
+    std::string item;
+    while (std::getline(list, item, ',')) {
+        size_t n = std::stoul(item);
+        std::mt19937_64 rng(n);
+        std::vector<uint64_t> delays(n);
+        for (auto &delay: delays) delay = 1 + rng() % span;
+        BenchWheel(delays, span);
+        BenchHeap(delays);
+        BenchTree(delays, span);
+        printf("\n");
+    }
+    return 0;
+}
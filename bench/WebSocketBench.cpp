@@ -0,0 +1,244 @@
+/**
+ * WebSocket 网关测试：服务器在子进程中同时监听 TCP 端口和 WebSocket 端口，
+ * 分别用 TCP 文本客户端和 WebSocket 客户端（带掩码的文本帧，每帧一条命令）做同样的测试：
+ * 1. 逐条发送私聊消息，测量从发送到接收者收到的延迟；
+ * 2. 一个群组有 members 个成员，发送者每次连续发送 burst 条群组消息，统计投递吞吐量和每条消息的服务器CPU时间。
+ * 最后让一个 WebSocket 客户端加入 TCP 客户端的群组，检查两种客户端共用同一条扇出路径。
+ * 用法: WebSocketBench [--members N] [--samples N] [--messages N] [--burst N] [--payload N] [--port N]
+ */
+#include "BenchUtil.h"
+#include "Shard.h"
+#include "WebSocket.h"
+#include <fcntl.h>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 测试连接：TCP 文本客户端或已完成升级的 WebSocket 客户端
+struct BenchConn {
+    SOCKET s{INVALID_SOCKET};
+    bool webSocket{};
+};
+
+// 把一条命令编码为客户端帧追加到 out，WebSocket 客户端帧必须带掩码
+static void AppendCommand(std::string &out, const BenchConn &conn, const std::string &line) {
+    if (!conn.webSocket) {
+        out += line;
+        out += '\n';
+        return;
+    }
+    static const uint8_t mask[4] = {0x37, 0xfa, 0x21, 0x3d};
+    size_t offset = out.size();
+    out.resize(offset + WebSocketHeaderSize(line.size()));
+    WriteWebSocketHeader(&out[offset], WS_TEXT, line.size());
+    out[offset + 1] = (char) (out[offset + 1] | 0x80);
+    out.append((const char *) mask, 4);
+    for (size_t i = 0; i < line.size(); i++) out += (char) (line[i] ^ mask[i & 3]);
+}
+
+static void SendCommand(const BenchConn &conn, const std::string &line) {
+    std::string frame;
+    AppendCommand(frame, conn, line);
+    send(conn.s, frame.data(), frame.size(), 0);
+}
+
+// 等待数据流中出现 marker，服务器发往 WebSocket 客户端的帧不带掩码，内容可以直接匹配
+static bool WaitMarker(const BenchConn &conn, const std::string &marker) {
+    std::string tail;
+    char buf[4096];
+    while (true) {
+        int r = (int) recv(conn.s, buf, sizeof(buf), 0);
+        if (r <= 0) return false;
+        if (CountMarker(tail, buf, r, marker) > 0) return true;
+    }
+}
+
+static BenchConn Connect(int port, bool webSocket) {
+    BenchConn conn{ConnectTo(port), webSocket};
+    if (conn.s == INVALID_SOCKET || !webSocket) return conn;
+    std::string request = "GET /chat HTTP/1.1\r\nHost: 127.0.0.1\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                          "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n";
+    send(conn.s, request.data(), request.size(), 0);
+    // 响应之后服务器在收到命令之前不会发送其它数据
+    std::string response;
+    char c;
+    while (response.find("\r\n\r\n") == std::string::npos && recv(conn.s, &c, 1, 0) == 1) response += c;
+    if (response.find("s3pPLMBiTxaQ9kYGzzhZRbK+xOo=") == std::string::npos) {
+        closesocket(conn.s);
+        conn.s = INVALID_SOCKET;
+    }
+    return conn;
+}
+
+struct ModeResult {
+    double p50{};
+    double p99{};
+    double deliveriesPerSecond{};
+    double cpuPerMessage{};
+};
+
+static double Percentile(std::vector<double> values, double p) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, (size_t) (p * (double) values.size()))];
+}
+
+/**
+ * 用一种传输方式建立 members 个连接并完成延迟和群组吞吐量测试
+ * @param prefix 用户名和群组名的前缀，两种传输方式使用不同的用户和群组
+ */
+static bool RunMode(pid_t pid, int port, bool webSocket, const std::string &prefix, int members, int samples,
+                    int messages, int burst, int payload, ModeResult &result, std::vector<BenchConn> &conns) {
+    std::string group = prefix + "g";
+    for (int i = 0; i < members; i++) {
+        BenchConn conn = Connect(port, webSocket);
+        if (conn.s == INVALID_SOCKET) {
+            std::cerr << "connect failed: " << strerror(errno) << std::endl;
+            return false;
+        }
+        conns.push_back(conn);
+        SendCommand(conn, "REGISTER SERVER " + prefix + std::to_string(i));
+        WaitMarker(conn, "Registered.");
+        if (i == 0) SendCommand(conn, "CREATE_GROUP " + group);
+        else SendCommand(conn, "JOIN_GROUP JOIN " + group);
+        WaitMarker(conn, i == 0 ? "Group created." : "Joined group.");
+    }
+
+    // 1. 私聊延迟：成员 0 发给成员 1，等待成员 1 收到后再发下一条
+    std::vector<double> latency;
+    std::string direct = "MESSAGE " + prefix + "1 " + std::string(payload, 'x');
+    std::string directMarker = prefix + "0: ";
+    for (int i = 0; i < samples; i++) {
+        auto start = std::chrono::steady_clock::now();
+        SendCommand(conns[0], direct);
+        if (!WaitMarker(conns[1], directMarker)) return false;
+        latency.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+    }
+    // 清除发送者收到的私聊确认
+    SetNonBlocking(conns[0].s);
+    std::vector<char> buf(65536);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    while (recv(conns[0].s, buf.data(), buf.size(), 0) > 0) {}
+    result.p50 = Percentile(latency, 0.5);
+    result.p99 = Percentile(latency, 0.99);
+
+    // 2. 群组吞吐量：接收线程统计除发送者以外所有成员收到的群组消息
+    std::atomic<long> delivered{0};
+    std::string groupMarker = "(" + group + ") ";
+    std::thread reader([&]() {
+        int ep = epoll_create1(0);
+        for (int i = 1; i < members; i++) {
+            SetNonBlocking(conns[i].s);
+            epoll_event ev{};
+            ev.events = EPOLLIN;
+            ev.data.u32 = i;
+            epoll_ctl(ep, EPOLL_CTL_ADD, conns[i].s, &ev);
+        }
+        std::vector<std::string> tails(members);
+        std::vector<char> readBuf(65536);
+        epoll_event events[256];
+        long target = (long) messages * (members - 1);
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+        while (delivered.load() < target && std::chrono::steady_clock::now() < deadline) {
+            int k = epoll_wait(ep, events, 256, 100);
+            for (int e = 0; e < k; e++) {
+                int i = (int) events[e].data.u32;
+                while (true) {
+                    int r = (int) recv(conns[i].s, readBuf.data(), readBuf.size(), 0);
+                    if (r <= 0) break;
+                    delivered += CountMarker(tails[i], readBuf.data(), r, groupMarker);
+                }
+            }
+        }
+        close(ep);
+    });
+
+    double cpuBefore = ProcCpuMicros(pid);
+    auto start = std::chrono::steady_clock::now();
+    std::string batch;
+    for (int i = 0; i < burst; i++) {
+        AppendCommand(batch, conns[0], "GROUP_MESSAGE GROUP " + group + " " + std::string(payload, 'x'));
+    }
+    std::string tail;
+    for (int sent = 0; sent < messages; sent += burst) {
+        send(conns[0].s, batch.data(), batch.size(), 0);
+        int acks = 0;
+        while (acks < burst) {
+            int r = (int) recv(conns[0].s, buf.data(), buf.size(), 0);
+            if (r == 0) break;
+            if (r < 0) {
+                std::this_thread::yield();
+                continue;
+            }
+            acks += CountMarker(tail, buf.data(), r, "Group message sent.");
+        }
+    }
+    reader.join();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.deliveriesPerSecond = (double) delivered.load() / elapsed;
+    result.cpuPerMessage = (ProcCpuMicros(pid) - cpuBefore) / messages;
+    return delivered.load() == (long) messages * (members - 1);
+}
+
+int main(int argc, char **argv) {
+    int members = 500;
+    int samples = 2000;
+    int messages = 400;
+    int burst = 16;
+    int payload = 64;
+    int port = 22990;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string key = argv[i];
+        int value = std::stoi(argv[i + 1]);
+        if (key == "--members") members = value;
+        else if (key == "--samples") samples = value;
+        else if (key == "--messages") messages = value;
+        else if (key == "--burst") burst = value;
+        else if (key == "--payload") payload = value;
+        else if (key == "--port") port = value;
+    }
+    members = std::max(members, 2);
+    messages = messages / burst * burst;
+    InitNetwork();
+
+    pid_t pid = StartServerProcess(port, [&]() {
+        ShardSet shards(1);
+        // 测量服务器本身的吞吐量，不启用速率限制和连接准入
+        shards.SetLimits(Limits::Unlimited());
+        if (!shards.Listen(port) || !shards.ListenWebSocket(port + 1)) return;
+        shards.Start();
+        shards.Join();
+    });
+
+    printf("members=%d samples=%d messages=%d burst=%d payload=%d\n", members, samples, messages, burst, payload);
+    std::vector<BenchConn> tcpConns, webSocketConns;
+    ModeResult tcp, webSocket;
+    bool tcpOk = RunMode(pid, port, false, "t", members, samples, messages, burst, payload, tcp, tcpConns);
+    bool webSocketOk = RunMode(pid, port + 1, true, "w", members, samples, messages, burst, payload, webSocket,
+                               webSocketConns);
+    const char *format = "%-10s direct p50 %7.1f us  p99 %7.1f us  group %10.0f deliveries/s  "
+                         "server_cpu/msg %6.0f us%s\n";
+    printf(format, "tcp text", tcp.p50, tcp.p99, tcp.deliveriesPerSecond, tcp.cpuPerMessage,
+           tcpOk ? "" : "  INCOMPLETE");
+    printf(format, "websocket", webSocket.p50, webSocket.p99, webSocket.deliveriesPerSecond, webSocket.cpuPerMessage,
+           webSocketOk ? "" : "  INCOMPLETE");
+
+    // 混合群组：TCP 发送者的群组消息同时投递给两种客户端，帧按传输方式各编码一次
+    if (tcpOk && webSocketOk) {
+        BenchConn wsMember = webSocketConns[1];
+        int flags = fcntl(wsMember.s, F_GETFL, 0);
+        fcntl(wsMember.s, F_SETFL, flags & ~O_NONBLOCK);
+        SendCommand(wsMember, "JOIN_GROUP JOIN tg");
+        WaitMarker(wsMember, "Joined group.");
+        SendCommand(tcpConns[0], "GROUP_MESSAGE GROUP tg mixed");
+        printf("mixed group: websocket member %s the tcp sender's group message\n",
+               WaitMarker(wsMember, "(tg) t0: mixed") ? "received" : "did NOT receive");
+    }
+    for (auto &conn: tcpConns) closesocket(conn.s);
+    for (auto &conn: webSocketConns) closesocket(conn.s);
+    StopServerProcess(pid);
+    return 0;
+}